@@ -0,0 +1,149 @@
+// Captures with the simulated sensor for every frame buffer count and consumer speed and reports the latency, the
+// drops and the buffer occupancy of each run. The dma queue depth is CONFIG_CAMERA_DMA_QUEUE_DEPTH, build with
+// -DCONFIG_CAMERA_DMA_QUEUE_DEPTH=<n> to compare depths.
+//
+// usage: camera_bench [j|g|y] [frames] [pclk_hz]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "exlibconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define BENCH_MAX_FRAMES 1000
+
+static const size_t bench_fb_counts[] = {1, 2, 3, 4};
+static const uint32_t bench_consumer_ms[] = {0, 20, 60};
+
+static volatile bool bench_sampling;
+static volatile uint32_t bench_samples;
+static volatile uint32_t bench_busy_sum;
+static volatile uint32_t bench_busy_max;
+
+static void bench_sample(void *arg) {
+  // sample the frame buffers in use every millisecond
+  while (bench_sampling) {
+    camera_stats_t stats;
+    esp_camera_stats_get(&stats);
+    bench_samples++;
+    bench_busy_sum += stats.fb_busy;
+    if (stats.fb_busy > bench_busy_max) {
+      bench_busy_max = stats.fb_busy;
+    }
+    vTaskDelay(1);
+  }
+  vTaskDelete(NULL);
+}
+
+static int bench_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool bench_run(const camera_sim_config_t *sim, pixformat_t format, size_t fb_count, uint32_t consumer_ms, int frames) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = format,
+      .frame_size = format == PIXFORMAT_JPEG ? FRAMESIZE_SVGA : FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = fb_count,
+  };
+  camera_sim_start(sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    return false;
+  }
+
+  // sample the occupancy while the consumer fetches the frames
+  bench_samples = 0;
+  bench_busy_sum = 0;
+  bench_busy_max = 0;
+  bench_sampling = true;
+  xTaskCreate(bench_sample, "sample", 2048, NULL, 1, NULL);
+
+  // latency from the end of the frame on the bus to the return of fb_get
+  static int64_t latency[BENCH_MAX_FRAMES];
+  int count = 0, unknown = 0;
+  uint32_t first = 0, last = 0;
+  for (int i = 0; i < frames; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    int64_t now = esp_timer_get_time();
+    uint32_t seq;
+    int64_t end;
+    if (camera_sim_frame(fb, &seq, NULL, &end)) {
+      first = count == 0 ? seq : first;
+      last = seq;
+      latency[count++] = now - end;
+    } else {
+      unknown++;
+    }
+    if (consumer_ms > 0) {
+      vTaskDelay(consumer_ms / portTICK_PERIOD_MS);
+    }
+    esp_camera_fb_return(fb);
+  }
+
+  bench_sampling = false;
+  vTaskDelay(5);
+  camera_stats_t stats;
+  esp_camera_stats_get(&stats);
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  // frames the sensor read out between the first and the last delivered one but the consumer did not get
+  uint32_t span = count > 0 ? last - first + 1 : 0;
+  float missed = span > 0 ? 100.0f * (span - count) / span : 0;
+  qsort(latency, count, sizeof(int64_t), bench_compare);
+  int64_t p50 = count ? latency[count / 2] : 0;
+  int64_t p99 = count ? latency[count * 99 / 100] : 0;
+  float busy = bench_samples ? (float)bench_busy_sum / bench_samples : 0;
+  printf("%2zu %5u %6d %7u %7.1f %8zu %8zu %7zu %7zu %8.2f %8.2f %8.2f %6.2f %4u %8zu\n", fb_count, consumer_ms, count, unknown, missed, stats.frames_rejected,
+         stats.frames_skipped, stats.buffers_overrun, stats.buffers_late, p50 / 1000.0, p99 / 1000.0, count ? latency[count - 1] / 1000.0 : 0, busy,
+         bench_busy_max, stats.buffers_pending_max);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  char format = argc > 1 ? argv[1][0] : 'j';
+  int frames = argc > 2 ? atoi(argv[2]) : 30;
+  frames = frames > BENCH_MAX_FRAMES ? BENCH_MAX_FRAMES : frames;
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  if (argc > 3) {
+    sim.pclk_hz = (uint32_t)atoi(argv[3]);
+  }
+  pixformat_t pixformat = format == 'g' ? PIXFORMAT_GRAYSCALE : format == 'y' ? PIXFORMAT_YUV422 : PIXFORMAT_JPEG;
+
+  printf("format %c, %d frames per run, pclk %u Hz, %u fps, dma queue depth %d\n", format, frames, sim.pclk_hz, sim.fps, CONFIG_CAMERA_DMA_QUEUE_DEPTH);
+  printf("fb cons_ms frames unknown missed%% rejected  skipped overrun    late  p50 ms   p99 ms   max ms  fb avg  max dma_max\n");
+  for (size_t i = 0; i < sizeof(bench_fb_counts) / sizeof(bench_fb_counts[0]); i++) {
+    for (size_t j = 0; j < sizeof(bench_consumer_ms) / sizeof(bench_consumer_ms[0]); j++) {
+      if (!bench_run(&sim, pixformat, bench_fb_counts[i], bench_consumer_ms[j], frames)) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,135 @@
+// Takes bursts of frames with esp_camera_burst and prints the achieved frame rate and the missed frames.
+//
+// Bursts run for JPEG and grayscale with two and three frame buffers, with a callback that returns the frame at once
+// or holds it like a slow publish, and with and without an interval. Every frame has to be a whole frame of the
+// sensor, the indices have to count up and the sensor frames have to be in order. Without an interval the dropped
+// count has to match the frames the sensor sent between them, with an interval the frames have to start at least
+// that far apart. esp_camera_fb_get has to work after every burst.
+//
+// usage: camera_burst_bench [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define BENCH_MAX_FRAMES 200
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  size_t fb_count;
+  uint32_t interval_ms;
+  uint32_t hold_ms;
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+    {"jpeg", PIXFORMAT_JPEG, 2, 0, 0},
+    {"jpeg", PIXFORMAT_JPEG, 3, 0, 0},
+    {"jpeg", PIXFORMAT_JPEG, 3, 0, 60},
+    {"jpeg", PIXFORMAT_JPEG, 3, 100, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 2, 0, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 3, 0, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 3, 0, 60},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 3, 100, 0},
+};
+
+typedef struct {
+  uint32_t hold_ms;
+  size_t count;
+  size_t order;
+  size_t bad;
+  uint32_t seqs[BENCH_MAX_FRAMES];
+  int64_t starts[BENCH_MAX_FRAMES];
+} bench_burst_t;
+
+static void bench_frame(camera_fb_t *fb, size_t index, void *arg) {
+  bench_burst_t *b = arg;
+  uint32_t seq;
+  int64_t start;
+  b->bad += !camera_sim_frame(fb, &seq, &start, NULL);
+  b->order += index != b->count || (index > 0 && seq <= b->seqs[index - 1]);
+  if (b->count < BENCH_MAX_FRAMES) {
+    b->seqs[b->count] = seq;
+    b->starts[b->count] = start;
+    b->count++;
+  }
+  if (b->hold_ms > 0) {
+    vTaskDelay(b->hold_ms / portTICK_PERIOD_MS);
+  }
+  esp_camera_fb_return(fb);
+}
+
+static bool bench_run(const bench_case_t *c, size_t frames) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = c->format,
+      .frame_size = c->format == PIXFORMAT_JPEG ? FRAMESIZE_SVGA : FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = c->fb_count,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("%-9s %2zu init failed\n", c->name, c->fb_count);
+    return false;
+  }
+
+  static bench_burst_t burst;
+  burst = (bench_burst_t){.hold_ms = c->hold_ms};
+  camera_burst_stats_t stats;
+  esp_err_t err = esp_camera_burst(frames, c->interval_ms, bench_frame, &burst, &stats);
+
+  // the frames the sensor sent between the ones of the burst, and the least time between two of them
+  size_t missed = 0;
+  int64_t closest = INT64_MAX;
+  for (size_t i = 1; i < burst.count; i++) {
+    missed += burst.seqs[i] - burst.seqs[i - 1] - 1;
+    closest = burst.starts[i] - burst.starts[i - 1] < closest ? burst.starts[i] - burst.starts[i - 1] : closest;
+  }
+  bool ok = err == ESP_OK && burst.count == frames && stats.frames == frames && burst.order == 0 && burst.bad == 0;
+  ok = ok && (c->interval_ms > 0 ? closest >= (int64_t)c->interval_ms * 1000 : stats.dropped == missed);
+
+  camera_fb_t *fb = esp_camera_fb_get();
+  ok = ok && fb != NULL && camera_sim_frame(fb, &(uint32_t){0}, NULL, NULL);
+  esp_camera_fb_return(fb);
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  printf("%-9s %2zu %8u %4u %6zu %7zu %6zu %6.1f %6.1f %5zu %5s\n", c->name, c->fb_count, c->interval_ms, c->hold_ms, burst.count,
+         stats.dropped, missed, stats.fps, stats.fps_max, burst.bad, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  size_t frames = argc > 1 ? atoi(argv[1]) : 20;
+  frames = frames > BENCH_MAX_FRAMES ? BENCH_MAX_FRAMES : frames;
+
+  printf("format    fb interval hold frames dropped missed    fps    max   bad\n");
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    failed += !bench_run(&bench_cases[i], frames);
+  }
+  return failed ? 1 : 0;
+}
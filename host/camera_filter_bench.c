@@ -0,0 +1,156 @@
+// Checks the dma filters of camera.c against a per pixel model of the sampling modes and measures them per line.
+//
+// Every filter gets random dma buffers of the line lengths the driver configures for the frame sizes from QQVGA to
+// UXGA, random lengths and, for the high speed filters, lengths that end in the half element of SM_0A0B_0B0C. The
+// output must match the model byte for byte including the bytes around it, at every offset of the destination.
+//
+// usage: camera_filter_bench [reps]
+
+#include <time.h>
+
+#include "camera.c"
+
+#define BENCH_GUARD 8
+#define BENCH_MAX_LINE 4096
+
+typedef struct {
+  const char *name;
+  i2s_sampling_mode_t mode;
+  size_t bytes_per_pixel;
+  dma_filter_t filter;
+} bench_kernel_t;
+
+static const bench_kernel_t bench_kernels[] = {
+    {"jpeg", SM_0A00_0B00, 1, dma_filter_jpeg},
+    {"grayscale", SM_0A0B_0C0D, 1, dma_filter_grayscale},
+    {"grayscale_highspeed", SM_0A00_0B00, 1, dma_filter_grayscale_highspeed},
+    {"yuyv", SM_0A0B_0C0D, 2, dma_filter_yuyv},
+    {"yuyv_highspeed", SM_0A00_0B00, 2, dma_filter_yuyv_highspeed},
+};
+
+static const size_t bench_widths[] = {160, 176, 240, 320, 400, 640, 800, 1024, 1280, 1600};
+
+static uint32_t bench_src[BENCH_MAX_LINE / 4 + 4];
+static uint8_t bench_out[BENCH_MAX_LINE + 2 * BENCH_GUARD];
+static uint8_t bench_model[BENCH_MAX_LINE + 2 * BENCH_GUARD];
+
+static double bench_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static size_t bench_buffer(const bench_kernel_t *kernel, size_t width, size_t *per_line) {
+  // the dma buffer length and the buffers per line like dma_desc_init
+  size_t line = width * 2 * i2s_bytes_per_sample(kernel->mode);
+  *per_line = 1;
+  while (line >= 4096) {
+    line /= 2;
+    *per_line *= 2;
+  }
+  return line;
+}
+
+static uint8_t bench_sample(size_t elem, int sample) {
+  // an element is a little endian word with sample1 in bits 16-23 and sample2 in bits 0-7
+  return bench_src[elem] >> (sample == 1 ? 16 : 0);
+}
+
+static void bench_expect(const bench_kernel_t *kernel, size_t len, uint8_t *dst) {
+  // a high speed pixel takes two elements and the sample1 of both, otherwise a pixel is the samples of one element.
+  // the filters convert four pixels at a time, a line in SM_0A0B_0B0C ends with two more
+  size_t elems = len / 4;
+  bool highspeed = kernel->mode == SM_0A00_0B00 && kernel->filter != dma_filter_jpeg;
+  size_t pixels = highspeed ? elems / 8 * 4 : elems / 4 * 4;
+  size_t tail = highspeed && (len & 0x7) ? 2 : 0;
+  for (size_t p = 0; p < pixels + tail; p++) {
+    size_t elem = highspeed ? 2 * p : p;
+    dst[p * kernel->bytes_per_pixel] = bench_sample(elem, 1);
+    if (kernel->bytes_per_pixel == 2) {
+      // the last pixel of such a line has no element of its own for v
+      bool last = p == pixels + tail - 1 && tail;
+      dst[p * 2 + 1] = !highspeed ? bench_sample(elem, 2) : last ? bench_sample(elem, 2) : bench_sample(elem + 1, 1);
+    }
+  }
+}
+
+static bool bench_check(const bench_kernel_t *kernel, size_t len, size_t offset) {
+  for (size_t i = 0; i < sizeof(bench_src) / sizeof(bench_src[0]); i++) {
+    bench_src[i] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+  }
+  memset(bench_out, 0xA5, sizeof(bench_out));
+  memset(bench_model, 0xA5, sizeof(bench_model));
+  lldesc_t desc = {.length = len};
+  kernel->filter((const dma_elem_t *)bench_src, &desc, bench_out + BENCH_GUARD + offset);
+  bench_expect(kernel, len, bench_model + BENCH_GUARD + offset);
+  if (memcmp(bench_out, bench_model, sizeof(bench_out)) != 0) {
+    printf("%s: mismatch for %zu bytes at offset %zu\n", kernel->name, len, offset);
+    return false;
+  }
+  return true;
+}
+
+static double bench_time(dma_filter_t filter, size_t len, size_t per_line, size_t reps) {
+  // best of five runs in ns per line
+  lldesc_t desc = {.length = len};
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    double start = bench_now();
+    for (size_t r = 0; r < reps; r++) {
+      for (size_t i = 0; i < per_line; i++) {
+        filter((const dma_elem_t *)bench_src, &desc, bench_out + BENCH_GUARD);
+        __asm__ volatile("" ::: "memory");
+      }
+    }
+    double time = (bench_now() - start) / reps;
+    best = time < best ? time : best;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  size_t reps = argc > 1 ? (size_t)atoi(argv[1]) : 20000;
+  size_t kernels = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+  size_t widths = sizeof(bench_widths) / sizeof(bench_widths[0]);
+  int failed = 0;
+
+  // bit exact output
+  for (size_t k = 0; k < kernels; k++) {
+    const bench_kernel_t *kernel = &bench_kernels[k];
+    bool highspeed = kernel->mode == SM_0A00_0B00 && kernel->filter != dma_filter_jpeg;
+    size_t checks = 0;
+    for (size_t offset = 0; offset < 4; offset++) {
+      for (size_t w = 0; w < widths; w++) {
+        size_t per_line;
+        size_t len = bench_buffer(kernel, bench_widths[w], &per_line);
+        failed += !bench_check(kernel, len, offset);
+        checks++;
+      }
+      for (int i = 0; i < 500; i++) {
+        size_t len = (1 + rand() % 255) * 16;
+        failed += !bench_check(kernel, len, offset);
+        checks++;
+        if (highspeed) {
+          // a line in SM_0A0B_0B0C ends in the middle of an element pair
+          failed += !bench_check(kernel, len + 4, offset);
+          checks++;
+        }
+      }
+    }
+    printf("%-20s %5zu buffers checked\n", kernel->name, checks);
+  }
+  printf("%s\n\n", failed ? "MISMATCH" : "bit exact");
+
+  // time per line, only the ratio between the filters carries over to the target
+  printf("%-20s %6s %10s\n", "kernel", "width", "ns");
+  for (size_t k = 0; k < kernels; k++) {
+    const bench_kernel_t *kernel = &bench_kernels[k];
+    size_t sizes[] = {640, 1600};
+    for (size_t s = 0; s < 2; s++) {
+      size_t per_line;
+      size_t len = bench_buffer(kernel, sizes[s], &per_line);
+      printf("%-20s %6zu %10.1f\n", kernel->name, sizes[s], bench_time(kernel->filter, len, per_line, reps));
+    }
+  }
+  return failed ? 1 : 0;
+}
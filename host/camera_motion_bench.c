@@ -0,0 +1,158 @@
+// Checks the motion filters of camera.c against a dma filter followed by the separate motion pass and measures both.
+//
+// Every motion filter gets random dma buffers for each part of a line. The frame buffer bytes and the block sums must
+// be the same as the ones of the selected dma filter and dma_motion_sum. The timing is per pixel for the dma filter
+// alone, the dma filter with the separate pass and the motion filter. Frames that are not copied or are reduced to a
+// region still take the separate pass, so its cost is printed as well.
+//
+// usage: camera_motion_bench [reps]
+
+#include <time.h>
+
+#include "camera.c"
+
+#define BENCH_MAX_LINE 4096
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  i2s_sampling_mode_t mode;
+  dma_filter_t filter;
+  dma_filter_t motion;
+} bench_kernel_t;
+
+static const bench_kernel_t bench_kernels[] = {
+    {"grayscale", PIXFORMAT_GRAYSCALE, SM_0A0B_0C0D, dma_filter_grayscale, dma_filter_grayscale_motion},
+    {"grayscale_highspeed", PIXFORMAT_GRAYSCALE, SM_0A00_0B00, dma_filter_grayscale_highspeed, dma_filter_grayscale_highspeed_motion},
+    {"yuyv", PIXFORMAT_YUV422, SM_0A0B_0C0D, dma_filter_yuyv, dma_filter_yuyv_motion},
+    {"yuyv_highspeed", PIXFORMAT_YUV422, SM_0A00_0B00, dma_filter_yuyv_highspeed, dma_filter_yuyv_highspeed_motion},
+};
+
+// 328 leaves pixels right of the last full block
+static const size_t bench_widths[] = {160, 320, 328, 640, 800, 1600};
+
+static uint32_t bench_src[BENCH_MAX_LINE / 4];
+static uint8_t bench_out_filter[BENCH_MAX_LINE];
+static uint8_t bench_out_motion[BENCH_MAX_LINE];
+static uint32_t bench_sum_filter[BENCH_MAX_LINE / CONFIG_CAMERA_MOTION_BLOCK];
+static uint32_t bench_sum_motion[BENCH_MAX_LINE / CONFIG_CAMERA_MOTION_BLOCK];
+
+static double bench_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static size_t bench_setup(const bench_kernel_t *kernel, size_t width) {
+  // the state of camera_init for the width, returns the dma buffer length
+  size_t line = width * 2 * i2s_bytes_per_sample(kernel->mode);
+  s_state->width = width;
+  s_state->dma_per_line = 1;
+  while (line >= 4096) {
+    line /= 2;
+    s_state->dma_per_line *= 2;
+  }
+  s_state->dma_filter = kernel->filter;
+  s_state->dma_filter_motion = kernel->motion;
+  s_state->motion_step = kernel->mode == SM_0A00_0B00 ? 2 : 1;
+  s_state->motion_cols = width / CONFIG_CAMERA_MOTION_BLOCK;
+  s_state->motion_rows = 1;
+  s_state->motion_row = 0;
+  return line;
+}
+
+static bool bench_check(const bench_kernel_t *kernel, size_t len, size_t part) {
+  for (size_t i = 0; i < sizeof(bench_src) / sizeof(bench_src[0]); i++) {
+    bench_src[i] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+  }
+  lldesc_t desc = {.length = len};
+  dma_ring_entry_t entry = {.pos = part};
+
+  // dma filter and separate pass
+  memset(bench_out_filter, 0xA5, sizeof(bench_out_filter));
+  memset(bench_sum_filter, 0, sizeof(bench_sum_filter));
+  s_state->motion_sum = bench_sum_filter;
+  dma_motion_buffer(entry);
+  kernel->filter((const dma_elem_t *)bench_src, &desc, bench_out_filter);
+  dma_motion_sum((const dma_elem_t *)bench_src);
+
+  // motion filter
+  memset(bench_out_motion, 0xA5, sizeof(bench_out_motion));
+  memset(bench_sum_motion, 0, sizeof(bench_sum_motion));
+  s_state->motion_sum = bench_sum_motion;
+  dma_motion_buffer(entry);
+  kernel->motion((const dma_elem_t *)bench_src, &desc, bench_out_motion);
+
+  if (memcmp(bench_out_filter, bench_out_motion, sizeof(bench_out_filter)) != 0 ||
+      memcmp(bench_sum_filter, bench_sum_motion, sizeof(bench_sum_filter)) != 0) {
+    printf("%s: mismatch for %zu pixels, part %zu\n", kernel->name, s_state->width, part);
+    return false;
+  }
+  return true;
+}
+
+static double bench_time(const bench_kernel_t *kernel, size_t len, int mode, size_t reps) {
+  // best of five runs in ns per pixel, mode 0 is the dma filter, 1 adds the separate pass, 2 the motion filter and
+  // 3 the separate pass alone
+  lldesc_t desc = {.length = len};
+  dma_ring_entry_t entry = {.pos = 0};
+  s_state->motion_sum = bench_sum_motion;
+  double best = 1e30;
+  for (int run = 0; run < 5; run++) {
+    double start = bench_now();
+    for (size_t r = 0; r < reps; r++) {
+      dma_motion_buffer(entry);
+      if (mode == 0 || mode == 1) {
+        kernel->filter((const dma_elem_t *)bench_src, &desc, bench_out_filter);
+      }
+      if (mode == 1 || mode == 3) {
+        dma_motion_sum((const dma_elem_t *)bench_src);
+      }
+      if (mode == 2) {
+        kernel->motion((const dma_elem_t *)bench_src, &desc, bench_out_motion);
+      }
+      __asm__ volatile("" ::: "memory");
+    }
+    double time = (bench_now() - start) / reps;
+    best = time < best ? time : best;
+  }
+  return best / (s_state->width / s_state->dma_per_line);
+}
+
+int main(int argc, char **argv) {
+  size_t reps = argc > 1 ? (size_t)atoi(argv[1]) : 20000;
+  size_t kernels = sizeof(bench_kernels) / sizeof(bench_kernels[0]);
+  size_t widths = sizeof(bench_widths) / sizeof(bench_widths[0]);
+  s_state = (camera_state_t *)calloc(1, sizeof(*s_state));
+  int failed = 0;
+
+  // same frame buffer and block sums
+  for (size_t k = 0; k < kernels; k++) {
+    const bench_kernel_t *kernel = &bench_kernels[k];
+    size_t checks = 0;
+    for (size_t w = 0; w < widths; w++) {
+      size_t len = bench_setup(kernel, bench_widths[w]);
+      for (size_t part = 0; part < s_state->dma_per_line; part++) {
+        for (int i = 0; i < 20; i++) {
+          failed += !bench_check(kernel, len, part);
+          checks++;
+        }
+      }
+    }
+    printf("%-20s %5zu buffers checked\n", kernel->name, checks);
+  }
+  printf("%s\n\n", failed ? "MISMATCH" : "identical");
+
+  // time per pixel of a VGA line
+  printf("%-20s %10s %10s %10s %10s\n", "kernel", "filter", "+ pass", "motion", "pass");
+  for (size_t k = 0; k < kernels; k++) {
+    const bench_kernel_t *kernel = &bench_kernels[k];
+    size_t len = bench_setup(kernel, 640);
+    printf("%-20s", kernel->name);
+    for (int mode = 0; mode < 4; mode++) {
+      printf(" %10.3f", bench_time(kernel, len, mode, reps));
+    }
+    printf("\n");
+  }
+  return failed ? 1 : 0;
+}
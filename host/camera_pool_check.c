@@ -0,0 +1,232 @@
+// Runs consumers of different speed on the refcounted frame buffer pool and checks what each of them gets.
+//
+// One consumer returns its frames at once, the others hold them for a while, so the pool runs out of free buffers
+// with few frame buffers. No frame may share memory with a frame of another number that is still held, and its
+// bytes may not change until it is returned. Every consumer has to get its frames in order, and its dropped count
+// has to match the complete frames it missed. Those are known from the frames all consumers saw and the numbers of
+// the rejected or skipped frames before each of them.
+//
+// usage: camera_pool_check [seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define CHECK_CONSUMERS 3
+#define CHECK_MAX_FRAMES 4096
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  size_t fb_count;
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+    {"grayscale", PIXFORMAT_GRAYSCALE, 2},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 3},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 5},
+    {"jpeg", PIXFORMAT_JPEG, 2},
+    {"jpeg", PIXFORMAT_JPEG, 3},
+    {"jpeg", PIXFORMAT_JPEG, 5},
+};
+
+static const uint32_t check_hold_ms[CHECK_CONSUMERS] = {0, 20, 90};
+
+typedef struct {
+  camera_consumer_t *consumer;
+  size_t slot;
+  uint32_t hold_ms;
+  size_t frames;
+  size_t order;
+  size_t changed;
+  size_t count;
+  uint32_t seqs[CHECK_MAX_FRAMES];
+} check_consumer_t;
+
+typedef struct {
+  const uint8_t *buf;
+  size_t len;
+  uint32_t seq;
+} check_held_t;
+
+// frame numbers known to be complete (1) or rejected and skipped (2)
+static uint8_t check_status[CHECK_MAX_FRAMES];
+static check_held_t check_held[CHECK_CONSUMERS];
+static SemaphoreHandle_t check_mutex;
+static size_t check_reused;
+static volatile bool check_running;
+static volatile int check_active;
+
+static uint32_t check_sum(const camera_fb_t *fb) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < fb->len; i++) {
+    sum = sum * 31 + fb->buf[i];
+  }
+  return sum;
+}
+
+static void check_hold(size_t slot, const camera_fb_t *fb) {
+  // the frame may not overlap a held frame of another number
+  xSemaphoreTake(check_mutex, portMAX_DELAY);
+  for (size_t i = 0; i < CHECK_CONSUMERS; i++) {
+    const check_held_t *held = &check_held[i];
+    if (held->buf != NULL && held->seq != fb->seq && fb->buf < held->buf + held->len && held->buf < fb->buf + fb->len) {
+      printf("  frame %u reuses the memory of frame %u\n", fb->seq, held->seq);
+      check_reused++;
+    }
+  }
+  check_held[slot] = (check_held_t){.buf = fb->buf, .len = fb->len, .seq = fb->seq};
+
+  // the frames before it up to the previous complete one were rejected or skipped
+  if (fb->seq < CHECK_MAX_FRAMES) {
+    check_status[fb->seq] = 1;
+    for (uint32_t seq = fb->seq - fb->dropped; seq < fb->seq; seq++) {
+      check_status[seq] = 2;
+    }
+    if (fb->seq > fb->dropped + 1) {
+      check_status[fb->seq - fb->dropped - 1] = 1;
+    }
+  }
+  xSemaphoreGive(check_mutex);
+}
+
+static void check_consume(void *arg) {
+  check_consumer_t *c = arg;
+  while (check_running) {
+    camera_fb_t *fb = c->consumer != NULL ? esp_camera_consumer_fb_get(c->consumer) : esp_camera_fb_get();
+    if (fb == NULL) {
+      continue;
+    }
+    check_hold(c->slot, fb);
+    if (c->count > 0 && fb->seq <= c->seqs[c->count - 1]) {
+      c->order++;
+    }
+    if (c->count < CHECK_MAX_FRAMES) {
+      c->seqs[c->count++] = fb->seq;
+    }
+    c->frames++;
+
+    // hold the frame, its bytes must stay the same
+    uint32_t sum = check_sum(fb);
+    if (c->hold_ms > 0) {
+      vTaskDelay(c->hold_ms / portTICK_PERIOD_MS);
+    }
+    c->changed += check_sum(fb) != sum;
+    xSemaphoreTake(check_mutex, portMAX_DELAY);
+    check_held[c->slot].buf = NULL;
+    xSemaphoreGive(check_mutex);
+    esp_camera_fb_return(fb);
+  }
+  __atomic_fetch_sub(&check_active, 1, __ATOMIC_ACQ_REL);
+  vTaskDelete(NULL);
+}
+
+static void check_expect(const check_consumer_t *c, size_t *low, size_t *high) {
+  // the complete frames between the ones the consumer got, frames of unknown state may have been complete
+  *low = 0;
+  *high = 0;
+  for (size_t i = 1; i < c->count; i++) {
+    for (uint32_t seq = c->seqs[i - 1] + 1; seq < c->seqs[i]; seq++) {
+      *low += check_status[seq] == 1;
+      *high += check_status[seq] != 2;
+    }
+  }
+}
+
+static bool check_run(const check_case_t *cs, int seconds) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = cs->format,
+      .frame_size = cs->format == PIXFORMAT_JPEG ? FRAMESIZE_SVGA : FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = cs->fb_count,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("%-9s %2zu init failed\n", cs->name, cs->fb_count);
+    return false;
+  }
+
+  // the first consumer is the one of esp_camera_fb_get
+  static check_consumer_t consumers[CHECK_CONSUMERS];
+  memset(consumers, 0, sizeof(consumers));
+  memset(check_status, 0, sizeof(check_status));
+  memset(check_held, 0, sizeof(check_held));
+  check_reused = 0;
+  check_running = true;
+  check_active = CHECK_CONSUMERS;
+  for (size_t i = 0; i < CHECK_CONSUMERS; i++) {
+    consumers[i].consumer = i > 0 ? esp_camera_consumer_add() : NULL;
+    consumers[i].slot = i;
+    consumers[i].hold_ms = check_hold_ms[i];
+  }
+  for (size_t i = 0; i < CHECK_CONSUMERS; i++) {
+    xTaskCreate(check_consume, "consumer", 4096, &consumers[i], 5, NULL);
+  }
+  vTaskDelay(seconds * 1000 / portTICK_PERIOD_MS);
+  check_running = false;
+
+  // consumers wait for a frame, capturing may not have stopped for good
+  for (int wait = 0; __atomic_load_n(&check_active, __ATOMIC_ACQUIRE) > 0; wait++) {
+    if (wait == 500) {
+      printf("%-9s %2zu no frames for 5 s\n", cs->name, cs->fb_count);
+      exit(1);
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+
+  camera_stats_t stats;
+  esp_camera_stats_get(&stats);
+  bool ok = check_reused == 0;
+  for (size_t i = 0; i < CHECK_CONSUMERS; i++) {
+    const check_consumer_t *c = &consumers[i];
+    camera_consumer_stats_t cstats;
+    esp_camera_consumer_stats(c->consumer, &cstats);
+    size_t low, high;
+    check_expect(c, &low, &high);
+    bool good = c->order == 0 && c->changed == 0 && cstats.frames == c->frames && cstats.dropped >= low && cstats.dropped <= high;
+    printf("%-9s %2zu %4u %6zu %7zu %5zu/%-5zu %5zu %7zu %6zu %8zu %5s\n", cs->name, cs->fb_count, c->hold_ms, c->frames, cstats.dropped, low, high,
+           c->order, c->changed, check_reused, stats.frames_skipped + stats.frames_rejected, good ? "ok" : "FAIL");
+    ok = ok && good;
+  }
+  camera_sim_stop();
+  esp_camera_deinit();
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 3;
+  check_mutex = xSemaphoreCreateMutex();
+
+  printf("format    fb hold frames dropped  expected order changed reused skip+rej\n");
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(check_cases) / sizeof(check_cases[0]); i++) {
+    failed += !check_run(&check_cases[i], seconds);
+  }
+  return failed ? 1 : 0;
+}
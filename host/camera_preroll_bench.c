@@ -0,0 +1,127 @@
+// Measures how long esp_camera_fb_get_latest and esp_camera_fb_get_at_or_after take with pre-roll capture.
+//
+// Requests come at irregular intervals like those of a door bell. With one frame buffer there is no pre-roll and
+// esp_camera_fb_get is measured instead. The latest frame has to be a whole frame of the sensor, a frame at or after a
+// time has to start at or after it, and asking again for the time of the latest frame has to return that frame while
+// it is held.
+//
+// usage: camera_preroll_bench [requests]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define BENCH_MAX_REQUESTS 1000
+
+static const size_t bench_fb_counts[] = {1, 2, 3};
+
+static int bench_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void bench_print(int64_t *times, int count) {
+  // p50 and maximum in ms
+  qsort(times, count, sizeof(int64_t), bench_compare);
+  printf(" %8.3f %8.3f", count ? times[count / 2] / 1000.0 : 0, count ? times[count - 1] / 1000.0 : 0);
+}
+
+static bool bench_run(pixformat_t format, size_t fb_count, int requests) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = format,
+      .frame_size = format == PIXFORMAT_JPEG ? FRAMESIZE_SVGA : FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = fb_count,
+      .preroll = fb_count > 1,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    return false;
+  }
+  vTaskDelay(200 / portTICK_PERIOD_MS);
+
+  static int64_t latest[BENCH_MAX_REQUESTS];
+  static int64_t age[BENCH_MAX_REQUESTS];
+  static int64_t after[BENCH_MAX_REQUESTS];
+  int count = 0, wrong = 0;
+  for (int i = 0; i < requests; i++) {
+    vTaskDelay((37 + i * 13 % 50) / portTICK_PERIOD_MS);
+
+    // the newest frame, without pre-roll the next one
+    int64_t start = esp_timer_get_time();
+    camera_fb_t *fb = fb_count > 1 ? esp_camera_fb_get_latest() : esp_camera_fb_get();
+    latest[count] = esp_timer_get_time() - start;
+    age[count] = start - fb->timestamp;
+    wrong += !camera_sim_frame(fb, &(uint32_t){0}, NULL, NULL);
+    if (fb_count == 1) {
+      esp_camera_fb_return(fb);
+      after[count++] = 0;
+      continue;
+    }
+
+    // the held frame is the oldest one at or after its own time
+    camera_fb_t *same = esp_camera_fb_get_at_or_after(fb->timestamp);
+    wrong += same->timestamp < fb->timestamp || (same != fb && same->timestamp != fb->timestamp);
+    esp_camera_fb_return(same);
+    esp_camera_fb_return(fb);
+
+    // a frame that starts after the request
+    start = esp_timer_get_time();
+    fb = esp_camera_fb_get_at_or_after(start);
+    after[count] = esp_timer_get_time() - start;
+    wrong += fb->timestamp < start || !camera_sim_frame(fb, &(uint32_t){0}, NULL, NULL);
+    esp_camera_fb_return(fb);
+    count++;
+  }
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  printf("%-9s %2zu %8d", format == PIXFORMAT_JPEG ? "jpeg" : "grayscale", fb_count, count);
+  bench_print(latest, count);
+  bench_print(age, count);
+  bench_print(after, count);
+  printf(" %5d\n", wrong);
+  return wrong == 0;
+}
+
+int main(int argc, char **argv) {
+  int requests = argc > 1 ? atoi(argv[1]) : 50;
+  requests = requests > BENCH_MAX_REQUESTS ? BENCH_MAX_REQUESTS : requests;
+
+  printf("                      latest ms         age ms      after ms\n");
+  printf("format    fb requests      p50      max      p50      max      p50      max wrong\n");
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(bench_fb_counts) / sizeof(bench_fb_counts[0]); i++) {
+    failed += !bench_run(PIXFORMAT_JPEG, bench_fb_counts[i], requests);
+  }
+  for (size_t i = 0; i < sizeof(bench_fb_counts) / sizeof(bench_fb_counts[0]); i++) {
+    failed += !bench_run(PIXFORMAT_GRAYSCALE, bench_fb_counts[i], requests);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+// Checks the region and decimation of raw frames against a reference downscale of the full frame.
+//
+// The simulated sensor plays a random QVGA clip, so every frame buffer can be compared with the crop of the clip
+// that keeps every decimation-th pixel and line of the region. Each case runs for grayscale and YUV422 at a
+// decimation of 1, 2 and 4, with esp_camera_fb_get and with esp_camera_chunk_get.
+//
+// usage: camera_roi_check [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+
+#define CHECK_WIDTH 320
+#define CHECK_HEIGHT 240
+
+typedef struct {
+  pixformat_t format;
+  const char *name;
+  size_t bytes_per_pixel;
+} check_format_t;
+
+static const check_format_t check_formats[] = {
+    {PIXFORMAT_GRAYSCALE, "grayscale", 1},
+    {PIXFORMAT_YUV422, "yuv422", 2},
+};
+
+static const uint8_t check_decimations[] = {1, 2, 4};
+
+static const camera_roi_t check_rois[] = {
+    {0, 0, 0, 0},          // whole frame
+    {64, 40, 160, 120},    // centre
+    {4, 3, 96, 32},        // odd line offset
+    {256, 200, 64, 40},    // bottom right corner
+};
+
+static uint8_t check_clip[CHECK_WIDTH * CHECK_HEIGHT * 2];
+static uint8_t check_copy[CHECK_WIDTH * CHECK_HEIGHT * 2];
+
+static bool check_expect(const check_format_t *format, size_t decimation, const camera_roi_t *roi, size_t col, size_t row,
+                         size_t byte, uint8_t *value) {
+  // the source pixel, two bytes of luma and chroma
+  size_t x = roi->x + col * decimation;
+  size_t y = roi->y + row * decimation;
+  const uint8_t *src = check_clip + (y * CHECK_WIDTH + x) * 2;
+
+  // the sensor writes the sequence number over the luma of the first four pixels
+  if (y == 0 && x < 4 && byte == 0) {
+    return false;
+  }
+
+  // the kept pixels all start a pair of the source and carry U, odd pixels take the V of their right neighbour
+  if (byte == 0 || format->format == PIXFORMAT_GRAYSCALE) {
+    *value = src[0];
+  } else if (decimation > 1 && (col & 1)) {
+    *value = src[3];
+  } else {
+    *value = src[1];
+  }
+  return true;
+}
+
+static bool check_frame(const check_format_t *format, size_t decimation, const camera_roi_t *roi, const camera_fb_t *fb) {
+  // size of the frame buffer
+  size_t width = roi->width / decimation;
+  size_t height = roi->height / decimation;
+  if (fb->width != width || fb->height != height || fb->len != width * height * format->bytes_per_pixel) {
+    printf("  %zux%zu with %zu bytes, expected %zux%zu\n", fb->width, fb->height, fb->len, width, height);
+    return false;
+  }
+
+  // every byte against the downscale of the clip
+  for (size_t row = 0; row < height; row++) {
+    for (size_t col = 0; col < width; col++) {
+      for (size_t byte = 0; byte < format->bytes_per_pixel; byte++) {
+        uint8_t expected;
+        uint8_t value = fb->buf[(row * width + col) * format->bytes_per_pixel + byte];
+        if (check_expect(format, decimation, roi, col, row, byte, &expected) && value != expected) {
+          printf("  pixel %zu,%zu byte %zu is %u, expected %u\n", col, row, byte, value, expected);
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+static bool check_chunks(camera_fb_t **fb) {
+  // collect the chunks of a frame and compare them with the frame buffer they end in
+  for (;;) {
+    camera_chunk_t chunk;
+    size_t offset = 0;
+    bool ordered = true;
+    esp_err_t err;
+    while ((err = esp_camera_chunk_get(&chunk)) == ESP_OK) {
+      ordered = ordered && chunk.offset == offset && offset + chunk.len <= sizeof(check_copy);
+      if (ordered) {
+        memcpy(check_copy + offset, chunk.buf, chunk.len);
+        offset += chunk.len;
+      }
+      if (chunk.final) {
+        break;
+      }
+    }
+    if (err != ESP_OK) {
+      // rejected frame, start over with the next one
+      continue;
+    }
+    *fb = chunk.fb;
+    if (!ordered || offset != chunk.fb->len || memcmp(check_copy, chunk.fb->buf, offset) != 0) {
+      printf("  chunks differ from the frame buffer\n");
+      return false;
+    }
+    return true;
+  }
+}
+
+static bool check_run(const check_format_t *format, uint8_t decimation, const camera_roi_t *roi, bool chunked, int frames) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = format->format,
+      .frame_size = FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = 2,
+      .roi = *roi,
+      .decimation = decimation,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  sim.clip = check_clip;
+  sim.clip_frames = 1;
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("  init failed\n");
+    return false;
+  }
+
+  // the whole frame if no region is given
+  camera_roi_t region = *roi;
+  if (!region.width) {
+    region.width = CHECK_WIDTH;
+    region.height = CHECK_HEIGHT;
+  }
+
+  int good = 0;
+  for (int i = 0; i < frames; i++) {
+    camera_fb_t *fb = NULL;
+    bool ok = chunked ? check_chunks(&fb) : (fb = esp_camera_fb_get()) != NULL;
+    good += ok && check_frame(format, decimation, &region, fb);
+    esp_camera_fb_return(fb);
+  }
+
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  printf("%-9s %3u %3ux%-3u+%-3u+%-3u %-5s %2d/%d\n", format->name, decimation, region.width, region.height, region.x, region.y,
+         chunked ? "chunk" : "fb", good, frames);
+  return good == frames;
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 3;
+  for (size_t i = 0; i < sizeof(check_clip); i++) {
+    check_clip[i] = (uint8_t)rand();
+  }
+
+  printf("format    dec region          mode  good\n");
+  int failed = 0;
+  for (size_t f = 0; f < sizeof(check_formats) / sizeof(check_formats[0]); f++) {
+    for (size_t d = 0; d < sizeof(check_decimations); d++) {
+      for (size_t r = 0; r < sizeof(check_rois) / sizeof(check_rois[0]); r++) {
+        failed += !check_run(&check_formats[f], check_decimations[d], &check_rois[r], false, frames);
+        failed += !check_run(&check_formats[f], check_decimations[d], &check_rois[r], true, frames);
+      }
+    }
+  }
+  printf("%s\n", failed ? "MISMATCH" : "all frames match");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+// Counts the SCCB transactions and the time of esp_camera_init without, with and with a stale probe cache in NVS.
+//
+// Without the cache the driver scans the bus for the sensor address and reads the sensor id, with it a single read
+// of the product id confirms the cached sensor. A cache that names an address nobody answers at must fall back to the
+// scan and be rewritten, so the init after it is as cheap as with a valid cache. Every init has to find the same sensor
+// and deliver a frame.
+//
+// usage: camera_sccb_check  (deletes nvs.bin in the working directory)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+// the probe cache of camera.c
+typedef struct {
+  uint8_t slv_addr;
+  sensor_id_t id;
+} check_probe_t;
+
+static bool check_init(const char *name, uint32_t *sccb, sensor_id_t *id) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = PIXFORMAT_JPEG,
+      .frame_size = FRAMESIZE_SVGA,
+      .jpeg_quality = 12,
+      .fb_count = 2,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  camera_sim_start(&sim);
+
+  // transactions and time of the init alone
+  camera_sim_stats_t before, after;
+  camera_sim_stats(&before);
+  int64_t start = esp_timer_get_time();
+  esp_err_t err = esp_camera_init(&config);
+  int64_t time = esp_timer_get_time() - start;
+  camera_sim_stats(&after);
+  *sccb = after.sccb - before.sccb;
+  if (err != ESP_OK) {
+    camera_sim_stop();
+    printf("%-8s init failed 0x%x\n", name, err);
+    return false;
+  }
+
+  // the sensor and a frame
+  *id = esp_camera_sensor_get()->id;
+  camera_fb_t *fb = esp_camera_fb_get();
+  bool ok = camera_sim_frame(fb, &(uint32_t){0}, NULL, NULL);
+  esp_camera_fb_return(fb);
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  printf("%-8s %6u %8.1f  0x%02x %5s\n", name, *sccb, time / 1000.0, id->PID, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+static bool check_store(uint8_t slv_addr, const sensor_id_t *id) {
+  // overwrite the cache with another address
+  nvs_handle handle;
+  if (nvs_open("camera", NVS_READWRITE, &handle) != ESP_OK) {
+    return false;
+  }
+  check_probe_t probe = {.slv_addr = slv_addr, .id = *id};
+  esp_err_t err = nvs_set_blob(handle, "probe", &probe, sizeof(probe));
+  nvs_close(handle);
+  return err == ESP_OK;
+}
+
+int main(int argc, char **argv) {
+  uint32_t cold, warm, stale, again;
+  sensor_id_t cold_id, warm_id, stale_id, again_id;
+
+  // erased flash, then the cache of that init, then a cache with a wrong address and the one it was replaced with
+  printf("cache      sccb  init ms   pid frame\n");
+  remove("nvs.bin");
+  bool ok = check_init("none", &cold, &cold_id);
+  ok = check_init("valid", &warm, &warm_id) && ok;
+  ok = check_store(0x21, &warm_id) && check_init("stale", &stale, &stale_id) && ok;
+  ok = check_init("rewrite", &again, &again_id) && ok;
+
+  // the cache skips the scan and the id reads, a stale one scans again
+  if (warm_id.PID != cold_id.PID || stale_id.PID != cold_id.PID || again_id.PID != cold_id.PID) {
+    printf("the sensor differs\n");
+    ok = false;
+  }
+  if (warm >= cold || stale <= warm || again != warm) {
+    printf("unexpected transactions\n");
+    ok = false;
+  }
+  printf("the cache saves %d transactions\n", (int)cold - (int)warm);
+  return ok ? 0 : 1;
+}
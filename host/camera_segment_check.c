@@ -0,0 +1,119 @@
+// Initializes the camera several times in a row and checks how the segment pool is sized from the JPEGs before.
+//
+// The first init of a frame size and quality has no history and reserves the full frame for every buffer. The later
+// ones size the pool from the histogram of the frames captured so far. Small JPEGs have to shrink the pool below the
+// first one, JPEGs beyond the histogram range must keep a pool that holds the largest of them. Every frame has to fit,
+// so a frame is only rejected for an overrun or a late DMA buffer, and every init has to deliver all frames.
+//
+// usage: camera_segment_check [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+
+#define CHECK_ROUNDS 4
+
+typedef struct {
+  const char *name;
+  framesize_t frame_size;
+  size_t jpeg_size;
+  size_t jpeg_jitter;
+} check_case_t;
+
+static const check_case_t check_cases[] = {
+    {"svga", FRAMESIZE_SVGA, 30000, 5000},
+    {"uxga", FRAMESIZE_UXGA, 180000, 20000},
+};
+
+static bool check_round(const check_case_t *c, size_t fb_count, int round, int frames, size_t *pool, size_t *largest) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = PIXFORMAT_JPEG,
+      .frame_size = c->frame_size,
+      // every buffer count gets its own history
+      .jpeg_quality = 10 + fb_count,
+      .fb_count = fb_count,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  sim.jpeg_size = c->jpeg_size;
+  sim.jpeg_jitter = c->jpeg_jitter;
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("%-5s %2zu %5d init failed\n", c->name, fb_count, round);
+    return false;
+  }
+
+  int good = 0;
+  *largest = 0;
+  for (int i = 0; i < frames; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    good += camera_sim_frame(fb, &(uint32_t){0}, NULL, NULL);
+    *largest = fb->len > *largest ? fb->len : *largest;
+    esp_camera_fb_return(fb);
+  }
+  camera_stats_t stats;
+  esp_camera_stats_get(&stats);
+  *pool = stats.pool_size;
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  bool ok = good == frames && stats.frames_rejected <= stats.buffers_overrun + stats.buffers_late;
+  printf("%-5s %2zu %5d %8zu %8zu %5d %8zu %8zu %5s\n", c->name, fb_count, round, *pool / 1024, *largest / 1024, good, stats.frames_rejected,
+         stats.buffers_overrun + stats.buffers_late, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+static bool check_case(const check_case_t *c, size_t fb_count, int frames) {
+  size_t first = 0, largest = 0;
+  bool ok = true;
+  for (int round = 1; round <= CHECK_ROUNDS; round++) {
+    size_t pool, frame;
+    ok = check_round(c, fb_count, round, frames, &pool, &frame) && ok;
+
+    // the history of the rounds before has to fit, small JPEGs need less than the full frames
+    if (round > 1 && pool < largest) {
+      printf("  pool of %zu KB is smaller than a frame of %zu KB\n", pool / 1024, largest / 1024);
+      ok = false;
+    }
+    if (round > 1 && c->jpeg_size * 2 < first / fb_count && pool >= first) {
+      printf("  pool of %zu KB did not shrink\n", pool / 1024);
+      ok = false;
+    }
+    first = round == 1 ? pool : first;
+    largest = frame > largest ? frame : largest;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 30;
+
+  printf("size  fb round  pool KB  max KB  good rejected late+ovr\n");
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(check_cases) / sizeof(check_cases[0]); i++) {
+    for (size_t fb_count = 1; fb_count <= 3; fb_count++) {
+      failed += !check_case(&check_cases[i], fb_count, frames);
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,559 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "camera_common.h"
+#include "camera_sim.h"
+#include "driver/gpio.h"
+#include "driver/periph_ctrl.h"
+#include "esp_intr_alloc.h"
+#include "esp_timer.h"
+#include "soc/gpio_sig_map.h"
+#include "soc/i2s_struct.h"
+#include "twi.h"
+#include "xclk.h"
+
+#define CAMERA_SIM_PINS 40
+#define CAMERA_SIM_HISTORY 64   // frames that can be identified
+#define CAMERA_SIM_BLOCK 512    // bytes transferred between two sleeps
+#define CAMERA_SIM_ADDRESS 0x30  // sccb address of the ov2640
+#define CAMERA_SIM_PID 0x26      // product id of the ov2640
+
+i2s_dev_t I2S0;
+gpio_dev_t GPIO;
+
+struct intr_handle_data_t {
+  int source;
+  intr_handler_t handler;
+  void *arg;
+  volatile bool enabled;
+};
+
+typedef struct {
+  uint32_t seq;
+  int64_t start;
+  int64_t end;
+} camera_sim_frame_t;
+
+static struct {
+  camera_sim_config_t config;
+  pthread_t thread;
+  volatile bool running;
+  pthread_mutex_t mutex;
+
+  intr_handle_t i2s;
+  int vsync_pin;
+  gpio_int_type_t intr_type[CAMERA_SIM_PINS];
+  gpio_isr_t isr[CAMERA_SIM_PINS];
+  void *isr_arg[CAMERA_SIM_PINS];
+
+  bool xclk;
+  uint8_t regs[2][256];
+  uint8_t bank;
+  uint8_t reg;
+
+  lldesc_t *desc;
+  size_t pos;
+  uint32_t seq;
+  bool complete;
+  uint32_t random;
+
+  camera_sim_stats_t stats;
+  camera_sim_frame_t frames[CAMERA_SIM_HISTORY];
+} camera_sim = {.mutex = PTHREAD_MUTEX_INITIALIZER, .vsync_pin = -1};
+
+/* interrupts */
+
+esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle) {
+  // allocate handle
+  intr_handle_t handle = calloc(1, sizeof(struct intr_handle_data_t));
+  if (handle == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  handle->source = source;
+  handle->handler = handler;
+  handle->arg = arg;
+  handle->enabled = (flags & ESP_INTR_FLAG_INTRDISABLED) == 0;
+
+  // remember i2s interrupt
+  if (source == ETS_I2S0_INTR_SOURCE) {
+    pthread_mutex_lock(&camera_sim.mutex);
+    camera_sim.i2s = handle;
+    pthread_mutex_unlock(&camera_sim.mutex);
+  }
+
+  if (ret_handle != NULL) {
+    *ret_handle = handle;
+  }
+
+  return ESP_OK;
+}
+
+esp_err_t esp_intr_free(intr_handle_t handle) {
+  // forget i2s interrupt
+  pthread_mutex_lock(&camera_sim.mutex);
+  if (camera_sim.i2s == handle) {
+    camera_sim.i2s = NULL;
+  }
+  pthread_mutex_unlock(&camera_sim.mutex);
+
+  free(handle);
+
+  return ESP_OK;
+}
+
+esp_err_t esp_intr_enable(intr_handle_t handle) {
+  handle->enabled = true;
+  return ESP_OK;
+}
+
+esp_err_t esp_intr_disable(intr_handle_t handle) {
+  handle->enabled = false;
+  return ESP_OK;
+}
+
+/* gpio */
+
+esp_err_t gpio_config(const gpio_config_t *config) { return ESP_OK; }
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) { return ESP_OK; }
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type) {
+  if (gpio_num < 0 || gpio_num >= CAMERA_SIM_PINS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  camera_sim.intr_type[gpio_num] = intr_type;
+  return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags) { return ESP_OK; }
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t handler, void *arg) {
+  if (gpio_num < 0 || gpio_num >= CAMERA_SIM_PINS) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  pthread_mutex_lock(&camera_sim.mutex);
+  camera_sim.isr[gpio_num] = handler;
+  camera_sim.isr_arg[gpio_num] = arg;
+  pthread_mutex_unlock(&camera_sim.mutex);
+  return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num) { return gpio_isr_handler_add(gpio_num, NULL, NULL); }
+
+void gpio_matrix_in(uint32_t gpio, uint32_t signal_idx, bool inv) {
+  // the driver routes vsync through the matrix
+  if (signal_idx == I2S0I_V_SYNC_IDX && gpio < CAMERA_SIM_PINS) {
+    camera_sim.vsync_pin = (int)gpio;
+  }
+}
+
+/* sccb bus and xclk */
+
+void twi_init(unsigned char sda, unsigned char scl) {}
+
+uint8_t twi_writeTo(unsigned char address, unsigned char *buf, unsigned int len, unsigned char sendStop) {
+  // count transaction, the sensor acknowledges its own address only
+  pthread_mutex_lock(&camera_sim.mutex);
+  camera_sim.stats.sccb++;
+  if (address != CAMERA_SIM_ADDRESS) {
+    pthread_mutex_unlock(&camera_sim.mutex);
+    return 2;
+  }
+
+  // the first byte selects the register, a second one selects the bank or is written to the selected bank
+  if (len > 0) {
+    camera_sim.reg = buf[0];
+  }
+  if (len > 1) {
+    if (camera_sim.reg == 0xFF) {
+      camera_sim.bank = buf[1];
+    } else {
+      camera_sim.regs[camera_sim.bank & 1][camera_sim.reg] = buf[1];
+    }
+  }
+  pthread_mutex_unlock(&camera_sim.mutex);
+  return 0;
+}
+
+uint8_t twi_readFrom(unsigned char address, unsigned char *buf, unsigned int len, unsigned char sendStop) {
+  // count transaction and read the selected register
+  pthread_mutex_lock(&camera_sim.mutex);
+  camera_sim.stats.sccb++;
+  if (address != CAMERA_SIM_ADDRESS) {
+    pthread_mutex_unlock(&camera_sim.mutex);
+    return 2;
+  }
+  for (unsigned int i = 0; i < len; i++) {
+    buf[i] = camera_sim.reg == 0xFF ? camera_sim.bank : camera_sim.regs[camera_sim.bank & 1][camera_sim.reg];
+  }
+  pthread_mutex_unlock(&camera_sim.mutex);
+  return 0;
+}
+
+esp_err_t camera_enable_out_clock(camera_config_t *config) {
+  camera_sim.xclk = true;
+  return ESP_OK;
+}
+
+void camera_stop_out_clock(camera_config_t *config) { camera_sim.xclk = false; }
+
+void camera_disable_out_clock() { camera_sim.xclk = false; }
+
+void periph_module_enable(periph_module_t periph) {}
+
+void periph_module_disable(periph_module_t periph) {
+  if (periph == PERIPH_I2S0_MODULE) {
+    memset((void *)&I2S0, 0, sizeof(I2S0));
+  }
+}
+
+/* sensor */
+
+static void camera_sim_sleep_until(int64_t deadline) {
+  // sleep on the clock of esp_timer_get_time
+  struct timespec t = {.tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {
+  }
+}
+
+static uint32_t camera_sim_random(void) {
+  // xorshift
+  uint32_t x = camera_sim.random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  camera_sim.random = x;
+  return x;
+}
+
+static void camera_sim_vsync(int level) {
+  // get pin
+  int pin = camera_sim.vsync_pin;
+  if (pin < 0) {
+    return;
+  }
+
+  // set level
+  if (pin < 32) {
+    GPIO.in = level ? GPIO.in | (1u << pin) : GPIO.in & ~(1u << pin);
+  } else {
+    uint32_t data = GPIO.in1.data;
+    GPIO.in1.data = level ? data | (1u << (pin - 32)) : data & ~(1u << (pin - 32));
+  }
+
+  // raise interrupt on the falling edge
+  gpio_int_type_t type = camera_sim.intr_type[pin];
+  if (level || (type != GPIO_INTR_NEGEDGE && type != GPIO_INTR_ANYEDGE)) {
+    return;
+  }
+  pthread_mutex_lock(&camera_sim.mutex);
+  gpio_isr_t isr = camera_sim.isr[pin];
+  void *arg = camera_sim.isr_arg[pin];
+  pthread_mutex_unlock(&camera_sim.mutex);
+  if (isr != NULL) {
+    if (pin < 32) {
+      GPIO.status |= 1u << pin;
+    } else {
+      GPIO.status1.val |= 1u << (pin - 32);
+    }
+    isr(arg);
+  }
+}
+
+static void camera_sim_in_done(void) {
+  // raise interrupt if enabled
+  pthread_mutex_lock(&camera_sim.mutex);
+  intr_handle_t handle = camera_sim.i2s;
+  camera_sim.stats.buffers++;
+  pthread_mutex_unlock(&camera_sim.mutex);
+  I2S0.int_raw.in_done = 1;
+  if (handle != NULL && handle->enabled && I2S0.int_ena.in_done) {
+    handle->handler(handle->arg);
+  }
+
+  // clear acknowledged bits
+  I2S0.int_raw.val &= ~I2S0.int_clr.val;
+  I2S0.int_clr.val = 0;
+}
+
+static void camera_sim_dma(const uint8_t *data, size_t len) {
+  // the frame ends with the last transferred byte, record it before the interrupts can complete the frame
+  pthread_mutex_lock(&camera_sim.mutex);
+  camera_sim.frames[camera_sim.seq % CAMERA_SIM_HISTORY].end = esp_timer_get_time();
+  pthread_mutex_unlock(&camera_sim.mutex);
+
+  for (size_t i = 0; i < len;) {
+    // discard data while the bus is stopped
+    if (!I2S0.conf.rx_start || !I2S0.in_link.start) {
+      camera_sim.complete = false;
+      pthread_mutex_lock(&camera_sim.mutex);
+      camera_sim.stats.dropped += len - i;
+      pthread_mutex_unlock(&camera_sim.mutex);
+      return;
+    }
+
+    // follow a newly written link
+    uintptr_t addr = I2S0.in_link.addr;
+    if (addr != 0) {
+      I2S0.in_link.addr = 0;
+      camera_sim.desc = (lldesc_t *)addr;
+      camera_sim.pos = 0;
+    }
+    lldesc_t *desc = camera_sim.desc;
+    if (desc == NULL) {
+      camera_sim.complete = false;
+      return;
+    }
+
+    // pack bytes into an element like the fifo does in the configured sampling mode
+    uint32_t *elem = (uint32_t *)(desc->buf + camera_sim.pos);
+    uint32_t next = i + 1 < len ? data[i + 1] : 0;
+    switch (I2S0.fifo_conf.rx_fifo_mod) {
+      case SM_0A0B_0C0D:
+        *elem = (uint32_t)data[i] << 16 | next;
+        i += 2;
+        break;
+      case SM_0A0B_0B0C:
+        *elem = (uint32_t)data[i] << 16 | next;
+        i += 1;
+        break;
+      default:
+        *elem = (uint32_t)data[i] << 16;
+        i += 1;
+        break;
+    }
+    camera_sim.pos += sizeof(uint32_t);
+
+    // complete descriptor
+    if (camera_sim.pos >= desc->length) {
+      camera_sim.desc = desc->qe.stqe_next;
+      camera_sim.pos = 0;
+      camera_sim_in_done();
+    }
+  }
+}
+
+static void camera_sim_seq(uint8_t *dst, size_t stride, uint32_t seq) {
+  // 7 bits per byte so the sequence never forms a marker
+  for (int i = 0; i < 4; i++) {
+    dst[i * stride] = (seq >> (7 * i)) & 0x7F;
+  }
+}
+
+static void camera_sim_jpeg(uint32_t seq, int64_t start) {
+  // pick size
+  size_t size = camera_sim.config.jpeg_size;
+  if (camera_sim.config.jpeg_jitter > 0) {
+    size_t span = 2 * camera_sim.config.jpeg_jitter + 1;
+    size = size - camera_sim.config.jpeg_jitter + camera_sim_random() % span;
+  }
+  if (size < 16) {
+    size = 16;
+  }
+
+  // prepare SOI, APP0 holding the sequence and SOS
+  uint8_t header[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x06, 0, 0, 0, 0, 0xFF, 0xDA, 0x00, 0x02};
+  camera_sim_seq(header + 6, 1, seq);
+
+  // stream header, entropy coded data without markers and EOI
+  uint8_t block[CAMERA_SIM_BLOCK];
+  for (size_t pos = 0; pos < size;) {
+    size_t n = size - pos < sizeof(block) ? size - pos : sizeof(block);
+    for (size_t i = 0; i < n; i++) {
+      size_t p = pos + i;
+      if (p < sizeof(header)) {
+        block[i] = header[p];
+      } else if (p >= size - 2) {
+        block[i] = p == size - 2 ? 0xFF : 0xD9;
+      } else {
+        block[i] = (uint8_t)(camera_sim_random() % 0xFF);
+      }
+    }
+    camera_sim_dma(block, n);
+    pos += n;
+    camera_sim_sleep_until(start + (int64_t)pos * 1000000 / camera_sim.config.pclk_hz);
+  }
+
+  // the sensor pads the last line after EOI with zeros, which completes the descriptor
+  const uint8_t zero = 0;
+  while (camera_sim.desc != NULL && camera_sim.pos > 0 && I2S0.conf.rx_start && I2S0.in_link.start) {
+    camera_sim_dma(&zero, 1);
+  }
+}
+
+static void camera_sim_raw(uint32_t seq, int64_t start, size_t width, size_t height) {
+  // allocate line, the sensor sends two bytes per pixel
+  size_t len = width * 2;
+  uint8_t *line = malloc(len);
+  if (line == NULL) {
+    return;
+  }
+
+  // pick clip frame
+  const uint8_t *clip = NULL;
+  if (camera_sim.config.clip != NULL && camera_sim.config.clip_frames > 0) {
+    clip = camera_sim.config.clip + (seq % camera_sim.config.clip_frames) * len * height;
+  }
+
+  // stream lines with blanking
+  int64_t line_us = (int64_t)len * 1000000 / camera_sim.config.pclk_hz + camera_sim.config.line_blank_us;
+  for (size_t y = 0; y < height && camera_sim.running; y++) {
+    for (size_t x = 0; x < len; x++) {
+      line[x] = clip != NULL ? clip[y * len + x] : (uint8_t)(x + y);
+    }
+    if (y == 0) {
+      camera_sim_seq(line, 2, seq);
+    }
+    camera_sim_dma(line, len);
+    camera_sim_sleep_until(start + (int64_t)(y + 1) * line_us);
+  }
+
+  free(line);
+}
+
+static void *camera_sim_run(void *arg) {
+  int64_t next = esp_timer_get_time();
+  for (uint32_t seq = 0; camera_sim.running; seq++) {
+    // nothing is read out without xclk or in standby, vsync stays high meanwhile
+    while (camera_sim.running && (!camera_sim.xclk || (camera_sim.regs[1][0x09] & 0x10))) {
+      next += 1000000 / camera_sim.config.fps;
+      camera_sim_sleep_until(next);
+    }
+
+    // vsync is pulled low between frames
+    camera_sim_vsync(0);
+    camera_sim_sleep_until(next + camera_sim.config.vsync_us);
+    camera_sim_vsync(1);
+    camera_sim_sleep_until(next + 2 * camera_sim.config.vsync_us);
+
+    // record frame
+    int64_t start = esp_timer_get_time();
+    pthread_mutex_lock(&camera_sim.mutex);
+    camera_sim.seq = seq;
+    camera_sim.frames[seq % CAMERA_SIM_HISTORY] = (camera_sim_frame_t){.seq = seq, .start = start, .end = start};
+    pthread_mutex_unlock(&camera_sim.mutex);
+
+    // read out a frame in the configured format, nothing is sent before the driver configured the sensor
+    camera_sim.complete = I2S0.conf.rx_start && I2S0.in_link.start;
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor != NULL && sensor->pixformat == PIXFORMAT_JPEG) {
+      camera_sim_jpeg(seq, start);
+    } else if (sensor != NULL && sensor->pixformat != PIXFORMAT_RGB888) {
+      framesize_t size = sensor->status.framesize;
+      camera_sim_raw(seq, start, resolution[size][0], resolution[size][1]);
+    } else {
+      camera_sim.complete = false;
+    }
+
+    // count frame
+    pthread_mutex_lock(&camera_sim.mutex);
+    camera_sim.stats.frames++;
+    if (camera_sim.complete) {
+      camera_sim.stats.captured++;
+    }
+    pthread_mutex_unlock(&camera_sim.mutex);
+
+    // wait for the next frame, skip missed periods
+    int64_t end = esp_timer_get_time();
+    next += 1000000 / camera_sim.config.fps;
+    if (next < end) {
+      next = end;
+    }
+    camera_sim_sleep_until(next);
+  }
+
+  return NULL;
+}
+
+/* public */
+
+void camera_sim_default_config(camera_sim_config_t *config) {
+  *config = (camera_sim_config_t){
+      .pclk_hz = 10000000,
+      .fps = 25,
+      .vsync_us = 500,
+      .line_blank_us = 20,
+      .jpeg_size = 30000,
+      .jpeg_jitter = 5000,
+      .seed = 1,
+  };
+}
+
+void camera_sim_start(const camera_sim_config_t *config) {
+  // reset state
+  camera_sim.config = *config;
+  camera_sim.random = config->seed != 0 ? config->seed : 1;
+  camera_sim.desc = NULL;
+  camera_sim.pos = 0;
+  memset(&camera_sim.stats, 0, sizeof(camera_sim.stats));
+  memset(camera_sim.frames, 0xFF, sizeof(camera_sim.frames));
+
+  // power up the ov2640 with the sensor bank selected
+  memset(camera_sim.regs, 0, sizeof(camera_sim.regs));
+  camera_sim.bank = 1;
+  camera_sim.regs[1][0x0A] = CAMERA_SIM_PID;
+  camera_sim.regs[1][0x0B] = 0x42;
+  camera_sim.regs[1][0x1C] = 0x7F;
+  camera_sim.regs[1][0x1D] = 0xA2;
+
+  // start sensor
+  camera_sim.running = true;
+  pthread_create(&camera_sim.thread, NULL, camera_sim_run, NULL);
+}
+
+void camera_sim_stop(void) {
+  // stop sensor
+  if (!camera_sim.running) {
+    return;
+  }
+  camera_sim.running = false;
+  pthread_join(camera_sim.thread, NULL);
+}
+
+void camera_sim_stats(camera_sim_stats_t *stats) {
+  pthread_mutex_lock(&camera_sim.mutex);
+  *stats = camera_sim.stats;
+  pthread_mutex_unlock(&camera_sim.mutex);
+}
+
+bool camera_sim_frame(const camera_fb_t *fb, uint32_t *seq, int64_t *start, int64_t *end) {
+  // decode sequence, grayscale keeps every second byte of the sensor
+  if (fb == NULL || fb->len < 10) {
+    return false;
+  }
+  const uint8_t *src = fb->buf;
+  size_t stride = 2;
+  if (fb->format == PIXFORMAT_JPEG) {
+    if (src[0] != 0xFF || src[1] != 0xD8) {
+      return false;
+    }
+    src += 6;
+    stride = 1;
+  } else if (fb->format == PIXFORMAT_GRAYSCALE) {
+    stride = 1;
+  }
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= (uint32_t)(src[i * stride] & 0x7F) << (7 * i);
+  }
+
+  // look up times
+  pthread_mutex_lock(&camera_sim.mutex);
+  camera_sim_frame_t frame = camera_sim.frames[value % CAMERA_SIM_HISTORY];
+  pthread_mutex_unlock(&camera_sim.mutex);
+  if (frame.seq != value) {
+    return false;
+  }
+
+  *seq = value;
+  if (start != NULL) {
+    *start = frame.start;
+  }
+  if (end != NULL) {
+    *end = frame.end;
+  }
+
+  return true;
+}
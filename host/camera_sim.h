@@ -0,0 +1,78 @@
+#ifndef CAMERA_SIM_H
+#define CAMERA_SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_camera.h"
+
+/**
+ * The timing and content of the simulated sensor.
+ */
+typedef struct {
+  uint32_t pclk_hz;        // pixel clock, one byte is transferred per clock
+  uint32_t fps;            // frame rate of the sensor
+  uint32_t vsync_us;       // length of the low vsync pulse between frames and of the gap before the first line
+  uint32_t line_blank_us;  // horizontal blanking after each line of raw frames
+  size_t jpeg_size;        // average size of a jpeg frame
+  size_t jpeg_jitter;      // maximum deviation from the average jpeg size
+  uint32_t seed;           // seed of the generated content
+  const uint8_t *clip;     // raw frames played in a loop instead of the generated content, two bytes per pixel
+  size_t clip_frames;      // frames of the clip, each of the frame size the driver configured
+} camera_sim_config_t;
+
+/**
+ * The counters of the simulated sensor.
+ */
+typedef struct {
+  uint32_t frames;    // frames read out by the sensor
+  uint32_t captured;  // frames read out while the i2s bus was receiving
+  uint32_t buffers;   // completed dma buffers
+  uint32_t dropped;   // bytes read out while the i2s bus was stopped
+  uint32_t sccb;      // sccb transactions, every addressed write or read counts once
+} camera_sim_stats_t;
+
+/**
+ * Fill the configuration with a 10 MHz pixel clock, 25 fps and 30 KB jpeg frames.
+ *
+ * @param config - The configuration.
+ */
+void camera_sim_default_config(camera_sim_config_t *config);
+
+/**
+ * Start the sensor. This must happen before `esp_camera_init` which waits for vsync.
+ *
+ * The sensor thread toggles vsync and writes the generated frames into the dma descriptors linked to the i2s
+ * registers, raising the interrupts registered by the driver like the hardware would.
+ *
+ * @param config - The configuration.
+ */
+void camera_sim_start(const camera_sim_config_t *config);
+
+/**
+ * Stop the sensor. This must happen before `esp_camera_deinit` frees the dma buffers.
+ */
+void camera_sim_stop(void);
+
+/**
+ * Get the counters.
+ *
+ * @param stats - The counters.
+ */
+void camera_sim_stats(camera_sim_stats_t *stats);
+
+/**
+ * Identify a frame buffer returned by the driver.
+ *
+ * The sequence number is embedded in the generated content, the times are taken from the `esp_timer_get_time` clock.
+ *
+ * @param fb - The frame buffer.
+ * @param seq - The sequence number of the frame.
+ * @param start - The time the readout of the frame started.
+ * @param end - The time the readout of the frame ended.
+ * @return Whether the frame could be identified.
+ */
+bool camera_sim_frame(const camera_fb_t *fb, uint32_t *seq, int64_t *start, int64_t *end);
+
+#endif  // CAMERA_SIM_H
@@ -0,0 +1,167 @@
+// Suspends and resumes the camera many times and compares the cost of a resume with the one of a full init.
+//
+// Each cycle takes a few frames, holds one of them across the suspend and waits a while in standby. The sensor may
+// not read out frames while suspended, calls that take frames have to fail until the resume, and the held frame may
+// not change. After the resume the frames have to be whole and new ones have to follow, with the settings of before.
+// The time and SCCB transactions of the suspend and the resume and the time until the frames after it are printed
+// next to those of the init and its first frames.
+//
+// usage: camera_suspend_bench [cycles]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define BENCH_FRAMES 3
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  size_t fb_count;
+  bool preroll;
+  uint8_t motion_threshold;
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+    {"jpeg", PIXFORMAT_JPEG, 1, false, 0},
+    {"jpeg", PIXFORMAT_JPEG, 2, false, 0},
+    {"jpeg", PIXFORMAT_JPEG, 3, true, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 1, false, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 2, true, 0},
+    {"grayscale", PIXFORMAT_GRAYSCALE, 3, false, 20},
+    {"yuv422", PIXFORMAT_YUV422, 2, false, 0},
+};
+
+static uint32_t bench_sum(const camera_fb_t *fb) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < fb->len; i++) {
+    sum = sum * 31 + fb->buf[i];
+  }
+  return sum;
+}
+
+static int bench_frames(const bench_case_t *c, int64_t after) {
+  // whole frames, the last one started after the given time, the latest pre-roll frame may be from before it
+  int bad = 0;
+  int64_t start = 0;
+  for (int i = 0; i < BENCH_FRAMES; i++) {
+    camera_fb_t *fb = c->preroll ? esp_camera_fb_get_at_or_after(i > 0 ? start + 1 : after) : esp_camera_fb_get();
+    if (fb == NULL) {
+      return BENCH_FRAMES;
+    }
+    bad += !camera_sim_frame(fb, &(uint32_t){0}, &start, NULL);
+    esp_camera_fb_return(fb);
+  }
+  return bad + (start < after);
+}
+
+static bool bench_run(const bench_case_t *c, int cycles) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = c->format,
+      .frame_size = c->format == PIXFORMAT_JPEG ? FRAMESIZE_SVGA : FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = c->fb_count,
+      .preroll = c->preroll,
+      .motion_threshold = c->motion_threshold,
+      .motion_blocks = 3,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  camera_sim_start(&sim);
+
+  // the full init and its first frame
+  camera_sim_stats_t before, after;
+  camera_sim_stats(&before);
+  int64_t start = esp_timer_get_time();
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("%-9s %2zu init failed\n", c->name, c->fb_count);
+    return false;
+  }
+  camera_sim_stats(&after);
+  int bad = bench_frames(c, start);
+  double init_ms = (esp_timer_get_time() - start) / 1000.0;
+  uint32_t init_sccb = after.sccb - before.sccb;
+  sensor_t *sensor = esp_camera_sensor_get();
+  framesize_t framesize = sensor->status.framesize;
+
+  int failed = 0;
+  uint32_t sleeping = 0, resume_sccb = 0;
+  double suspend_ms = 0, resume_ms = 0, frames_ms = 0;
+  for (int i = 0; i < cycles; i++) {
+    bad += bench_frames(c, 0);
+
+    // hold a frame across the suspend, with one frame buffer it is returned before
+    camera_fb_t *held = c->fb_count > 1 ? esp_camera_fb_get() : NULL;
+    uint32_t sum = held != NULL ? bench_sum(held) : 0;
+    start = esp_timer_get_time();
+    failed += esp_camera_suspend() != ESP_OK;
+    suspend_ms += (esp_timer_get_time() - start) / 1000.0;
+    failed += esp_camera_suspend() != ESP_ERR_INVALID_STATE;
+    failed += esp_camera_fb_get() != NULL;
+
+    // nothing may be read out in standby, the frame in progress may end
+    camera_sim_stats(&before);
+    vTaskDelay(200 / portTICK_PERIOD_MS);
+    camera_sim_stats(&after);
+    sleeping += after.frames - before.frames > 1 ? after.frames - before.frames : 0;
+
+    start = esp_timer_get_time();
+    failed += esp_camera_resume() != ESP_OK;
+    resume_ms += (esp_timer_get_time() - start) / 1000.0;
+    camera_sim_stats(&before);
+    resume_sccb += before.sccb - after.sccb;
+    failed += sensor->status.framesize != framesize;
+
+    // with two buffers the held frame and the latest one take the whole pool, so it is returned first
+    if (held != NULL) {
+      failed += bench_sum(held) != sum;
+      esp_camera_fb_return(held);
+    }
+    bad += bench_frames(c, start);
+    frames_ms += (esp_timer_get_time() - start) / 1000.0;
+  }
+  failed += esp_camera_resume() != ESP_ERR_INVALID_STATE;
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  bool ok = failed == 0 && bad == 0 && sleeping == 0;
+  printf("%-9s %2zu %7d %6d %7.1f %6u %7.2f %7.2f %6.1f %6u %8.1f %5d %5s\n", c->name, c->fb_count, c->preroll, c->motion_threshold, init_ms,
+         init_sccb, suspend_ms / cycles, resume_ms / cycles, cycles ? (double)resume_sccb / cycles : 0, sleeping, frames_ms / cycles, bad,
+         ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int cycles = argc > 1 ? atoi(argv[1]) : 10;
+
+  printf("                                  init            suspend  resume                 frames\n");
+  printf("format    fb preroll motion      ms   sccb      ms      ms   sccb asleep       ms   bad\n");
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    failed += !bench_run(&bench_cases[i], cycles);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Verifies every line of raw frames while the filter task falls behind the DMA and counts the torn frames.
+//
+// The simulated sensor plays a random QVGA clip of a few frames, so a line that was copied from a DMA buffer after
+// the DMA refilled it with a later line or frame differs from the clip. Such buffers have to be counted as late or
+// overrun and their frame rejected, so no frame buffer handed out may differ from its frame of the clip. The pixel
+// clocks leave the filter task less time per line than the default.
+//
+// usage: camera_torn_check [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "camera_sim.h"
+#include "esp_camera.h"
+
+#define CHECK_WIDTH 320
+#define CHECK_HEIGHT 240
+#define CHECK_CLIP_FRAMES 5
+
+typedef struct {
+  const char *name;
+  pixformat_t format;
+  size_t bytes_per_pixel;
+} check_format_t;
+
+static const check_format_t check_formats[] = {
+    {"grayscale", PIXFORMAT_GRAYSCALE, 1},
+    {"yuv422", PIXFORMAT_YUV422, 2},
+};
+
+static const uint32_t check_pclks[] = {10000000, 20000000, 40000000};
+
+static uint8_t check_clip[CHECK_CLIP_FRAMES * CHECK_WIDTH * CHECK_HEIGHT * 2];
+
+static bool check_frame(const check_format_t *format, const camera_fb_t *fb, uint32_t seq) {
+  // grayscale keeps the luma of each pair, the sensor writes the sequence number over the luma of the first pixels
+  const uint8_t *clip = check_clip + (seq % CHECK_CLIP_FRAMES) * CHECK_WIDTH * CHECK_HEIGHT * 2;
+  size_t stride = 2 / format->bytes_per_pixel;
+  if (fb->width != CHECK_WIDTH || fb->height != CHECK_HEIGHT || fb->len != CHECK_WIDTH * CHECK_HEIGHT * format->bytes_per_pixel) {
+    printf("  frame %u has %zu bytes\n", seq, fb->len);
+    return false;
+  }
+  for (size_t i = 8 / stride; i < fb->len; i++) {
+    if (fb->buf[i] != clip[i * stride]) {
+      printf("  frame %u differs from line %zu on\n", seq, i / (CHECK_WIDTH * format->bytes_per_pixel));
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool check_run(const check_format_t *format, uint32_t pclk_hz, size_t fb_count, int frames) {
+  camera_config_t config = {
+      .pin_pwdn = -1,
+      .pin_reset = -1,
+      .pin_xclk = 21,
+      .pin_sscb_sda = 26,
+      .pin_sscb_scl = 27,
+      .pin_d7 = 35,
+      .pin_d6 = 34,
+      .pin_d5 = 39,
+      .pin_d4 = 36,
+      .pin_d3 = 19,
+      .pin_d2 = 18,
+      .pin_d1 = 5,
+      .pin_d0 = 4,
+      .pin_vsync = 25,
+      .pin_href = 23,
+      .pin_pclk = 22,
+      .xclk_freq_hz = 20000000,
+      .pixel_format = format->format,
+      .frame_size = FRAMESIZE_QVGA,
+      .jpeg_quality = 12,
+      .fb_count = fb_count,
+  };
+  camera_sim_config_t sim;
+  camera_sim_default_config(&sim);
+  sim.pclk_hz = pclk_hz;
+  sim.clip = check_clip;
+  sim.clip_frames = CHECK_CLIP_FRAMES;
+  camera_sim_start(&sim);
+  if (esp_camera_init(&config) != ESP_OK) {
+    camera_sim_stop();
+    printf("%-9s %3u %2zu init failed\n", format->name, pclk_hz / 1000000, fb_count);
+    return false;
+  }
+
+  int torn = 0;
+  for (int i = 0; i < frames; i++) {
+    camera_fb_t *fb = esp_camera_fb_get();
+    uint32_t seq;
+    torn += !camera_sim_frame(fb, &seq, NULL, NULL) || !check_frame(format, fb, seq);
+    esp_camera_fb_return(fb);
+  }
+  camera_stats_t stats;
+  esp_camera_stats_get(&stats);
+  camera_sim_stop();
+  esp_camera_deinit();
+
+  printf("%-9s %3u %2zu %6d %5d %8zu %7zu %4zu %5s\n", format->name, pclk_hz / 1000000, fb_count, frames, torn, stats.frames_rejected,
+         stats.buffers_overrun, stats.buffers_late, torn == 0 ? "ok" : "FAIL");
+  return torn == 0;
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 40;
+  for (size_t i = 0; i < sizeof(check_clip); i++) {
+    check_clip[i] = (uint8_t)rand();
+  }
+
+  printf("format    MHz fb frames  torn rejected overrun late\n");
+  int failed = 0;
+  for (size_t f = 0; f < sizeof(check_formats) / sizeof(check_formats[0]); f++) {
+    for (size_t p = 0; p < sizeof(check_pclks) / sizeof(check_pclks[0]); p++) {
+      for (size_t fb_count = 1; fb_count <= 3; fb_count++) {
+        failed += !check_run(&check_formats[f], check_pclks[p], fb_count, frames);
+      }
+    }
+  }
+  return failed ? 1 : 0;
+}
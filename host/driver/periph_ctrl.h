@@ -0,0 +1,16 @@
+#ifndef DRIVER_PERIPH_CTRL_POSIX_H
+#define DRIVER_PERIPH_CTRL_POSIX_H
+
+typedef enum {
+  PERIPH_LEDC_MODULE = 0,
+  PERIPH_I2S0_MODULE = 6,
+} periph_module_t;
+
+void periph_module_enable(periph_module_t periph);
+
+/**
+ * Disabling the i2s module resets its registers, so that a new `esp_camera_init` starts from a stopped bus.
+ */
+void periph_module_disable(periph_module_t periph);
+
+#endif  // DRIVER_PERIPH_CTRL_POSIX_H
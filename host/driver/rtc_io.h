@@ -0,0 +1,12 @@
+#ifndef DRIVER_RTC_IO_POSIX_H
+#define DRIVER_RTC_IO_POSIX_H
+
+#include <stdbool.h>
+
+#include "driver/gpio.h"
+
+static inline bool rtc_gpio_is_valid_gpio(gpio_num_t gpio_num) { return false; }
+
+static inline esp_err_t rtc_gpio_deinit(gpio_num_t gpio_num) { return ESP_OK; }
+
+#endif  // DRIVER_RTC_IO_POSIX_H
@@ -0,0 +1,7 @@
+#ifndef ESP_ATTR_POSIX_H
+#define ESP_ATTR_POSIX_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif  // ESP_ATTR_POSIX_H
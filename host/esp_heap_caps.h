@@ -0,0 +1,28 @@
+#ifndef ESP_HEAP_CAPS_POSIX_H
+#define ESP_HEAP_CAPS_POSIX_H
+
+#include <stdlib.h>
+
+#include "esp_err.h"
+
+// all memory is the same on the host
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// the heap of the target that programs linked with host/heap_posix.c count their allocations against
+#define HEAP_POSIX_SIZE (320 * 1024)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+
+// only with host/heap_posix.c, which counts every allocation of the process
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+esp_err_t heap_caps_monitor_local_minimum_free_size_start(void);
+esp_err_t heap_caps_monitor_local_minimum_free_size_stop(void);
+
+#endif  // ESP_HEAP_CAPS_POSIX_H
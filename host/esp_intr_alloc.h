@@ -0,0 +1,28 @@
+#ifndef ESP_INTR_ALLOC_POSIX_H
+#define ESP_INTR_ALLOC_POSIX_H
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+
+// interrupts are raised by the camera simulation, see camera_sim.h
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+#define ESP_INTR_FLAG_INTRDISABLED (1 << 11)
+
+#define ETS_I2S0_INTR_SOURCE 32
+
+typedef void (*intr_handler_t)(void *arg);
+
+typedef struct intr_handle_data_t *intr_handle_t;
+
+esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle);
+
+esp_err_t esp_intr_free(intr_handle_t handle);
+
+esp_err_t esp_intr_enable(intr_handle_t handle);
+
+esp_err_t esp_intr_disable(intr_handle_t handle);
+
+#endif  // ESP_INTR_ALLOC_POSIX_H
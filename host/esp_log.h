@@ -0,0 +1,18 @@
+#ifndef ESP_LOG_POSIX_H
+#define ESP_LOG_POSIX_H
+
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define ESP_POSIX_LOG(level, tag, format, ...) \
+  fprintf(stderr, "%c (%u) %s: " format "\n", level, (unsigned)xTaskGetTickCount(), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) ESP_POSIX_LOG('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_POSIX_LOG('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_POSIX_LOG('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)
+#define ESP_LOGV(tag, format, ...)
+
+#endif  // ESP_LOG_POSIX_H
@@ -0,0 +1,13 @@
+#ifndef ESP_TIMER_POSIX_H
+#define ESP_TIMER_POSIX_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif  // ESP_TIMER_POSIX_H
@@ -0,0 +1,32 @@
+#ifndef FREERTOS_POSIX_H
+#define FREERTOS_POSIX_H
+
+// POSIX shim of the FreeRTOS API subset used by esp-mqtt and the camera driver, see README.md.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+// pass -DconfigTICK_RATE_HZ=100 to get the tick of the target
+#ifndef configTICK_RATE_HZ
+#define configTICK_RATE_HZ 1000
+#endif
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+#define tskNO_AFFINITY 0x7fffffff
+
+#define portYIELD_FROM_ISR()
+
+#endif  // FREERTOS_POSIX_H
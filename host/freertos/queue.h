@@ -0,0 +1,53 @@
+#ifndef FREERTOS_POSIX_QUEUE_H
+#define FREERTOS_POSIX_QUEUE_H
+
+#include "FreeRTOS.h"
+
+/**
+ * A queue is a ring of fixed size items guarded by a pthread mutex and conditions.
+ */
+typedef struct freertos_posix_queue *QueueHandle_t;
+
+/**
+ * Create a queue that holds length items of item_size bytes.
+ */
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+
+/**
+ * Copy an item to the back of the queue, waiting up to the specified amount of ticks for space.
+ */
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+
+#define xQueueSendToBack xQueueSend
+
+/**
+ * Copy the front item out of the queue, waiting up to the specified amount of ticks for an item.
+ */
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+
+/**
+ * Copy an item to the back of the queue without waiting. A task is never woken by the shim.
+ */
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+
+/**
+ * Copy the front item out of the queue without waiting. A task is never woken by the shim.
+ */
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *woken);
+
+/**
+ * Check whether the queue is full.
+ */
+BaseType_t xQueueIsQueueFullFromISR(QueueHandle_t queue);
+
+/**
+ * Get the amount of queued items.
+ */
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+/**
+ * Free the queue.
+ */
+void vQueueDelete(QueueHandle_t queue);
+
+#endif  // FREERTOS_POSIX_QUEUE_H
@@ -0,0 +1,40 @@
+#ifndef FREERTOS_POSIX_SEMPHR_H
+#define FREERTOS_POSIX_SEMPHR_H
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+/**
+ * A semaphore is a counter guarded by a pthread mutex and condition.
+ */
+typedef struct freertos_posix_semaphore *SemaphoreHandle_t;
+
+/**
+ * Create a counting semaphore with the specified maximum and initial count.
+ */
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial);
+
+#define xSemaphoreCreateMutex() xSemaphoreCreateCounting(1, 1)
+#define xSemaphoreCreateBinary() xSemaphoreCreateCounting(1, 0)
+
+/**
+ * Take the semaphore within the specified amount of ticks.
+ */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+
+/**
+ * Give the semaphore.
+ */
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+/**
+ * Give the semaphore from an interrupt. A task is never woken by the shim.
+ */
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+
+/**
+ * Free the semaphore.
+ */
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif  // FREERTOS_POSIX_SEMPHR_H
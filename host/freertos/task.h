@@ -0,0 +1,59 @@
+#ifndef FREERTOS_POSIX_TASK_H
+#define FREERTOS_POSIX_TASK_H
+
+#include "FreeRTOS.h"
+
+/**
+ * A task is backed by a detached pthread.
+ */
+typedef struct freertos_posix_task *TaskHandle_t;
+
+typedef void (*TaskFunction_t)(void *);
+
+/**
+ * Create a task. The stack depth, priority and core are ignored.
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+
+#define xTaskCreate(fn, name, stack_depth, param, priority, handle) \
+  xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, handle, tskNO_AFFINITY)
+
+/**
+ * Delete the specified task or the calling task if NULL.
+ *
+ * Other tasks are cancelled at their next blocking call and joined.
+ */
+void vTaskDelete(TaskHandle_t task);
+
+/**
+ * Block the calling task for the specified amount of ticks.
+ */
+void vTaskDelay(TickType_t ticks);
+
+/**
+ * Get the ticks since the start of the process.
+ */
+TickType_t xTaskGetTickCount(void);
+
+/**
+ * Get the handle of the calling task. Threads not created by the shim get a handle on first use.
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/**
+ * Increment the notification value of the specified task.
+ */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+/**
+ * Increment the notification value of the specified task from an interrupt. A task is never woken by the shim.
+ */
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+
+/**
+ * Wait until the notification value of the calling task is non zero and clear or decrement it.
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+
+#endif  // FREERTOS_POSIX_TASK_H
@@ -0,0 +1,414 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct freertos_posix_task {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  TaskFunction_t fn;
+  void *param;
+  uint32_t notification;
+};
+
+struct freertos_posix_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+struct freertos_posix_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t readable;
+  pthread_cond_t writable;
+  uint8_t *items;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+static __thread TaskHandle_t freertos_posix_current = NULL;
+
+static void freertos_posix_deadline(TickType_t ticks, struct timespec *deadline) {
+  // get current time
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+
+  // add ticks
+  uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+  deadline->tv_sec += ms / 1000;
+  deadline->tv_nsec += (ms % 1000) * 1000000;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+static void freertos_posix_cond_init(pthread_cond_t *cond) {
+  // use the monotonic clock for timed waits
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+static bool freertos_posix_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, TickType_t ticks,
+                                const struct timespec *deadline) {
+  // wait forever
+  if (ticks == portMAX_DELAY) {
+    pthread_cond_wait(cond, mutex);
+    return true;
+  }
+
+  return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static void freertos_posix_unlock(void *mutex) { pthread_mutex_unlock((pthread_mutex_t *)mutex); }
+
+static TaskHandle_t freertos_posix_task_new(TaskFunction_t fn, void *param) {
+  // allocate task
+  TaskHandle_t task = calloc(1, sizeof(struct freertos_posix_task));
+  if (task == NULL) {
+    return NULL;
+  }
+
+  // initialize notification
+  pthread_mutex_init(&task->mutex, NULL);
+  freertos_posix_cond_init(&task->cond);
+  task->fn = fn;
+  task->param = param;
+
+  return task;
+}
+
+static void freertos_posix_task_free(void *ref) {
+  // cast task
+  TaskHandle_t task = (TaskHandle_t)ref;
+
+  // free task
+  pthread_cond_destroy(&task->cond);
+  pthread_mutex_destroy(&task->mutex);
+  free(task);
+}
+
+static void *freertos_posix_task_run(void *ref) {
+  // set current task
+  TaskHandle_t task = (TaskHandle_t)ref;
+  freertos_posix_current = task;
+
+  // run task and free it when it returns, deletes itself or gets cancelled
+  pthread_cleanup_push(freertos_posix_task_free, task);
+  task->fn(task->param);
+  pthread_cleanup_pop(1);
+
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core) {
+  // allocate task
+  TaskHandle_t task = freertos_posix_task_new(fn, param);
+  if (task == NULL) {
+    return pdFAIL;
+  }
+
+  // set handle before the task runs
+  if (handle != NULL) {
+    *handle = task;
+  }
+
+  // start thread
+  if (pthread_create(&task->thread, NULL, freertos_posix_task_run, task) != 0) {
+    freertos_posix_task_free(task);
+    if (handle != NULL) {
+      *handle = NULL;
+    }
+    return pdFAIL;
+  }
+
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  // exit the calling task
+  if (task == NULL || task == freertos_posix_current) {
+    pthread_detach(pthread_self());
+    pthread_exit(NULL);
+  }
+
+  // cancel other task and wait until it is gone like on FreeRTOS
+  pthread_t thread = task->thread;
+  pthread_cancel(thread);
+  pthread_join(thread, NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  // sleep
+  uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+  struct timespec t = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+  while (nanosleep(&t, &t) != 0 && errno == EINTR) {
+  }
+}
+
+TickType_t xTaskGetTickCount(void) {
+  // get time since the first call
+  static struct timespec start = {0};
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (start.tv_sec == 0 && start.tv_nsec == 0) {
+    start = now;
+  }
+
+  uint64_t ms = (uint64_t)(now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+  return (TickType_t)(ms / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  // adopt threads that have not been created by the shim
+  if (freertos_posix_current == NULL) {
+    freertos_posix_current = freertos_posix_task_new(NULL, NULL);
+    freertos_posix_current->thread = pthread_self();
+  }
+
+  return freertos_posix_current;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  // increment notification
+  pthread_mutex_lock(&task->mutex);
+  task->notification++;
+  pthread_cond_signal(&task->cond);
+  pthread_mutex_unlock(&task->mutex);
+
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {
+  // notify without yielding
+  if (woken != NULL) {
+    *woken = pdFALSE;
+  }
+
+  xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  // get task
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  // prepare deadline
+  struct timespec deadline;
+  freertos_posix_deadline(ticks, &deadline);
+
+  // wait for notification
+  uint32_t value = 0;
+  pthread_mutex_lock(&task->mutex);
+  pthread_cleanup_push(freertos_posix_unlock, &task->mutex);
+  while (task->notification == 0 && ticks > 0 && freertos_posix_wait(&task->cond, &task->mutex, ticks, &deadline)) {
+  }
+
+  // take notification
+  value = task->notification;
+  if (value > 0) {
+    task->notification = clear ? 0 : value - 1;
+  }
+  pthread_cleanup_pop(1);
+
+  return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  // allocate semaphore
+  SemaphoreHandle_t sem = calloc(1, sizeof(struct freertos_posix_semaphore));
+  if (sem == NULL) {
+    return NULL;
+  }
+
+  // initialize semaphore
+  pthread_mutex_init(&sem->mutex, NULL);
+  freertos_posix_cond_init(&sem->cond);
+  sem->count = initial;
+  sem->max = max;
+
+  return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  // prepare deadline
+  struct timespec deadline;
+  freertos_posix_deadline(ticks, &deadline);
+
+  // wait until available
+  BaseType_t ret = pdFALSE;
+  pthread_mutex_lock(&sem->mutex);
+  pthread_cleanup_push(freertos_posix_unlock, &sem->mutex);
+  while (sem->count == 0 && ticks > 0 && freertos_posix_wait(&sem->cond, &sem->mutex, ticks, &deadline)) {
+  }
+
+  // take semaphore
+  if (sem->count > 0) {
+    sem->count--;
+    ret = pdTRUE;
+  }
+  pthread_cleanup_pop(1);
+
+  return ret;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  // give semaphore
+  pthread_mutex_lock(&sem->mutex);
+  BaseType_t ret = pdFALSE;
+  if (sem->count < sem->max) {
+    sem->count++;
+    pthread_cond_signal(&sem->cond);
+    ret = pdTRUE;
+  }
+  pthread_mutex_unlock(&sem->mutex);
+
+  return ret;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+  // give without yielding
+  if (woken != NULL) {
+    *woken = pdFALSE;
+  }
+
+  return xSemaphoreGive(sem);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  // free semaphore
+  pthread_cond_destroy(&sem->cond);
+  pthread_mutex_destroy(&sem->mutex);
+  free(sem);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  // allocate queue
+  QueueHandle_t queue = calloc(1, sizeof(struct freertos_posix_queue));
+  if (queue == NULL) {
+    return NULL;
+  }
+
+  // allocate items
+  queue->items = malloc((size_t)length * item_size);
+  if (queue->items == NULL) {
+    free(queue);
+    return NULL;
+  }
+
+  // initialize queue
+  pthread_mutex_init(&queue->mutex, NULL);
+  freertos_posix_cond_init(&queue->readable);
+  freertos_posix_cond_init(&queue->writable);
+  queue->length = length;
+  queue->item_size = item_size;
+
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+  // prepare deadline
+  struct timespec deadline;
+  freertos_posix_deadline(ticks, &deadline);
+
+  // wait for space
+  BaseType_t ret = pdFALSE;
+  pthread_mutex_lock(&queue->mutex);
+  pthread_cleanup_push(freertos_posix_unlock, &queue->mutex);
+  while (queue->count == queue->length && ticks > 0 &&
+         freertos_posix_wait(&queue->writable, &queue->mutex, ticks, &deadline)) {
+  }
+
+  // copy item to the back
+  if (queue->count < queue->length) {
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->readable);
+    ret = pdTRUE;
+  }
+  pthread_cleanup_pop(1);
+
+  return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  // prepare deadline
+  struct timespec deadline;
+  freertos_posix_deadline(ticks, &deadline);
+
+  // wait for an item
+  BaseType_t ret = pdFALSE;
+  pthread_mutex_lock(&queue->mutex);
+  pthread_cleanup_push(freertos_posix_unlock, &queue->mutex);
+  while (queue->count == 0 && ticks > 0 && freertos_posix_wait(&queue->readable, &queue->mutex, ticks, &deadline)) {
+  }
+
+  // copy item from the front
+  if (queue->count > 0) {
+    memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->writable);
+    ret = pdTRUE;
+  }
+  pthread_cleanup_pop(1);
+
+  return ret;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+  // send without waiting
+  if (woken != NULL) {
+    *woken = pdFALSE;
+  }
+
+  return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *woken) {
+  // receive without waiting
+  if (woken != NULL) {
+    *woken = pdFALSE;
+  }
+
+  return xQueueReceive(queue, item, 0);
+}
+
+BaseType_t xQueueIsQueueFullFromISR(QueueHandle_t queue) {
+  // compare count
+  pthread_mutex_lock(&queue->mutex);
+  BaseType_t full = queue->count == queue->length ? pdTRUE : pdFALSE;
+  pthread_mutex_unlock(&queue->mutex);
+
+  return full;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  // get count
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t count = queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+
+  return count;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  // free queue
+  pthread_cond_destroy(&queue->writable);
+  pthread_cond_destroy(&queue->readable);
+  pthread_mutex_destroy(&queue->mutex);
+  free(queue->items);
+  free(queue);
+}
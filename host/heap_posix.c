@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_heap_caps.h"
+
+// the allocator of the process is replaced by one that counts the used bytes and forwards to glibc, so every
+// allocation of the program and its libraries is taken from the heap size of the target
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static struct {
+  int64_t used;
+  int64_t peak;
+  int64_t local_peak;
+  bool monitoring;
+} heap_posix;
+
+static void heap_posix_add(void *ptr) {
+  // count the usable size, it is also what free gives back
+  if (ptr == NULL) {
+    return;
+  }
+  int64_t used = __atomic_add_fetch(&heap_posix.used, (int64_t)malloc_usable_size(ptr), __ATOMIC_SEQ_CST);
+
+  // raise the peaks
+  int64_t *peaks[] = {&heap_posix.peak, &heap_posix.local_peak};
+  for (size_t i = 0; i < 2; i++) {
+    int64_t peak = __atomic_load_n(peaks[i], __ATOMIC_SEQ_CST);
+    while (used > peak && !__atomic_compare_exchange_n(peaks[i], &peak, used, false, __ATOMIC_SEQ_CST,
+                                                        __ATOMIC_SEQ_CST)) {
+    }
+  }
+}
+
+static void heap_posix_remove(void *ptr) {
+  if (ptr != NULL) {
+    __atomic_sub_fetch(&heap_posix.used, (int64_t)malloc_usable_size(ptr), __ATOMIC_SEQ_CST);
+  }
+}
+
+void *malloc(size_t size) {
+  void *ptr = __libc_malloc(size);
+  heap_posix_add(ptr);
+  return ptr;
+}
+
+void *calloc(size_t n, size_t size) {
+  void *ptr = __libc_calloc(n, size);
+  heap_posix_add(ptr);
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  // a failed realloc keeps the old block
+  size_t old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+  void *moved = __libc_realloc(ptr, size);
+  if (moved != NULL || size == 0) {
+    __atomic_sub_fetch(&heap_posix.used, (int64_t)old, __ATOMIC_SEQ_CST);
+    heap_posix_add(moved);
+  }
+  return moved;
+}
+
+void *memalign(size_t alignment, size_t size) {
+  void *ptr = __libc_memalign(alignment, size);
+  heap_posix_add(ptr);
+  return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  *ptr = memalign(alignment, size);
+  return *ptr != NULL ? 0 : ENOMEM;
+}
+
+void free(void *ptr) {
+  heap_posix_remove(ptr);
+  __libc_free(ptr);
+}
+
+static size_t heap_posix_free(int64_t used) {
+  return used < HEAP_POSIX_SIZE ? (size_t)(HEAP_POSIX_SIZE - used) : 0;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  return heap_posix_free(__atomic_load_n(&heap_posix.used, __ATOMIC_SEQ_CST));
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  // the low-water mark since the start of the process or of the monitoring
+  int64_t *peak = heap_posix.monitoring ? &heap_posix.local_peak : &heap_posix.peak;
+  return heap_posix_free(__atomic_load_n(peak, __ATOMIC_SEQ_CST));
+}
+
+esp_err_t heap_caps_monitor_local_minimum_free_size_start(void) {
+  __atomic_store_n(&heap_posix.local_peak, __atomic_load_n(&heap_posix.used, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  heap_posix.monitoring = true;
+  return ESP_OK;
+}
+
+esp_err_t heap_caps_monitor_local_minimum_free_size_stop(void) {
+  if (!heap_posix.monitoring) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  heap_posix.monitoring = false;
+  return ESP_OK;
+}
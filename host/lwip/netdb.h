@@ -0,0 +1,15 @@
+#ifndef LWIP_POSIX_NETDB_H
+#define LWIP_POSIX_NETDB_H
+
+#include <netdb.h>
+
+#include "lwip/sockets.h"
+
+static inline int lwip_getaddrinfo(const char *nodename, const char *servname, const struct addrinfo *hints,
+                                   struct addrinfo **res) {
+  return getaddrinfo(nodename, servname, hints, res);
+}
+
+static inline void lwip_freeaddrinfo(struct addrinfo *ai) { freeaddrinfo(ai); }
+
+#endif  // LWIP_POSIX_NETDB_H
@@ -0,0 +1,60 @@
+#ifndef LWIP_POSIX_SOCKETS_H
+#define LWIP_POSIX_SOCKETS_H
+
+// Maps the lwip socket calls used by esp_lwmqtt to the BSD socket API of the host.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// lwip pulls in FreeRTOS through its port layer
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// the default TCP send buffer of ESP-IDF, writes wait for the peer like on the target instead of filling megabytes
+#define LWIP_POSIX_SND_BUF 5744
+
+static inline int lwip_socket(int domain, int type, int protocol) {
+  int s = socket(domain, type, protocol);
+  int size = LWIP_POSIX_SND_BUF;
+  if (s >= 0) {
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  }
+  return s;
+}
+
+static inline int lwip_connect_r(int s, const struct sockaddr *name, socklen_t namelen) {
+  return connect(s, name, namelen);
+}
+
+static inline int lwip_close_r(int s) { return close(s); }
+
+static inline int lwip_read_r(int s, void *mem, size_t len) { return (int)read(s, mem, len); }
+
+static inline int lwip_write_r(int s, const void *data, size_t size) {
+  return (int)send(s, data, size, MSG_NOSIGNAL);
+}
+
+static inline int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset,
+                              struct timeval *timeout) {
+  return select(maxfdp1, readset, writeset, exceptset, timeout);
+}
+
+static inline int lwip_setsockopt_r(int s, int level, int optname, const void *opval, socklen_t optlen) {
+  return setsockopt(s, level, optname, opval, optlen);
+}
+
+static inline int lwip_getsockopt_r(int s, int level, int optname, void *opval, socklen_t *optlen) {
+  return getsockopt(s, level, optname, opval, optlen);
+}
+
+static inline int lwip_fcntl_r(int s, int cmd, int val) { return fcntl(s, cmd, val); }
+
+static inline int lwip_ioctl_r(int s, long cmd, void *argp) { return ioctl(s, cmd, argp); }
+
+#endif  // LWIP_POSIX_SOCKETS_H
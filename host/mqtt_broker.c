@@ -0,0 +1,358 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt_broker.h"
+
+#define MQTT_BROKER_MAX 4
+#define MQTT_BROKER_CHUNK 1024
+#define MQTT_BROKER_SESSIONS 8
+
+typedef struct {
+  int socket;
+  uint16_t port;
+  uint32_t ack_delay_us;
+  uint32_t rate;
+  uint8_t drop_type;
+  uint32_t drop_count;
+  int32_t dropped_id;
+  char sessions[MQTT_BROKER_SESSIONS][24];
+  mqtt_broker_stats_t stats;
+} mqtt_broker_t;
+
+typedef struct {
+  mqtt_broker_t *broker;
+  int fd;
+} mqtt_broker_conn_t;
+
+static struct {
+  pthread_mutex_t mutex;
+  size_t count;
+  mqtt_broker_t brokers[MQTT_BROKER_MAX];
+} mqtt_broker = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static bool mqtt_broker_read(mqtt_broker_t *broker, int fd, uint8_t *buf, size_t len) {
+  // read exactly len bytes, with a limited rate in small chunks
+  while (len > 0) {
+    ssize_t n = recv(fd, buf, broker->rate > 0 && len > MQTT_BROKER_CHUNK ? MQTT_BROKER_CHUNK : len, 0);
+    if (n <= 0) {
+      return false;
+    }
+    if (broker->rate > 0) {
+      usleep((useconds_t)((uint64_t)n * 1000000 / broker->rate));
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static bool mqtt_broker_match(const char *filter, const uint8_t *body, size_t len) {
+  // the topic has to equal the filter or start with the part before a trailing #
+  size_t topic_len = len >= 2 ? (size_t)body[0] << 8 | body[1] : 0;
+  size_t filter_len = strlen(filter);
+  if (filter_len == 0 || 2 + topic_len > len) {
+    return false;
+  }
+  if (filter[filter_len - 1] == '#') {
+    return topic_len >= filter_len - 1 && memcmp(filter, body + 2, filter_len - 1) == 0;
+  }
+  return topic_len == filter_len && memcmp(filter, body + 2, filter_len) == 0;
+}
+
+static void mqtt_broker_echo(int fd, uint8_t header, const uint8_t *body, size_t len) {
+  // send the publish back with qos 0, without its packet id
+  if (len < 2) {
+    return;
+  }
+  size_t topic = 2 + ((size_t)body[0] << 8 | body[1]);
+  size_t skip = (header & 0x06) != 0 ? 2 : 0;
+  if (topic + skip > len) {
+    return;
+  }
+  uint8_t prefix[5] = {0x30 | (header & 0x01)};
+  size_t remaining = len - skip, n = 1;
+  do {
+    prefix[n] = remaining & 0x7F;
+    remaining >>= 7;
+    prefix[n++] |= remaining > 0 ? 0x80 : 0;
+  } while (remaining > 0);
+  send(fd, prefix, n, MSG_MORE);
+  send(fd, body, topic, MSG_MORE);
+  send(fd, body + topic + skip, len - topic - skip, 0);
+}
+
+static bool mqtt_broker_session(mqtt_broker_t *broker, const uint8_t *body, size_t len) {
+  // keep the client ids of persistent sessions, a clean session ends the stored one
+  if (len < 12) {
+    return false;
+  }
+  bool clean = (body[7] & 0x02) != 0;
+  size_t id_len = (size_t)body[10] << 8 | body[11];
+  char id[24] = {0};
+  memcpy(id, body + 12, id_len < sizeof(id) - 1 && 12 + id_len <= len ? id_len : 0);
+  int found = -1, free_slot = -1;
+  for (int i = 0; i < MQTT_BROKER_SESSIONS; i++) {
+    if (broker->sessions[i][0] != 0 && strcmp(broker->sessions[i], id) == 0) {
+      found = i;
+    } else if (broker->sessions[i][0] == 0 && free_slot < 0) {
+      free_slot = i;
+    }
+  }
+  if (clean) {
+    // packet ids start over, a dropped packet can no longer be resent
+    broker->dropped_id = -1;
+  }
+  if (clean && found >= 0) {
+    broker->sessions[found][0] = 0;
+  } else if (!clean && found < 0 && free_slot >= 0) {
+    strcpy(broker->sessions[free_slot], id);
+  }
+  broker->stats.keep_alive = (uint16_t)(body[8] << 8 | body[9]);
+  return !clean && found >= 0;
+}
+
+static bool mqtt_broker_drops(mqtt_broker_t *broker, uint8_t type, int32_t id, bool resend) {
+  // count resent packets and decide whether to drop the connection instead of answering
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  if (resend && id >= 0 && id == broker->dropped_id) {
+    broker->stats.resent++;
+    broker->dropped_id = -1;
+  }
+  bool drop = broker->drop_type == type && broker->drop_count > 0 && --broker->drop_count == 0;
+  if (drop) {
+    broker->dropped_id = id;
+    broker->stats.drops++;
+  }
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+  return drop;
+}
+
+static void *mqtt_broker_serve(void *arg) {
+  mqtt_broker_conn_t conn = *(mqtt_broker_conn_t *)arg;
+  mqtt_broker_t *broker = conn.broker;
+  int fd = conn.fd;
+  free(arg);
+  uint8_t *body = NULL;
+  size_t capacity = 0;
+  char filter[64] = {0};
+  for (;;) {
+    // read fixed header and remaining length
+    uint8_t header;
+    if (!mqtt_broker_read(broker, fd, &header, 1)) {
+      break;
+    }
+    size_t len = 0;
+    uint8_t digit = 0x80;
+    for (int shift = 0; (digit & 0x80) && shift < 28; shift += 7) {
+      if (!mqtt_broker_read(broker, fd, &digit, 1)) {
+        goto done;
+      }
+      len |= (size_t)(digit & 0x7F) << shift;
+    }
+
+    // read body
+    if (len > capacity) {
+      free(body);
+      capacity = len;
+      body = malloc(capacity);
+      if (body == NULL) {
+        break;
+      }
+    }
+    if (!mqtt_broker_read(broker, fd, body, len)) {
+      break;
+    }
+
+    // answer packet
+    switch (header >> 4) {
+      case 1: {  // connect
+        pthread_mutex_lock(&mqtt_broker.mutex);
+        bool present = mqtt_broker_session(broker, body, len);
+        broker->stats.connects++;
+        broker->stats.sessions += present;
+        pthread_mutex_unlock(&mqtt_broker.mutex);
+        uint8_t connack[] = {0x20, 0x02, present, 0x00};
+        send(fd, connack, sizeof(connack), 0);
+        break;
+      }
+      case 3: {  // publish
+        int32_t packet_id = -1;
+        size_t id = len >= 2 ? 2 + ((size_t)body[0] << 8 | body[1]) : len;
+        if ((header & 0x06) != 0 && id + 2 <= len) {
+          packet_id = body[id] << 8 | body[id + 1];
+        }
+        pthread_mutex_lock(&mqtt_broker.mutex);
+        broker->stats.publishes++;
+        broker->stats.duplicates += (header & 0x08) != 0;
+        broker->stats.bytes += len;
+        pthread_mutex_unlock(&mqtt_broker.mutex);
+        if (mqtt_broker_drops(broker, 3, packet_id, (header & 0x08) != 0)) {
+          goto done;
+        }
+        if (packet_id >= 0) {
+          if (broker->ack_delay_us > 0) {
+            usleep(broker->ack_delay_us);
+          }
+          // puback for qos 1, pubrec for qos 2
+          uint8_t ack[] = {(header & 0x04) != 0 ? 0x50 : 0x40, 0x02, body[id], body[id + 1]};
+          send(fd, ack, sizeof(ack), 0);
+        }
+        if (mqtt_broker_match(filter, body, len)) {
+          mqtt_broker_echo(fd, header, body, len);
+        }
+        break;
+      }
+      case 6: {  // pubrel
+        if (len >= 2) {
+          if (mqtt_broker_drops(broker, 6, body[0] << 8 | body[1], true)) {
+            goto done;
+          }
+          uint8_t pubcomp[] = {0x70, 0x02, body[0], body[1]};
+          send(fd, pubcomp, sizeof(pubcomp), 0);
+        }
+        break;
+      }
+      case 8: {  // subscribe, granted with qos 0
+        if (len >= 2) {
+          uint8_t suback[] = {0x90, 0x03, body[0], body[1], 0x00};
+          send(fd, suback, sizeof(suback), 0);
+          size_t filter_len = len >= 4 ? (size_t)body[2] << 8 | body[3] : 0;
+          if (filter_len < sizeof(filter) && 4 + filter_len <= len) {
+            memcpy(filter, body + 4, filter_len);
+            filter[filter_len] = 0;
+          }
+          pthread_mutex_lock(&mqtt_broker.mutex);
+          broker->stats.subscribes++;
+          pthread_mutex_unlock(&mqtt_broker.mutex);
+        }
+        break;
+      }
+      case 12: {  // ping
+        uint8_t pingresp[] = {0xD0, 0x00};
+        send(fd, pingresp, sizeof(pingresp), 0);
+        break;
+      }
+      case 14:  // disconnect
+        goto done;
+      default:
+        break;
+    }
+  }
+
+done:
+  free(body);
+  close(fd);
+  return NULL;
+}
+
+static void *mqtt_broker_accept(void *arg) {
+  // serve every connection in its own thread
+  mqtt_broker_t *broker = arg;
+  for (;;) {
+    int fd = accept(broker->socket, NULL, NULL);
+    if (fd < 0) {
+      return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    mqtt_broker_conn_t *conn = malloc(sizeof(mqtt_broker_conn_t));
+    pthread_t thread;
+    if (conn == NULL) {
+      close(fd);
+      continue;
+    }
+    *conn = (mqtt_broker_conn_t){.broker = broker, .fd = fd};
+    if (pthread_create(&thread, NULL, mqtt_broker_serve, conn) != 0) {
+      free(conn);
+      close(fd);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+}
+
+uint16_t mqtt_broker_start(uint32_t ack_delay_us) {
+  // take the next broker
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  if (mqtt_broker.count == MQTT_BROKER_MAX) {
+    pthread_mutex_unlock(&mqtt_broker.mutex);
+    return 0;
+  }
+  mqtt_broker_t *broker = &mqtt_broker.brokers[mqtt_broker.count++];
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+
+  // open socket on a free loopback port
+  broker->ack_delay_us = ack_delay_us;
+  broker->dropped_id = -1;
+  broker->socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (broker->socket < 0) {
+    return 0;
+  }
+  struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK), .sin_port = 0};
+  socklen_t addr_len = sizeof(addr);
+  if (bind(broker->socket, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(broker->socket, 8) != 0 ||
+      getsockname(broker->socket, (struct sockaddr *)&addr, &addr_len) != 0) {
+    close(broker->socket);
+    return 0;
+  }
+
+  // accept connections
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, mqtt_broker_accept, broker) != 0) {
+    close(broker->socket);
+    return 0;
+  }
+  pthread_detach(thread);
+
+  // make the counters available
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  broker->port = ntohs(addr.sin_port);
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+
+  return broker->port;
+}
+
+void mqtt_broker_stats(uint16_t port, mqtt_broker_stats_t *stats) {
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  *stats = (mqtt_broker_stats_t){0};
+  for (size_t i = 0; i < mqtt_broker.count; i++) {
+    if (mqtt_broker.brokers[i].port == port) {
+      *stats = mqtt_broker.brokers[i].stats;
+    }
+  }
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+}
+
+void mqtt_broker_limit(uint16_t port, uint32_t rate) {
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  for (size_t i = 0; i < mqtt_broker.count; i++) {
+    mqtt_broker_t *broker = &mqtt_broker.brokers[i];
+    if (broker->port == port) {
+      // a small receive buffer makes the sender wait for the reads
+      int size = MQTT_BROKER_CHUNK * 4;
+      setsockopt(broker->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+      broker->rate = rate;
+    }
+  }
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+}
+
+void mqtt_broker_drop(uint16_t port, uint8_t type, uint32_t count) {
+  pthread_mutex_lock(&mqtt_broker.mutex);
+  for (size_t i = 0; i < mqtt_broker.count; i++) {
+    mqtt_broker_t *broker = &mqtt_broker.brokers[i];
+    if (broker->port == port) {
+      broker->drop_type = type;
+      broker->drop_count = count;
+    }
+  }
+  pthread_mutex_unlock(&mqtt_broker.mutex);
+}
@@ -0,0 +1,62 @@
+#ifndef MQTT_BROKER_H
+#define MQTT_BROKER_H
+
+#include <stdint.h>
+
+/**
+ * The counters of the loopback broker.
+ */
+typedef struct {
+  uint32_t connects;    // accepted connections
+  uint32_t sessions;    // connections that found their persistent session
+  uint16_t keep_alive;  // keep alive of the last connection in seconds
+  uint32_t subscribes;  // received subscribe packets
+  uint32_t publishes;   // received publish packets
+  uint32_t duplicates;  // received publish packets with the DUP flag
+  uint32_t drops;       // connections dropped by `mqtt_broker_drop`
+  uint32_t resent;      // DUP publishes and PUBRELs with the packet id of a dropped packet
+  uint64_t bytes;       // received publish payload and topic bytes
+} mqtt_broker_stats_t;
+
+/**
+ * Start a minimal MQTT 3.1.1 broker on a free loopback port. Up to four brokers can run at the same time.
+ *
+ * Every connection is served by its own thread that accepts any CONNECT, acknowledges QoS 1 and 2 publishes,
+ * subscriptions and pings. A CONNECT without clean session finds the session of an earlier one with the same client
+ * id, but only the flag of the CONNACK is kept, no subscriptions or messages. Publishes that match the last filter a
+ * connection subscribed to, exactly or before a trailing #, are sent back to it with QoS 0, other messages are
+ * dropped.
+ *
+ * @param ack_delay_us - The delay before each PUBACK, stands in for the round trip of a real link.
+ * @return The port or zero if the socket could not be opened.
+ */
+uint16_t mqtt_broker_start(uint32_t ack_delay_us);
+
+/**
+ * Get the counters of a broker.
+ *
+ * @param port - The port returned by `mqtt_broker_start`.
+ * @param stats - The counters.
+ */
+void mqtt_broker_stats(uint16_t port, mqtt_broker_stats_t *stats);
+
+/**
+ * Limit the rate at which a broker reads from its connections, stands in for a slow uplink.
+ *
+ * Only connections accepted afterwards get the small receive buffer that makes socket writes of the client wait.
+ *
+ * @param port - The port returned by `mqtt_broker_start`.
+ * @param rate - The bytes per second or zero for no limit.
+ */
+void mqtt_broker_limit(uint16_t port, uint32_t rate);
+
+/**
+ * Drop a connection instead of answering a packet, stands in for a link that fails before the ack arrives.
+ *
+ * @param port - The port returned by `mqtt_broker_start`.
+ * @param type - The packet type, 3 for PUBLISH or 6 for PUBREL.
+ * @param count - The packet of that type counted from now that is not answered or zero to cancel.
+ */
+void mqtt_broker_drop(uint16_t port, uint8_t type, uint32_t count);
+
+#endif  // MQTT_BROKER_H
@@ -0,0 +1,127 @@
+// Receives a message every 10 ms with a handler that takes 20 ms and checks what the dispatcher task changes.
+//
+// The loopback broker sends every publish back to the client. Without a dispatcher the network task calls the handler
+// for every message and falls behind until the queue overflows, which is printed for comparison. With a dispatcher the
+// handler gets the messages in batches on its own task. Every message has to arrive without a drop or a reconnect in
+// fewer batches than messages, the publishes may not wait for the handler, and the counters have to add up with an
+// empty queue at the end.
+//
+// usage: mqtt_dispatch_check [messages]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_mqtt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_broker.h"
+
+#define CHECK_INTERVAL 10  // ms
+#define CHECK_HANDLER 20   // ms
+#define CHECK_MAX_MESSAGES 1000
+
+static volatile bool check_connected;
+static volatile int check_disconnects;
+static volatile size_t check_received;
+static int64_t check_latency[CHECK_MAX_MESSAGES];
+
+static void check_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  check_connected = status == ESP_MQTT_STATUS_CONNECTED;
+  check_disconnects += !check_connected;
+}
+
+static void check_message(esp_mqtt_client_t *client, const char *topic, uint8_t *payload, size_t len) {
+  check_received++;
+  vTaskDelay(CHECK_HANDLER / portTICK_PERIOD_MS);
+}
+
+static void check_batch(esp_mqtt_client_t *client, const esp_mqtt_message_t *messages, size_t count) {
+  check_received += count;
+  vTaskDelay(CHECK_HANDLER / portTICK_PERIOD_MS);
+}
+
+static int check_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool check_run(const char *port, bool dispatcher, int messages) {
+  // start the client with the handler on the network task or the dispatcher
+  esp_mqtt_client_config_t config;
+  esp_mqtt_client_default_config(&config);
+  config.status_callback = check_status;
+  config.buffer_size = 1024;
+  config.queue_size = 64;
+  config.dispatcher = dispatcher;
+  if (dispatcher) {
+    config.batch_callback = check_batch;
+  } else {
+    config.message_callback = check_message;
+  }
+  check_connected = false;
+  check_disconnects = 0;
+  check_received = 0;
+  esp_mqtt_client_t *client = esp_mqtt_client_create(&config);
+  if (client == NULL || !esp_mqtt_client_start(client, "127.0.0.1", port, "dispatch", NULL, NULL, 30, true)) {
+    printf("%-10s client failed\n", dispatcher ? "dispatcher" : "network");
+    return false;
+  }
+  while (!check_connected) {
+    vTaskDelay(5);
+  }
+  esp_mqtt_client_subscribe(client, "doorbell/ring", 0);
+
+  // every publish comes back
+  size_t failed = 0;
+  TickType_t wake = xTaskGetTickCount();
+  for (int i = 0; i < messages; i++) {
+    int64_t start = esp_timer_get_time();
+    failed += !esp_mqtt_client_publish(client, "doorbell/ring", (uint8_t *)"ring", 4, 1, false);
+    check_latency[i] = esp_timer_get_time() - start;
+    wake += CHECK_INTERVAL / portTICK_PERIOD_MS;
+    TickType_t now = xTaskGetTickCount();
+    vTaskDelay(wake > now ? wake - now : 0);
+  }
+  for (int wait = 0; check_received < (size_t)messages && wait < 1000; wait++) {
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  vTaskDelay(100 / portTICK_PERIOD_MS);
+  esp_mqtt_dispatch_stats_t stats;
+  esp_mqtt_client_dispatch_stats(client, &stats);
+  esp_mqtt_client_destroy(client);
+
+  qsort(check_latency, messages, sizeof(int64_t), check_compare);
+  int64_t p50 = check_latency[messages / 2];
+  int64_t max = check_latency[messages - 1];
+  // the counters add up, the network task only has to keep the connection
+  bool ok = failed == 0 && check_disconnects == 0 && stats.queue_depth == 0 &&
+            stats.messages + stats.dropped == (uint32_t)messages && check_received == stats.messages;
+  if (dispatcher) {
+    ok = ok && stats.dropped == 0 && stats.batches < stats.messages && p50 < CHECK_HANDLER * 1000 &&
+         stats.max_handler_time >= CHECK_HANDLER * 1000;
+  }
+  printf("%-10s %8zu %7u %7u %9u %10.1f %11.1f %11.1f %6zu %5d %5s\n", dispatcher ? "dispatcher" : "network",
+         check_received, stats.batches, stats.dropped, stats.max_queue_depth, stats.max_handler_time / 1000.0,
+         p50 / 1000.0, max / 1000.0, failed, check_disconnects, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int messages = argc > 1 ? atoi(argv[1]) : 200;
+  messages = messages > CHECK_MAX_MESSAGES ? CHECK_MAX_MESSAGES : messages;
+
+  uint16_t port = mqtt_broker_start(0);
+  if (port == 0) {
+    fprintf(stderr, "broker failed\n");
+    return 1;
+  }
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+
+  printf("handler    received batches dropped max depth handler ms publish p50 publish max failed downs\n");
+  bool ok = check_run(port_str, false, messages);
+  ok = check_run(port_str, true, messages) && ok;
+  return ok ? 0 : 1;
+}
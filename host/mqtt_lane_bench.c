@@ -0,0 +1,120 @@
+// Publishes on all lanes at once against the loopback broker and reports the latency of each lane.
+//
+// usage: mqtt_lane_bench [seconds] [ack_delay_us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_mqtt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_broker.h"
+
+#define BENCH_SAMPLES 100000
+
+typedef struct {
+  const char *name;
+  esp_mqtt_lane_t lane;
+  size_t len;
+  uint32_t interval;  // ms between publishes, zero publishes back to back
+  int64_t *samples;
+  size_t count;
+  size_t failed;
+} bench_lane_t;
+
+static esp_mqtt_client_t *bench_client;
+static volatile bool bench_connected;
+static volatile bool bench_running;
+static volatile int bench_done;
+static uint8_t bench_payload[27000];
+
+static void bench_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  bench_connected = status == ESP_MQTT_STATUS_CONNECTED;
+}
+
+static void bench_publish(void *arg) {
+  // publish until the end of the run and record the time each call took
+  bench_lane_t *lane = arg;
+  while (bench_running) {
+    int64_t start = esp_timer_get_time();
+    bool ok = esp_mqtt_client_publish_lane(bench_client, lane->name, bench_payload, lane->len, 1, false, lane->lane);
+    if (!ok) {
+      lane->failed++;
+    } else if (lane->count < BENCH_SAMPLES) {
+      lane->samples[lane->count++] = esp_timer_get_time() - start;
+    }
+    if (lane->interval > 0) {
+      vTaskDelay(lane->interval / portTICK_PERIOD_MS);
+    }
+  }
+  __atomic_add_fetch(&bench_done, 1, __ATOMIC_SEQ_CST);
+  vTaskDelete(NULL);
+}
+
+static int bench_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+  uint32_t ack_delay = argc > 2 ? (uint32_t)atoi(argv[2]) : 2000;
+
+  // start broker and client
+  uint16_t port = mqtt_broker_start(ack_delay);
+  if (port == 0) {
+    fprintf(stderr, "broker failed\n");
+    return 1;
+  }
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  esp_mqtt_client_config_t config;
+  esp_mqtt_client_default_config(&config);
+  config.status_callback = bench_status;
+  config.buffer_size = 2048;
+  bench_client = esp_mqtt_client_create(&config);
+  if (bench_client == NULL || !esp_mqtt_client_start(bench_client, "127.0.0.1", port_str, "bench", NULL, NULL, 30, true)) {
+    fprintf(stderr, "client failed\n");
+    return 1;
+  }
+  while (!bench_connected) {
+    vTaskDelay(5);
+  }
+
+  // a picture on the bulk lane, a stream of status messages and a time stamp now and then
+  bench_lane_t lanes[] = {
+      {.name = "realtime", .lane = ESP_MQTT_LANE_REALTIME, .len = 4, .interval = 10},
+      {.name = "normal", .lane = ESP_MQTT_LANE_NORMAL, .len = 256, .interval = 2},
+      {.name = "bulk", .lane = ESP_MQTT_LANE_BULK, .len = sizeof(bench_payload), .interval = 0},
+  };
+  size_t count = sizeof(lanes) / sizeof(lanes[0]);
+  bench_running = true;
+  for (size_t i = 0; i < count; i++) {
+    lanes[i].samples = malloc(BENCH_SAMPLES * sizeof(int64_t));
+    xTaskCreate(bench_publish, lanes[i].name, 4096, &lanes[i], 2, NULL);
+  }
+  vTaskDelay(seconds * 1000 / portTICK_PERIOD_MS);
+  bench_running = false;
+  while (bench_done < (int)count) {
+    vTaskDelay(5);
+  }
+
+  // report percentiles
+  printf("ack delay %u us, %d s\n", ack_delay, seconds);
+  printf("%-9s %8s %7s %10s %10s %10s\n", "lane", "messages", "failed", "p50 us", "p99 us", "max us");
+  for (size_t i = 0; i < count; i++) {
+    bench_lane_t *lane = &lanes[i];
+    qsort(lane->samples, lane->count, sizeof(int64_t), bench_compare);
+    int64_t p50 = lane->count ? lane->samples[lane->count / 2] : 0;
+    int64_t p99 = lane->count ? lane->samples[lane->count * 99 / 100] : 0;
+    int64_t max = lane->count ? lane->samples[lane->count - 1] : 0;
+    printf("%-9s %8zu %7zu %10lld %10lld %10lld\n", lane->name, lane->count, lane->failed, (long long)p50, (long long)p99, (long long)max);
+    free(lane->samples);
+  }
+
+  esp_mqtt_client_destroy(bench_client);
+  return 0;
+}
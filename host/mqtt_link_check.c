@@ -0,0 +1,160 @@
+// Sends pictures from three producers over a slow link and checks the link state they see.
+//
+// The loopback broker reads at a limited rate. Each producer has a picture every 50 ms, more than the link can take.
+// Without asking the link the producers block in the publishes and fall behind. When they ask whether a picture can
+// be sent within a deadline and drop it otherwise, the pictures they send have to be sent within one and a half times
+// the deadline and the link has to stay busy. The throughput estimate has to settle near the rate of the broker, an
+// idle link has to accept a picture, and once the producers are done no bytes may be queued and no message may be in
+// flight.
+//
+// usage: mqtt_link_check [seconds] [rate]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_mqtt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_broker.h"
+
+#define CHECK_PRODUCERS 3
+#define CHECK_INTERVAL 50  // ms
+#define CHECK_WITHIN 150   // ms
+#define CHECK_SAMPLES 1000
+
+typedef struct {
+  bool ask;
+  size_t sent;
+  size_t dropped;
+  size_t count;
+  int64_t samples[CHECK_SAMPLES];
+} check_producer_t;
+
+static esp_mqtt_client_t *check_client;
+static volatile bool check_connected;
+static volatile bool check_running;
+static volatile int check_done;
+static uint8_t check_payload[27000];
+
+static void check_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  check_connected = status == ESP_MQTT_STATUS_CONNECTED;
+}
+
+static void check_produce(void *arg) {
+  // take a picture every interval and send it unless the link cannot take it in time
+  check_producer_t *p = arg;
+  TickType_t wake = xTaskGetTickCount();
+  while (check_running) {
+    if (p->ask && !esp_mqtt_client_can_accept(check_client, sizeof(check_payload), CHECK_WITHIN)) {
+      p->dropped++;
+    } else {
+      int64_t start = esp_timer_get_time();
+      esp_mqtt_client_publish_lane(check_client, "pictures", check_payload, sizeof(check_payload), 1, false,
+                                   ESP_MQTT_LANE_BULK);
+      if (p->count < CHECK_SAMPLES) {
+        p->samples[p->count++] = esp_timer_get_time() - start;
+      }
+      p->sent++;
+    }
+    // a producer that fell behind takes the next picture at once
+    TickType_t now = xTaskGetTickCount();
+    wake = now - wake > CHECK_INTERVAL / portTICK_PERIOD_MS ? now : wake + CHECK_INTERVAL / portTICK_PERIOD_MS;
+    vTaskDelay(wake - now);
+  }
+  __atomic_add_fetch(&check_done, 1, __ATOMIC_SEQ_CST);
+  vTaskDelete(NULL);
+}
+
+static int check_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool check_run(bool ask, int seconds, uint32_t rate) {
+  // run the producers
+  static check_producer_t producers[CHECK_PRODUCERS];
+  check_running = true;
+  check_done = 0;
+  for (int i = 0; i < CHECK_PRODUCERS; i++) {
+    producers[i] = (check_producer_t){.ask = ask};
+    xTaskCreate(check_produce, "producer", 4096, &producers[i], 2, NULL);
+  }
+  vTaskDelay(seconds * 1000 / portTICK_PERIOD_MS);
+  esp_mqtt_link_stats_t stats;
+  esp_mqtt_client_link_stats(check_client, &stats);
+  check_running = false;
+  while (check_done < CHECK_PRODUCERS) {
+    vTaskDelay(5);
+  }
+
+  // the latency of all sent pictures
+  static int64_t samples[CHECK_PRODUCERS * CHECK_SAMPLES];
+  size_t count = 0, sent = 0, dropped = 0;
+  for (int i = 0; i < CHECK_PRODUCERS; i++) {
+    for (size_t j = 0; j < producers[i].count; j++) {
+      samples[count++] = producers[i].samples[j];
+    }
+    sent += producers[i].sent;
+    dropped += producers[i].dropped;
+  }
+  qsort(samples, count, sizeof(int64_t), check_compare);
+  int64_t p50 = count ? samples[count / 2] : 0;
+  int64_t max = count ? samples[count - 1] : 0;
+
+  // asking keeps the publishes in time and the link busy, the estimate follows the link
+  size_t used = sent * sizeof(check_payload) / (size_t)seconds;
+  bool ok = stats.throughput >= rate / 2 && stats.throughput <= rate * 2;
+  if (ask) {
+    ok = ok && max <= CHECK_WITHIN * 1500 && dropped > 0 && used >= rate / 2;
+  }
+  printf("%-5s %6zu %7zu %8u %13zu %10lld %10lld %5s\n", ask ? "yes" : "no", sent, dropped, stats.throughput / 1024,
+         used / 1024, (long long)p50 / 1000, (long long)max / 1000, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+  uint32_t rate = argc > 2 ? (uint32_t)atoi(argv[2]) : 200000;
+
+  // start a broker behind a slow link and the client
+  uint16_t port = mqtt_broker_start(0);
+  if (port == 0) {
+    fprintf(stderr, "broker failed\n");
+    return 1;
+  }
+  mqtt_broker_limit(port, rate);
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  esp_mqtt_client_config_t config;
+  esp_mqtt_client_default_config(&config);
+  config.status_callback = check_status;
+  config.buffer_size = 2048;
+  config.command_timeout = 10000;
+  check_client = esp_mqtt_client_create(&config);
+  if (check_client == NULL ||
+      !esp_mqtt_client_start(check_client, "127.0.0.1", port_str, "link", NULL, NULL, 30, true)) {
+    fprintf(stderr, "client failed\n");
+    return 1;
+  }
+  while (!check_connected) {
+    vTaskDelay(5);
+  }
+
+  printf("link %u KB/s, a picture every %d ms from %d producers, deadline %d ms\n", rate / 1024, CHECK_INTERVAL,
+         CHECK_PRODUCERS, CHECK_WITHIN);
+  printf("ask     sent dropped estimate used KB/s      p50 ms     max ms\n");
+  bool ok = check_run(false, seconds, rate);
+  ok = check_run(true, seconds, rate) && ok;
+
+  // the counters return to zero and an idle link takes a picture
+  vTaskDelay(100 / portTICK_PERIOD_MS);
+  esp_mqtt_link_stats_t stats;
+  esp_mqtt_client_link_stats(check_client, &stats);
+  bool idle = stats.queued_bytes == 0 && stats.in_flight == 0 &&
+              esp_mqtt_client_can_accept(check_client, sizeof(check_payload), CHECK_WITHIN);
+  printf("idle queued %zu in flight %u %s\n", stats.queued_bytes, stats.in_flight, idle ? "ok" : "FAIL");
+  esp_mqtt_client_destroy(check_client);
+  return ok && idle ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Runs two clients against two loopback brokers at once and checks that they do not share any state.
+//
+// The first client sends pictures to a broker that acknowledges slowly, the second one sends small events to a fast
+// broker. Each broker has to see only the connection and the publishes of its own client, and the status callbacks
+// have to get their own client and reference. The events may not wait for the pictures, so their median latency has
+// to stay below the acknowledgement delay of the slow broker. Destroying the first client may not disturb the second,
+// and the default instance of the old functions has to work next to it.
+//
+// usage: mqtt_multi_check [pictures] [ack_delay_us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_mqtt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_broker.h"
+
+#define CHECK_CLIENTS 2
+#define CHECK_MAX_EVENTS 100000
+
+typedef struct {
+  const char *name;
+  uint16_t port;
+  esp_mqtt_client_t *client;
+  volatile bool connected;
+  volatile size_t wrong;  // status callbacks with another client or reference
+  size_t published;
+  size_t failed;
+} check_client_t;
+
+static check_client_t check_clients[CHECK_CLIENTS];
+static volatile bool check_sending;
+static uint8_t check_payload[27000];
+static int64_t check_latency[CHECK_MAX_EVENTS];
+
+static void check_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  check_client_t *c = esp_mqtt_client_ref(client);
+  if (c < check_clients || c >= check_clients + CHECK_CLIENTS || (c->client != NULL && c->client != client)) {
+    // the reference of another client, nothing to record it in
+    check_clients[0].wrong++;
+    return;
+  }
+  c->connected = status == ESP_MQTT_STATUS_CONNECTED;
+}
+
+static void check_pictures(void *arg) {
+  // publish the pictures back to back
+  int pictures = *(int *)arg;
+  check_client_t *c = &check_clients[0];
+  for (int i = 0; i < pictures; i++) {
+    if (esp_mqtt_client_publish(c->client, "pictures", check_payload, sizeof(check_payload), 1, false)) {
+      c->published++;
+    } else {
+      c->failed++;
+    }
+  }
+  check_sending = false;
+  vTaskDelete(NULL);
+}
+
+static int check_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool check_broker(const check_client_t *c, uint32_t connects, size_t publishes) {
+  mqtt_broker_stats_t stats;
+  mqtt_broker_stats(c->port, &stats);
+  bool ok = stats.connects == connects && stats.publishes == publishes;
+  printf("%-8s %5u %8zu %8u %9u %6zu %5s\n", c->name, c->port, publishes, stats.connects, stats.publishes, c->failed,
+         ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int pictures = argc > 1 ? atoi(argv[1]) : 50;
+  uint32_t ack_delay = argc > 2 ? (uint32_t)atoi(argv[2]) : 20000;
+
+  // a slow broker for the pictures and a fast one for the events
+  check_clients[0] = (check_client_t){.name = "pictures", .port = mqtt_broker_start(ack_delay)};
+  check_clients[1] = (check_client_t){.name = "events", .port = mqtt_broker_start(0)};
+  for (size_t i = 0; i < CHECK_CLIENTS; i++) {
+    check_client_t *c = &check_clients[i];
+    if (c->port == 0) {
+      fprintf(stderr, "broker failed\n");
+      return 1;
+    }
+    char port[8];
+    snprintf(port, sizeof(port), "%u", c->port);
+    esp_mqtt_client_config_t config;
+    esp_mqtt_client_default_config(&config);
+    config.status_callback = check_status;
+    config.ref = c;
+    config.buffer_size = i == 0 ? 2048 : 512;
+    config.task_priority = i == 0 ? 2 : 4;
+    c->client = esp_mqtt_client_create(&config);
+    if (c->client == NULL || !esp_mqtt_client_start(c->client, "127.0.0.1", port, c->name, NULL, NULL, 30, true)) {
+      fprintf(stderr, "client failed\n");
+      return 1;
+    }
+  }
+  for (int wait = 0; !check_clients[0].connected || !check_clients[1].connected; wait++) {
+    if (wait == 200) {
+      fprintf(stderr, "clients did not connect\n");
+      return 1;
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+
+  // events on the second client while the first one sends pictures
+  check_sending = true;
+  xTaskCreate(check_pictures, "pictures", 4096, &pictures, 2, NULL);
+  check_client_t *events = &check_clients[1];
+  size_t count = 0;
+  while (check_sending) {
+    int64_t start = esp_timer_get_time();
+    if (!esp_mqtt_client_publish(events->client, "events", check_payload, 4, 1, false)) {
+      events->failed++;
+      continue;
+    }
+    events->published++;
+    if (count < CHECK_MAX_EVENTS) {
+      check_latency[count++] = esp_timer_get_time() - start;
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  qsort(check_latency, count, sizeof(int64_t), check_compare);
+  int64_t p50 = count ? check_latency[count / 2] : 0;
+  int64_t max = count ? check_latency[count - 1] : 0;
+
+  printf("client    port expected connects publishes failed\n");
+  bool ok = check_broker(&check_clients[0], 1, (size_t)pictures);
+  ok = check_broker(events, 1, events->published) && ok;
+
+  // the second client keeps working without the first one
+  esp_mqtt_client_destroy(check_clients[0].client);
+  check_clients[0].client = NULL;
+  bool alone = esp_mqtt_client_publish(events->client, "events", check_payload, 4, 1, false);
+  events->published += alone;
+
+  // the default instance connects to the fast broker as a third client
+  char port[8];
+  snprintf(port, sizeof(port), "%u", events->port);
+  esp_mqtt_init(NULL, NULL, 512, 1000);
+  bool legacy = esp_mqtt_start("127.0.0.1", port, "legacy", NULL, NULL, 30, true);
+  for (int wait = 0; legacy && wait < 200 && !esp_mqtt_publish("legacy", check_payload, 4, 1, false); wait++) {
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  legacy = legacy && esp_mqtt_default_client() != events->client;
+  ok = check_broker(events, 2, events->published + 1) && ok;
+  esp_mqtt_stop();
+  esp_mqtt_client_destroy(events->client);
+
+  bool fast = p50 < ack_delay;
+  printf("events while sending pictures: %zu, p50 %lld us, max %lld us %s\n", count, (long long)p50, (long long)max,
+         fast ? "ok" : "FAIL");
+  printf("alone %s, legacy %s, wrong status callbacks %zu\n", alone ? "ok" : "FAIL", legacy ? "ok" : "FAIL",
+         check_clients[0].wrong);
+  ok = ok && fast && alone && legacy && check_clients[0].wrong == 0;
+  return ok ? 0 : 1;
+}
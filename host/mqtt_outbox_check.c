@@ -0,0 +1,299 @@
+// Cuts the power of the outbox in the middle of its writes and checks what it replays after reopening the file.
+//
+// A copy of the file is taken after every push while the ring wraps, with the header of the last record written up
+// to a byte count or only its data, as if the power failed at that point, and some with the state of the oldest record
+// cleared halfway. The reopened copy has to replay the queued messages complete and in order without the torn records,
+// and go on with messages pushed after the recovery. A child
+// process that pushes and replays is also killed at random times. The quota has to evict the oldest messages with
+// DROP_OLDEST and refuse the new ones with DROP_NEWEST, and the counters have to add up.
+//
+// usage: mqtt_outbox_check [rounds]
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "esp_mqtt_outbox.h"
+
+#define CHECK_FILE "mqtt_outbox_check.bin"
+#define CHECK_COPY "mqtt_outbox_check.copy"
+#define CHECK_QUOTA (3 * 4096)
+#define CHECK_HEADER 28  // the last word is the state which stays erased until the record is replayed
+#define CHECK_MESSAGES 400
+#define CHECK_QUEUED 8
+
+typedef struct {
+  volatile uint32_t pushed;  // last message whose push returned
+  volatile uint32_t popped;  // last message whose pop returned
+} check_progress_t;
+
+static uint8_t check_image[CHECK_QUOTA + 4096];
+static int check_failures;
+
+static void check_fail(const char *what, uint32_t n) {
+  printf("  %s (message %u)\n", what, n);
+  check_failures++;
+}
+
+static size_t check_payload(uint32_t n, uint8_t *buf) {
+  // the number followed by a pattern of a length that lets records wrap anywhere in a sector
+  size_t len = 40 + n * 97 % 700;
+  memcpy(buf, &n, sizeof(n));
+  for (size_t i = sizeof(n); i < len; i++) {
+    buf[i] = (uint8_t)(n * 7 + i);
+  }
+  return len;
+}
+
+static bool check_push(esp_mqtt_outbox_t *outbox, uint32_t n) {
+  uint8_t payload[800];
+  char topic[32];
+  snprintf(topic, sizeof(topic), "doorbell/%u", n % 5);
+  return esp_mqtt_outbox_push(outbox, topic, payload, check_payload(n, payload), n % 3, n % 2);
+}
+
+static bool check_message(const esp_mqtt_outbox_message_t *msg, uint32_t *n) {
+  // the message has to be the one its number names
+  uint8_t payload[800];
+  char topic[32];
+  if (msg->payload_len < sizeof(*n)) {
+    return false;
+  }
+  memcpy(n, msg->payload, sizeof(*n));
+  snprintf(topic, sizeof(topic), "doorbell/%u", *n % 5);
+  size_t len = check_payload(*n, payload);
+  return strcmp(msg->topic, topic) == 0 && msg->payload_len == len && memcmp(msg->payload, payload, len) == 0 && msg->qos == (int)(*n % 3) &&
+         msg->retained == (*n % 2);
+}
+
+static bool check_pop(esp_mqtt_outbox_t *outbox, uint32_t expected) {
+  esp_mqtt_outbox_message_t msg;
+  uint32_t n = 0;
+  if (!esp_mqtt_outbox_peek(outbox, &msg)) {
+    check_fail("queued message missing", expected);
+    return false;
+  }
+  bool ok = check_message(&msg, &n) && n == expected;
+  if (!ok) {
+    check_fail("wrong or corrupt message replayed", expected);
+  }
+  esp_mqtt_outbox_pop(outbox, &msg);
+  return ok;
+}
+
+static void check_copy(size_t offset, size_t written, size_t span, size_t popping) {
+  // copy the file as it is on the storage, the record at offset only got the first bytes of its header
+  FILE *file = fopen(CHECK_FILE, "rb");
+  size_t size = fread(check_image, 1, sizeof(check_image), file);
+  fclose(file);
+  if (popping != SIZE_MAX) {
+    // the state of the oldest record was being cleared
+    memset(check_image + popping + CHECK_HEADER - 2, 0xFF, 2);
+    memset(check_image + popping + CHECK_HEADER - 4, 0x00, 2);
+  }
+  if (written < CHECK_HEADER) {
+    memset(check_image + offset + written, 0xFF, CHECK_HEADER - written);
+  }
+  if (written == 0) {
+    // the data was not complete either
+    memset(check_image + offset + CHECK_HEADER + (span - CHECK_HEADER) / 2, 0xFF, (span - CHECK_HEADER + 1) / 2);
+  }
+  file = fopen(CHECK_COPY, "wb");
+  fwrite(check_image, 1, size, file);
+  fclose(file);
+}
+
+static void check_recovered(uint32_t first, uint32_t last, bool torn, uint32_t next) {
+  // the copy has to replay the queued messages without the torn one and then the one pushed after the recovery
+  esp_mqtt_outbox_t copy = {0};
+  if (!esp_mqtt_outbox_open(&copy, CHECK_COPY, CHECK_QUOTA, 0, ESP_MQTT_OUTBOX_DROP_NEWEST)) {
+    check_fail("copy cannot be opened", last);
+    return;
+  }
+  uint32_t end = torn ? last : last + 1;
+  if (copy.stats.pending != end - first) {
+    check_fail("wrong number of recovered messages", last);
+  }
+  if (!check_push(&copy, next)) {
+    check_fail("push after the recovery failed", next);
+  }
+  esp_mqtt_outbox_close(&copy);
+
+  // also after opening it once more
+  esp_mqtt_outbox_open(&copy, CHECK_COPY, CHECK_QUOTA, 0, ESP_MQTT_OUTBOX_DROP_NEWEST);
+  for (uint32_t n = first; n < end && check_pop(&copy, n); n++) {
+  }
+  check_pop(&copy, next);
+  if (copy.stats.pending != 0 || copy.stats.failed != 0) {
+    check_fail("messages left or failed after the replay", last);
+  }
+  esp_mqtt_outbox_close(&copy);
+}
+
+static void check_torn(void) {
+  // push while replaying behind, tear the header of each new record at another byte
+  esp_mqtt_outbox_t outbox = {0};
+  unlink(CHECK_FILE);
+  esp_mqtt_outbox_open(&outbox, CHECK_FILE, CHECK_QUOTA, 0, ESP_MQTT_OUTBOX_DROP_NEWEST);
+  uint32_t first = 0;
+  size_t wraps = 0;
+  static size_t offsets[CHECK_MESSAGES];
+  for (uint32_t n = 0; n < CHECK_MESSAGES; n++) {
+    // the record goes to the head or, if it does not fit in front of the end, to the start
+    uint8_t payload[800];
+    size_t span = (CHECK_HEADER + strlen("doorbell/0") + check_payload(n, payload) + 3) & ~(size_t)3;
+    size_t offset = outbox.head + span > outbox.size ? 0 : outbox.head;
+    wraps += offset == 0 && n > 0;
+    offsets[n] = offset;
+    if (!check_push(&outbox, n)) {
+      check_fail("push failed", n);
+      break;
+    }
+
+    // every fifth copy is also taken while the oldest record is replayed
+    size_t written = n % 8 * 4;
+    bool popping = n % 5 == 4 && outbox.stats.pending > 1;
+    check_copy(offset, written, span, popping ? offsets[first] : SIZE_MAX);
+    check_recovered(first + popping, n, written < CHECK_HEADER - 4, 100000 + n);
+
+    while (outbox.stats.pending > CHECK_QUEUED) {
+      check_pop(&outbox, first++);
+    }
+  }
+  esp_mqtt_outbox_close(&outbox);
+  printf("torn     %6u %6zu %8s\n", CHECK_MESSAGES, wraps, check_failures ? "FAIL" : "ok");
+}
+
+static void check_quota(esp_mqtt_outbox_policy_t policy, uint32_t max_messages) {
+  // push more than fits and reopen, the oldest or the newest messages are dropped
+  esp_mqtt_outbox_t outbox = {0};
+  int failures = check_failures;
+  unlink(CHECK_FILE);
+  esp_mqtt_outbox_open(&outbox, CHECK_FILE, CHECK_QUOTA, max_messages, policy);
+  uint32_t pushes = 100, stored = 0;
+  for (uint32_t n = 0; n < pushes; n++) {
+    stored += check_push(&outbox, n);
+  }
+  esp_mqtt_outbox_stats_t stats = outbox.stats;
+  esp_mqtt_outbox_close(&outbox);
+  if (stats.appended != stored || stats.appended + stats.rejected != pushes || stats.appended != stats.pending + stats.evicted ||
+      stats.pending_bytes > CHECK_QUOTA || stats.failed != 0 || (max_messages > 0 && stats.pending != max_messages)) {
+    check_fail("counters do not add up", pushes);
+  }
+  if (policy == ESP_MQTT_OUTBOX_DROP_OLDEST ? stats.rejected != 0 || stats.evicted == 0 : stats.evicted != 0 || stats.rejected == 0) {
+    check_fail("wrong policy applied", pushes);
+  }
+
+  // the newest messages survive with DROP_OLDEST, the first ones with DROP_NEWEST
+  esp_mqtt_outbox_open(&outbox, CHECK_FILE, CHECK_QUOTA, max_messages, policy);
+  if (outbox.stats.pending != stats.pending || outbox.stats.pending_bytes != stats.pending_bytes) {
+    check_fail("pending messages not recovered", pushes);
+  }
+  uint32_t first = policy == ESP_MQTT_OUTBOX_DROP_OLDEST ? pushes - stats.pending : 0;
+  for (uint32_t n = first; n < first + stats.pending && check_pop(&outbox, n); n++) {
+  }
+  if (outbox.stats.replayed != stats.pending || outbox.stats.pending != 0 || outbox.stats.pending_bytes != 0) {
+    check_fail("replay counters do not add up", pushes);
+  }
+  esp_mqtt_outbox_close(&outbox);
+  printf("%-8s %6u %6u %6u %7u %8u %8s\n", policy == ESP_MQTT_OUTBOX_DROP_OLDEST ? "oldest" : "newest", max_messages, stats.appended,
+         stats.pending, stats.evicted, stats.rejected, check_failures > failures ? "FAIL" : "ok");
+}
+
+static void check_child(check_progress_t *progress, esp_mqtt_outbox_policy_t policy, uint32_t n) {
+  // push and replay until killed, DROP_OLDEST leaves the room to the quota
+  esp_mqtt_outbox_t outbox = {0};
+  esp_mqtt_outbox_open(&outbox, CHECK_FILE, CHECK_QUOTA, 0, policy);
+  for (;; n++) {
+    if (!check_push(&outbox, n)) {
+      exit(1);
+    }
+    progress->pushed = n;
+    while (policy == ESP_MQTT_OUTBOX_DROP_NEWEST && outbox.stats.pending > CHECK_QUEUED) {
+      esp_mqtt_outbox_message_t msg;
+      uint32_t popped = 0;
+      esp_mqtt_outbox_peek(&outbox, &msg);
+      check_message(&msg, &popped);
+      esp_mqtt_outbox_pop(&outbox, &msg);
+      progress->popped = popped;
+    }
+  }
+}
+
+static void check_kill(esp_mqtt_outbox_policy_t policy, int rounds) {
+  // kill a child in the middle of its writes, the messages left have to follow each other from the last replayed one
+  check_progress_t *progress = mmap(NULL, sizeof(*progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  int failures = check_failures;
+  uint32_t next = 1, recovered = 0;
+  unlink(CHECK_FILE);
+  srand(1);
+  for (int round = 0; round < rounds; round++) {
+    progress->pushed = next - 1;
+    progress->popped = next - 1;
+    pid_t child = fork();
+    if (child == 0) {
+      check_child(progress, policy, next);
+    }
+    usleep(1000 + rand() % 20000);
+    kill(child, SIGKILL);
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFSIGNALED(status)) {
+      check_fail("push of the child failed", progress->pushed + 1);
+    }
+
+    esp_mqtt_outbox_t outbox = {0};
+    esp_mqtt_outbox_open(&outbox, CHECK_FILE, CHECK_QUOTA, 0, policy);
+    uint32_t pending = outbox.stats.pending, first = 0, last = 0;
+    for (uint32_t i = 0; i < pending; i++) {
+      esp_mqtt_outbox_message_t msg;
+      uint32_t n = 0;
+      if (!esp_mqtt_outbox_peek(&outbox, &msg) || !check_message(&msg, &n) || (i > 0 && n != last + 1)) {
+        check_fail("recovered messages do not follow each other", n);
+        break;
+      }
+      first = i == 0 ? n : first;
+      last = n;
+      esp_mqtt_outbox_pop(&outbox, &msg);
+    }
+    if (pending > 0 && (first <= progress->popped || last < progress->pushed || last > progress->pushed + 1)) {
+      check_fail("recovered messages from the wrong range", first);
+    }
+    if (policy == ESP_MQTT_OUTBOX_DROP_NEWEST && pending > 0 && first > progress->popped + 2) {
+      check_fail("queued message lost", progress->popped + 1);
+    }
+    if (outbox.stats.failed != 0 || outbox.stats.pending != 0) {
+      check_fail("recovery failed", last);
+    }
+    esp_mqtt_outbox_close(&outbox);
+    recovered += pending;
+    next = (pending > 0 ? last : progress->pushed) + 1;
+  }
+  munmap(progress, sizeof(*progress));
+  printf("kill %-3s %6d %6u %6u %8s\n", policy == ESP_MQTT_OUTBOX_DROP_OLDEST ? "old" : "new", rounds, next - 1, recovered,
+         check_failures > failures ? "FAIL" : "ok");
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 50;
+
+  printf("case     pushes  wraps\n");
+  check_torn();
+  printf("policy   limit appended pending evicted rejected\n");
+  check_quota(ESP_MQTT_OUTBOX_DROP_OLDEST, 0);
+  check_quota(ESP_MQTT_OUTBOX_DROP_NEWEST, 0);
+  check_quota(ESP_MQTT_OUTBOX_DROP_OLDEST, 10);
+  check_quota(ESP_MQTT_OUTBOX_DROP_NEWEST, 10);
+  printf("case     rounds pushed recovered\n");
+  check_kill(ESP_MQTT_OUTBOX_DROP_NEWEST, rounds);
+  check_kill(ESP_MQTT_OUTBOX_DROP_OLDEST, rounds);
+
+  unlink(CHECK_FILE);
+  unlink(CHECK_COPY);
+  return check_failures ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+// Checks the wildcards of the topic router and measures a dispatch against a linear strcmp over the filters.
+//
+// Every topic of the table has to reach exactly the routes of the filters it matches: `+` matches one level, also an
+// empty one, a trailing `#` matches the level before it and everything below, wildcards at the first level skip
+// topics starting with `$`, and a filter that was added twice calls both routes. Filters with a misplaced wildcard
+// have to be refused. The timing adds 1 to 1000 plain routes and dispatches the topic of the last one.
+//
+// usage: mqtt_router_bench [dispatches]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_mqtt_router.h"
+
+#define BENCH_MAX_ROUTES 1000
+
+static const char *bench_filters[] = {
+    "doorbell/ring", "doorbell/+", "doorbell/#", "#", "+/ring", "$SYS/#", "doorbell/+/battery", "doorbell/ring", "+",
+};
+
+typedef struct {
+  const char *topic;
+  uint32_t routes;  // bit mask of the matching filters
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+    {"doorbell/ring", 0x09F},
+    {"doorbell", 0x10C},
+    {"doorbell/front/battery", 0x04C},
+    {"doorbell//battery", 0x04C},
+    {"doorbell/ring/extra", 0x00C},
+    {"garage/ring", 0x018},
+    {"/ring", 0x018},
+    {"ring", 0x108},
+    {"$SYS", 0x020},
+    {"$SYS/uptime", 0x020},
+    {"$SYS/ring", 0x020},
+};
+
+static const char *bench_invalid[] = {"doorbell/#/ring", "doorbell/ring#", "doorbell/ring+", "doorbell/+x", "#/ring"};
+
+static const int bench_counts[] = {1, 10, 100, 1000};
+
+static uint32_t bench_hits;
+static char bench_names[BENCH_MAX_ROUTES][40];
+
+static double bench_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void bench_handler(const char *topic, uint8_t *payload, size_t len, void *ctx) {
+  bench_hits |= 1u << (uintptr_t)ctx;
+}
+
+static void bench_count(const char *topic, uint8_t *payload, size_t len, void *ctx) {
+  (*(size_t *)ctx)++;
+}
+
+static bool bench_check() {
+  // add the filters and the invalid ones
+  esp_mqtt_router_t router;
+  esp_mqtt_router_init(&router);
+  bool ok = true;
+  size_t filters = sizeof(bench_filters) / sizeof(bench_filters[0]);
+  for (size_t i = 0; i < filters; i++) {
+    ok = esp_mqtt_router_add(&router, bench_filters[i], bench_handler, (void *)(uintptr_t)i) && ok;
+  }
+  for (size_t i = 0; i < sizeof(bench_invalid) / sizeof(bench_invalid[0]); i++) {
+    if (esp_mqtt_router_add(&router, bench_invalid[i], bench_handler, NULL)) {
+      printf("%-24s accepted\n", bench_invalid[i]);
+      ok = false;
+    }
+  }
+
+  // every topic reaches its routes
+  printf("topic                    routes expected\n");
+  for (size_t i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); i++) {
+    const bench_case_t *c = &bench_cases[i];
+    bench_hits = 0;
+    size_t called = esp_mqtt_router_dispatch(&router, c->topic, NULL, 0);
+    bool good = bench_hits == c->routes && called == (size_t)__builtin_popcount(c->routes);
+    printf("%-24s  0x%03x    0x%03x %s\n", c->topic, bench_hits, c->routes, good ? "ok" : "FAIL");
+    ok = ok && good;
+  }
+  esp_mqtt_router_free(&router);
+  return ok;
+}
+
+static bool bench_time(int count, int dispatches) {
+  // plain routes of one sensor per room
+  esp_mqtt_router_t router;
+  esp_mqtt_router_init(&router);
+  size_t called = 0;
+  for (int i = 0; i < count; i++) {
+    snprintf(bench_names[i], sizeof(bench_names[i]), "home/room%d/sensor/temperature", i);
+    esp_mqtt_router_add(&router, bench_names[i], bench_count, &called);
+  }
+  const char *topic = bench_names[count - 1];
+
+  // dispatch the topic of the last route
+  double start = bench_now();
+  for (int i = 0; i < dispatches; i++) {
+    esp_mqtt_router_dispatch(&router, topic, NULL, 0);
+  }
+  double trie = (bench_now() - start) / dispatches;
+
+  // find it with strcmp
+  volatile size_t found = 0;
+  start = bench_now();
+  for (int i = 0; i < dispatches; i++) {
+    for (int j = 0; j < count; j++) {
+      if (strcmp(bench_names[j], topic) == 0) {
+        found++;
+        break;
+      }
+    }
+  }
+  double linear = (bench_now() - start) / dispatches;
+  esp_mqtt_router_free(&router);
+
+  bool ok = called == (size_t)dispatches && found == (size_t)dispatches;
+  printf("%6d %10.1f %10.1f %5s\n", count, trie, linear, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  int dispatches = argc > 1 ? atoi(argv[1]) : 200000;
+
+  bool ok = bench_check();
+  printf("\nroutes    trie ns  strcmp ns\n");
+  for (size_t i = 0; i < sizeof(bench_counts) / sizeof(bench_counts[0]); i++) {
+    ok = bench_time(bench_counts[i], dispatches) && ok;
+  }
+  return ok ? 0 : 1;
+}
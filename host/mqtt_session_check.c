@@ -0,0 +1,127 @@
+// Drops the connection before the broker answers and checks what a persistent session keeps over the reconnect.
+//
+// The broker drops the connection on a QoS 1 message, on the PUBREL of a QoS 2 message and on a picture that is
+// larger than the in-flight budget. With a persistent session the message has to be resent with the DUP flag under
+// its packet id, the PUBREL has to be sent again, the broker has to report the session and the subscription may not
+// be sent again. With a clean session none of that may happen and the outbox has to replay the messages instead. In
+// both runs the picture has to come from the outbox and the keep alive has to reach the broker.
+//
+// usage: mqtt_session_check [keep_alive]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_mqtt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_broker.h"
+
+#define CHECK_FILE "mqtt_session_check.bin"
+#define CHECK_QUOTA (64 * 1024)
+
+static volatile bool check_connected;
+static volatile int check_connects;
+static uint8_t check_payload[27000];
+
+static void check_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  check_connected = status == ESP_MQTT_STATUS_CONNECTED;
+  check_connects += check_connected;
+}
+
+static bool check_wait(esp_mqtt_client_t *client, int connects) {
+  // wait for the reconnect and an empty outbox
+  for (int wait = 0; wait < 500; wait++) {
+    esp_mqtt_outbox_stats_t outbox;
+    esp_mqtt_client_outbox_stats(client, &outbox);
+    if (check_connected && check_connects >= connects && outbox.pending == 0) {
+      vTaskDelay(200 / portTICK_PERIOD_MS);
+      return true;
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  return false;
+}
+
+static bool check_run(uint16_t port, bool clean, uint16_t keep_alive) {
+  // start a client with a fresh outbox
+  remove(CHECK_FILE);
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+  esp_mqtt_client_config_t config;
+  esp_mqtt_client_default_config(&config);
+  config.status_callback = check_status;
+  config.buffer_size = 1024;
+  config.command_timeout = 1000;
+  check_connected = false;
+  check_connects = 0;
+  esp_mqtt_client_t *client = esp_mqtt_client_create(&config);
+  if (client == NULL || !esp_mqtt_client_outbox(client, CHECK_FILE, CHECK_QUOTA, 0, ESP_MQTT_OUTBOX_DROP_OLDEST, 10)) {
+    printf("%-10s client failed\n", clean ? "clean" : "persistent");
+    return false;
+  }
+  esp_mqtt_client_reconnect_policy(client, 50, 100, 0);
+  mqtt_broker_stats_t before;
+  mqtt_broker_stats(port, &before);
+  const char *id = clean ? "session-clean" : "session-persistent";
+  if (!esp_mqtt_client_start(client, "127.0.0.1", port_str, id, NULL, NULL, keep_alive, clean) ||
+      !check_wait(client, 1)) {
+    printf("%-10s client failed\n", clean ? "clean" : "persistent");
+    return false;
+  }
+  bool ok = esp_mqtt_client_subscribe(client, "doorbell/commands/#", 1);
+  ok = esp_mqtt_client_publish(client, "doorbell/ok", (uint8_t *)"ok", 2, 1, false) && ok;
+
+  // a message without its puback
+  mqtt_broker_drop(port, 3, 1);
+  ok = esp_mqtt_client_publish(client, "doorbell/ring", (uint8_t *)"ring", 4, 1, false) && ok;
+  ok = check_wait(client, 2) && ok;
+  bool present = esp_mqtt_client_session_present(client);
+
+  // a released qos 2 message without its pubcomp
+  mqtt_broker_drop(port, 6, 1);
+  ok = esp_mqtt_client_publish(client, "doorbell/event", (uint8_t *)"event", 5, 2, false) && ok;
+  ok = check_wait(client, 3) && ok;
+
+  // a picture beyond the in-flight budget without its puback
+  mqtt_broker_drop(port, 3, 1);
+  ok = esp_mqtt_client_publish(client, "doorbell/picture", check_payload, sizeof(check_payload), 1, false) && ok;
+  ok = check_wait(client, 4) && ok;
+  ok = esp_mqtt_client_publish(client, "doorbell/ok", (uint8_t *)"ok", 2, 1, false) && ok;
+
+  esp_mqtt_outbox_stats_t outbox;
+  esp_mqtt_client_outbox_stats(client, &outbox);
+  esp_mqtt_client_destroy(client);
+  remove(CHECK_FILE);
+
+  // compare with what the session has to keep, three reconnects
+  mqtt_broker_stats_t after;
+  mqtt_broker_stats(port, &after);
+  uint32_t resent = after.resent - before.resent;
+  uint32_t duplicates = after.duplicates - before.duplicates;
+  uint32_t sessions = after.sessions - before.sessions;
+  uint32_t subscribes = after.subscribes - before.subscribes;
+  uint32_t replayed = clean ? 3 : 1;
+  ok = ok && present == !clean && resent == (clean ? 0 : 2) && duplicates == (clean ? 0 : 1) &&
+       sessions == (clean ? 0 : 3) && subscribes == (clean ? 4 : 1) && outbox.appended == replayed &&
+       outbox.replayed == replayed && outbox.pending == 0 && after.keep_alive == keep_alive &&
+       after.drops - before.drops == 3;
+  printf("%-10s %8d %7s %6u %10u %8u %10u %8u %10u %5s\n", clean ? "clean" : "persistent", check_connects,
+         present ? "yes" : "no", resent, duplicates, sessions, subscribes, outbox.replayed, after.keep_alive,
+         ok ? "ok" : "FAIL");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  uint16_t keep_alive = argc > 1 ? (uint16_t)atoi(argv[1]) : 17;
+
+  uint16_t port = mqtt_broker_start(0);
+  if (port == 0) {
+    fprintf(stderr, "broker failed\n");
+    return 1;
+  }
+
+  printf("session    connects present resent duplicates sessions subscribes replayed keep alive\n");
+  bool ok = check_run(port, false, keep_alive);
+  ok = check_run(port, true, keep_alive) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+// Measures full and resumed TLS handshakes of the client against a loopback TLS server and the heap they take.
+//
+// The server issues session tickets and forwards to a loopback broker. Every round creates a client, whose first
+// connect needs a full handshake with the certificate exchange and key agreement, then stops and starts it again,
+// which has to resume the session with the ticket of the first connect. The table shows the median handshake time the
+// client reports, the median time from the start until the broker accepted the connection and the largest peak heap
+// above the level before the start. Every restart has to resume, faster and with less heap than the full handshake,
+// and the server may not see a failed handshake.
+//
+// usage: mqtt_tls_bench [rounds]
+
+#include <mbedtls/certs.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_heap_caps.h"
+#include "esp_mqtt.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_tls_server.h"
+
+#define BENCH_MAX_ROUNDS 100
+
+typedef struct {
+  const char *name;
+  uint32_t resumptions;  // resumed handshakes after the connect
+  int64_t handshake[BENCH_MAX_ROUNDS];
+  int64_t connect[BENCH_MAX_ROUNDS];
+  int64_t heap[BENCH_MAX_ROUNDS];
+} bench_handshake_t;
+
+static volatile bool bench_connected;
+static volatile int64_t bench_connected_at;
+
+static void bench_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  if (status == ESP_MQTT_STATUS_CONNECTED) {
+    bench_connected_at = esp_timer_get_time();
+  }
+  bench_connected = status == ESP_MQTT_STATUS_CONNECTED;
+}
+
+static int bench_compare(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static bool bench_connect(esp_mqtt_client_t *client, const char *port, bench_handshake_t *h, int round) {
+  // start with a fresh low-water mark
+  bench_connected = false;
+  size_t before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_start();
+  int64_t start = esp_timer_get_time();
+  bool ok = esp_mqtt_client_start(client, "localhost", port, "tls", NULL, NULL, 30, true);
+  for (int wait = 0; ok && !bench_connected; wait++) {
+    ok = wait < 500;
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  h->heap[round] = (int64_t)before - (int64_t)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  h->connect[round] = bench_connected_at - start;
+
+  // the handshake as seen by the client
+  esp_mqtt_reconnect_stats_t stats;
+  esp_mqtt_client_reconnect_stats(client, &stats);
+  h->handshake[round] = stats.tls_handshake_time;
+  h->resumptions += stats.tls_resumptions;
+  esp_mqtt_client_stop(client);
+  return ok;
+}
+
+static void bench_print(bench_handshake_t *h, int rounds) {
+  // medians of the times, the largest peak
+  qsort(h->handshake, rounds, sizeof(int64_t), bench_compare);
+  qsort(h->connect, rounds, sizeof(int64_t), bench_compare);
+  qsort(h->heap, rounds, sizeof(int64_t), bench_compare);
+  printf("%-9s %12lld %10.2f %9lld %11u\n", h->name, (long long)h->handshake[rounds / 2],
+         h->connect[rounds / 2] / 1000.0, (long long)h->heap[rounds - 1], h->resumptions);
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 10;
+  rounds = rounds > BENCH_MAX_ROUNDS ? BENCH_MAX_ROUNDS : rounds < 1 ? 1 : rounds;
+
+  // the server is forked before the first task
+  uint16_t port = mqtt_tls_server_start(0);
+  if (port == 0) {
+    fprintf(stderr, "server failed\n");
+    return 1;
+  }
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+
+  // a new client needs a full handshake, its restart resumes
+  static bench_handshake_t full = {.name = "full"};
+  static bench_handshake_t resumed = {.name = "resumed"};
+  bool ok = true;
+  for (int i = 0; i < rounds && ok; i++) {
+    esp_mqtt_client_config_t config;
+    esp_mqtt_client_default_config(&config);
+    config.status_callback = bench_status;
+    config.buffer_size = 1024;
+    esp_mqtt_client_t *client = esp_mqtt_client_create(&config);
+    ok = client != NULL && esp_mqtt_client_tls(client, true, true, (const uint8_t *)mbedtls_test_ca_crt_ec_pem,
+                                               mbedtls_test_ca_crt_ec_pem_len);
+    ok = ok && bench_connect(client, port_str, &full, i) && bench_connect(client, port_str, &resumed, i);
+    esp_mqtt_client_destroy(client);
+  }
+  if (!ok) {
+    fprintf(stderr, "client failed\n");
+    return 1;
+  }
+
+  // every restart resumed, faster and smaller than a full handshake
+  vTaskDelay(100 / portTICK_PERIOD_MS);
+  printf("handshake handshake ms connect ms   peak B resumptions\n");
+  bench_print(&full, rounds);
+  bench_print(&resumed, rounds);
+  mqtt_tls_server_stats_t stats;
+  mqtt_tls_server_stats(&stats);
+  ok = full.resumptions == 0 && resumed.resumptions == (uint32_t)rounds &&
+       resumed.connect[rounds / 2] < full.connect[rounds / 2] && resumed.heap[rounds - 1] < full.heap[rounds - 1] &&
+       stats.handshakes == (uint32_t)rounds * 2 && stats.failures == 0 && stats.broker.connects == (uint32_t)rounds * 2;
+  printf("server handshakes %u failures %u broker connects %u %s\n", stats.handshakes, stats.failures,
+         stats.broker.connects, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
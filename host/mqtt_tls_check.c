@@ -0,0 +1,94 @@
+// Publishes 27 KB pictures over TLS and checks the records and the heap with and without a TLS buffer budget.
+//
+// lwmqtt sends the payload of a publish from the memory of the caller, so the heap may not grow by a picture while it
+// is sent. With CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET the client has to negotiate a max_fragment_length whose in and out
+// records fit into the budget and the server may not receive a larger record, without it the records take the
+// default 16 KB. The table shows the peak heap of the connect and of the publishes above the level before them. Build
+// it once as is and once with -DCONFIG_ESP_MQTT_TLS_BUFFER_BUDGET=10240 to compare both.
+//
+// usage: mqtt_tls_check [pictures]
+
+#include <mbedtls/certs.h>
+#include <mbedtls/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_heap_caps.h"
+#include "esp_mqtt.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_tls_server.h"
+
+static volatile bool check_connected;
+static uint8_t check_payload[27000];
+
+static void check_status(esp_mqtt_client_t *client, esp_mqtt_status_t status) {
+  check_connected = status == ESP_MQTT_STATUS_CONNECTED;
+}
+
+int main(int argc, char **argv) {
+  int pictures = argc > 1 ? atoi(argv[1]) : 5;
+
+  // the server is forked before the first task
+  uint16_t port = mqtt_tls_server_start(0);
+  if (port == 0) {
+    fprintf(stderr, "server failed\n");
+    return 1;
+  }
+  char port_str[8];
+  snprintf(port_str, sizeof(port_str), "%u", port);
+
+  // connect with the buffers of the doorbell
+  esp_mqtt_client_config_t config;
+  esp_mqtt_client_default_config(&config);
+  config.status_callback = check_status;
+  config.buffer_size = 2048;
+  config.command_timeout = 5000;
+  esp_mqtt_client_t *client = esp_mqtt_client_create(&config);
+  if (client == NULL || !esp_mqtt_client_tls(client, true, true, (const uint8_t *)mbedtls_test_ca_crt_ec_pem,
+                                             mbedtls_test_ca_crt_ec_pem_len)) {
+    fprintf(stderr, "client failed\n");
+    return 1;
+  }
+  size_t before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_start();
+  bool ok = esp_mqtt_client_start(client, "localhost", port_str, "tls-check", NULL, NULL, 30, true);
+  for (int wait = 0; ok && !check_connected; wait++) {
+    ok = wait < 500;
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+  size_t connect_peak = before - heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  if (!ok) {
+    fprintf(stderr, "client did not connect\n");
+    return 1;
+  }
+
+  // publish the pictures, each one acknowledged by the broker
+  before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_start();
+  size_t failed = 0;
+  for (int i = 0; i < pictures; i++) {
+    failed += !esp_mqtt_client_publish(client, "doorbell/picture", check_payload, sizeof(check_payload), 1, false);
+  }
+  size_t publish_peak = before - heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap_caps_monitor_local_minimum_free_size_stop();
+  vTaskDelay(100 / portTICK_PERIOD_MS);
+  mqtt_tls_server_stats_t stats;
+  mqtt_tls_server_stats(&stats);
+  esp_mqtt_client_destroy(client);
+
+  // the records follow the budget, the pictures are not copied
+  size_t budget = CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET;
+  ok = failed == 0 && stats.broker.publishes == (uint32_t)pictures && stats.record <= stats.fragment &&
+       publish_peak < sizeof(check_payload);
+  if (budget > 0) {
+    ok = ok && stats.fragment <= budget / 2;
+  } else {
+    ok = ok && stats.fragment >= MBEDTLS_SSL_IN_CONTENT_LEN;
+  }
+  printf("budget fragment record connect peak B publish peak B publishes failed\n");
+  printf("%6zu %8u %6u %14zu %14zu %9u %6zu %s\n", budget, stats.fragment, stats.record, connect_peak, publish_peak,
+         stats.broker.publishes, failed, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
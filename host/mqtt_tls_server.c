@@ -0,0 +1,274 @@
+#include <arpa/inet.h>
+#include <mbedtls/certs.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_ticket.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mqtt_tls_server.h"
+
+#define MQTT_TLS_SERVER_BUFFER 16384
+
+// the counters live in memory shared with the child
+typedef struct {
+  pthread_mutex_t mutex;
+  mqtt_tls_server_stats_t stats;
+} mqtt_tls_server_shared_t;
+
+static struct {
+  mqtt_tls_server_shared_t *shared;
+  char broker_port[8];
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_x509_crt cert;
+  mbedtls_pk_context key;
+  mbedtls_ssl_ticket_context ticket;
+  mbedtls_ssl_config conf;
+  mbedtls_net_context listener;
+  uint8_t buf[MQTT_TLS_SERVER_BUFFER];
+} mqtt_tls_server;
+
+static void mqtt_tls_server_update(uint16_t broker_port, uint32_t record) {
+  // copy the counters of the broker next to the own ones
+  mqtt_tls_server_shared_t *shared = mqtt_tls_server.shared;
+  pthread_mutex_lock(&shared->mutex);
+  mqtt_broker_stats(broker_port, &shared->stats.broker);
+  if (record > shared->stats.record) {
+    shared->stats.record = record;
+  }
+  pthread_mutex_unlock(&shared->mutex);
+}
+
+static bool mqtt_tls_server_write(mbedtls_ssl_context *ssl, const uint8_t *buf, size_t len) {
+  // a write sends at most one record
+  while (len > 0) {
+    int ret = mbedtls_ssl_write(ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      continue;
+    } else if (ret <= 0) {
+      return false;
+    }
+    buf += ret;
+    len -= (size_t)ret;
+  }
+  return true;
+}
+
+static bool mqtt_tls_server_send(int fd, const uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+static void mqtt_tls_server_serve(mbedtls_net_context *client, uint16_t broker_port) {
+  // perform the handshake
+  mqtt_tls_server_shared_t *shared = mqtt_tls_server.shared;
+  mbedtls_ssl_context ssl;
+  mbedtls_net_context broker;
+  mbedtls_ssl_init(&ssl);
+  mbedtls_net_init(&broker);
+  int ret = mbedtls_ssl_setup(&ssl, &mqtt_tls_server.conf);
+  if (ret == 0) {
+    mbedtls_ssl_set_bio(&ssl, client, mbedtls_net_send, mbedtls_net_recv, NULL);
+    do {
+      ret = mbedtls_ssl_handshake(&ssl);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+  }
+  pthread_mutex_lock(&shared->mutex);
+  if (ret == 0) {
+    shared->stats.handshakes++;
+    shared->stats.fragment = (uint32_t)mbedtls_ssl_get_input_max_frag_len(&ssl);
+  } else {
+    shared->stats.failures++;
+  }
+  pthread_mutex_unlock(&shared->mutex);
+  if (ret != 0 || mbedtls_net_connect(&broker, "127.0.0.1", mqtt_tls_server.broker_port, MBEDTLS_NET_PROTO_TCP) != 0) {
+    goto done;
+  }
+
+  // forward the decrypted stream both ways until one side closes
+  uint8_t *buf = mqtt_tls_server.buf;
+  for (;;) {
+    // decrypted bytes of a record may wait without the socket being readable
+    if (mbedtls_ssl_get_bytes_avail(&ssl) == 0) {
+      struct pollfd fds[2] = {{.fd = client->fd, .events = POLLIN}, {.fd = broker.fd, .events = POLLIN}};
+      if (poll(fds, 2, -1) < 0) {
+        break;
+      }
+      if (fds[1].revents != 0) {
+        ssize_t n = recv(broker.fd, buf, MQTT_TLS_SERVER_BUFFER, 0);
+        mqtt_tls_server_update(broker_port, 0);
+        if (n <= 0 || !mqtt_tls_server_write(&ssl, buf, (size_t)n)) {
+          break;
+        }
+      }
+      if (fds[0].revents == 0) {
+        continue;
+      }
+    }
+
+    // a read returns the content of at most one record
+    ret = mbedtls_ssl_read(&ssl, buf, MQTT_TLS_SERVER_BUFFER);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+      continue;
+    } else if (ret <= 0 || !mqtt_tls_server_send(broker.fd, buf, (size_t)ret)) {
+      break;
+    }
+    mqtt_tls_server_update(broker_port, (uint32_t)ret);
+  }
+
+done:
+  mbedtls_ssl_close_notify(&ssl);
+  mbedtls_ssl_free(&ssl);
+  mbedtls_net_free(&broker);
+  mqtt_tls_server_update(broker_port, 0);
+}
+
+static int mqtt_tls_server_prepare() {
+  // seed the random generator
+  mbedtls_entropy_init(&mqtt_tls_server.entropy);
+  mbedtls_ctr_drbg_init(&mqtt_tls_server.ctr_drbg);
+  mbedtls_x509_crt_init(&mqtt_tls_server.cert);
+  mbedtls_pk_init(&mqtt_tls_server.key);
+  mbedtls_ssl_ticket_init(&mqtt_tls_server.ticket);
+  mbedtls_ssl_config_init(&mqtt_tls_server.conf);
+  int ret = mbedtls_ctr_drbg_seed(&mqtt_tls_server.ctr_drbg, mbedtls_entropy_func, &mqtt_tls_server.entropy, NULL, 0);
+  if (ret != 0) {
+    return ret;
+  }
+
+  // parse the test certificate and key for localhost
+  ret = mbedtls_x509_crt_parse(&mqtt_tls_server.cert, (const unsigned char *)mbedtls_test_srv_crt_ec_pem,
+                               mbedtls_test_srv_crt_ec_pem_len);
+  if (ret != 0) {
+    return ret;
+  }
+  ret = mbedtls_pk_parse_key(&mqtt_tls_server.key, (const unsigned char *)mbedtls_test_srv_key_ec_pem,
+                             mbedtls_test_srv_key_ec_pem_len, NULL, 0);
+  if (ret != 0) {
+    return ret;
+  }
+
+  // configure a server that issues session tickets
+  ret = mbedtls_ssl_config_defaults(&mqtt_tls_server.conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret != 0) {
+    return ret;
+  }
+  mbedtls_ssl_conf_rng(&mqtt_tls_server.conf, mbedtls_ctr_drbg_random, &mqtt_tls_server.ctr_drbg);
+  ret = mbedtls_ssl_conf_own_cert(&mqtt_tls_server.conf, &mqtt_tls_server.cert, &mqtt_tls_server.key);
+  if (ret != 0) {
+    return ret;
+  }
+  ret = mbedtls_ssl_ticket_setup(&mqtt_tls_server.ticket, mbedtls_ctr_drbg_random, &mqtt_tls_server.ctr_drbg,
+                                 MBEDTLS_CIPHER_AES_256_GCM, 86400);
+  if (ret != 0) {
+    return ret;
+  }
+  mbedtls_ssl_conf_session_tickets_cb(&mqtt_tls_server.conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse,
+                                      &mqtt_tls_server.ticket);
+
+  // listen on a free loopback port
+  mbedtls_net_init(&mqtt_tls_server.listener);
+  return mbedtls_net_bind(&mqtt_tls_server.listener, "127.0.0.1", "0", MBEDTLS_NET_PROTO_TCP);
+}
+
+static void mqtt_tls_server_run(uint32_t ack_delay_us, int pipe_fd) {
+  // start the broker and the server
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  uint16_t broker_port = mqtt_broker_start(ack_delay_us);
+  snprintf(mqtt_tls_server.broker_port, sizeof(mqtt_tls_server.broker_port), "%u", broker_port);
+  uint16_t port = 0;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  if (broker_port != 0 && mqtt_tls_server_prepare() == 0 &&
+      getsockname(mqtt_tls_server.listener.fd, (struct sockaddr *)&addr, &addr_len) == 0) {
+    port = ntohs(addr.sin_port);
+  }
+
+  // report the port, zero if the server failed
+  ssize_t written = write(pipe_fd, &port, sizeof(port));
+  close(pipe_fd);
+  if (port == 0 || written != sizeof(port)) {
+    _exit(1);
+  }
+
+  // serve one connection at a time
+  for (;;) {
+    mbedtls_net_context client;
+    mbedtls_net_init(&client);
+    if (mbedtls_net_accept(&mqtt_tls_server.listener, &client, NULL, 0, NULL) != 0) {
+      _exit(1);
+    }
+    pthread_mutex_lock(&mqtt_tls_server.shared->mutex);
+    mqtt_tls_server.shared->stats.connections++;
+    pthread_mutex_unlock(&mqtt_tls_server.shared->mutex);
+    mqtt_tls_server_serve(&client, broker_port);
+    mbedtls_net_free(&client);
+  }
+}
+
+uint16_t mqtt_tls_server_start(uint32_t ack_delay_us) {
+  // share the counters with the child
+  mqtt_tls_server.shared =
+      mmap(NULL, sizeof(mqtt_tls_server_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mqtt_tls_server.shared == MAP_FAILED) {
+    mqtt_tls_server.shared = NULL;
+    return 0;
+  }
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&mqtt_tls_server.shared->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  // run the server in a child that reports its port
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return 0;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+  } else if (pid == 0) {
+    close(fds[0]);
+    mqtt_tls_server_run(ack_delay_us, fds[1]);
+  }
+  close(fds[1]);
+  uint16_t port = 0;
+  if (read(fds[0], &port, sizeof(port)) != sizeof(port)) {
+    port = 0;
+  }
+  close(fds[0]);
+
+  return port;
+}
+
+void mqtt_tls_server_stats(mqtt_tls_server_stats_t *stats) {
+  *stats = (mqtt_tls_server_stats_t){0};
+  if (mqtt_tls_server.shared == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&mqtt_tls_server.shared->mutex);
+  *stats = mqtt_tls_server.shared->stats;
+  pthread_mutex_unlock(&mqtt_tls_server.shared->mutex);
+}
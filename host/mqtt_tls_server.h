@@ -0,0 +1,40 @@
+#ifndef MQTT_TLS_SERVER_H
+#define MQTT_TLS_SERVER_H
+
+#include <stdint.h>
+
+#include "mqtt_broker.h"
+
+/**
+ * The counters of the loopback TLS server.
+ */
+typedef struct {
+  uint32_t connections;        // accepted connections
+  uint32_t handshakes;         // completed handshakes
+  uint32_t failures;           // failed handshakes
+  uint32_t fragment;           // max fragment length negotiated by the last handshake
+  uint32_t record;             // largest record received from a client in bytes of content
+  mqtt_broker_stats_t broker;  // the counters of the broker behind the server
+} mqtt_tls_server_stats_t;
+
+/**
+ * Start a loopback broker behind an mbedTLS server in a child process, so its memory is not counted in the heap of
+ * the client. Must be called before any task or thread is started.
+ *
+ * The server presents the EC test certificate of mbedTLS for localhost, which `mbedtls_test_ca_crt_ec_pem` verifies,
+ * issues session tickets, honors max_fragment_length and forwards the decrypted stream of one connection at a time to
+ * the broker. The child is killed when the parent exits.
+ *
+ * @param ack_delay_us - The delay before each PUBACK of the broker.
+ * @return The port or zero if the server could not be started.
+ */
+uint16_t mqtt_tls_server_start(uint32_t ack_delay_us);
+
+/**
+ * Get the counters of the server and its broker.
+ *
+ * @param stats - The counters.
+ */
+void mqtt_tls_server_stats(mqtt_tls_server_stats_t *stats);
+
+#endif  // MQTT_TLS_SERVER_H
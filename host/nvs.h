@@ -0,0 +1,51 @@
+#ifndef NVS_POSIX_H
+#define NVS_POSIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+
+/**
+ * The file holding the stored values, relative to the working directory. Delete it to start with an erased flash.
+ */
+#define NVS_POSIX_FILE "nvs.bin"
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+  NVS_READONLY,
+  NVS_READWRITE,
+} nvs_open_mode;
+
+/**
+ * Open a namespace. Read only namespaces must have been written before.
+ */
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+
+/**
+ * Read a blob. The length is updated to the stored length and the blob is not copied if it does not fit.
+ */
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+
+/**
+ * Write a blob. The file is rewritten immediately.
+ */
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+
+/**
+ * Commit written values. Nothing to do on the host.
+ */
+esp_err_t nvs_commit(nvs_handle handle);
+
+/**
+ * Close a namespace.
+ */
+void nvs_close(nvs_handle handle);
+
+#endif  // NVS_POSIX_H
@@ -0,0 +1,11 @@
+#ifndef NVS_FLASH_POSIX_H
+#define NVS_FLASH_POSIX_H
+
+#include "nvs.h"
+
+/**
+ * Initialize the storage. Nothing to do on the host.
+ */
+esp_err_t nvs_flash_init(void);
+
+#endif  // NVS_FLASH_POSIX_H
@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nvs_flash.h"
+
+#define NVS_POSIX_HANDLES 8
+#define NVS_POSIX_NAME 16  // length of namespaces and keys including the terminator
+
+// a record in the file is the namespace, the key, the length and the blob
+typedef struct {
+  char ns[NVS_POSIX_NAME];
+  char key[NVS_POSIX_NAME];
+  uint32_t length;
+} nvs_posix_record_t;
+
+static struct {
+  pthread_mutex_t mutex;
+  char ns[NVS_POSIX_HANDLES][NVS_POSIX_NAME];
+  bool writable[NVS_POSIX_HANDLES];
+} nvs_posix = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void nvs_posix_name(char *dst, const char *src) {
+  // copy and pad name
+  memset(dst, 0, NVS_POSIX_NAME);
+  strncpy(dst, src, NVS_POSIX_NAME - 1);
+}
+
+static const char *nvs_posix_namespace(nvs_handle handle) {
+  // handles are the slot plus one
+  if (handle == 0 || handle > NVS_POSIX_HANDLES || nvs_posix.ns[handle - 1][0] == 0) {
+    return NULL;
+  }
+
+  return nvs_posix.ns[handle - 1];
+}
+
+static long nvs_posix_find(FILE *file, const char *ns, const char *key, nvs_posix_record_t *record) {
+  // walk records from the start, a null key matches any key of the namespace
+  rewind(file);
+  for (;;) {
+    long pos = ftell(file);
+    if (fread(record, sizeof(*record), 1, file) != 1) {
+      return -1;
+    }
+    if (strncmp(record->ns, ns, NVS_POSIX_NAME) == 0 && (key == NULL || strncmp(record->key, key, NVS_POSIX_NAME) == 0)) {
+      return pos;
+    }
+    if (fseek(file, record->length, SEEK_CUR) != 0) {
+      return -1;
+    }
+  }
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle) {
+  // read only namespaces must exist
+  char ns[NVS_POSIX_NAME];
+  nvs_posix_name(ns, name);
+  if (open_mode == NVS_READONLY) {
+    FILE *file = fopen(NVS_POSIX_FILE, "rb");
+    nvs_posix_record_t record;
+    bool found = file != NULL && nvs_posix_find(file, ns, NULL, &record) >= 0;
+    if (file != NULL) {
+      fclose(file);
+    }
+    if (!found) {
+      return ESP_ERR_NVS_NOT_FOUND;
+    }
+  }
+
+  // take a free slot
+  pthread_mutex_lock(&nvs_posix.mutex);
+  for (nvs_handle i = 0; i < NVS_POSIX_HANDLES; i++) {
+    if (nvs_posix.ns[i][0] == 0) {
+      memcpy(nvs_posix.ns[i], ns, NVS_POSIX_NAME);
+      nvs_posix.writable[i] = open_mode == NVS_READWRITE;
+      pthread_mutex_unlock(&nvs_posix.mutex);
+      *out_handle = i + 1;
+      return ESP_OK;
+    }
+  }
+  pthread_mutex_unlock(&nvs_posix.mutex);
+
+  return ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length) {
+  // check handle
+  const char *ns = nvs_posix_namespace(handle);
+  if (ns == NULL) {
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+
+  // find record
+  char name[NVS_POSIX_NAME];
+  nvs_posix_name(name, key);
+  FILE *file = fopen(NVS_POSIX_FILE, "rb");
+  if (file == NULL) {
+    return ESP_ERR_NVS_NOT_FOUND;
+  }
+  nvs_posix_record_t record;
+  esp_err_t err = ESP_OK;
+  if (nvs_posix_find(file, ns, name, &record) < 0) {
+    err = ESP_ERR_NVS_NOT_FOUND;
+  } else if (out_value != NULL && *length < record.length) {
+    err = ESP_ERR_NVS_INVALID_LENGTH;
+  } else if (out_value != NULL && fread(out_value, 1, record.length, file) != record.length) {
+    err = ESP_FAIL;
+  }
+  if (err == ESP_OK || err == ESP_ERR_NVS_INVALID_LENGTH) {
+    *length = record.length;
+  }
+  fclose(file);
+
+  return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length) {
+  // check handle
+  const char *ns = nvs_posix_namespace(handle);
+  if (ns == NULL || !nvs_posix.writable[handle - 1]) {
+    return ESP_ERR_NVS_INVALID_HANDLE;
+  }
+
+  // read the other records
+  char name[NVS_POSIX_NAME];
+  nvs_posix_name(name, key);
+  size_t size = 0;
+  char *data = NULL;
+  FILE *file = fopen(NVS_POSIX_FILE, "rb");
+  if (file != NULL) {
+    nvs_posix_record_t record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+      char *next = realloc(data, size + sizeof(record) + record.length);
+      if (next == NULL) {
+        free(data);
+        fclose(file);
+        return ESP_ERR_NO_MEM;
+      }
+      data = next;
+      memcpy(data + size, &record, sizeof(record));
+      if (fread(data + size + sizeof(record), 1, record.length, file) != record.length) {
+        break;
+      }
+      if (strncmp(record.ns, ns, NVS_POSIX_NAME) != 0 || strncmp(record.key, name, NVS_POSIX_NAME) != 0) {
+        size += sizeof(record) + record.length;
+      }
+    }
+    fclose(file);
+  }
+
+  // write them back followed by the new record
+  nvs_posix_record_t record = {.length = (uint32_t)length};
+  memcpy(record.ns, ns, NVS_POSIX_NAME);
+  memcpy(record.key, name, NVS_POSIX_NAME);
+  file = fopen(NVS_POSIX_FILE, "wb");
+  bool ok = file != NULL && fwrite(data, 1, size, file) == size && fwrite(&record, sizeof(record), 1, file) == 1 &&
+            fwrite(value, 1, length, file) == length;
+  if (file != NULL) {
+    fclose(file);
+  }
+  free(data);
+
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) { return nvs_posix_namespace(handle) != NULL ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE; }
+
+void nvs_close(nvs_handle handle) {
+  // free slot
+  pthread_mutex_lock(&nvs_posix.mutex);
+  if (nvs_posix_namespace(handle) != NULL) {
+    nvs_posix.ns[handle - 1][0] = 0;
+  }
+  pthread_mutex_unlock(&nvs_posix.mutex);
+}
@@ -0,0 +1,20 @@
+#ifndef LLDESC_POSIX_H
+#define LLDESC_POSIX_H
+
+#include <stdint.h>
+
+/**
+ * A DMA descriptor. The bit fields match the device, the link is a full pointer.
+ */
+typedef struct lldesc_s {
+  volatile uint32_t size : 12, length : 12, offset : 5, sosf : 1, eof : 1, owner : 1;
+  volatile uint8_t *buf;
+  union {
+    volatile uint32_t empty;
+    struct {
+      struct lldesc_s *stqe_next;
+    } qe;
+  };
+} lldesc_t;
+
+#endif  // LLDESC_POSIX_H
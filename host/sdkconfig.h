@@ -0,0 +1,6 @@
+#ifndef SDKCONFIG_POSIX_H
+#define SDKCONFIG_POSIX_H
+
+#include "exlibconfig.h"
+
+#endif  // SDKCONFIG_POSIX_H
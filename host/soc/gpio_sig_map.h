@@ -0,0 +1,18 @@
+#ifndef SOC_GPIO_SIG_MAP_POSIX_H
+#define SOC_GPIO_SIG_MAP_POSIX_H
+
+#define I2S0I_DATA_IN0_IDX 140
+#define I2S0I_DATA_IN1_IDX 141
+#define I2S0I_DATA_IN2_IDX 142
+#define I2S0I_DATA_IN3_IDX 143
+#define I2S0I_DATA_IN4_IDX 144
+#define I2S0I_DATA_IN5_IDX 145
+#define I2S0I_DATA_IN6_IDX 146
+#define I2S0I_DATA_IN7_IDX 147
+#define I2S0I_BCK_IN_IDX 15
+#define I2S0I_WS_IN_IDX 16
+#define I2S0I_V_SYNC_IDX 190
+#define I2S0I_H_SYNC_IDX 191
+#define I2S0I_H_ENABLE_IDX 192
+
+#endif  // SOC_GPIO_SIG_MAP_POSIX_H
@@ -0,0 +1,31 @@
+#ifndef SOC_GPIO_STRUCT_POSIX_H
+#define SOC_GPIO_STRUCT_POSIX_H
+
+#include <stdint.h>
+
+/**
+ * The subset of the GPIO registers used by the camera driver.
+ */
+typedef volatile struct {
+  uint32_t in;
+  union {
+    struct {
+      uint32_t data : 8;
+      uint32_t reserved8 : 24;
+    };
+    uint32_t val;
+  } in1;
+  uint32_t status;
+  uint32_t status_w1tc;
+  union {
+    struct {
+      uint32_t intr_st : 8;
+      uint32_t reserved8 : 24;
+    };
+    uint32_t val;
+  } status1, status1_w1tc;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+
+#endif  // SOC_GPIO_STRUCT_POSIX_H
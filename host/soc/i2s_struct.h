@@ -0,0 +1,125 @@
+#ifndef SOC_I2S_STRUCT_POSIX_H
+#define SOC_I2S_STRUCT_POSIX_H
+
+#include <stdint.h>
+
+/**
+ * The subset of the I2S registers used by the camera driver. The DMA link address is a full pointer.
+ */
+typedef volatile struct {
+  union {
+    struct {
+      uint32_t tx_reset : 1;
+      uint32_t rx_reset : 1;
+      uint32_t tx_fifo_reset : 1;
+      uint32_t rx_fifo_reset : 1;
+      uint32_t tx_start : 1;
+      uint32_t rx_start : 1;
+      uint32_t tx_slave_mod : 1;
+      uint32_t rx_slave_mod : 1;
+      uint32_t tx_right_first : 1;
+      uint32_t rx_right_first : 1;
+      uint32_t tx_msb_shift : 1;
+      uint32_t rx_msb_shift : 1;
+      uint32_t tx_short_sync : 1;
+      uint32_t rx_short_sync : 1;
+      uint32_t tx_mono : 1;
+      uint32_t rx_mono : 1;
+      uint32_t tx_msb_right : 1;
+      uint32_t rx_msb_right : 1;
+      uint32_t reserved18 : 14;
+    };
+    uint32_t val;
+  } conf;
+  union {
+    struct {
+      uint32_t rx_take_data : 1;
+      uint32_t tx_put_data : 1;
+      uint32_t reserved2 : 6;
+      uint32_t in_done : 1;
+      uint32_t in_suc_eof : 1;
+      uint32_t reserved10 : 22;
+    };
+    uint32_t val;
+  } int_raw, int_ena, int_clr;
+  union {
+    struct {
+      uint32_t camera_en : 1;
+      uint32_t reserved1 : 4;
+      uint32_t lcd_en : 1;
+      uint32_t reserved6 : 26;
+    };
+    uint32_t val;
+  } conf2;
+  union {
+    struct {
+      uint32_t rx_dsync_sw : 1;
+      uint32_t reserved1 : 31;
+    };
+    uint32_t val;
+  } timing;
+  union {
+    struct {
+      uint32_t rx_data_num : 6;
+      uint32_t tx_data_num : 6;
+      uint32_t dscr_en : 1;
+      uint32_t tx_fifo_mod : 3;
+      uint32_t rx_fifo_mod : 3;
+      uint32_t tx_fifo_mod_force_en : 1;
+      uint32_t rx_fifo_mod_force_en : 1;
+      uint32_t reserved21 : 11;
+    };
+    uint32_t val;
+  } fifo_conf;
+  uint32_t rx_eof_num;
+  union {
+    struct {
+      uint32_t tx_chan_mod : 3;
+      uint32_t rx_chan_mod : 2;
+      uint32_t reserved5 : 27;
+    };
+    uint32_t val;
+  } conf_chan;
+  struct {
+    uintptr_t addr;
+    uint32_t stop;
+    uint32_t start;
+  } in_link;
+  union {
+    struct {
+      uint32_t in_rst : 1;
+      uint32_t out_rst : 1;
+      uint32_t ahbm_fifo_rst : 1;
+      uint32_t ahbm_rst : 1;
+      uint32_t reserved4 : 28;
+    };
+    uint32_t val;
+  } lc_conf;
+  union {
+    struct {
+      uint32_t clkm_div_num : 8;
+      uint32_t clkm_div_b : 6;
+      uint32_t clkm_div_a : 6;
+      uint32_t reserved20 : 12;
+    };
+    uint32_t val;
+  } clkm_conf;
+  union {
+    struct {
+      uint32_t tx_bck_div_num : 6;
+      uint32_t rx_bck_div_num : 6;
+      uint32_t tx_bits_mod : 6;
+      uint32_t rx_bits_mod : 6;
+      uint32_t reserved24 : 8;
+    };
+    uint32_t val;
+  } sample_rate_conf;
+  struct {
+    uint32_t tx_fifo_reset_back : 1;
+    uint32_t rx_fifo_reset_back : 1;
+  } state;
+} i2s_dev_t;
+
+extern i2s_dev_t I2S0;
+
+#endif  // SOC_I2S_STRUCT_POSIX_H
@@ -0,0 +1,4 @@
+#ifndef SOC_IO_MUX_REG_POSIX_H
+#define SOC_IO_MUX_REG_POSIX_H
+
+#endif  // SOC_IO_MUX_REG_POSIX_H
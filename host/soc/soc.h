@@ -0,0 +1,6 @@
+#ifndef SOC_POSIX_H
+#define SOC_POSIX_H
+
+#include "esp_attr.h"
+
+#endif  // SOC_POSIX_H
@@ -22,32 +22,61 @@ int32_t esp_lwmqtt_timer_get(void *ref) {
   return (int32_t)t->deadline - (int32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
 }
 
-lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *host, char *port) {
-  // disconnect if not already the case
-  esp_lwmqtt_network_disconnect(network);
+static uint32_t esp_lwmqtt_millis() {
+  return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static bool esp_lwmqtt_network_resolve(esp_lwmqtt_network_t *network, char *host, char *port) {
+  // use cached address if still valid
+  if (network->dns_cached && (int32_t)(network->dns_deadline - esp_lwmqtt_millis()) > 0) {
+    network->dns_hits++;
+    return true;
+  }
 
   // prepare hints
   struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
 
   // lookup ip address (there is no way to configure a timeout)
+  network->dns_misses++;
+  network->dns_cached = false;
   struct addrinfo *res;
   int r = lwip_getaddrinfo(host, port, &hints, &res);
   if (r != 0 || res == NULL) {
+    return false;
+  }
+
+  // cache address
+  memcpy(&network->dns_addr, res->ai_addr, sizeof(network->dns_addr));
+  network->dns_deadline = esp_lwmqtt_millis() + network->dns_ttl;
+  network->dns_cached = network->dns_ttl > 0;
+
+  // free address
+  lwip_freeaddrinfo(res);
+
+  return true;
+}
+
+lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *host, char *port) {
+  // disconnect if not already the case
+  esp_lwmqtt_network_disconnect(network);
+
+  // resolve or reuse address
+  if (!esp_lwmqtt_network_resolve(network, host, port)) {
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
   // create socket
-  network->socket = lwip_socket(res->ai_family, res->ai_socktype, 0);
+  network->socket = lwip_socket(AF_INET, SOCK_STREAM, 0);
   if (network->socket < 0) {
-    lwip_freeaddrinfo(res);
+    network->socket = 0;
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
   // disable nagle's algorithm
   int flag = 1;
-  r = lwip_setsockopt_r(network->socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+  int r = lwip_setsockopt_r(network->socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
   if (r < 0) {
-    lwip_close_r(network->socket);
+    esp_lwmqtt_network_disconnect(network);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
@@ -55,25 +84,26 @@ lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *hos
   int flags = lwip_fcntl_r(network->socket, F_GETFL, 0);
   r = lwip_fcntl_r(network->socket, F_SETFL, flags | O_NONBLOCK);
   if (r < 0) {
-    lwip_close_r(network->socket);
-    lwip_freeaddrinfo(res);
+    esp_lwmqtt_network_disconnect(network);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
   // connect socket
-  r = lwip_connect_r(network->socket, res->ai_addr, res->ai_addrlen);
+  r = lwip_connect_r(network->socket, (struct sockaddr *)&network->dns_addr, sizeof(network->dns_addr));
   if (r < 0 && errno != EINPROGRESS) {
-    lwip_close_r(network->socket);
-    lwip_freeaddrinfo(res);
+    esp_lwmqtt_network_disconnect(network);
+    esp_lwmqtt_network_flush(network);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
-  // free address
-  lwip_freeaddrinfo(res);
-
   return LWMQTT_SUCCESS;
 }
 
+void esp_lwmqtt_network_flush(esp_lwmqtt_network_t *network) {
+  // invalidate cached address
+  network->dns_cached = false;
+}
+
 lwmqtt_err_t esp_lwmqtt_network_wait(esp_lwmqtt_network_t *network, bool *connected, uint32_t timeout) {
   // prepare set
   fd_set set;
@@ -84,18 +114,31 @@ lwmqtt_err_t esp_lwmqtt_network_wait(esp_lwmqtt_network_t *network, bool *connec
   struct timeval t = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
   int result = lwip_select(network->socket + 1, NULL, &set, NULL, &t);
   if (result < 0) {
-    lwip_close_r(network->socket);
+    esp_lwmqtt_network_disconnect(network);
+    esp_lwmqtt_network_flush(network);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
-  // set whether socket is connected
+  // a refused connection also becomes writable, check the pending error
+  if (result > 0) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (lwip_getsockopt_r(network->socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+      result = 0;
+    }
+  }
+
+  // set whether socket is connected and resolve again next time if not
   *connected = result > 0;
+  if (!*connected) {
+    esp_lwmqtt_network_flush(network);
+  }
 
   // set socket to blocking
   int flags = lwip_fcntl_r(network->socket, F_GETFL, 0);
   int r = lwip_fcntl_r(network->socket, F_SETFL, flags & (~O_NONBLOCK));
   if (r < 0) {
-    lwip_close_r(network->socket);
+    esp_lwmqtt_network_disconnect(network);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
@@ -1,6 +1,7 @@
 #ifndef ESP_LWMQTT_H
 #define ESP_LWMQTT_H
 
+#include <lwip/sockets.h>
 #include <lwmqtt.h>
 
 /**
@@ -25,13 +26,27 @@ int32_t esp_lwmqtt_timer_get(void *ref);
  */
 typedef struct {
   int socket;
+  uint32_t dns_ttl;
+  bool dns_cached;
+  uint32_t dns_deadline;
+  struct sockaddr_in dns_addr;
+  uint32_t dns_hits;
+  uint32_t dns_misses;
 } esp_lwmqtt_network_t;
 
 /**
  * Initiate a connection to the specified remote hose.
+ *
+ * The resolved address is cached for dns_ttl milliseconds (0 disables the cache) and dropped when a connection attempt
+ * fails.
  */
 lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *host, char *port);
 
+/**
+ * Drop the cached address so that the next connection attempt resolves the host again.
+ */
+void esp_lwmqtt_network_flush(esp_lwmqtt_network_t *network);
+
 /**
  * Wait until the socket is connected or a timeout has been reached.
  */
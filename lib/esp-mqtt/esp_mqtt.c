@@ -1,4 +1,5 @@
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
@@ -16,125 +17,563 @@
 #include "exlibconfig.h"
 #define ESP_MQTT_LOG_TAG "esp_mqtt"
 
-static SemaphoreHandle_t esp_mqtt_main_mutex = NULL;
-
-#define ESP_MQTT_LOCK_MAIN() \
-    do {                     \
-    } while (xSemaphoreTake(esp_mqtt_main_mutex, portMAX_DELAY) != pdPASS)
-
-#define ESP_MQTT_UNLOCK_MAIN() xSemaphoreGive(esp_mqtt_main_mutex)
+#if defined(CONFIG_ESP_MQTT_TLS_ENABLE) && CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET > 0 && \
+    (CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN > CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET)
+#warning "mbedTLS record buffers exceed CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET, reduce CONFIG_MBEDTLS_SSL_IN/OUT_CONTENT_LEN"
+#endif
 
-static SemaphoreHandle_t esp_mqtt_select_mutex = NULL;
+#if defined(ESP_PLATFORM)
+#include <esp_system.h>
+#define ESP_MQTT_RANDOM() esp_random()
+#else
+#define ESP_MQTT_RANDOM() ((uint32_t)rand())
+#endif
 
-#define ESP_MQTT_LOCK_SELECT() \
-    do {                       \
-    } while (xSemaphoreTake(esp_mqtt_select_mutex, portMAX_DELAY) != pdPASS)
+#define ESP_MQTT_LOCK_MAIN(c) \
+    do {                      \
+    } while (xSemaphoreTake((c)->main_mutex, portMAX_DELAY) != pdPASS)
 
-#define ESP_MQTT_UNLOCK_SELECT() xSemaphoreGive(esp_mqtt_select_mutex)
+#define ESP_MQTT_UNLOCK_MAIN(c) xSemaphoreGive((c)->main_mutex)
 
-static TaskHandle_t esp_mqtt_task = NULL;
+#define ESP_MQTT_LOCK_SELECT(c) \
+    do {                        \
+    } while (xSemaphoreTake((c)->select_mutex, portMAX_DELAY) != pdPASS)
 
-static size_t esp_mqtt_buffer_size;
-static uint32_t esp_mqtt_command_timeout;
+#define ESP_MQTT_UNLOCK_SELECT(c) xSemaphoreGive((c)->select_mutex)
 
-static struct {
-    char* host;
-    char* port;
-    char* client_id;
-    char* username;
-    char* password;
-} esp_mqtt_config = {0};
+// the write time that is accumulated for one throughput sample
+#define ESP_MQTT_THROUGHPUT_WINDOW 20000  // us
 
-static struct {
-    char* topic;
-    char* payload;
-    int qos;
-    bool retained;
-} esp_mqtt_lwt_config = {0};
+// the tasks that may wait on one lane at the same time
+#define ESP_MQTT_LANE_WAITERS 32
 
-static bool esp_mqtt_running = false;
-static bool esp_mqtt_connected = false;
-static bool esp_mqtt_error = false;
+static const uint32_t esp_mqtt_reconnect_bounds[ESP_MQTT_RECONNECT_BUCKETS - 1] = {250, 500, 1000, 2000, 5000, 10000, 30000};
 
-static esp_mqtt_status_callback_t esp_mqtt_status_callback = NULL;
-static esp_mqtt_message_callback_t esp_mqtt_message_callback = NULL;
+typedef struct {
+    lwmqtt_string_t topic;
+    lwmqtt_message_t message;
+} esp_mqtt_event_t;
 
-static lwmqtt_client_t esp_mqtt_client;
+typedef struct {
+    uint16_t packet_id;  // 0 if the slot is free
+    bool released;       // pubrec received, only the pubrel is missing
+    char* topic;
+    lwmqtt_message_t message;
+} esp_mqtt_inflight_t;
 
-static esp_lwmqtt_network_t esp_mqtt_network = {0};
+typedef struct esp_mqtt_subscription {
+    char* topic;
+    int qos;
+    struct esp_mqtt_subscription* next;
+} esp_mqtt_subscription_t;
+
+struct esp_mqtt_client {
+    SemaphoreHandle_t main_mutex;
+    SemaphoreHandle_t select_mutex;
+
+    TaskHandle_t task;
+    uint32_t task_stack;
+    uint32_t task_priority;
+    int task_core;
+    SemaphoreHandle_t process_done;
+    bool process_stopped;
+
+    TaskHandle_t dispatcher;
+    SemaphoreHandle_t dispatcher_done;
+    bool dispatcher_stopped;
+    size_t batch_size;
+    esp_mqtt_event_t** batch_events;
+    esp_mqtt_message_t* batch_messages;
+    esp_mqtt_dispatch_stats_t dispatch_counters;
+
+    SemaphoreHandle_t router_mutex;
+    esp_mqtt_router_t router;
+
+    size_t buffer_size;
+    uint32_t command_timeout;
+
+    struct {
+        char* host;
+        char* port;
+        char* client_id;
+        char* username;
+        char* password;
+        uint16_t keep_alive;
+        bool clean_session;
+    } config;
+
+    bool session_present;
+    esp_mqtt_inflight_t inflight[CONFIG_ESP_MQTT_INFLIGHT_MAX];
+    size_t inflight_bytes;
+    esp_mqtt_subscription_t* subscriptions;
+
+    struct {
+        char* topic;
+        char* payload;
+        int qos;
+        bool retained;
+    } lwt_config;
+
+    bool running;
+    bool connected;
+    bool error;
+
+    esp_mqtt_client_status_callback_t status_callback;
+    esp_mqtt_client_message_callback_t message_callback;
+    esp_mqtt_client_batch_callback_t batch_callback;
+    void* ref;
+
+    lwmqtt_client_t lwmqtt;
+
+    esp_lwmqtt_network_t network;
 
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-static bool esp_mqtt_use_tls = false;
-static esp_tls_lwmqtt_network_t esp_mqtt_tls_network = {0};
+    bool use_tls;
+    esp_tls_lwmqtt_network_t tls_network;
 #endif
 
-static esp_lwmqtt_timer_t esp_mqtt_timer1, esp_mqtt_timer2;
-
-static void* esp_mqtt_write_buffer;
-static void* esp_mqtt_read_buffer;
-
-static QueueHandle_t esp_mqtt_event_queue = NULL;
+    esp_lwmqtt_timer_t timer1, timer2;
+
+    void* write_buffer;
+    void* read_buffer;
+
+    QueueHandle_t event_queue;
+
+    struct {
+        uint32_t min_backoff;
+        uint32_t max_backoff;
+    } reconnect_config;
+
+    esp_mqtt_reconnect_stats_t reconnect_counters;
+
+    esp_mqtt_outbox_t outbox;
+    uint32_t outbox_interval;
+    uint32_t outbox_last_replay;
+
+    SemaphoreHandle_t link_mutex;
+    uint32_t lane_waiting[ESP_MQTT_LANES];
+    uint32_t lane_parked[ESP_MQTT_LANES];
+    SemaphoreHandle_t lane_ready[ESP_MQTT_LANES];
+    size_t queued_bytes;
+    uint32_t in_flight;
+    uint32_t throughput;
+    size_t window_bytes;
+    int64_t window_time;
+    SemaphoreHandle_t bulk_mutex;
+    SemaphoreHandle_t bulk_ack;
+    uint16_t bulk_packet_id;
+};
+
+static void esp_mqtt_dispatcher(void* p);
+
+static esp_mqtt_client_t* esp_mqtt_default = NULL;
+static esp_mqtt_status_callback_t esp_mqtt_default_status_callback = NULL;
+static esp_mqtt_message_callback_t esp_mqtt_default_message_callback = NULL;
+
+void esp_mqtt_client_default_config(esp_mqtt_client_config_t* config) {
+    // set defaults from configuration
+    memset(config, 0, sizeof(esp_mqtt_client_config_t));
+    config->buffer_size = 256;
+    config->command_timeout = 2000;
+    config->queue_size = CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE;
+    config->task_stack = CONFIG_ESP_MQTT_TASK_STACK_SIZE;
+    config->task_priority = CONFIG_ESP_MQTT_TASK_STACK_PRIORITY;
+    config->task_core = 1;
+    config->batch_size = CONFIG_ESP_MQTT_BATCH_SIZE;
+    config->dispatcher_stack = CONFIG_ESP_MQTT_DISPATCHER_STACK_SIZE;
+    config->dispatcher_priority = CONFIG_ESP_MQTT_DISPATCHER_PRIORITY;
+    config->dispatcher_core = 0;
+}
 
-typedef struct {
-    lwmqtt_string_t topic;
-    lwmqtt_message_t message;
-} esp_mqtt_event_t;
+esp_mqtt_client_t* esp_mqtt_client_create(const esp_mqtt_client_config_t* config) {
+    // allocate client
+    esp_mqtt_client_t* client = calloc(1, sizeof(esp_mqtt_client_t));
+    if (client == NULL) {
+        ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_client_create: failed to allocate client");
+        return NULL;
+    }
 
-void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size, int command_timeout) {
     // set callbacks
-    esp_mqtt_status_callback = scb;
-    esp_mqtt_message_callback = mcb;
-    esp_mqtt_buffer_size = buffer_size;
-    esp_mqtt_command_timeout = (uint32_t)command_timeout;
+    client->status_callback = config->status_callback;
+    client->message_callback = config->message_callback;
+    client->batch_callback = config->batch_callback;
+    client->ref = config->ref;
+    client->buffer_size = config->buffer_size;
+    client->command_timeout = config->command_timeout;
+
+    // set task parameters
+    client->task_stack = config->task_stack;
+    client->task_priority = config->task_priority;
+    client->task_core = config->task_core;
 
     // allocate buffers
-    esp_mqtt_write_buffer = malloc((size_t)buffer_size);
-    esp_mqtt_read_buffer = malloc((size_t)buffer_size);
+    client->write_buffer = malloc(config->buffer_size);
+    client->read_buffer = malloc(config->buffer_size);
+    client->batch_size = config->batch_size > 0 ? config->batch_size : 1;
+    client->batch_events = malloc(client->batch_size * sizeof(esp_mqtt_event_t*));
+    client->batch_messages = malloc(client->batch_size * sizeof(esp_mqtt_message_t));
 
     // create mutexes
-    esp_mqtt_main_mutex = xSemaphoreCreateMutex();
-    esp_mqtt_select_mutex = xSemaphoreCreateMutex();
+    client->main_mutex = xSemaphoreCreateMutex();
+    client->select_mutex = xSemaphoreCreateMutex();
+    client->link_mutex = xSemaphoreCreateMutex();
+    client->bulk_mutex = xSemaphoreCreateMutex();
+    client->bulk_ack = xSemaphoreCreateBinary();
+    client->dispatcher_done = xSemaphoreCreateBinary();
+    client->process_done = xSemaphoreCreateBinary();
+    client->router_mutex = xSemaphoreCreateMutex();
+    bool lanes = true;
+    for (int i = 0; i < ESP_MQTT_LANES; i++) {
+        client->lane_ready[i] = xSemaphoreCreateCounting(ESP_MQTT_LANE_WAITERS, 0);
+        lanes = lanes && client->lane_ready[i] != NULL;
+    }
 
     // create queue
-    esp_mqtt_event_queue = xQueueCreate(CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE, sizeof(esp_mqtt_event_t*));
+    client->event_queue = xQueueCreate(config->queue_size, sizeof(esp_mqtt_event_t*));
+
+    // check allocations
+    if (client->write_buffer == NULL || client->read_buffer == NULL || client->batch_events == NULL || client->batch_messages == NULL ||
+        client->main_mutex == NULL || client->select_mutex == NULL || client->link_mutex == NULL || client->bulk_mutex == NULL || client->bulk_ack == NULL ||
+        client->dispatcher_done == NULL || client->process_done == NULL || client->router_mutex == NULL || !lanes || client->event_queue == NULL || !esp_mqtt_router_init(&client->router)) {
+        ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_client_create: failed to allocate resources");
+        esp_mqtt_client_destroy(client);
+        return NULL;
+    }
+
+    // create dispatcher thread
+    if (config->dispatcher) {
+        BaseType_t core = config->dispatcher_core < 0 ? tskNO_AFFINITY : config->dispatcher_core;
+        BaseType_t ret = xTaskCreatePinnedToCore(esp_mqtt_dispatcher, "esp_mqtt_dispatch", config->dispatcher_stack, client, config->dispatcher_priority,
+                                                 &client->dispatcher, core);
+        if (ret != pdPASS) {
+            ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_client_create: failed to create dispatcher");
+            client->dispatcher = NULL;
+            esp_mqtt_client_destroy(client);
+            return NULL;
+        }
+    }
+
+    // set reconnection defaults
+    client->reconnect_config.min_backoff = CONFIG_ESP_MQTT_BACKOFF_MIN;
+    client->reconnect_config.max_backoff = CONFIG_ESP_MQTT_BACKOFF_MAX;
+    client->network.dns_ttl = CONFIG_ESP_MQTT_DNS_TTL;
+
+    return client;
 }
 
+void esp_mqtt_client_destroy(esp_mqtt_client_t* client) {
+    // check client
+    if (client == NULL) {
+        return;
+    }
+
+    // stop process
+    if (client->main_mutex != NULL && client->select_mutex != NULL) {
+        esp_mqtt_client_stop(client);
+    }
+
+    // let the dispatcher finish the queued messages and exit
+    if (client->dispatcher != NULL) {
+        esp_mqtt_event_t* stop = NULL;
+        xQueueSend(client->event_queue, &stop, portMAX_DELAY);
+        xSemaphoreTake(client->dispatcher_done, portMAX_DELAY);
+    }
+
+    // drain queue
+    if (client->event_queue != NULL) {
+        esp_mqtt_event_t* evt = NULL;
+        while (xQueueReceive(client->event_queue, &evt, 0) == pdTRUE) {
+            free(evt->topic.data);
+            free(evt->message.payload);
+            free(evt);
+        }
+        vQueueDelete(client->event_queue);
+    }
+
+    // free resources
+    if (client->main_mutex != NULL) {
+        vSemaphoreDelete(client->main_mutex);
+    }
+    if (client->select_mutex != NULL) {
+        vSemaphoreDelete(client->select_mutex);
+    }
+    if (client->link_mutex != NULL) {
+        vSemaphoreDelete(client->link_mutex);
+    }
+    if (client->bulk_mutex != NULL) {
+        vSemaphoreDelete(client->bulk_mutex);
+    }
+    if (client->bulk_ack != NULL) {
+        vSemaphoreDelete(client->bulk_ack);
+    }
+    for (int i = 0; i < ESP_MQTT_LANES; i++) {
+        if (client->lane_ready[i] != NULL) {
+            vSemaphoreDelete(client->lane_ready[i]);
+        }
+    }
+    if (client->dispatcher_done != NULL) {
+        vSemaphoreDelete(client->dispatcher_done);
+    }
+    if (client->process_done != NULL) {
+        vSemaphoreDelete(client->process_done);
+    }
+    if (client->router_mutex != NULL) {
+        vSemaphoreDelete(client->router_mutex);
+    }
+    esp_mqtt_router_free(&client->router);
+    free(client->batch_events);
+    free(client->batch_messages);
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-bool esp_mqtt_tls(bool enable, bool verify, const uint8_t* ca_buf, size_t ca_len) {
+    esp_tls_lwmqtt_network_release(&client->tls_network);
+#endif
+    if (client->outbox.open) {
+        esp_mqtt_outbox_close(&client->outbox);
+    }
+    free(client->config.host);
+    free(client->config.port);
+    free(client->config.client_id);
+    free(client->config.username);
+    free(client->config.password);
+    free(client->lwt_config.topic);
+    free(client->lwt_config.payload);
+    for (int i = 0; i < CONFIG_ESP_MQTT_INFLIGHT_MAX; i++) {
+        free(client->inflight[i].topic);
+        free(client->inflight[i].message.payload);
+    }
+    while (client->subscriptions != NULL) {
+        esp_mqtt_subscription_t* next = client->subscriptions->next;
+        free(client->subscriptions->topic);
+        free(client->subscriptions);
+        client->subscriptions = next;
+    }
+    free(client->write_buffer);
+    free(client->read_buffer);
+    free(client);
+}
+
+void* esp_mqtt_client_ref(esp_mqtt_client_t* client) {
+    return client->ref;
+}
+
+#if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
+bool esp_mqtt_client_tls(esp_mqtt_client_t* client, bool enable, bool verify, const uint8_t* ca_buf, size_t ca_len) {
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // free state of a previous configuration
+    esp_tls_lwmqtt_network_release(&client->tls_network);
 
     // disable if requested
     if (!enable) {
-        esp_mqtt_use_tls = false;
-        esp_mqtt_tls_network.verify = false;
-        esp_mqtt_tls_network.ca_buf = NULL;
-        esp_mqtt_tls_network.ca_len = 0;
-        ESP_MQTT_UNLOCK_MAIN();
+        client->use_tls = false;
+        client->tls_network.verify = false;
+        client->tls_network.ca_buf = NULL;
+        client->tls_network.ca_len = 0;
+        ESP_MQTT_UNLOCK_MAIN(client);
         return true;
     }
 
     // check ca certificate
     if (!ca_buf || ca_len <= 0) {
         ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_tls: ca_buf must be not NULL.");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
     // set configuration
-    esp_mqtt_use_tls = true;
-    esp_mqtt_tls_network.verify = verify;
-    esp_mqtt_tls_network.ca_buf = (uint8_t*)ca_buf;
-    esp_mqtt_tls_network.ca_len = ca_len;
+    client->use_tls = true;
+    client->tls_network.verify = verify;
+    client->tls_network.ca_buf = (uint8_t*)ca_buf;
+    client->tls_network.ca_len = ca_len;
+    client->tls_network.budget = CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET;
 
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     return true;
 }
 #endif
 
-static void esp_mqtt_message_handler(lwmqtt_client_t* client, void* ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
+bool esp_mqtt_client_outbox(esp_mqtt_client_t* client, const char* storage, size_t quota, uint32_t max_messages, esp_mqtt_outbox_policy_t policy, uint32_t replay_interval) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // open outbox and recover messages from previous runs
+    if (!esp_mqtt_outbox_open(&client->outbox, storage, quota, max_messages, policy)) {
+        ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_outbox: failed to open storage %s", storage);
+        ESP_MQTT_UNLOCK_MAIN(client);
+        return false;
+    }
+
+    // set replay interval
+    client->outbox_interval = replay_interval;
+
+    ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_outbox: %u messages (%u bytes) pending", (unsigned)client->outbox.stats.pending, (unsigned)client->outbox.stats.pending_bytes);
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+
+    return true;
+}
+
+void esp_mqtt_client_outbox_stats(esp_mqtt_client_t* client, esp_mqtt_outbox_stats_t* stats) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // copy counters
+    *stats = client->outbox.stats;
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+}
+
+void esp_mqtt_client_reconnect_policy(esp_mqtt_client_t* client, uint32_t min_backoff, uint32_t max_backoff, uint32_t dns_ttl) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // set configuration
+    client->reconnect_config.min_backoff = min_backoff > 0 ? min_backoff : 1;
+    client->reconnect_config.max_backoff = max_backoff > min_backoff ? max_backoff : min_backoff;
+    client->network.dns_ttl = dns_ttl;
+    esp_lwmqtt_network_flush(&client->network);
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+}
+
+void esp_mqtt_client_kick(esp_mqtt_client_t* client) {
+    // wake up the process if it is waiting for the next attempt, without blocking on a running attempt
+    TaskHandle_t task = client->task;
+    if (client->running && task != NULL) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void esp_mqtt_client_reconnect_stats(esp_mqtt_client_t* client, esp_mqtt_reconnect_stats_t* stats) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // copy counters
+    *stats = client->reconnect_counters;
+    stats->dns_hits = client->network.dns_hits;
+    stats->dns_misses = client->network.dns_misses;
+#if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
+    stats->tls_handshakes = client->tls_network.handshakes;
+    stats->tls_resumptions = client->tls_network.resumptions;
+    stats->tls_handshake_time = client->tls_network.handshake_time;
+#endif
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+}
+
+bool esp_mqtt_client_route(esp_mqtt_client_t* client, const char* filter, esp_mqtt_route_handler_t handler, void* ctx) {
+    // acquire router mutex
+    xSemaphoreTake(client->router_mutex, portMAX_DELAY);
+
+    // add route
+    bool ret = esp_mqtt_router_add(&client->router, filter, handler, ctx);
+    if (!ret) {
+        ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_route: invalid filter or out of memory");
+    }
+
+    // release router mutex
+    xSemaphoreGive(client->router_mutex);
+
+    return ret;
+}
+
+void esp_mqtt_client_dispatch_stats(esp_mqtt_client_t* client, esp_mqtt_dispatch_stats_t* stats) {
+    // acquire link mutex
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+
+    // copy counters
+    *stats = client->dispatch_counters;
+    stats->queue_depth = uxQueueMessagesWaiting(client->event_queue);
+
+    // release link mutex
+    xSemaphoreGive(client->link_mutex);
+}
+
+void esp_mqtt_client_link_stats(esp_mqtt_client_t* client, esp_mqtt_link_stats_t* stats) {
+    // acquire link mutex, the main mutex may be held for the duration of a publish
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+
+    // copy counters
+    stats->queued_bytes = client->queued_bytes;
+    stats->in_flight = client->in_flight;
+    stats->throughput = client->throughput;
+
+    // release link mutex
+    xSemaphoreGive(client->link_mutex);
+
+    // the outbox counter is only written by the owner of the main mutex, a torn read is not possible for a word
+    stats->outbox_bytes = client->outbox.open ? client->outbox.stats.pending_bytes : 0;
+}
+
+bool esp_mqtt_client_can_accept(esp_mqtt_client_t* client, size_t len, uint32_t within) {
+    // get link state
+    esp_mqtt_link_stats_t stats;
+    esp_mqtt_client_link_stats(client, &stats);
+
+    // only the outbox can take the message while disconnected
+    if (!client->connected) {
+        return client->outbox.open && stats.outbox_bytes + len <= client->outbox.quota;
+    }
+
+    // accept until the first throughput sample has been taken
+    if (stats.throughput == 0) {
+        return true;
+    }
+
+    // check if the backlog including the message drains in time
+    uint64_t backlog = (uint64_t)stats.queued_bytes + stats.outbox_bytes + len;
+    return backlog * 1000 <= (uint64_t)stats.throughput * within;
+}
+
+static lwmqtt_err_t esp_mqtt_replay_outbox(esp_mqtt_client_t* client) {
+    // check if there is anything to replay
+    if (client->outbox.stats.pending == 0) {
+        return LWMQTT_SUCCESS;
+    }
+
+    // rate limit replay
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    if (now - client->outbox_last_replay < client->outbox_interval) {
+        return LWMQTT_SUCCESS;
+    }
+    client->outbox_last_replay = now;
+
+    // read oldest message
+    esp_mqtt_outbox_message_t stored;
+    if (!esp_mqtt_outbox_peek(&client->outbox, &stored)) {
+        return LWMQTT_SUCCESS;
+    }
+
+    // prepare message
+    lwmqtt_message_t message;
+    message.qos = (lwmqtt_qos_t)stored.qos;
+    message.retained = stored.retained;
+    message.payload = stored.payload;
+    message.payload_len = stored.payload_len;
+
+    // publish message and keep it in the outbox if that fails
+    lwmqtt_err_t err = lwmqtt_publish(&client->lwmqtt, lwmqtt_string(stored.topic), message, client->command_timeout);
+    if (err != LWMQTT_SUCCESS) {
+        esp_mqtt_outbox_release(&stored);
+        return err;
+    }
+
+    // remove message from outbox
+    esp_mqtt_outbox_pop(&client->outbox, &stored);
+
+    return LWMQTT_SUCCESS;
+}
+
+static void esp_mqtt_message_handler(lwmqtt_client_t* c, void* ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)ref;
+
     // create message
     esp_mqtt_event_t* evt = malloc(sizeof(esp_mqtt_event_t));
 
@@ -153,59 +592,362 @@ static void esp_mqtt_message_handler(lwmqtt_client_t* client, void* ref, lwmqtt_
     evt->message.payload[msg.payload_len] = 0;
 
     // queue event
-    if (xQueueSend(esp_mqtt_event_queue, &evt, 0) != pdTRUE) {
+    bool queued = xQueueSend(client->event_queue, &evt, 0) == pdTRUE;
+    if (!queued) {
         ESP_LOGE(ESP_MQTT_LOG_TAG, "xQueueSend: queue is full, dropping message");
         free(evt->topic.data);
         free(evt->message.payload);
         free(evt);
     }
+
+    // update counters
+    uint32_t depth = uxQueueMessagesWaiting(client->event_queue);
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+    client->dispatch_counters.dropped += !queued;
+    if (depth > client->dispatch_counters.max_queue_depth) {
+        client->dispatch_counters.max_queue_depth = depth;
+    }
+    xSemaphoreGive(client->link_mutex);
 }
 
-static void esp_mqtt_dispatch_events() {
-    // prepare event
+static esp_mqtt_inflight_t* esp_mqtt_find_inflight(esp_mqtt_client_t* client, uint16_t packet_id) {
+    for (int i = 0; i < CONFIG_ESP_MQTT_INFLIGHT_MAX; i++) {
+        if (client->inflight[i].packet_id == packet_id) {
+            return &client->inflight[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool esp_mqtt_track_inflight(esp_mqtt_client_t* client, const char* topic, lwmqtt_message_t message, uint16_t packet_id) {
+    // only persistent sessions can resend messages
+    if (client->config.clean_session || packet_id == 0) {
+        return false;
+    }
+
+    // check budget, larger messages fall back to the outbox if they are not acknowledged
+    esp_mqtt_inflight_t* slot = esp_mqtt_find_inflight(client, 0);
+    if (slot == NULL || client->inflight_bytes + message.payload_len > CONFIG_ESP_MQTT_INFLIGHT_BYTES) {
+        return false;
+    }
+
+    // copy topic and payload
+    slot->topic = strdup(topic);
+    slot->message = message;
+    slot->message.payload = malloc(message.payload_len > 0 ? message.payload_len : 1);
+    if (slot->topic == NULL || slot->message.payload == NULL) {
+        free(slot->topic);
+        free(slot->message.payload);
+        return false;
+    }
+    memcpy(slot->message.payload, message.payload, message.payload_len);
+
+    // occupy slot
+    slot->packet_id = packet_id;
+    slot->released = false;
+    client->inflight_bytes += message.payload_len;
+
+    return true;
+}
+
+static bool esp_mqtt_keep_unacked(esp_mqtt_client_t* client, const char* topic, lwmqtt_message_t message, bool tracked) {
+    // a tracked copy is resent after the reconnect
+    if (tracked) {
+        return true;
+    }
+
+    // otherwise store the message in the outbox for its replay
+    if (message.qos == LWMQTT_QOS0 || !client->outbox.open) {
+        return false;
+    }
+    bool stored = esp_mqtt_outbox_push(&client->outbox, topic, message.payload, message.payload_len, message.qos, message.retained);
+    if (!stored) {
+        ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_keep_unacked: outbox rejected message");
+    }
+
+    return stored;
+}
+
+static void esp_mqtt_clear_inflight(esp_mqtt_client_t* client, esp_mqtt_inflight_t* slot) {
+    // free copies and slot
+    client->inflight_bytes -= slot->message.payload_len;
+    free(slot->topic);
+    free(slot->message.payload);
+    memset(slot, 0, sizeof(esp_mqtt_inflight_t));
+}
+
+static void esp_mqtt_ack_handler(lwmqtt_client_t* c, void* ref, uint16_t packet_id, bool complete) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)ref;
+
+    // update tracked message
+    esp_mqtt_inflight_t* slot = packet_id != 0 ? esp_mqtt_find_inflight(client, packet_id) : NULL;
+    if (slot != NULL && complete) {
+        esp_mqtt_clear_inflight(client, slot);
+    } else if (slot != NULL) {
+        slot->released = true;
+    }
+
+    // wake up the bulk publisher waiting for this ack
+    if (complete && client->bulk_packet_id != 0 && client->bulk_packet_id == packet_id) {
+        client->bulk_packet_id = 0;
+        xSemaphoreGive(client->bulk_ack);
+    }
+}
+
+static void esp_mqtt_remember_subscription(esp_mqtt_client_t* client, const char* topic, int qos) {
+    // update existing subscription
+    for (esp_mqtt_subscription_t* sub = client->subscriptions; sub != NULL; sub = sub->next) {
+        if (strcmp(sub->topic, topic) == 0) {
+            sub->qos = qos;
+            return;
+        }
+    }
+
+    // add subscription
+    esp_mqtt_subscription_t* sub = malloc(sizeof(esp_mqtt_subscription_t));
+    if (sub == NULL) {
+        return;
+    }
+    sub->topic = strdup(topic);
+    if (sub->topic == NULL) {
+        free(sub);
+        return;
+    }
+    sub->qos = qos;
+    sub->next = client->subscriptions;
+    client->subscriptions = sub;
+}
+
+static void esp_mqtt_forget_subscription(esp_mqtt_client_t* client, const char* topic) {
+    // unlink and free subscription
+    for (esp_mqtt_subscription_t** sub = &client->subscriptions; *sub != NULL; sub = &(*sub)->next) {
+        if (strcmp((*sub)->topic, topic) == 0) {
+            esp_mqtt_subscription_t* old = *sub;
+            *sub = old->next;
+            free(old->topic);
+            free(old);
+            return;
+        }
+    }
+}
+
+static lwmqtt_err_t esp_mqtt_restore_session(esp_mqtt_client_t* client) {
+    // subscribe again if the broker did not keep the session
+    if (!client->session_present) {
+        for (esp_mqtt_subscription_t* sub = client->subscriptions; sub != NULL; sub = sub->next) {
+            lwmqtt_err_t err = lwmqtt_subscribe_one(&client->lwmqtt, lwmqtt_string(sub->topic), (lwmqtt_qos_t)sub->qos, client->command_timeout);
+            if (err != LWMQTT_SUCCESS) {
+                ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_subscribe_one: %d", err);
+                return err;
+            }
+        }
+    }
+
+    // resend unacknowledged messages, the acks are handled by the ack handler
+    for (int i = 0; i < CONFIG_ESP_MQTT_INFLIGHT_MAX; i++) {
+        esp_mqtt_inflight_t* slot = &client->inflight[i];
+        if (slot->packet_id == 0) {
+            continue;
+        }
+
+        lwmqtt_err_t err;
+        if (slot->released) {
+            err = lwmqtt_release(&client->lwmqtt, slot->packet_id, client->command_timeout);
+        } else {
+            err = lwmqtt_republish(&client->lwmqtt, lwmqtt_string(slot->topic), slot->message, slot->packet_id, client->command_timeout);
+        }
+        if (err != LWMQTT_SUCCESS) {
+            ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_restore_session: %d", err);
+            return err;
+        }
+    }
+
+    return LWMQTT_SUCCESS;
+}
+
+static size_t esp_mqtt_receive_batch(esp_mqtt_client_t* client, TickType_t wait) {
+    // receive events until the batch is full, only the first one is awaited
+    size_t count = 0;
     esp_mqtt_event_t* evt = NULL;
+    while (count < client->batch_size && xQueueReceive(client->event_queue, &evt, count == 0 ? wait : 0) == pdTRUE) {
+        // a null event stops the dispatcher
+        if (evt == NULL) {
+            client->dispatcher_stopped = true;
+            break;
+        }
 
-    // receive next event
-    while (xQueueReceive(esp_mqtt_event_queue, &evt, 0) == pdTRUE) {
-        // call callback if existing
-        if (esp_mqtt_message_callback) {
-            esp_mqtt_message_callback(evt->topic.data, evt->message.payload, evt->message.payload_len);
+        client->batch_events[count++] = evt;
+    }
+
+    return count;
+}
+
+static void esp_mqtt_free_event(esp_mqtt_event_t* evt) {
+    free(evt->topic.data);
+    free(evt->message.payload);
+    free(evt);
+}
+
+static void esp_mqtt_dispatch_batch(esp_mqtt_client_t* client, size_t count) {
+    // get start time
+    int64_t start = esp_timer_get_time();
+
+    // pass messages to their routes and keep the unrouted ones for the callbacks
+    size_t unrouted = 0;
+    xSemaphoreTake(client->router_mutex, portMAX_DELAY);
+    for (size_t i = 0; i < count; i++) {
+        esp_mqtt_event_t* evt = client->batch_events[i];
+        if (esp_mqtt_router_dispatch(&client->router, evt->topic.data, evt->message.payload, evt->message.payload_len) > 0) {
+            esp_mqtt_free_event(evt);
+        } else {
+            client->batch_events[unrouted++] = evt;
+        }
+    }
+    xSemaphoreGive(client->router_mutex);
+
+    // call callbacks if existing
+    if (client->batch_callback && unrouted > 0) {
+        for (size_t i = 0; i < unrouted; i++) {
+            client->batch_messages[i].topic = client->batch_events[i]->topic.data;
+            client->batch_messages[i].payload = client->batch_events[i]->message.payload;
+            client->batch_messages[i].len = client->batch_events[i]->message.payload_len;
+        }
+        client->batch_callback(client, client->batch_messages, unrouted);
+    } else if (client->message_callback) {
+        for (size_t i = 0; i < unrouted; i++) {
+            esp_mqtt_event_t* evt = client->batch_events[i];
+            client->message_callback(client, evt->topic.data, evt->message.payload, evt->message.payload_len);
         }
+    }
 
-        // free data
-        free(evt->topic.data);
-        free(evt->message.payload);
-        free(evt);
+    // get handler time
+    uint32_t time = (uint32_t)(esp_timer_get_time() - start);
+
+    // free data
+    for (size_t i = 0; i < unrouted; i++) {
+        esp_mqtt_free_event(client->batch_events[i]);
+    }
+
+    // update counters
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+    client->dispatch_counters.messages += count;
+    client->dispatch_counters.batches++;
+    client->dispatch_counters.handler_time = time;
+    if (time > client->dispatch_counters.max_handler_time) {
+        client->dispatch_counters.max_handler_time = time;
+    }
+    xSemaphoreGive(client->link_mutex);
+}
+
+static void esp_mqtt_dispatch_events(esp_mqtt_client_t* client) {
+    // dispatch queued events in batches
+    size_t count;
+    while ((count = esp_mqtt_receive_batch(client, 0)) > 0) {
+        esp_mqtt_dispatch_batch(client, count);
     }
 }
 
-static bool esp_mqtt_process_connect() {
-    // initialize the client
-    lwmqtt_init(&esp_mqtt_client, esp_mqtt_write_buffer, esp_mqtt_buffer_size, esp_mqtt_read_buffer, esp_mqtt_buffer_size);
+static void esp_mqtt_dispatcher(void* p) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)p;
+
+    // dispatch events until stopped
+    while (!client->dispatcher_stopped) {
+        size_t count = esp_mqtt_receive_batch(client, portMAX_DELAY);
+        if (count > 0) {
+            esp_mqtt_dispatch_batch(client, count);
+        }
+    }
+
+    // signal exit
+    xSemaphoreGive(client->dispatcher_done);
+    vTaskDelete(NULL);
+}
+
+static lwmqtt_err_t esp_mqtt_network_read(void* ref, uint8_t* buf, size_t len, size_t* read, uint32_t timeout) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)ref;
 
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-    if (esp_mqtt_use_tls) {
-        lwmqtt_set_network(&esp_mqtt_client, &esp_mqtt_tls_network, esp_tls_lwmqtt_network_read, esp_tls_lwmqtt_network_write);
+    if (client->use_tls) {
+        return esp_tls_lwmqtt_network_read(&client->tls_network, buf, len, read, timeout);
+    }
+#endif
+
+    return esp_lwmqtt_network_read(&client->network, buf, len, read, timeout);
+}
+
+static void esp_mqtt_record_write(esp_mqtt_client_t* client, size_t sent, int64_t time) {
+    // acquire mutex
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+
+    // accumulate write completions
+    client->window_bytes += sent;
+    client->window_time += time;
+
+    // take a sample once the window is full and update the moving average (alpha = 1/4)
+    if (client->window_time >= ESP_MQTT_THROUGHPUT_WINDOW) {
+        uint32_t sample = (uint32_t)((uint64_t)client->window_bytes * 1000000 / client->window_time);
+        client->throughput = client->throughput > 0 ? (client->throughput * 3 + sample) / 4 : sample;
+        client->window_bytes = 0;
+        client->window_time = 0;
+    }
+
+    // release mutex
+    xSemaphoreGive(client->link_mutex);
+}
+
+static lwmqtt_err_t esp_mqtt_network_write(void* ref, uint8_t* buf, size_t len, size_t* sent, uint32_t timeout) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)ref;
+
+    // write data
+    lwmqtt_err_t err;
+    int64_t start = esp_timer_get_time();
+#if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
+    if (client->use_tls) {
+        err = esp_tls_lwmqtt_network_write(&client->tls_network, buf, len, sent, timeout);
     } else {
-        lwmqtt_set_network(&esp_mqtt_client, &esp_mqtt_network, esp_lwmqtt_network_read, esp_lwmqtt_network_write);
+        err = esp_lwmqtt_network_write(&client->network, buf, len, sent, timeout);
     }
 #else
-    lwmqtt_set_network(&esp_mqtt_client, &esp_mqtt_network, esp_lwmqtt_network_read, esp_lwmqtt_network_write);
+    err = esp_lwmqtt_network_write(&client->network, buf, len, sent, timeout);
 #endif
 
-    lwmqtt_set_timers(&esp_mqtt_client, &esp_mqtt_timer1, &esp_mqtt_timer2, esp_lwmqtt_timer_set, esp_lwmqtt_timer_get);
-    lwmqtt_set_callback(&esp_mqtt_client, NULL, esp_mqtt_message_handler);
+    // update throughput estimate
+    if (err == LWMQTT_SUCCESS) {
+        esp_mqtt_record_write(client, *sent, esp_timer_get_time() - start);
+    }
+
+    return err;
+}
+
+static bool esp_mqtt_process_connect(esp_mqtt_client_t* client) {
+    // initialize the client, a persistent session keeps its packet ids unique across connections
+    uint16_t last_packet_id = client->lwmqtt.last_packet_id;
+    lwmqtt_init(&client->lwmqtt, client->write_buffer, client->buffer_size, client->read_buffer, client->buffer_size);
+    if (!client->config.clean_session && last_packet_id != 0) {
+        client->lwmqtt.last_packet_id = last_packet_id;
+    }
+
+    lwmqtt_set_network(&client->lwmqtt, client, esp_mqtt_network_read, esp_mqtt_network_write);
+
+    lwmqtt_set_timers(&client->lwmqtt, &client->timer1, &client->timer2, esp_lwmqtt_timer_set, esp_lwmqtt_timer_get);
+    lwmqtt_set_callback(&client->lwmqtt, client, esp_mqtt_message_handler);
+    lwmqtt_set_ack_callback(&client->lwmqtt, esp_mqtt_ack_handler);
 
     // initiate network connection
     lwmqtt_err_t err;
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-    if (esp_mqtt_use_tls) {
-        err = esp_tls_lwmqtt_network_connect(&esp_mqtt_tls_network, esp_mqtt_config.host, esp_mqtt_config.port);
+    if (client->use_tls) {
+        err = esp_tls_lwmqtt_network_connect(&client->tls_network, client->config.host, client->config.port);
     } else {
-        err = esp_lwmqtt_network_connect(&esp_mqtt_network, esp_mqtt_config.host, esp_mqtt_config.port);
+        err = esp_lwmqtt_network_connect(&client->network, client->config.host, client->config.port);
     }
 #else
-    err = esp_lwmqtt_network_connect(&esp_mqtt_network, esp_mqtt_config.host, esp_mqtt_config.port);
+    err = esp_lwmqtt_network_connect(&client->network, client->config.host, client->config.port);
 #endif
 
     if (err != LWMQTT_SUCCESS) {
@@ -214,34 +956,36 @@ static bool esp_mqtt_process_connect() {
     }
 
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     // acquire select mutex
-    ESP_MQTT_LOCK_SELECT();
+    ESP_MQTT_LOCK_SELECT(client);
 
     // wait for connection
     bool connected = false;
 
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-    if (esp_mqtt_use_tls) {
-        err = esp_tls_lwmqtt_network_wait(&esp_mqtt_tls_network, &connected, esp_mqtt_command_timeout);
+    if (client->use_tls) {
+        err = esp_tls_lwmqtt_network_wait(&client->tls_network, &connected, client->command_timeout);
     } else {
-        err = esp_lwmqtt_network_wait(&esp_mqtt_network, &connected, esp_mqtt_command_timeout);
+        err = esp_lwmqtt_network_wait(&client->network, &connected, client->command_timeout);
     }
 #else
-    err = esp_lwmqtt_network_wait(&esp_mqtt_network, &connected, esp_mqtt_command_timeout);
+    err = esp_lwmqtt_network_wait(&client->network, &connected, client->command_timeout);
 #endif
 
     if (err != LWMQTT_SUCCESS) {
         ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_wait: %d", err);
+        ESP_MQTT_UNLOCK_SELECT(client);
+        ESP_MQTT_LOCK_MAIN(client);
         return false;
     }
 
     // release select mutex
-    ESP_MQTT_UNLOCK_SELECT();
+    ESP_MQTT_UNLOCK_SELECT(client);
 
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
 
     // return if not connected
     if (!connected) {
@@ -250,103 +994,165 @@ static bool esp_mqtt_process_connect() {
 
     // setup connect data
     lwmqtt_options_t options = lwmqtt_default_options;
-    options.keep_alive = 30;
-    options.client_id = lwmqtt_string(esp_mqtt_config.client_id);
-    options.username = lwmqtt_string(esp_mqtt_config.username);
-    options.password = lwmqtt_string(esp_mqtt_config.password);
+    options.keep_alive = client->config.keep_alive;
+    options.clean_session = client->config.clean_session;
+    options.client_id = lwmqtt_string(client->config.client_id);
+    options.username = lwmqtt_string(client->config.username);
+    options.password = lwmqtt_string(client->config.password);
 
     // last will data
     lwmqtt_will_t will;
-    will.topic = lwmqtt_string(esp_mqtt_lwt_config.topic);
-    will.qos = (lwmqtt_qos_t)esp_mqtt_lwt_config.qos;
-    will.retained = esp_mqtt_lwt_config.retained;
-    will.payload = lwmqtt_string(esp_mqtt_lwt_config.payload);
+    will.topic = lwmqtt_string(client->lwt_config.topic);
+    will.qos = (lwmqtt_qos_t)client->lwt_config.qos;
+    will.retained = client->lwt_config.retained;
+    will.payload = lwmqtt_string(client->lwt_config.payload);
 
     // attempt connection
     lwmqtt_return_code_t return_code;
-    err = lwmqtt_connect(&esp_mqtt_client, options, will.topic.len ? &will : NULL, &return_code, esp_mqtt_command_timeout);
+    err = lwmqtt_connect(&client->lwmqtt, options, will.topic.len ? &will : NULL, &return_code, &client->session_present, client->command_timeout);
     if (err != LWMQTT_SUCCESS) {
         ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_connect: %d", err);
         return false;
     }
 
+    // restore subscriptions and unacknowledged messages
+    err = esp_mqtt_restore_session(client);
+    if (err != LWMQTT_SUCCESS) {
+        return false;
+    }
+
     return true;
 }
 
-static void esp_mqtt_process(void* p) {
+static uint32_t esp_mqtt_millis() {
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static bool esp_mqtt_backoff_wait(uint32_t window) {
+    // wait a random time of the upper half of the window (equal jitter) or until kicked
+    uint32_t delay = window / 2 + (window > 1 ? ESP_MQTT_RANDOM() % (window - window / 2) : 0);
+    if (ulTaskNotifyTake(pdTRUE, delay / portTICK_PERIOD_MS) > 0) {
+        ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_backoff_wait: kicked");
+        return true;
+    }
+
+    return false;
+}
+
+static void esp_mqtt_record_reconnect(esp_mqtt_client_t* client, uint32_t since) {
+    // calculate time to reconnect
+    uint32_t duration = esp_mqtt_millis() - since;
+
+    // find histogram bucket
+    int bucket = 0;
+    while (bucket < ESP_MQTT_RECONNECT_BUCKETS - 1 && duration >= esp_mqtt_reconnect_bounds[bucket]) {
+        bucket++;
+    }
+
+    // update stats
+    client->reconnect_counters.reconnects++;
+    client->reconnect_counters.histogram[bucket]++;
+    client->reconnect_counters.last_time = duration;
+    if (duration > client->reconnect_counters.max_time) {
+        client->reconnect_counters.max_time = duration;
+    }
+}
+
+static bool esp_mqtt_process_establish(esp_mqtt_client_t* client, uint32_t since) {
     // connection loop
+    uint32_t attempt = 0;
     for (;;) {
+        // acquire mutex
+        ESP_MQTT_LOCK_MAIN(client);
+
+        // give up if stopped
+        if (client->process_stopped) {
+            ESP_MQTT_UNLOCK_MAIN(client);
+            return false;
+        }
+
         // log attempt
         ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_process: begin connection attempt");
 
-        // acquire mutex
-        ESP_MQTT_LOCK_MAIN();
-
         // make connection attempt
-        if (esp_mqtt_process_connect()) {
+        client->reconnect_counters.attempts++;
+        if (esp_mqtt_process_connect(client)) {
             // log success
             ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_process: connection attempt successful");
 
             // set local flag
-            esp_mqtt_connected = true;
+            client->connected = true;
+
+            // record time to reconnect
+            esp_mqtt_record_reconnect(client, since);
 
             // release mutex
-            ESP_MQTT_UNLOCK_MAIN();
+            ESP_MQTT_UNLOCK_MAIN(client);
+
+            // discard kicks that arrived while connecting
+            ulTaskNotifyTake(pdTRUE, 0);
 
             // exit loop
-            break;
+            return true;
         }
 
+        // count failure
+        client->reconnect_counters.failures++;
+
         // release mutex
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
 
         // log fail
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_process: connection attempt failed");
 
-        // delay loop by 1s and yield to other processes
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
-    }
-
-    // call callback if existing
-    if (esp_mqtt_status_callback) {
-        esp_mqtt_status_callback(ESP_MQTT_STATUS_CONNECTED);
+        // back off exponentially, a kick restarts with the smallest window
+        uint32_t window = client->reconnect_config.max_backoff;
+        if (attempt < 16 && (client->reconnect_config.min_backoff << attempt) < window) {
+            window = client->reconnect_config.min_backoff << attempt;
+        }
+        attempt = esp_mqtt_backoff_wait(window) ? 0 : attempt + 1;
     }
+}
 
-    // yield loop
+static void esp_mqtt_process_yield(esp_mqtt_client_t* client) {
     for (;;) {
-        // check for error
-        if (esp_mqtt_error) {
+        // check for error or stop
+        if (client->error || client->process_stopped) {
             break;
         }
 
         // acquire select mutex
-        ESP_MQTT_LOCK_SELECT();
+        ESP_MQTT_LOCK_SELECT(client);
 
-        // block until data is available
+        // block until data is available or the next outbox message is due
         bool available = false;
+        uint32_t select_timeout = client->command_timeout;
+        if (client->outbox.stats.pending > 0 && client->outbox_interval < select_timeout) {
+            select_timeout = client->outbox_interval;
+        }
 
         lwmqtt_err_t err;
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-        if (esp_mqtt_use_tls) {
-            err = esp_tls_lwmqtt_network_select(&esp_mqtt_tls_network, &available, esp_mqtt_command_timeout);
+        if (client->use_tls) {
+            err = esp_tls_lwmqtt_network_select(&client->tls_network, &available, select_timeout);
         } else {
-            err = esp_lwmqtt_network_select(&esp_mqtt_network, &available, esp_mqtt_command_timeout);
+            err = esp_lwmqtt_network_select(&client->network, &available, select_timeout);
         }
 #else
-        err = esp_lwmqtt_network_select(&esp_mqtt_network, &available, esp_mqtt_command_timeout);
+        err = esp_lwmqtt_network_select(&client->network, &available, select_timeout);
 #endif
 
         if (err != LWMQTT_SUCCESS) {
             ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_select: %d", err);
-            ESP_MQTT_UNLOCK_SELECT();
+            ESP_MQTT_UNLOCK_SELECT(client);
             break;
         }
 
         // release select mutex
-        ESP_MQTT_UNLOCK_SELECT();
+        ESP_MQTT_UNLOCK_SELECT(client);
 
         // acquire mutex
-        ESP_MQTT_LOCK_MAIN();
+        ESP_MQTT_LOCK_MAIN(client);
 
         // process data if available
         if (available) {
@@ -354,261 +1160,453 @@ static void esp_mqtt_process(void* p) {
             size_t available_bytes = 0;
 
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-            if (esp_mqtt_use_tls) {
-                err = esp_tls_lwmqtt_network_peek(&esp_mqtt_tls_network, &available_bytes, esp_mqtt_command_timeout);
+            if (client->use_tls) {
+                err = esp_tls_lwmqtt_network_peek(&client->tls_network, &available_bytes, client->command_timeout);
             } else {
-                err = esp_lwmqtt_network_peek(&esp_mqtt_network, &available_bytes);
+                err = esp_lwmqtt_network_peek(&client->network, &available_bytes);
             }
 #else
-            err = esp_lwmqtt_network_peek(&esp_mqtt_network, &available_bytes);
+            err = esp_lwmqtt_network_peek(&client->network, &available_bytes);
 #endif
 
             if (err != LWMQTT_SUCCESS) {
                 ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_peek: %d", err);
-                ESP_MQTT_UNLOCK_MAIN();
+                ESP_MQTT_UNLOCK_MAIN(client);
                 break;
             }
 
             // yield client only if there is still data to read since select might unblock because of incoming ack packets
             // that are already handled until we get to this point
             if (available_bytes > 0) {
-                err = lwmqtt_yield(&esp_mqtt_client, available_bytes, esp_mqtt_command_timeout);
+                err = lwmqtt_yield(&client->lwmqtt, available_bytes, client->command_timeout);
                 if (err != LWMQTT_SUCCESS) {
                     ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_yield: %d", err);
-                    ESP_MQTT_UNLOCK_MAIN();
+                    ESP_MQTT_UNLOCK_MAIN(client);
                     break;
                 }
             }
         }
 
         // do mqtt background work
-        err = lwmqtt_keep_alive(&esp_mqtt_client, esp_mqtt_command_timeout);
+        err = lwmqtt_keep_alive(&client->lwmqtt, client->command_timeout);
         if (err != LWMQTT_SUCCESS) {
             ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_keep_alive: %d", err);
-            ESP_MQTT_UNLOCK_MAIN();
+            ESP_MQTT_UNLOCK_MAIN(client);
+            break;
+        }
+
+        // replay messages stored while disconnected
+        err = esp_mqtt_replay_outbox(client);
+        if (err != LWMQTT_SUCCESS) {
+            ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_replay_outbox: %d", err);
+            ESP_MQTT_UNLOCK_MAIN(client);
             break;
         }
 
         // release mutex
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
 
-        // dispatch queued events
-        esp_mqtt_dispatch_events();
+        // dispatch queued events if there is no dispatcher
+        if (client->dispatcher == NULL) {
+            esp_mqtt_dispatch_events(client);
+        }
     }
+}
 
-    // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+static void esp_mqtt_process(void* p) {
+    // get client
+    esp_mqtt_client_t* client = (esp_mqtt_client_t*)p;
+
+    // time since the broker is unreachable
+    uint32_t since = esp_mqtt_millis();
+
+    for (;;) {
+        // connect with backoff until stopped
+        if (!esp_mqtt_process_establish(client, since)) {
+            break;
+        }
+
+        // call callback if existing
+        if (client->status_callback) {
+            client->status_callback(client, ESP_MQTT_STATUS_CONNECTED);
+        }
+
+        // process connection until an error occurs or the client is stopped
+        esp_mqtt_process_yield(client);
+
+        // leave the connection to stop
+        if (client->process_stopped) {
+            break;
+        }
+
+        // acquire mutex
+        ESP_MQTT_LOCK_MAIN(client);
 
 // disconnect network
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-    if (esp_mqtt_use_tls) {
-        esp_tls_lwmqtt_network_disconnect(&esp_mqtt_tls_network);
-    } else {
-        esp_lwmqtt_network_disconnect(&esp_mqtt_network);
-    }
+        if (client->use_tls) {
+            esp_tls_lwmqtt_network_disconnect(&client->tls_network);
+        } else {
+            esp_lwmqtt_network_disconnect(&client->network);
+        }
 #else
-    esp_lwmqtt_network_disconnect(&esp_mqtt_network);
+        esp_lwmqtt_network_disconnect(&client->network);
 #endif
 
-    // set local flags
-    esp_mqtt_connected = false;
-    esp_mqtt_running = false;
-    esp_mqtt_error = false;
+        // set local flags
+        client->connected = false;
+        client->error = false;
 
-    // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+        // release mutex
+        ESP_MQTT_UNLOCK_MAIN(client);
 
-    ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_process: exit task");
+        ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_process: connection lost");
 
-    // call callback if existing
-    if (esp_mqtt_status_callback) {
-        esp_mqtt_status_callback(ESP_MQTT_STATUS_DISCONNECTED);
+        // call callback if existing
+        if (client->status_callback) {
+            client->status_callback(client, ESP_MQTT_STATUS_DISCONNECTED);
+        }
+
+        // spread the first attempt of devices that lost the broker at the same time
+        since = esp_mqtt_millis();
+        esp_mqtt_backoff_wait(client->reconnect_config.min_backoff);
     }
 
-    // delete task
+    // signal exit
+    xSemaphoreGive(client->process_done);
     vTaskDelete(NULL);
 }
 
-void esp_mqtt_lwt(const char* topic, const char* payload, int qos, bool retained) {
+void esp_mqtt_client_lwt(esp_mqtt_client_t* client, const char* topic, const char* payload, int qos, bool retained) {
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
 
     // free topic if set
-    if (esp_mqtt_lwt_config.topic != NULL) {
-        free(esp_mqtt_lwt_config.topic);
-        esp_mqtt_lwt_config.topic = NULL;
+    if (client->lwt_config.topic != NULL) {
+        free(client->lwt_config.topic);
+        client->lwt_config.topic = NULL;
     }
 
     // free payload if set
-    if (esp_mqtt_lwt_config.payload != NULL) {
-        free(esp_mqtt_lwt_config.payload);
-        esp_mqtt_lwt_config.payload = NULL;
+    if (client->lwt_config.payload != NULL) {
+        free(client->lwt_config.payload);
+        client->lwt_config.payload = NULL;
     }
 
     // set topic if provided
     if (topic != NULL) {
-        esp_mqtt_lwt_config.topic = strdup(topic);
+        client->lwt_config.topic = strdup(topic);
     }
 
     // set payload if provided
     if (payload != NULL) {
-        esp_mqtt_lwt_config.payload = strdup(payload);
+        client->lwt_config.payload = strdup(payload);
     }
 
     // set qos
-    esp_mqtt_lwt_config.qos = qos;
+    client->lwt_config.qos = qos;
 
     // set retained
-    esp_mqtt_lwt_config.retained = retained;
+    client->lwt_config.retained = retained;
 
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 }
 
-bool esp_mqtt_start(const char* host, const char* port, const char* client_id, const char* username, const char* password) {
+bool esp_mqtt_client_start(esp_mqtt_client_t* client, const char* host, const char* port, const char* client_id, const char* username, const char* password,
+                           uint16_t keep_alive, bool clean_session) {
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
 
     // check if already running
-    if (esp_mqtt_running) {
+    if (client->running) {
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_start: already running");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return true;
     }
 
+    // resolve the broker again if its address changed
+    if (client->config.host == NULL || host == NULL || strcmp(client->config.host, host) != 0 || client->config.port == NULL || port == NULL ||
+        strcmp(client->config.port, port) != 0) {
+        esp_lwmqtt_network_flush(&client->network);
+    }
+
     // free host if set
-    if (esp_mqtt_config.host != NULL) {
-        free(esp_mqtt_config.host);
-        esp_mqtt_config.host = NULL;
+    if (client->config.host != NULL) {
+        free(client->config.host);
+        client->config.host = NULL;
     }
 
     // free port if set
-    if (esp_mqtt_config.port != NULL) {
-        free(esp_mqtt_config.port);
-        esp_mqtt_config.port = NULL;
+    if (client->config.port != NULL) {
+        free(client->config.port);
+        client->config.port = NULL;
     }
 
     // free client id if set
-    if (esp_mqtt_config.client_id != NULL) {
-        free(esp_mqtt_config.client_id);
-        esp_mqtt_config.client_id = NULL;
+    if (client->config.client_id != NULL) {
+        free(client->config.client_id);
+        client->config.client_id = NULL;
     }
 
     // free username if set
-    if (esp_mqtt_config.username != NULL) {
-        free(esp_mqtt_config.username);
-        esp_mqtt_config.username = NULL;
+    if (client->config.username != NULL) {
+        free(client->config.username);
+        client->config.username = NULL;
     }
 
     // free password if set
-    if (esp_mqtt_config.password != NULL) {
-        free(esp_mqtt_config.password);
-        esp_mqtt_config.password = NULL;
+    if (client->config.password != NULL) {
+        free(client->config.password);
+        client->config.password = NULL;
     }
 
     // set host if provided
     if (host != NULL) {
-        esp_mqtt_config.host = strdup(host);
+        client->config.host = strdup(host);
     }
 
     // set port if provided
     if (port != NULL) {
-        esp_mqtt_config.port = strdup(port);
+        client->config.port = strdup(port);
     }
 
     // set client id if provided
     if (client_id != NULL) {
-        esp_mqtt_config.client_id = strdup(client_id);
+        client->config.client_id = strdup(client_id);
     }
 
     // set username if provided
     if (username != NULL) {
-        esp_mqtt_config.username = strdup(username);
+        client->config.username = strdup(username);
     }
 
     // set password if provided
     if (password != NULL) {
-        esp_mqtt_config.password = strdup(password);
+        client->config.password = strdup(password);
+    }
+
+    // set session parameters
+    client->config.keep_alive = keep_alive;
+    client->config.clean_session = clean_session;
+
+    // a clean session does not resend messages of a previous session
+    if (clean_session) {
+        for (int i = 0; i < CONFIG_ESP_MQTT_INFLIGHT_MAX; i++) {
+            if (client->inflight[i].packet_id != 0) {
+                esp_mqtt_clear_inflight(client, &client->inflight[i]);
+            }
+        }
     }
 
     // create mqtt thread
     ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_start: create task");
-    BaseType_t ret = xTaskCreatePinnedToCore(esp_mqtt_process, "esp_mqtt", CONFIG_ESP_MQTT_TASK_STACK_SIZE, NULL, CONFIG_ESP_MQTT_TASK_STACK_PRIORITY, &esp_mqtt_task, 1);
+    client->process_stopped = false;
+    BaseType_t core = client->task_core < 0 ? tskNO_AFFINITY : client->task_core;
+    BaseType_t ret = xTaskCreatePinnedToCore(esp_mqtt_process, "esp_mqtt", client->task_stack, client, client->task_priority, &client->task, core);
     if (ret != pdPASS) {
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_start: failed to create task");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
     // set local flag
-    esp_mqtt_running = true;
+    client->running = true;
 
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     return true;
 }
 
-bool esp_mqtt_subscribe(const char* topic, int qos) {
+bool esp_mqtt_client_session_present(esp_mqtt_client_t* client) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // get flag
+    bool present = client->connected && client->session_present;
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+
+    return present;
+}
+
+bool esp_mqtt_client_subscribe(esp_mqtt_client_t* client, const char* topic, int qos) {
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
 
     // check if still connected
-    if (!esp_mqtt_connected) {
+    if (!client->connected) {
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_subscribe: not connected");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
     // subscribe to topic
-    lwmqtt_err_t err = lwmqtt_subscribe_one(&esp_mqtt_client, lwmqtt_string(topic), (lwmqtt_qos_t)qos, esp_mqtt_command_timeout);
+    lwmqtt_err_t err = lwmqtt_subscribe_one(&client->lwmqtt, lwmqtt_string(topic), (lwmqtt_qos_t)qos, client->command_timeout);
     if (err != LWMQTT_SUCCESS) {
-        esp_mqtt_error = true;
+        client->error = true;
         ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_subscribe_one: %d", err);
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
+    // remember subscription for reconnects
+    esp_mqtt_remember_subscription(client, topic, qos);
+
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     return true;
 }
 
-bool esp_mqtt_unsubscribe(const char* topic) {
+bool esp_mqtt_client_unsubscribe(esp_mqtt_client_t* client, const char* topic) {
     // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+    ESP_MQTT_LOCK_MAIN(client);
 
     // check if still connected
-    if (!esp_mqtt_connected) {
+    if (!client->connected) {
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_unsubscribe: not connected");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
     // unsubscribe from topic
-    lwmqtt_err_t err = lwmqtt_unsubscribe_one(&esp_mqtt_client, lwmqtt_string(topic), esp_mqtt_command_timeout);
+    lwmqtt_err_t err = lwmqtt_unsubscribe_one(&client->lwmqtt, lwmqtt_string(topic), client->command_timeout);
     if (err != LWMQTT_SUCCESS) {
-        esp_mqtt_error = true;
+        client->error = true;
         ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_unsubscribe_one: %d", err);
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
+    // forget subscription
+    esp_mqtt_forget_subscription(client, topic);
+
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     return true;
 }
 
-bool esp_mqtt_publish(const char* topic, uint8_t* payload, size_t len, int qos, bool retained) {
-    // acquire mutex
-    ESP_MQTT_LOCK_MAIN();
+static void esp_mqtt_count_link(esp_mqtt_client_t* client, ssize_t queued, int in_flight) {
+    // update counters
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+    client->queued_bytes += queued;
+    client->in_flight += in_flight;
+    xSemaphoreGive(client->link_mutex);
+}
+
+static void esp_mqtt_wake_lanes(esp_mqtt_client_t* client) {
+    // wake the parked waiters of every lane that no higher lane holds back anymore, called with the link mutex
+    bool blocked = false;
+    for (int i = 0; i < ESP_MQTT_LANES; i++) {
+        for (; !blocked && client->lane_parked[i] > 0; client->lane_parked[i]--) {
+            xSemaphoreGive(client->lane_ready[i]);
+        }
+        blocked = blocked || client->lane_waiting[i] > 0;
+    }
+}
+
+static void esp_mqtt_lock_lane(esp_mqtt_client_t* client, esp_mqtt_lane_t lane) {
+    // announce waiter
+    xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+    client->lane_waiting[lane]++;
+    xSemaphoreGive(client->link_mutex);
+
+    for (;;) {
+        // acquire mutex
+        ESP_MQTT_LOCK_MAIN(client);
+
+        // check for waiters of higher lanes, park behind them otherwise
+        bool preempted = false;
+        xSemaphoreTake(client->link_mutex, portMAX_DELAY);
+        for (int i = 0; i < lane; i++) {
+            preempted = preempted || client->lane_waiting[i] > 0;
+        }
+        if (preempted) {
+            client->lane_parked[lane]++;
+        } else {
+            client->lane_waiting[lane]--;
+            esp_mqtt_wake_lanes(client);
+        }
+        xSemaphoreGive(client->link_mutex);
+
+        // keep mutex if no higher lane is waiting
+        if (!preempted) {
+            return;
+        }
+
+        // let higher lanes go first, the mutex is taken again once the last of them got it
+        ESP_MQTT_UNLOCK_MAIN(client);
+        xSemaphoreTake(client->lane_ready[lane], portMAX_DELAY);
+    }
+}
+
+static bool esp_mqtt_publish_bulk(esp_mqtt_client_t* client, const char* topic, lwmqtt_message_t message) {
+    // clear a stale ack of a timed out message
+    xSemaphoreTake(client->bulk_ack, 0);
+
+    // send message without waiting for the ack
+    uint16_t packet_id = 0;
+    lwmqtt_err_t err = lwmqtt_publish_nowait(&client->lwmqtt, lwmqtt_string(topic), message, &packet_id, client->command_timeout);
+    if (err != LWMQTT_SUCCESS) {
+        client->error = true;
+        ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish_nowait: %d", err);
+        bool kept = esp_mqtt_keep_unacked(client, topic, message, false);
+        ESP_MQTT_UNLOCK_MAIN(client);
+        return kept;
+    }
+
+    // return immediately on qos zero
+    if (packet_id == 0) {
+        ESP_MQTT_UNLOCK_MAIN(client);
+        return true;
+    }
+
+    // count message until it has been acknowledged and keep a copy for a resend
+    esp_mqtt_count_link(client, 0, 1);
+    bool tracked = esp_mqtt_track_inflight(client, topic, message, packet_id);
+
+    // release mutex so that other lanes can use the connection during the round trip
+    client->bulk_packet_id = packet_id;
+    ESP_MQTT_UNLOCK_MAIN(client);
+
+    // wait for the ack that is read by the process or another publisher
+    bool acked = xSemaphoreTake(client->bulk_ack, client->command_timeout / portTICK_PERIOD_MS) == pdTRUE;
+    esp_mqtt_count_link(client, 0, -1);
+    if (acked) {
+        return true;
+    }
+
+    // give up on the message unless it is resent after the reconnect
+    ESP_MQTT_LOCK_MAIN(client);
+    client->bulk_packet_id = 0;
+    client->error = true;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_publish_bulk: ack timeout");
+    bool kept = esp_mqtt_keep_unacked(client, topic, message, tracked);
+    ESP_MQTT_UNLOCK_MAIN(client);
+
+    return kept;
+}
+
+static bool esp_mqtt_publish_locked(esp_mqtt_client_t* client, const char* topic, uint8_t* payload, size_t len, int qos, bool retained,
+                                    esp_mqtt_lane_t lane) {
+    // store message if disconnected or if older messages still wait for their replay
+    if (client->outbox.open && (!client->connected || client->outbox.stats.pending > 0)) {
+        bool stored = esp_mqtt_outbox_push(&client->outbox, topic, payload, len, qos, retained);
+        if (!stored) {
+            ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish: outbox rejected message");
+        }
+        ESP_MQTT_UNLOCK_MAIN(client);
+        return stored;
+    }
 
     // check if still connected
-    if (!esp_mqtt_connected) {
+    if (!client->connected) {
         ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish: not connected");
-        ESP_MQTT_UNLOCK_MAIN();
+        ESP_MQTT_UNLOCK_MAIN(client);
         return false;
     }
 
@@ -619,63 +1617,236 @@ bool esp_mqtt_publish(const char* topic, uint8_t* payload, size_t len, int qos,
     message.payload = payload;
     message.payload_len = len;
 
-    // publish message
-    lwmqtt_err_t err = lwmqtt_publish(&esp_mqtt_client, lwmqtt_string(topic), message, esp_mqtt_command_timeout);
+    // wait for the ack outside of the mutex on the bulk lane
+    if (lane == ESP_MQTT_LANE_BULK) {
+        return esp_mqtt_publish_bulk(client, topic, message);
+    }
+
+    // publish message and keep a copy for a resend until it has been acknowledged
+    esp_mqtt_count_link(client, 0, qos > 0);
+    uint16_t packet_id = 0;
+    bool tracked = false;
+    lwmqtt_err_t err = lwmqtt_publish_nowait(&client->lwmqtt, lwmqtt_string(topic), message, &packet_id, client->command_timeout);
+    if (err == LWMQTT_SUCCESS) {
+        tracked = esp_mqtt_track_inflight(client, topic, message, packet_id);
+        err = lwmqtt_wait_ack(&client->lwmqtt, packet_id, message.qos, client->command_timeout);
+    }
+    esp_mqtt_count_link(client, 0, -(qos > 0));
     if (err != LWMQTT_SUCCESS) {
-        esp_mqtt_error = true;
+        client->error = true;
         ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish: %d", err);
-        ESP_MQTT_UNLOCK_MAIN();
-        return false;
+        bool kept = esp_mqtt_keep_unacked(client, topic, message, tracked);
+        ESP_MQTT_UNLOCK_MAIN(client);
+        return kept;
     }
 
     // release mutex
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_MAIN(client);
 
     return true;
 }
 
-void esp_mqtt_stop() {
-    // acquire mutexes
-    ESP_MQTT_LOCK_MAIN();
-    ESP_MQTT_LOCK_SELECT();
+bool esp_mqtt_client_publish_lane(esp_mqtt_client_t* client, const char* topic, uint8_t* payload, size_t len, int qos, bool retained,
+                                  esp_mqtt_lane_t lane) {
+    // count message as queued until it has been sent, a message on the wire still has to drain
+    esp_mqtt_count_link(client, (ssize_t)len, 0);
+
+    // allow only one bulk message in flight
+    if (lane == ESP_MQTT_LANE_BULK) {
+        xSemaphoreTake(client->bulk_mutex, portMAX_DELAY);
+    }
+
+    // acquire mutex after higher lanes
+    esp_mqtt_lock_lane(client, lane);
 
-    // return immediately if not running anymore
-    if (!esp_mqtt_running) {
-        ESP_MQTT_UNLOCK_SELECT();
-        ESP_MQTT_UNLOCK_MAIN();
+    // publish message
+    bool ret = esp_mqtt_publish_locked(client, topic, payload, len, qos, retained, lane);
+    esp_mqtt_count_link(client, -(ssize_t)len, 0);
+
+    // release bulk lane
+    if (lane == ESP_MQTT_LANE_BULK) {
+        xSemaphoreGive(client->bulk_mutex);
+    }
+
+    return ret;
+}
+
+bool esp_mqtt_client_publish(esp_mqtt_client_t* client, const char* topic, uint8_t* payload, size_t len, int qos, bool retained) {
+    return esp_mqtt_client_publish_lane(client, topic, payload, len, qos, retained, ESP_MQTT_LANE_NORMAL);
+}
+
+void esp_mqtt_client_stop(esp_mqtt_client_t* client) {
+    // acquire mutex
+    ESP_MQTT_LOCK_MAIN(client);
+
+    // return immediately if not running anymore or already stopping
+    if (!client->running || client->process_stopped) {
+        ESP_MQTT_UNLOCK_MAIN(client);
         return;
     }
 
+    // ask the mqtt task to leave its loop
+    ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_stop: stopping task");
+    client->process_stopped = true;
+
+    // release mutex
+    ESP_MQTT_UNLOCK_MAIN(client);
+
+    // wake the task if it backs off and wait until it exits outside of any lock
+    xTaskNotifyGive(client->task);
+    xSemaphoreTake(client->process_done, portMAX_DELAY);
+
+    // acquire mutexes
+    ESP_MQTT_LOCK_MAIN(client);
+    ESP_MQTT_LOCK_SELECT(client);
+
     // attempt to properly disconnect a connected client
-    if (esp_mqtt_connected) {
-        lwmqtt_err_t err = lwmqtt_disconnect(&esp_mqtt_client, esp_mqtt_command_timeout);
+    if (client->connected) {
+        lwmqtt_err_t err = lwmqtt_disconnect(&client->lwmqtt, client->command_timeout);
         if (err != LWMQTT_SUCCESS) {
             ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_disconnect: %d", err);
         }
 
         // set flag
-        esp_mqtt_connected = false;
+        client->connected = false;
     }
 
 // disconnect network
 #if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
-    if (esp_mqtt_use_tls) {
-        esp_tls_lwmqtt_network_disconnect(&esp_mqtt_tls_network);
+    if (client->use_tls) {
+        esp_tls_lwmqtt_network_disconnect(&client->tls_network);
     } else {
-        esp_lwmqtt_network_disconnect(&esp_mqtt_network);
+        esp_lwmqtt_network_disconnect(&client->network);
     }
 #else
-    esp_lwmqtt_network_disconnect(&esp_mqtt_network);
+    esp_lwmqtt_network_disconnect(&client->network);
 #endif
 
-    // kill mqtt task
-    ESP_LOGI(ESP_MQTT_LOG_TAG, "esp_mqtt_stop: deleting task");
-    vTaskDelete(esp_mqtt_task);
-
-    // set flag
-    esp_mqtt_running = false;
+    // set flags
+    client->task = NULL;
+    client->running = false;
+    client->error = false;
+    client->process_stopped = false;
 
     // release mutexes
-    ESP_MQTT_UNLOCK_SELECT();
-    ESP_MQTT_UNLOCK_MAIN();
+    ESP_MQTT_UNLOCK_SELECT(client);
+    ESP_MQTT_UNLOCK_MAIN(client);
+}
+
+static void esp_mqtt_default_status_handler(esp_mqtt_client_t* client, esp_mqtt_status_t status) {
+    // call callback if existing
+    if (esp_mqtt_default_status_callback) {
+        esp_mqtt_default_status_callback(status);
+    }
+}
+
+static void esp_mqtt_default_message_handler(esp_mqtt_client_t* client, const char* topic, uint8_t* payload, size_t len) {
+    // call callback if existing
+    if (esp_mqtt_default_message_callback) {
+        esp_mqtt_default_message_callback(topic, payload, len);
+    }
+}
+
+void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size, int command_timeout) {
+    // set callbacks
+    esp_mqtt_default_status_callback = scb;
+    esp_mqtt_default_message_callback = mcb;
+
+    // prepare configuration
+    esp_mqtt_client_config_t config;
+    esp_mqtt_client_default_config(&config);
+    config.status_callback = esp_mqtt_default_status_handler;
+    config.message_callback = esp_mqtt_default_message_handler;
+    config.buffer_size = buffer_size;
+    config.command_timeout = (uint32_t)command_timeout;
+
+    // create default client
+    esp_mqtt_default = esp_mqtt_client_create(&config);
+}
+
+esp_mqtt_client_t* esp_mqtt_default_client() {
+    return esp_mqtt_default;
+}
+
+#if defined(CONFIG_ESP_MQTT_TLS_ENABLE)
+bool esp_mqtt_tls(bool enable, bool verify, const uint8_t* ca_buf, size_t ca_len) {
+    return esp_mqtt_client_tls(esp_mqtt_default, enable, verify, ca_buf, ca_len);
+}
+#endif
+
+bool esp_mqtt_outbox(const char* storage, size_t quota, uint32_t max_messages, esp_mqtt_outbox_policy_t policy, uint32_t replay_interval) {
+    return esp_mqtt_client_outbox(esp_mqtt_default, storage, quota, max_messages, policy, replay_interval);
+}
+
+void esp_mqtt_outbox_stats(esp_mqtt_outbox_stats_t* stats) {
+    esp_mqtt_client_outbox_stats(esp_mqtt_default, stats);
+}
+
+void esp_mqtt_reconnect_policy(uint32_t min_backoff, uint32_t max_backoff, uint32_t dns_ttl) {
+    esp_mqtt_client_reconnect_policy(esp_mqtt_default, min_backoff, max_backoff, dns_ttl);
+}
+
+void esp_mqtt_kick() {
+    // the wifi event handler may kick before the client has been created
+    if (esp_mqtt_default != NULL) {
+        esp_mqtt_client_kick(esp_mqtt_default);
+    }
+}
+
+void esp_mqtt_reconnect_stats(esp_mqtt_reconnect_stats_t* stats) {
+    esp_mqtt_client_reconnect_stats(esp_mqtt_default, stats);
+}
+
+bool esp_mqtt_route(const char* filter, esp_mqtt_route_handler_t handler, void* ctx) {
+    // routes can only be added after esp_mqtt_init
+    if (esp_mqtt_default == NULL) {
+        return false;
+    }
+
+    return esp_mqtt_client_route(esp_mqtt_default, filter, handler, ctx);
+}
+
+void esp_mqtt_dispatch_stats(esp_mqtt_dispatch_stats_t* stats) {
+    esp_mqtt_client_dispatch_stats(esp_mqtt_default, stats);
+}
+
+void esp_mqtt_link_stats(esp_mqtt_link_stats_t* stats) {
+    esp_mqtt_client_link_stats(esp_mqtt_default, stats);
+}
+
+bool esp_mqtt_can_accept(size_t len, uint32_t within) {
+    return esp_mqtt_client_can_accept(esp_mqtt_default, len, within);
+}
+
+void esp_mqtt_lwt(const char* topic, const char* payload, int qos, bool retained) {
+    esp_mqtt_client_lwt(esp_mqtt_default, topic, payload, qos, retained);
+}
+
+bool esp_mqtt_start(const char* host, const char* port, const char* client_id, const char* username, const char* password, uint16_t keep_alive,
+                    bool clean_session) {
+    return esp_mqtt_client_start(esp_mqtt_default, host, port, client_id, username, password, keep_alive, clean_session);
+}
+
+bool esp_mqtt_session_present() {
+    return esp_mqtt_client_session_present(esp_mqtt_default);
+}
+
+bool esp_mqtt_subscribe(const char* topic, int qos) {
+    return esp_mqtt_client_subscribe(esp_mqtt_default, topic, qos);
+}
+
+bool esp_mqtt_unsubscribe(const char* topic) {
+    return esp_mqtt_client_unsubscribe(esp_mqtt_default, topic);
+}
+
+bool esp_mqtt_publish(const char* topic, uint8_t* payload, size_t len, int qos, bool retained) {
+    return esp_mqtt_client_publish(esp_mqtt_default, topic, payload, len, qos, retained);
+}
+
+bool esp_mqtt_publish_lane(const char* topic, uint8_t* payload, size_t len, int qos, bool retained, esp_mqtt_lane_t lane) {
+    return esp_mqtt_client_publish_lane(esp_mqtt_default, topic, payload, len, qos, retained, lane);
+}
+
+void esp_mqtt_stop() {
+    esp_mqtt_client_stop(esp_mqtt_default);
 }
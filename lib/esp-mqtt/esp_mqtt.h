@@ -2,8 +2,12 @@
 #define ESP_MQTT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "esp_mqtt_outbox.h"
+#include "esp_mqtt_router.h"
+
 /**
  * The statuses emitted by the status callback.
  */
@@ -14,19 +18,188 @@ typedef enum esp_mqtt_status_t { ESP_MQTT_STATUS_DISCONNECTED, ESP_MQTT_STATUS_C
  */
 typedef void (*esp_mqtt_status_callback_t)(esp_mqtt_status_t);
 
+/**
+ * The number of buckets of the time-to-reconnect histogram.
+ */
+#define ESP_MQTT_RECONNECT_BUCKETS 8
+
+/**
+ * The counters of the reconnection engine.
+ *
+ * The histogram buckets hold reconnect times of <250ms, <500ms, <1s, <2s, <5s, <10s, <30s and >=30s. The time is
+ * measured from the loss of the connection (or the start of the process) until the broker accepted the connection.
+ */
+typedef struct {
+    uint32_t attempts;            // connection attempts
+    uint32_t failures;            // failed connection attempts
+    uint32_t reconnects;          // successful connections
+    uint32_t dns_hits;            // connection attempts that used the cached broker address
+    uint32_t dns_misses;          // connection attempts that resolved the broker host
+    uint32_t last_time;           // time of the last reconnect in milliseconds
+    uint32_t max_time;            // longest reconnect in milliseconds
+    uint32_t tls_handshakes;      // completed TLS handshakes
+    uint32_t tls_resumptions;     // TLS handshakes that resumed the previous session
+    uint32_t tls_handshake_time;  // duration of the last TLS handshake in milliseconds
+    uint32_t histogram[ESP_MQTT_RECONNECT_BUCKETS];
+} esp_mqtt_reconnect_stats_t;
+
+/**
+ * The state of the link as seen by producers.
+ *
+ * The throughput is an exponentially weighted moving average of the rate achieved by socket writes. It is zero until
+ * enough data has been written to take the first sample.
+ */
+typedef struct {
+    size_t queued_bytes;  // payload bytes of publishes waiting for the connection or being sent
+    size_t outbox_bytes;  // bytes waiting in the outbox for their replay
+    uint32_t in_flight;   // qos 1 and 2 messages sent but not yet acknowledged
+    uint32_t throughput;  // estimated send throughput in bytes per second
+} esp_mqtt_link_stats_t;
+
+/**
+ * The lanes used to prioritize published messages.
+ *
+ * A message waiting on a higher lane is always sent before messages waiting on lower lanes. Since MQTT does not allow
+ * to interleave packets the priority takes effect between messages: a realtime message never waits longer than the
+ * message that is currently being written. Messages on the bulk lane wait for their acknowledgement without blocking
+ * the connection so that other lanes can publish during the round trip.
+ */
+typedef enum esp_mqtt_lane_t { ESP_MQTT_LANE_REALTIME, ESP_MQTT_LANE_NORMAL, ESP_MQTT_LANE_BULK } esp_mqtt_lane_t;
+
+/**
+ * The number of publish lanes.
+ */
+#define ESP_MQTT_LANES 3
+
 /**
  * The message callback.
  */
 typedef void (*esp_mqtt_message_callback_t)(const char *topic, uint8_t *payload, size_t len);
 
+/**
+ * The MQTT client object.
+ *
+ * Each client owns its task, buffers, queue and connection and can talk to a different broker.
+ */
+typedef struct esp_mqtt_client esp_mqtt_client_t;
+
+/**
+ * The status callback of a client.
+ */
+typedef void (*esp_mqtt_client_status_callback_t)(esp_mqtt_client_t *client, esp_mqtt_status_t status);
+
+/**
+ * The message callback of a client.
+ */
+typedef void (*esp_mqtt_client_message_callback_t)(esp_mqtt_client_t *client, const char *topic, uint8_t *payload,
+                                                   size_t len);
+
+/**
+ * An incoming message passed to the batch callback.
+ */
+typedef struct {
+    const char *topic;
+    uint8_t *payload;
+    size_t len;
+} esp_mqtt_message_t;
+
+/**
+ * The batch callback of a client.
+ *
+ * Receives all messages that have been queued since the last call, at most `batch_size`. The messages are only valid
+ * during the call.
+ */
+typedef void (*esp_mqtt_client_batch_callback_t)(esp_mqtt_client_t *client, const esp_mqtt_message_t *messages,
+                                                 size_t count);
+
+/**
+ * The configuration of a client.
+ *
+ * Incoming messages are queued by the network task. Without a dispatcher the network task calls the message callbacks
+ * itself, a slow callback then delays keep alive and acks. With a dispatcher a separate task drains the queue and the
+ * network task only moves data.
+ */
+typedef struct {
+    esp_mqtt_client_status_callback_t status_callback;
+    esp_mqtt_client_message_callback_t message_callback;
+    esp_mqtt_client_batch_callback_t batch_callback;      // used instead of the message callback if set
+    void *ref;                                            // user data returned by esp_mqtt_client_ref
+    size_t buffer_size;                                   // read and write buffer size
+    uint32_t command_timeout;                             // ms
+    size_t queue_size;                                    // incoming messages waiting for the callbacks
+    size_t batch_size;                                    // messages passed to one batch callback at most
+    uint32_t task_stack;                                  // network task, bytes
+    uint32_t task_priority;
+    int task_core;                                        // core the network task is pinned to or -1 for no affinity
+    bool dispatcher;                                      // call the callbacks from a dedicated task
+    uint32_t dispatcher_stack;                            // bytes
+    uint32_t dispatcher_priority;
+    int dispatcher_core;                                  // core the dispatcher is pinned to or -1 for no affinity
+} esp_mqtt_client_config_t;
+
+/**
+ * The counters of the message dispatch.
+ *
+ * The handler time covers one batch callback or, without a batch callback, the message callbacks of one batch.
+ */
+typedef struct {
+    uint32_t messages;          // messages passed to the callbacks
+    uint32_t batches;           // batches passed to the callbacks
+    uint32_t dropped;           // messages dropped because the queue was full
+    uint32_t queue_depth;       // messages currently waiting
+    uint32_t max_queue_depth;   // most messages waiting at once
+    uint32_t handler_time;      // duration of the last batch in microseconds
+    uint32_t max_handler_time;  // longest batch in microseconds
+} esp_mqtt_dispatch_stats_t;
+
+/**
+ * Fill the configuration with the defaults from exlibconfig.h.
+ *
+ * @param config - The configuration.
+ */
+void esp_mqtt_client_default_config(esp_mqtt_client_config_t *config);
+
+/**
+ * Create a client. The buffers, the queue and the dispatcher are allocated immediately, the network task is created
+ * by `esp_mqtt_client_start`.
+ *
+ * @param config - The configuration.
+ * @return The client or NULL if the memory could not be allocated.
+ */
+esp_mqtt_client_t *esp_mqtt_client_create(const esp_mqtt_client_config_t *config);
+
+/**
+ * Stop the client and free all its memory.
+ *
+ * @param client - The client.
+ */
+void esp_mqtt_client_destroy(esp_mqtt_client_t *client);
+
+/**
+ * Get the user data of the client.
+ *
+ * @param client - The client.
+ * @return The ref from the configuration.
+ */
+void *esp_mqtt_client_ref(esp_mqtt_client_t *client);
+
+/**
+ * Get the client used by the functions without a client argument.
+ *
+ * @return The client created by `esp_mqtt_init` or NULL.
+ */
+esp_mqtt_client_t *esp_mqtt_default_client();
+
 /**
  * Initialize the MQTT management system.
  *
+ * Creates the default client that is used by all functions without a client argument.
+ *
  * Note: Should only be called once on boot.
  *
  * @param scb - The status callback.
  * @param mcb - The message callback.
- * @param buffer_size - The read and write buffer size.
+ * @param buffer_size - The read and write buffer size. Published payloads are streamed and do not need to fit.
  * @param command_timeout - The command timeout.
  */
 void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size,
@@ -47,6 +220,11 @@ void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t m
  * @return Whether TLS configuration was successful.
  */
 bool esp_mqtt_tls(bool enable, bool verify, const uint8_t *ca_buf, size_t ca_len);
+
+/**
+ * Same as `esp_mqtt_tls` for the specified client.
+ */
+bool esp_mqtt_client_tls(esp_mqtt_client_t *client, bool enable, bool verify, const uint8_t *ca_buf, size_t ca_len);
 #endif
 
 /**
@@ -61,31 +239,212 @@ bool esp_mqtt_tls(bool enable, bool verify, const uint8_t *ca_buf, size_t ca_len
  */
 void esp_mqtt_lwt(const char *topic, const char *payload, int qos, bool retained);
 
+/**
+ * Same as `esp_mqtt_lwt` for the specified client.
+ */
+void esp_mqtt_client_lwt(esp_mqtt_client_t *client, const char *topic, const char *payload, int qos, bool retained);
+
+/**
+ * Configure the offline outbox.
+ *
+ * While the client is disconnected, published messages are appended to a bounded persistent outbox instead of being
+ * dropped. After the next successful connection they are replayed in order, one message per replay interval. Messages
+ * published while the outbox is not yet drained are queued behind the stored ones to keep the order.
+ *
+ * On the device the storage is the label of a data partition, on the host it is the path of a file that is memory
+ * mapped.
+ *
+ * Note: Must be called after `esp_mqtt_init` and before `esp_mqtt_start`.
+ *
+ * @param storage - The partition label or file path.
+ * @param quota - The maximum amount of bytes occupied by queued messages (0 for the whole storage).
+ * @param max_messages - The maximum amount of queued messages (0 for no limit).
+ * @param policy - The policy applied if the quota is exceeded.
+ * @param replay_interval - The minimum time between two replayed messages in milliseconds.
+ * @return Whether the outbox could be opened.
+ */
+bool esp_mqtt_outbox(const char *storage, size_t quota, uint32_t max_messages, esp_mqtt_outbox_policy_t policy,
+                     uint32_t replay_interval);
+
+/**
+ * Same as `esp_mqtt_outbox` for the specified client.
+ */
+bool esp_mqtt_client_outbox(esp_mqtt_client_t *client, const char *storage, size_t quota, uint32_t max_messages,
+                            esp_mqtt_outbox_policy_t policy, uint32_t replay_interval);
+
+/**
+ * Get the outbox counters.
+ *
+ * @param stats - The structure that will receive the counters.
+ */
+void esp_mqtt_outbox_stats(esp_mqtt_outbox_stats_t *stats);
+
+/**
+ * Same as `esp_mqtt_outbox_stats` for the specified client.
+ */
+void esp_mqtt_client_outbox_stats(esp_mqtt_client_t *client, esp_mqtt_outbox_stats_t *stats);
+
+/**
+ * Configure the reconnection engine.
+ *
+ * Failed connection attempts are retried with an exponential backoff starting at min_backoff and capped at max_backoff.
+ * Each delay is randomized within the upper half of its window so that a fleet of devices does not reconnect in
+ * lockstep. The resolved broker address is cached for dns_ttl milliseconds and dropped if a connection attempt fails.
+ *
+ * Note: Must be called before `esp_mqtt_start`.
+ *
+ * @param min_backoff - The first retry window in milliseconds.
+ * @param max_backoff - The largest retry window in milliseconds.
+ * @param dns_ttl - The lifetime of the cached broker address in milliseconds (0 disables the cache).
+ */
+void esp_mqtt_reconnect_policy(uint32_t min_backoff, uint32_t max_backoff, uint32_t dns_ttl);
+
+/**
+ * Same as `esp_mqtt_reconnect_policy` for the specified client.
+ */
+void esp_mqtt_client_reconnect_policy(esp_mqtt_client_t *client, uint32_t min_backoff, uint32_t max_backoff,
+                                      uint32_t dns_ttl);
+
+/**
+ * Retry a pending connection attempt immediately and restart the backoff.
+ *
+ * Should be called when the network becomes available again, e.g. when Wi-Fi got an IP.
+ */
+void esp_mqtt_kick();
+
+/**
+ * Same as `esp_mqtt_kick` for the specified client.
+ */
+void esp_mqtt_client_kick(esp_mqtt_client_t *client);
+
+/**
+ * Get the counters of the reconnection engine.
+ *
+ * @param stats - The structure that will receive the counters.
+ */
+void esp_mqtt_reconnect_stats(esp_mqtt_reconnect_stats_t *stats);
+
+/**
+ * Same as `esp_mqtt_reconnect_stats` for the specified client.
+ */
+void esp_mqtt_client_reconnect_stats(esp_mqtt_client_t *client, esp_mqtt_reconnect_stats_t *stats);
+
+/**
+ * Route messages that match a topic filter to a handler.
+ *
+ * The filter may contain `+` and a trailing `#`. A message is passed to all routes it matches, only messages without a
+ * matching route reach the message or batch callback. Matching costs one lookup per topic level regardless of the
+ * number of routes. Handlers run on the same task as the message callback and must not add routes.
+ *
+ * @param filter - The topic filter.
+ * @param handler - The handler.
+ * @param ctx - The context passed to the handler.
+ * @return Whether the route has been added.
+ */
+bool esp_mqtt_route(const char *filter, esp_mqtt_route_handler_t handler, void *ctx);
+
+/**
+ * Same as `esp_mqtt_route` for the specified client.
+ */
+bool esp_mqtt_client_route(esp_mqtt_client_t *client, const char *filter, esp_mqtt_route_handler_t handler, void *ctx);
+
+/**
+ * Get the counters of the message dispatch.
+ *
+ * @param stats - The structure that will receive the counters.
+ */
+void esp_mqtt_dispatch_stats(esp_mqtt_dispatch_stats_t *stats);
+
+/**
+ * Same as `esp_mqtt_dispatch_stats` for the specified client.
+ */
+void esp_mqtt_client_dispatch_stats(esp_mqtt_client_t *client, esp_mqtt_dispatch_stats_t *stats);
+
+/**
+ * Get the state of the link.
+ *
+ * Does not wait for running publishes and can be polled by producers.
+ *
+ * @param stats - The structure that will receive the state.
+ */
+void esp_mqtt_link_stats(esp_mqtt_link_stats_t *stats);
+
+/**
+ * Same as `esp_mqtt_link_stats` for the specified client.
+ */
+void esp_mqtt_client_link_stats(esp_mqtt_client_t *client, esp_mqtt_link_stats_t *stats);
+
+/**
+ * Check whether a message of the specified size can be sent within the specified time.
+ *
+ * The queued messages, the outbox and the message are assumed to drain at the estimated throughput. Returns true as
+ * long as no estimate is available. While disconnected the free outbox quota is checked instead. Producers can use
+ * this to lower the quality or size of their messages or to drop them before the queues grow.
+ *
+ * @param len - The payload length.
+ * @param within - The time in milliseconds.
+ * @return Whether the link can accept the message.
+ */
+bool esp_mqtt_can_accept(size_t len, uint32_t within);
+
+/**
+ * Same as `esp_mqtt_can_accept` for the specified client.
+ */
+bool esp_mqtt_client_can_accept(esp_mqtt_client_t *client, size_t len, uint32_t within);
+
 /**
  * Start the MQTT process.
  *
- * The background process will attempt to connect to the specified broker once a second until a connection can be
- * established. This process can be interrupted by calling `esp_mqtt_stop();`. If a connection has been established,
- * the status callback will be called with `ESP_MQTT_STATUS_CONNECTED`. From that moment on the functions
- * `esp_mqtt_subscribe`, `esp_mqtt_unsubscribe` and `esp_mqtt_publish` can be used to interact with the broker.
+ * The background process will attempt to connect to the specified broker with an exponential backoff until a
+ * connection can be established. This process can be interrupted by calling `esp_mqtt_stop();`. If a connection has
+ * been established, the status callback will be called with `ESP_MQTT_STATUS_CONNECTED`. From that moment on the
+ * functions `esp_mqtt_subscribe`, `esp_mqtt_unsubscribe` and `esp_mqtt_publish` can be used to interact with the
+ * broker. If the connection is lost, the status callback will be called with `ESP_MQTT_STATUS_DISCONNECTED` and the
+ * process will reconnect on its own.
+ *
+ * Subscriptions are restored after a reconnect unless the broker kept the session. With a persistent session
+ * (`clean_session` false) qos 1 and 2 messages that were not acknowledged when the connection was lost are resent with
+ * the dup flag after the reconnect. Up to `CONFIG_ESP_MQTT_INFLIGHT_MAX` messages and `CONFIG_ESP_MQTT_INFLIGHT_BYTES`
+ * payload bytes are copied for this, publishing such a message returns true even if the ack is still missing. Larger
+ * messages are appended to the outbox if the ack is missing and the outbox has been configured.
  *
  * @param host - The broker host.
  * @param port - The broker port.
  * @param client_id - The client id.
  * @param username - The client username.
  * @param password - The client password.
+ * @param keep_alive - The keep alive interval in seconds.
+ * @param clean_session - Whether the broker should discard the session when the client disconnects.
  * @return Whether the operation was successful.
  */
 bool esp_mqtt_start(const char *host, const char *port, const char *client_id, const char *username,
-                    const char *password);
+                    const char *password, uint16_t keep_alive, bool clean_session);
+
+/**
+ * Same as `esp_mqtt_start` for the specified client.
+ */
+bool esp_mqtt_client_start(esp_mqtt_client_t *client, const char *host, const char *port, const char *client_id,
+                           const char *username, const char *password, uint16_t keep_alive, bool clean_session);
+
+/**
+ * Check whether the broker resumed a previous session on the current connection.
+ *
+ * @return Whether a session is present.
+ */
+bool esp_mqtt_session_present();
+
+/**
+ * Same as `esp_mqtt_session_present` for the specified client.
+ */
+bool esp_mqtt_client_session_present(esp_mqtt_client_t *client);
 
 /**
  * Subscribe to specified topic.
  *
  * When false is returned the current operation failed and any subsequent interactions will also fail. This can be used
  * to handle errors early. As soon as the background process unblocks the error will be detected, the connection closed
- * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. That callback then can simply call
- * `esp_mqtt_start()` to attempt an reconnection.
+ * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. The background process then reconnects on its
+ * own.
  *
  * @param topic - The topic.
  * @param qos - The qos level.
@@ -93,26 +452,38 @@ bool esp_mqtt_start(const char *host, const char *port, const char *client_id, c
  */
 bool esp_mqtt_subscribe(const char *topic, int qos);
 
+/**
+ * Same as `esp_mqtt_subscribe` for the specified client.
+ */
+bool esp_mqtt_client_subscribe(esp_mqtt_client_t *client, const char *topic, int qos);
+
 /**
  * Unsubscribe from specified topic.
  *
  * When false is returned the current operation failed and any subsequent interactions will also fail. This can be used
  * to handle errors early. As soon as the background process unblocks the error will be detected, the connection closed
- * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. That callback then can simply call
- * `esp_mqtt_start()` to attempt an reconnection.
+ * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. The background process then reconnects on its
+ * own.
  *
  * @param topic - The topic.
  * @return Whether the operation was successful.
  */
 bool esp_mqtt_unsubscribe(const char *topic);
 
+/**
+ * Same as `esp_mqtt_unsubscribe` for the specified client.
+ */
+bool esp_mqtt_client_unsubscribe(esp_mqtt_client_t *client, const char *topic);
+
 /**
  * Publish bytes payload to specified topic.
  *
  * When false is returned the current operation failed and any subsequent interactions will also fail. This can be used
  * to handle errors early. As soon as the background process unblocks the error will be detected, the connection closed
- * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. That callback then can simply call
- * `esp_mqtt_start()` to attempt an reconnection.
+ * and the status callback invoked with `ESP_MQTT_STATUS_DISCONNECTED`. The background process then reconnects on its
+ * own.
+ *
+ * If the outbox has been configured, messages published while disconnected are stored and true is returned.
  *
  * @param topic - The topic.
  * @param payload - The payload.
@@ -123,11 +494,46 @@ bool esp_mqtt_unsubscribe(const char *topic);
  */
 bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos, bool retained);
 
+/**
+ * Same as `esp_mqtt_publish` for the specified client.
+ */
+bool esp_mqtt_client_publish(esp_mqtt_client_t *client, const char *topic, uint8_t *payload, size_t len, int qos,
+                             bool retained);
+
+/**
+ * Publish a string or bytes payload to a topic on the specified lane.
+ *
+ * `esp_mqtt_publish` uses `ESP_MQTT_LANE_NORMAL`. Only one message is in flight on the bulk lane at a time, further
+ * bulk messages wait until the previous one has been acknowledged.
+ *
+ * @param topic - The topic.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @param qos - The qos level.
+ * @param retained - The retained flag.
+ * @param lane - The lane.
+ * @return Whether the operation was successful.
+ */
+bool esp_mqtt_publish_lane(const char *topic, uint8_t *payload, size_t len, int qos, bool retained,
+                           esp_mqtt_lane_t lane);
+
+/**
+ * Same as `esp_mqtt_publish_lane` for the specified client.
+ */
+bool esp_mqtt_client_publish_lane(esp_mqtt_client_t *client, const char *topic, uint8_t *payload, size_t len, int qos,
+                                  bool retained, esp_mqtt_lane_t lane);
+
 /**
  * Stop the MQTT process.
  *
- * Will stop initial connection attempts or disconnect any active connection.
+ * Will stop initial connection attempts or disconnect any active connection. Blocks until the background process has
+ * finished its current step, so it must not be called from the status or message callbacks.
  */
 void esp_mqtt_stop();
 
+/**
+ * Same as `esp_mqtt_stop` for the specified client.
+ */
+void esp_mqtt_client_stop(esp_mqtt_client_t *client);
+
 #endif  // ESP_MQTT_H
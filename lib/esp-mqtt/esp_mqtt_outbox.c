@@ -0,0 +1,581 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(ESP_PLATFORM)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "esp_mqtt_outbox.h"
+
+#define ESP_MQTT_OUTBOX_MAGIC 0x584F424D  // "MBOX"
+#define ESP_MQTT_OUTBOX_ALIGN 4
+#define ESP_MQTT_OUTBOX_HOST_SECTOR_SIZE 4096
+#define ESP_MQTT_OUTBOX_SCAN_CHUNK 256
+
+#define ESP_MQTT_OUTBOX_STATE_PENDING 0xFFFFFFFF
+#define ESP_MQTT_OUTBOX_STATE_DONE 0x00000000
+
+/**
+ * The on-storage record header. It is followed by the topic and the payload.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t payload_len;
+    uint16_t topic_len;
+    uint8_t qos;
+    uint8_t retained;
+    uint32_t data_crc;
+    uint32_t header_crc;
+    uint32_t state;
+} esp_mqtt_outbox_record_t;
+
+/*
+ * Storage backends
+ */
+
+#if defined(ESP_PLATFORM)
+
+static bool esp_mqtt_outbox_storage_open(esp_mqtt_outbox_t* outbox, const char* storage, size_t quota) {
+    // find data partition by label
+    outbox->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, storage);
+    if (outbox->partition == NULL) {
+        return false;
+    }
+
+    outbox->size = outbox->partition->size;
+    outbox->sector_size = SPI_FLASH_SEC_SIZE;
+
+    return true;
+}
+
+static void esp_mqtt_outbox_storage_close(esp_mqtt_outbox_t* outbox) {
+    outbox->partition = NULL;
+}
+
+static bool esp_mqtt_outbox_storage_read(esp_mqtt_outbox_t* outbox, size_t offset, void* buf, size_t len) {
+    return esp_partition_read(outbox->partition, offset, buf, len) == ESP_OK;
+}
+
+static bool esp_mqtt_outbox_storage_write(esp_mqtt_outbox_t* outbox, size_t offset, const void* buf, size_t len) {
+    return esp_partition_write(outbox->partition, offset, buf, len) == ESP_OK;
+}
+
+static bool esp_mqtt_outbox_storage_erase(esp_mqtt_outbox_t* outbox, size_t offset, size_t len) {
+    return esp_partition_erase_range(outbox->partition, offset, len) == ESP_OK;
+}
+
+#else
+
+static bool esp_mqtt_outbox_storage_open(esp_mqtt_outbox_t* outbox, const char* storage, size_t quota) {
+    // open or create backing file
+    outbox->fd = open(storage, O_RDWR | O_CREAT, 0644);
+    if (outbox->fd < 0) {
+        return false;
+    }
+
+    // get current size
+    struct stat st;
+    if (fstat(outbox->fd, &st) < 0) {
+        close(outbox->fd);
+        return false;
+    }
+
+    // size a new file after the quota plus one spare sector
+    outbox->sector_size = ESP_MQTT_OUTBOX_HOST_SECTOR_SIZE;
+    bool created = st.st_size < (off_t)(2 * outbox->sector_size);
+    if (created) {
+        outbox->size = ((quota + outbox->sector_size - 1) / outbox->sector_size + 1) * outbox->sector_size;
+        if (ftruncate(outbox->fd, (off_t)outbox->size) < 0) {
+            close(outbox->fd);
+            return false;
+        }
+    } else {
+        outbox->size = (size_t)st.st_size / outbox->sector_size * outbox->sector_size;
+    }
+
+    // map file
+    outbox->map = mmap(NULL, outbox->size, PROT_READ | PROT_WRITE, MAP_SHARED, outbox->fd, 0);
+    if (outbox->map == MAP_FAILED) {
+        outbox->map = NULL;
+        close(outbox->fd);
+        return false;
+    }
+
+    // a new file starts out erased like a flash partition
+    if (created) {
+        memset(outbox->map, 0xFF, outbox->size);
+    }
+
+    return true;
+}
+
+static void esp_mqtt_outbox_storage_close(esp_mqtt_outbox_t* outbox) {
+    if (outbox->map != NULL) {
+        msync(outbox->map, outbox->size, MS_SYNC);
+        munmap(outbox->map, outbox->size);
+        outbox->map = NULL;
+    }
+    close(outbox->fd);
+}
+
+static bool esp_mqtt_outbox_storage_read(esp_mqtt_outbox_t* outbox, size_t offset, void* buf, size_t len) {
+    memcpy(buf, outbox->map + offset, len);
+    return true;
+}
+
+static bool esp_mqtt_outbox_storage_write(esp_mqtt_outbox_t* outbox, size_t offset, const void* buf, size_t len) {
+    // behave like nor flash which can only clear bits
+    const uint8_t* src = buf;
+    for (size_t i = 0; i < len; i++) {
+        outbox->map[offset + i] &= src[i];
+    }
+    return msync(outbox->map + offset / outbox->sector_size * outbox->sector_size, offset % outbox->sector_size + len, MS_ASYNC) == 0;
+}
+
+static bool esp_mqtt_outbox_storage_erase(esp_mqtt_outbox_t* outbox, size_t offset, size_t len) {
+    memset(outbox->map + offset, 0xFF, len);
+    return true;
+}
+
+#endif
+
+/*
+ * Helpers
+ */
+
+static uint32_t esp_mqtt_outbox_crc(uint32_t crc, const uint8_t* data, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t esp_mqtt_outbox_header_crc(esp_mqtt_outbox_record_t* rec) {
+    return esp_mqtt_outbox_crc(0, (const uint8_t*)rec, offsetof(esp_mqtt_outbox_record_t, header_crc));
+}
+
+static size_t esp_mqtt_outbox_span(size_t topic_len, size_t payload_len) {
+    size_t len = sizeof(esp_mqtt_outbox_record_t) + topic_len + payload_len;
+    return (len + ESP_MQTT_OUTBOX_ALIGN - 1) & ~(size_t)(ESP_MQTT_OUTBOX_ALIGN - 1);
+}
+
+static size_t esp_mqtt_outbox_distance(esp_mqtt_outbox_t* outbox, size_t from, size_t to) {
+    return (to + outbox->size - from) % outbox->size;
+}
+
+static bool esp_mqtt_outbox_read_header(esp_mqtt_outbox_t* outbox, size_t offset, esp_mqtt_outbox_record_t* rec) {
+    // check bounds
+    if (offset + sizeof(*rec) > outbox->size) {
+        return false;
+    }
+
+    // read and validate header
+    if (!esp_mqtt_outbox_storage_read(outbox, offset, rec, sizeof(*rec))) {
+        return false;
+    }
+    if (rec->magic != ESP_MQTT_OUTBOX_MAGIC || rec->header_crc != esp_mqtt_outbox_header_crc(rec)) {
+        return false;
+    }
+
+    // check that the record fits the storage
+    return offset + esp_mqtt_outbox_span(rec->topic_len, rec->payload_len) <= outbox->size;
+}
+
+static bool esp_mqtt_outbox_find(esp_mqtt_outbox_t* outbox, size_t from, uint32_t seq, size_t* offset, esp_mqtt_outbox_record_t* rec) {
+    // scan the whole ring once starting at the specified offset
+    uint32_t chunk[ESP_MQTT_OUTBOX_SCAN_CHUNK / sizeof(uint32_t)];
+    size_t len = 0;
+    for (size_t scanned = 0; scanned < outbox->size; scanned += len) {
+        size_t pos = (from + scanned) % outbox->size;
+        len = sizeof(chunk);
+        if (pos + len > outbox->size) {
+            len = outbox->size - pos;
+        }
+        if (!esp_mqtt_outbox_storage_read(outbox, pos, chunk, len)) {
+            return false;
+        }
+        for (size_t i = 0; i < len / sizeof(uint32_t); i++) {
+            if (chunk[i] != ESP_MQTT_OUTBOX_MAGIC) {
+                continue;
+            }
+            size_t candidate = pos + i * sizeof(uint32_t);
+            if (esp_mqtt_outbox_read_header(outbox, candidate, rec) && rec->seq == seq && rec->state == ESP_MQTT_OUTBOX_STATE_PENDING) {
+                *offset = candidate;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void esp_mqtt_outbox_reset(esp_mqtt_outbox_t* outbox) {
+    outbox->tail = outbox->head;
+    outbox->used = 0;
+    outbox->stats.pending = 0;
+    outbox->stats.pending_bytes = 0;
+}
+
+static bool esp_mqtt_outbox_front(esp_mqtt_outbox_t* outbox, esp_mqtt_outbox_record_t* rec) {
+    // check if empty
+    if (outbox->stats.pending == 0) {
+        return false;
+    }
+
+    // the oldest record is usually right at the tail
+    uint32_t seq = outbox->next_seq - outbox->stats.pending;
+    if (esp_mqtt_outbox_read_header(outbox, outbox->tail, rec) && rec->seq == seq && rec->state == ESP_MQTT_OUTBOX_STATE_PENDING) {
+        return true;
+    }
+
+    // otherwise space has been skipped when the head wrapped around or recovered from a torn write
+    size_t offset;
+    if (!esp_mqtt_outbox_find(outbox, outbox->tail, seq, &offset, rec)) {
+        // the ring is inconsistent and can only be dropped
+        outbox->stats.failed += outbox->stats.pending;
+        esp_mqtt_outbox_reset(outbox);
+        return false;
+    }
+
+    // account skipped space
+    size_t skipped = esp_mqtt_outbox_distance(outbox, outbox->tail, offset);
+    outbox->used = (outbox->used > skipped) ? outbox->used - skipped : 0;
+    outbox->tail = offset;
+
+    return true;
+}
+
+static void esp_mqtt_outbox_drop_front(esp_mqtt_outbox_t* outbox, esp_mqtt_outbox_record_t* rec) {
+    // mark record as consumed
+    uint32_t state = ESP_MQTT_OUTBOX_STATE_DONE;
+    if (!esp_mqtt_outbox_storage_write(outbox, outbox->tail + offsetof(esp_mqtt_outbox_record_t, state), &state, sizeof(state))) {
+        outbox->stats.failed++;
+    }
+
+    // advance tail
+    size_t span = esp_mqtt_outbox_span(rec->topic_len, rec->payload_len);
+    outbox->tail = (outbox->tail + span) % outbox->size;
+    outbox->used = (outbox->used > span) ? outbox->used - span : 0;
+    outbox->stats.pending--;
+    if (outbox->stats.pending == 0) {
+        esp_mqtt_outbox_reset(outbox);
+    }
+    outbox->stats.pending_bytes = outbox->used;
+}
+
+static bool esp_mqtt_outbox_evict(esp_mqtt_outbox_t* outbox) {
+    // only the oldest records may be evicted
+    if (outbox->policy != ESP_MQTT_OUTBOX_DROP_OLDEST) {
+        return false;
+    }
+
+    esp_mqtt_outbox_record_t rec;
+    if (!esp_mqtt_outbox_front(outbox, &rec)) {
+        return false;
+    }
+
+    esp_mqtt_outbox_drop_front(outbox, &rec);
+    outbox->stats.evicted++;
+
+    return true;
+}
+
+static bool esp_mqtt_outbox_prepare(esp_mqtt_outbox_t* outbox, size_t end) {
+    // erase sectors in front of the head until the range up to end is writable
+    while (outbox->erased < end) {
+        // evict queued records that live in the sector to be erased
+        size_t sector_end = outbox->erased + outbox->sector_size;
+        while (outbox->stats.pending > 0 && esp_mqtt_outbox_distance(outbox, outbox->head, outbox->tail) < sector_end - outbox->head) {
+            if (!esp_mqtt_outbox_evict(outbox)) {
+                return false;
+            }
+        }
+
+        // erase sector
+        if (!esp_mqtt_outbox_storage_erase(outbox, outbox->erased, outbox->sector_size)) {
+            outbox->stats.failed++;
+            return false;
+        }
+        outbox->erased = sector_end;
+    }
+
+    return true;
+}
+
+static void esp_mqtt_outbox_recover(esp_mqtt_outbox_t* outbox) {
+    // prepare state
+    bool found = false;
+    bool found_pending = false;
+    uint32_t max_seq = 0;
+    uint32_t min_pending_seq = 0;
+    uint32_t pending = 0;
+    size_t max_offset = 0;
+    size_t min_pending_offset = 0;
+    esp_mqtt_outbox_record_t rec;
+    esp_mqtt_outbox_record_t max_rec = {0};
+
+    // scan storage for valid records
+    uint32_t chunk[ESP_MQTT_OUTBOX_SCAN_CHUNK / sizeof(uint32_t)];
+    for (size_t pos = 0; pos < outbox->size; pos += sizeof(chunk)) {
+        if (!esp_mqtt_outbox_storage_read(outbox, pos, chunk, sizeof(chunk))) {
+            outbox->stats.failed++;
+            break;
+        }
+        for (size_t i = 0; i < sizeof(chunk) / sizeof(uint32_t); i++) {
+            size_t offset = pos + i * sizeof(uint32_t);
+            if (chunk[i] != ESP_MQTT_OUTBOX_MAGIC || !esp_mqtt_outbox_read_header(outbox, offset, &rec)) {
+                continue;
+            }
+            if (!found || (int32_t)(rec.seq - max_seq) > 0) {
+                found = true;
+                max_seq = rec.seq;
+                max_offset = offset;
+                max_rec = rec;
+            }
+            if (rec.state == ESP_MQTT_OUTBOX_STATE_PENDING) {
+                pending++;
+                if (!found_pending || (int32_t)(rec.seq - min_pending_seq) < 0) {
+                    found_pending = true;
+                    min_pending_seq = rec.seq;
+                    min_pending_offset = offset;
+                }
+            }
+        }
+    }
+
+    // start with an empty ring
+    outbox->head = 0;
+    outbox->next_seq = 1;
+    if (found) {
+        outbox->head = (max_offset + esp_mqtt_outbox_span(max_rec.topic_len, max_rec.payload_len)) % outbox->size;
+        outbox->next_seq = max_seq + 1;
+    }
+
+    // make sure the remainder of the head sector is still erased, otherwise continue at the next sector
+    size_t sector_end = (outbox->head / outbox->sector_size + 1) * outbox->sector_size;
+    if (outbox->head % outbox->sector_size == 0) {
+        sector_end = outbox->head;
+    }
+    uint8_t byte;
+    for (size_t pos = outbox->head; pos < sector_end; pos++) {
+        if (!esp_mqtt_outbox_storage_read(outbox, pos, &byte, 1) || byte != 0xFF) {
+            outbox->head = sector_end % outbox->size;
+            sector_end = outbox->head;
+            break;
+        }
+    }
+    outbox->erased = sector_end;
+
+    // restore pending range
+    esp_mqtt_outbox_reset(outbox);
+    if (found_pending) {
+        outbox->tail = min_pending_offset;
+        outbox->used = esp_mqtt_outbox_distance(outbox, outbox->tail, outbox->head);
+        if (outbox->used == 0) {
+            outbox->used = outbox->size;
+        }
+        outbox->stats.pending = (outbox->next_seq - min_pending_seq < pending) ? outbox->next_seq - min_pending_seq : pending;
+        outbox->stats.pending_bytes = outbox->used;
+    }
+}
+
+/*
+ * Public Methods
+ */
+
+bool esp_mqtt_outbox_open(esp_mqtt_outbox_t* outbox, const char* storage, size_t quota, uint32_t max_messages, esp_mqtt_outbox_policy_t policy) {
+    // close if open
+    esp_mqtt_outbox_close(outbox);
+
+    // reset state
+    memset(outbox, 0, sizeof(*outbox));
+
+    // open storage
+    if (!esp_mqtt_outbox_storage_open(outbox, storage, quota)) {
+        return false;
+    }
+
+    // one sector is always kept free so that the head can be erased without touching the tail
+    if (outbox->size < 2 * outbox->sector_size) {
+        esp_mqtt_outbox_storage_close(outbox);
+        return false;
+    }
+    if (quota == 0 || quota > outbox->size - outbox->sector_size) {
+        quota = outbox->size - outbox->sector_size;
+    }
+
+    // set configuration
+    outbox->quota = quota;
+    outbox->max_messages = max_messages;
+    outbox->policy = policy;
+
+    // recover messages from a previous run
+    esp_mqtt_outbox_recover(outbox);
+
+    // set flag
+    outbox->open = true;
+
+    return true;
+}
+
+void esp_mqtt_outbox_close(esp_mqtt_outbox_t* outbox) {
+    // check if open
+    if (!outbox->open) {
+        return;
+    }
+
+    esp_mqtt_outbox_storage_close(outbox);
+    outbox->open = false;
+}
+
+bool esp_mqtt_outbox_push(esp_mqtt_outbox_t* outbox, const char* topic, const uint8_t* payload, size_t len, int qos, bool retained) {
+    // check if open
+    if (!outbox->open) {
+        return false;
+    }
+
+    // check if the record can be stored at all
+    size_t topic_len = strlen(topic);
+    size_t span = esp_mqtt_outbox_span(topic_len, len);
+    if (topic_len > UINT16_MAX || span > outbox->quota) {
+        outbox->stats.rejected++;
+        return false;
+    }
+
+    // space at the end of the storage that will be skipped if the record does not fit in front of it
+    size_t skip = (outbox->head + span > outbox->size) ? outbox->size - outbox->head : 0;
+
+    // enforce quota and message limit
+    while (outbox->stats.pending > 0 &&
+           (outbox->used + skip + span > outbox->quota || (outbox->max_messages > 0 && outbox->stats.pending >= outbox->max_messages))) {
+        if (!esp_mqtt_outbox_evict(outbox)) {
+            outbox->stats.rejected++;
+            return false;
+        }
+    }
+
+    // wrap around
+    if (skip > 0) {
+        if (outbox->stats.pending > 0) {
+            outbox->used += skip;
+        }
+        outbox->head = 0;
+        outbox->erased = 0;
+        if (outbox->stats.pending == 0) {
+            outbox->tail = 0;
+        }
+    }
+
+    // make room in front of the head
+    if (!esp_mqtt_outbox_prepare(outbox, outbox->head + span)) {
+        outbox->stats.rejected++;
+        return false;
+    }
+
+    // prepare header
+    esp_mqtt_outbox_record_t rec;
+    rec.magic = ESP_MQTT_OUTBOX_MAGIC;
+    rec.seq = outbox->next_seq;
+    rec.payload_len = (uint32_t)len;
+    rec.topic_len = (uint16_t)topic_len;
+    rec.qos = (uint8_t)qos;
+    rec.retained = retained;
+    rec.data_crc = esp_mqtt_outbox_crc(esp_mqtt_outbox_crc(0, (const uint8_t*)topic, topic_len), payload, len);
+    rec.header_crc = esp_mqtt_outbox_header_crc(&rec);
+    rec.state = ESP_MQTT_OUTBOX_STATE_PENDING;
+
+    // write data before the header so that a valid header always refers to complete data
+    size_t offset = outbox->head;
+    if (!esp_mqtt_outbox_storage_write(outbox, offset + sizeof(rec), topic, topic_len) ||
+        (len > 0 && !esp_mqtt_outbox_storage_write(outbox, offset + sizeof(rec) + topic_len, payload, len)) ||
+        !esp_mqtt_outbox_storage_write(outbox, offset, &rec, sizeof(rec))) {
+        outbox->stats.failed++;
+        return false;
+    }
+
+    // advance head
+    if (outbox->stats.pending == 0) {
+        outbox->tail = offset;
+    }
+    outbox->head = offset + span;
+    if (outbox->head >= outbox->size) {
+        outbox->head = 0;
+        outbox->erased = 0;
+    }
+    outbox->used += span;
+    outbox->next_seq++;
+
+    // update counters
+    outbox->stats.appended++;
+    outbox->stats.pending++;
+    outbox->stats.pending_bytes = outbox->used;
+
+    return true;
+}
+
+bool esp_mqtt_outbox_peek(esp_mqtt_outbox_t* outbox, esp_mqtt_outbox_message_t* msg) {
+    // check if open
+    if (!outbox->open) {
+        return false;
+    }
+
+    esp_mqtt_outbox_record_t rec;
+    while (esp_mqtt_outbox_front(outbox, &rec)) {
+        // allocate buffers with additional null termination
+        msg->topic = malloc((size_t)rec.topic_len + 1);
+        msg->payload = malloc((size_t)rec.payload_len + 1);
+        if (msg->topic == NULL || msg->payload == NULL) {
+            esp_mqtt_outbox_release(msg);
+            return false;
+        }
+
+        // read data
+        size_t offset = outbox->tail + sizeof(rec);
+        bool ok = esp_mqtt_outbox_storage_read(outbox, offset, msg->topic, rec.topic_len) &&
+                  esp_mqtt_outbox_storage_read(outbox, offset + rec.topic_len, msg->payload, rec.payload_len);
+        msg->topic[rec.topic_len] = 0;
+        msg->payload[rec.payload_len] = 0;
+
+        // verify data
+        if (ok && rec.data_crc == esp_mqtt_outbox_crc(esp_mqtt_outbox_crc(0, (uint8_t*)msg->topic, rec.topic_len), msg->payload, rec.payload_len)) {
+            msg->seq = rec.seq;
+            msg->payload_len = rec.payload_len;
+            msg->qos = rec.qos;
+            msg->retained = rec.retained;
+            return true;
+        }
+
+        // drop corrupt record
+        esp_mqtt_outbox_release(msg);
+        esp_mqtt_outbox_drop_front(outbox, &rec);
+        outbox->stats.failed++;
+    }
+
+    return false;
+}
+
+void esp_mqtt_outbox_pop(esp_mqtt_outbox_t* outbox, esp_mqtt_outbox_message_t* msg) {
+    // consume record if it is still the oldest one
+    esp_mqtt_outbox_record_t rec;
+    if (outbox->open && esp_mqtt_outbox_front(outbox, &rec) && rec.seq == msg->seq) {
+        esp_mqtt_outbox_drop_front(outbox, &rec);
+        outbox->stats.replayed++;
+    }
+
+    esp_mqtt_outbox_release(msg);
+}
+
+void esp_mqtt_outbox_release(esp_mqtt_outbox_message_t* msg) {
+    free(msg->topic);
+    free(msg->payload);
+    msg->topic = NULL;
+    msg->payload = NULL;
+}
@@ -0,0 +1,136 @@
+#ifndef ESP_MQTT_OUTBOX_H
+#define ESP_MQTT_OUTBOX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(ESP_PLATFORM)
+#include <esp_partition.h>
+#endif
+
+/**
+ * The policy applied when a new message does not fit into the outbox anymore.
+ */
+typedef enum esp_mqtt_outbox_policy_t {
+    ESP_MQTT_OUTBOX_DROP_OLDEST,  // evict the oldest queued messages to make room
+    ESP_MQTT_OUTBOX_DROP_NEWEST   // reject the new message
+} esp_mqtt_outbox_policy_t;
+
+/**
+ * The counters exposed by the outbox.
+ */
+typedef struct {
+    uint32_t appended;     // messages stored while the broker was unreachable
+    uint32_t replayed;     // messages delivered from the outbox after a reconnect
+    uint32_t evicted;      // queued messages dropped to make room for newer ones
+    uint32_t rejected;     // messages refused because of the quota or policy
+    uint32_t failed;       // storage errors and corrupt records
+    uint32_t pending;      // messages currently waiting to be replayed
+    size_t pending_bytes;  // storage currently occupied by waiting messages
+} esp_mqtt_outbox_stats_t;
+
+/**
+ * The outbox object.
+ *
+ * The outbox is a log-structured ring of records on a flash partition (device) or a memory mapped file (host). Records
+ * are appended at the head and consumed in sequence order from the tail. A consumed record is marked by clearing its
+ * state word which only needs a 1 -> 0 transition and thus no erase.
+ */
+typedef struct {
+#if defined(ESP_PLATFORM)
+    const esp_partition_t *partition;
+#else
+    int fd;
+    uint8_t *map;
+#endif
+    size_t size;
+    size_t sector_size;
+
+    size_t quota;
+    uint32_t max_messages;
+    esp_mqtt_outbox_policy_t policy;
+
+    size_t head;
+    size_t tail;
+    size_t erased;
+    size_t used;
+    uint32_t next_seq;
+
+    bool open;
+    esp_mqtt_outbox_stats_t stats;
+} esp_mqtt_outbox_t;
+
+/**
+ * The meta data of a queued message.
+ */
+typedef struct {
+    uint32_t seq;
+    char *topic;
+    uint8_t *payload;
+    size_t payload_len;
+    int qos;
+    bool retained;
+} esp_mqtt_outbox_message_t;
+
+/**
+ * Open the outbox on the specified storage and recover queued messages.
+ *
+ * @param outbox - The outbox object.
+ * @param storage - The partition label (device) or file path (host).
+ * @param quota - The maximum amount of bytes occupied by queued messages.
+ * @param max_messages - The maximum amount of queued messages (0 for no limit).
+ * @param policy - The policy applied if the quota is exceeded.
+ * @return Whether the outbox could be opened.
+ */
+bool esp_mqtt_outbox_open(esp_mqtt_outbox_t *outbox, const char *storage, size_t quota, uint32_t max_messages,
+                          esp_mqtt_outbox_policy_t policy);
+
+/**
+ * Close the outbox. Queued messages stay on the storage.
+ *
+ * @param outbox - The outbox object.
+ */
+void esp_mqtt_outbox_close(esp_mqtt_outbox_t *outbox);
+
+/**
+ * Append a message to the outbox.
+ *
+ * @param outbox - The outbox object.
+ * @param topic - The topic.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @param qos - The qos level.
+ * @param retained - The retained flag.
+ * @return Whether the message has been stored.
+ */
+bool esp_mqtt_outbox_push(esp_mqtt_outbox_t *outbox, const char *topic, const uint8_t *payload, size_t len, int qos,
+                          bool retained);
+
+/**
+ * Read the oldest queued message.
+ *
+ * The topic and payload are allocated and must be released using `esp_mqtt_outbox_release`.
+ *
+ * @param outbox - The outbox object.
+ * @param msg - The message that will be filled.
+ * @return Whether a message is available.
+ */
+bool esp_mqtt_outbox_peek(esp_mqtt_outbox_t *outbox, esp_mqtt_outbox_message_t *msg);
+
+/**
+ * Mark the oldest queued message as delivered and release the memory obtained by `esp_mqtt_outbox_peek`.
+ *
+ * @param outbox - The outbox object.
+ * @param msg - The message returned by `esp_mqtt_outbox_peek`.
+ */
+void esp_mqtt_outbox_pop(esp_mqtt_outbox_t *outbox, esp_mqtt_outbox_message_t *msg);
+
+/**
+ * Release the memory obtained by `esp_mqtt_outbox_peek` without consuming the message.
+ *
+ * @param msg - The message returned by `esp_mqtt_outbox_peek`.
+ */
+void esp_mqtt_outbox_release(esp_mqtt_outbox_message_t *msg);
+
+#endif  // ESP_MQTT_OUTBOX_H
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_mqtt_router.h"
+
+#define ESP_MQTT_ROUTER_INITIAL_CAPACITY 16  // edges, power of two
+
+typedef struct esp_mqtt_router_route {
+    esp_mqtt_route_handler_t handler;
+    void* ctx;
+    struct esp_mqtt_router_route* next;
+} esp_mqtt_router_route_t;
+
+struct esp_mqtt_router_node {
+    esp_mqtt_router_node_t* next;     // list of all nodes, used to free them
+    esp_mqtt_router_node_t* plus;     // child of a `+` level
+    esp_mqtt_router_route_t* routes;  // routes whose filter ends at this node
+    esp_mqtt_router_route_t* rest;    // routes whose filter continues with `#`
+    size_t len;
+    char level[];
+};
+
+static uint32_t esp_mqtt_router_hash(const esp_mqtt_router_node_t* parent, const char* level, size_t len) {
+    // FNV-1a over the level seeded with the parent
+    uint32_t hash = 2166136261u ^ (uint32_t)(uintptr_t)parent;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)level[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static esp_mqtt_router_node_t* esp_mqtt_router_node(esp_mqtt_router_t* router, const char* level, size_t len) {
+    // allocate node with level
+    esp_mqtt_router_node_t* node = calloc(1, sizeof(esp_mqtt_router_node_t) + len + 1);
+    if (node == NULL) {
+        return NULL;
+    }
+    node->len = len;
+    memcpy(node->level, level, len);
+
+    // link node behind the root
+    if (router->root != NULL) {
+        node->next = router->root->next;
+        router->root->next = node;
+    }
+
+    return node;
+}
+
+static esp_mqtt_router_node_t* esp_mqtt_router_lookup(esp_mqtt_router_t* router, const esp_mqtt_router_node_t* parent, const char* level, size_t len) {
+    // probe table
+    uint32_t hash = esp_mqtt_router_hash(parent, level, len);
+    size_t mask = router->capacity - 1;
+    for (size_t i = hash & mask; router->edges[i].child != NULL; i = (i + 1) & mask) {
+        esp_mqtt_router_edge_t* edge = &router->edges[i];
+        if (edge->hash == hash && edge->parent == parent && edge->child->len == len && memcmp(edge->child->level, level, len) == 0) {
+            return edge->child;
+        }
+    }
+
+    return NULL;
+}
+
+static void esp_mqtt_router_insert(esp_mqtt_router_edge_t* edges, size_t capacity, esp_mqtt_router_edge_t edge) {
+    // store edge in the first free slot
+    size_t mask = capacity - 1;
+    size_t i = edge.hash & mask;
+    while (edges[i].child != NULL) {
+        i = (i + 1) & mask;
+    }
+    edges[i] = edge;
+}
+
+static bool esp_mqtt_router_grow(esp_mqtt_router_t* router) {
+    // keep the load below 3/4
+    if ((router->count + 1) * 4 <= router->capacity * 3) {
+        return true;
+    }
+
+    // allocate larger table
+    size_t capacity = router->capacity * 2;
+    esp_mqtt_router_edge_t* edges = calloc(capacity, sizeof(esp_mqtt_router_edge_t));
+    if (edges == NULL) {
+        return false;
+    }
+
+    // move edges
+    for (size_t i = 0; i < router->capacity; i++) {
+        if (router->edges[i].child != NULL) {
+            esp_mqtt_router_insert(edges, capacity, router->edges[i]);
+        }
+    }
+
+    free(router->edges);
+    router->edges = edges;
+    router->capacity = capacity;
+
+    return true;
+}
+
+static esp_mqtt_router_node_t* esp_mqtt_router_child(esp_mqtt_router_t* router, esp_mqtt_router_node_t* parent, const char* level, size_t len) {
+    // use the dedicated child of `+`
+    if (len == 1 && level[0] == '+') {
+        if (parent->plus == NULL) {
+            parent->plus = esp_mqtt_router_node(router, level, len);
+        }
+        return parent->plus;
+    }
+
+    // find existing child
+    esp_mqtt_router_node_t* child = esp_mqtt_router_lookup(router, parent, level, len);
+    if (child != NULL) {
+        return child;
+    }
+
+    // create child
+    if (!esp_mqtt_router_grow(router)) {
+        return NULL;
+    }
+    child = esp_mqtt_router_node(router, level, len);
+    if (child == NULL) {
+        return NULL;
+    }
+
+    // add edge
+    esp_mqtt_router_edge_t edge = {.parent = parent, .child = child, .hash = esp_mqtt_router_hash(parent, level, len)};
+    esp_mqtt_router_insert(router->edges, router->capacity, edge);
+    router->count++;
+
+    return child;
+}
+
+static void esp_mqtt_router_call(esp_mqtt_router_route_t* route, const char* topic, uint8_t* payload, size_t len, size_t* count) {
+    for (; route != NULL; route = route->next) {
+        route->handler(topic, payload, len, route->ctx);
+        (*count)++;
+    }
+}
+
+static void esp_mqtt_router_match(esp_mqtt_router_t* router, const esp_mqtt_router_node_t* node, const char* level, bool first, const char* topic,
+                                  uint8_t* payload, size_t len, size_t* count) {
+    // wildcards at the first level do not match system topics
+    bool wild = !first || level[0] != '$';
+
+    // `#` also matches the parent level
+    if (wild) {
+        esp_mqtt_router_call(node->rest, topic, payload, len, count);
+    }
+
+    // call routes if the topic ends here
+    if (level == NULL) {
+        esp_mqtt_router_call(node->routes, topic, payload, len, count);
+        return;
+    }
+
+    // get the current level and the start of the next one
+    const char* end = strchr(level, '/');
+    size_t level_len = end != NULL ? (size_t)(end - level) : strlen(level);
+    const char* next = end != NULL ? end + 1 : NULL;
+
+    // follow plain child
+    const esp_mqtt_router_node_t* child = esp_mqtt_router_lookup(router, node, level, level_len);
+    if (child != NULL) {
+        esp_mqtt_router_match(router, child, next, false, topic, payload, len, count);
+    }
+
+    // follow `+` child
+    if (node->plus != NULL && wild) {
+        esp_mqtt_router_match(router, node->plus, next, false, topic, payload, len, count);
+    }
+}
+
+bool esp_mqtt_router_init(esp_mqtt_router_t* router) {
+    // allocate root and table
+    router->root = NULL;
+    router->root = esp_mqtt_router_node(router, "", 0);
+    router->edges = calloc(ESP_MQTT_ROUTER_INITIAL_CAPACITY, sizeof(esp_mqtt_router_edge_t));
+    router->capacity = ESP_MQTT_ROUTER_INITIAL_CAPACITY;
+    router->count = 0;
+    if (router->root == NULL || router->edges == NULL) {
+        esp_mqtt_router_free(router);
+        return false;
+    }
+
+    return true;
+}
+
+bool esp_mqtt_router_add(esp_mqtt_router_t* router, const char* filter, esp_mqtt_route_handler_t handler, void* ctx) {
+    // check arguments
+    if (filter == NULL || filter[0] == 0 || handler == NULL) {
+        return false;
+    }
+
+    // allocate route
+    esp_mqtt_router_route_t* route = calloc(1, sizeof(esp_mqtt_router_route_t));
+    if (route == NULL) {
+        return false;
+    }
+    route->handler = handler;
+    route->ctx = ctx;
+
+    // walk down the levels and create missing nodes
+    esp_mqtt_router_node_t* node = router->root;
+    const char* level = filter;
+    for (;;) {
+        const char* end = strchr(level, '/');
+        size_t len = end != NULL ? (size_t)(end - level) : strlen(level);
+
+        // `#` must be the last level and stands alone
+        if (len == 1 && level[0] == '#') {
+            if (end != NULL) {
+                free(route);
+                return false;
+            }
+            route->next = node->rest;
+            node->rest = route;
+            return true;
+        }
+
+        // wildcards may not be mixed with other characters
+        if (len > 1 && (memchr(level, '+', len) != NULL || memchr(level, '#', len) != NULL)) {
+            free(route);
+            return false;
+        }
+
+        // descend
+        node = esp_mqtt_router_child(router, node, level, len);
+        if (node == NULL) {
+            free(route);
+            return false;
+        }
+
+        // add route to the last level
+        if (end == NULL) {
+            route->next = node->routes;
+            node->routes = route;
+            return true;
+        }
+
+        level = end + 1;
+    }
+}
+
+size_t esp_mqtt_router_dispatch(esp_mqtt_router_t* router, const char* topic, uint8_t* payload, size_t len) {
+    // match topic from the root
+    size_t count = 0;
+    if (router->root != NULL) {
+        esp_mqtt_router_match(router, router->root, topic, true, topic, payload, len, &count);
+    }
+
+    return count;
+}
+
+static void esp_mqtt_router_free_routes(esp_mqtt_router_route_t* route) {
+    while (route != NULL) {
+        esp_mqtt_router_route_t* next = route->next;
+        free(route);
+        route = next;
+    }
+}
+
+void esp_mqtt_router_free(esp_mqtt_router_t* router) {
+    // free all nodes and their routes
+    esp_mqtt_router_node_t* node = router->root;
+    while (node != NULL) {
+        esp_mqtt_router_node_t* next = node->next;
+        esp_mqtt_router_free_routes(node->routes);
+        esp_mqtt_router_free_routes(node->rest);
+        free(node);
+        node = next;
+    }
+
+    // free table
+    free(router->edges);
+    router->root = NULL;
+    router->edges = NULL;
+    router->capacity = 0;
+    router->count = 0;
+}
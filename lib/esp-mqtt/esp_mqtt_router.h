@@ -0,0 +1,77 @@
+#ifndef ESP_MQTT_ROUTER_H
+#define ESP_MQTT_ROUTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The handler of a route.
+ */
+typedef void (*esp_mqtt_route_handler_t)(const char *topic, uint8_t *payload, size_t len, void *ctx);
+
+typedef struct esp_mqtt_router_node esp_mqtt_router_node_t;
+
+/**
+ * An edge from a node to the child of a plain topic level.
+ */
+typedef struct {
+    esp_mqtt_router_node_t *parent;
+    esp_mqtt_router_node_t *child;
+    uint32_t hash;
+} esp_mqtt_router_edge_t;
+
+/**
+ * The router object.
+ *
+ * Filters are stored as a trie of topic levels. The plain children of all nodes share one open addressing table keyed
+ * by the parent and the level, `+` and `#` hang off their parent directly. Matching a topic therefore costs one table
+ * lookup per level regardless of the number of routes and does not allocate memory.
+ */
+typedef struct {
+    esp_mqtt_router_node_t *root;
+    esp_mqtt_router_edge_t *edges;
+    size_t capacity;
+    size_t count;
+} esp_mqtt_router_t;
+
+/**
+ * Initialize the router.
+ *
+ * @param router - The router object.
+ * @return Whether the memory could be allocated.
+ */
+bool esp_mqtt_router_init(esp_mqtt_router_t *router);
+
+/**
+ * Add a route. Several routes may use the same filter.
+ *
+ * @param router - The router object.
+ * @param filter - The topic filter, may contain `+` and a trailing `#`.
+ * @param handler - The handler.
+ * @param ctx - The context passed to the handler.
+ * @return Whether the filter was valid and the memory could be allocated.
+ */
+bool esp_mqtt_router_add(esp_mqtt_router_t *router, const char *filter, esp_mqtt_route_handler_t handler, void *ctx);
+
+/**
+ * Call the handlers of all routes that match the topic.
+ *
+ * Wildcards at the first level do not match topics starting with `$`.
+ *
+ * @param router - The router object.
+ * @param topic - The topic.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @return The number of called handlers.
+ */
+size_t esp_mqtt_router_dispatch(esp_mqtt_router_t *router, const char *topic, uint8_t *payload, size_t len);
+
+/**
+ * Free all routes.
+ *
+ * @param router - The router object.
+ */
+void esp_mqtt_router_free(esp_mqtt_router_t *router);
+
+#endif  // ESP_MQTT_ROUTER_H
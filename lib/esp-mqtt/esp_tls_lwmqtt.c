@@ -1,45 +1,72 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <lwip/netdb.h>
+#include <mbedtls/ssl_internal.h>
 #include <string.h>  // needed
 
 // mbed TLS documentation: https://tls.mbed.org
 
 #include "esp_tls_lwmqtt.h"
 
-lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, char *host, char *port) {
-  // disconnect if not already the case
-  esp_tls_lwmqtt_network_disconnect(network);
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+static unsigned char esp_tls_lwmqtt_network_mfl(size_t budget) {
+  // use the default record size without a budget
+  if (budget == 0) {
+    return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+  }
+
+  // calculate the usable content length per direction
+  size_t overhead = MBEDTLS_SSL_OUT_BUFFER_LEN - MBEDTLS_SSL_OUT_CONTENT_LEN;
+  size_t content = budget / 2 > overhead ? budget / 2 - overhead : 0;
+  if (content > MBEDTLS_SSL_IN_CONTENT_LEN) {
+    content = MBEDTLS_SSL_IN_CONTENT_LEN;
+  }
+
+  // select largest fitting fragment length
+  if (content >= 4096) {
+    return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+  } else if (content >= 2048) {
+    return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+  } else if (content >= 1024) {
+    return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+  }
+
+  return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+}
+#endif
+
+static int esp_tls_lwmqtt_network_prepare(esp_tls_lwmqtt_network_t *network) {
+  // keep state of previous connections
+  if (network->prepared) {
+    return 0;
+  }
 
   // initialize support structures
-  mbedtls_net_init(&network->socket);
-  mbedtls_ssl_init(&network->ssl);
   mbedtls_ssl_config_init(&network->conf);
   mbedtls_x509_crt_init(&network->cacert);
   mbedtls_ctr_drbg_init(&network->ctr_drbg);
   mbedtls_entropy_init(&network->entropy);
+  mbedtls_ssl_session_init(&network->session);
+  network->prepared = true;
+  network->resumable = false;
 
   // setup entropy source
   int ret = mbedtls_ctr_drbg_seed(&network->ctr_drbg, mbedtls_entropy_func, &network->entropy, NULL, 0);
   if (ret != 0) {
-    return LWMQTT_NETWORK_FAILED_CONNECT;
+    return ret;
   }
 
   // parse ca certificate
   ret = mbedtls_x509_crt_parse(&network->cacert, network->ca_buf, network->ca_len);
   if (ret != 0) {
-    return LWMQTT_NETWORK_FAILED_CONNECT;
-  }
-
-  // connect socket
-  ret = mbedtls_net_connect(&network->socket, host, port, MBEDTLS_NET_PROTO_TCP);
-  if (ret != 0) {
-    return LWMQTT_NETWORK_FAILED_CONNECT;
+    return ret;
   }
 
   // load defaults
   ret = mbedtls_ssl_config_defaults(&network->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
                                     MBEDTLS_SSL_PRESET_DEFAULT);
   if (ret != 0) {
-    return LWMQTT_NETWORK_FAILED_CONNECT;
+    return ret;
   }
 
   // set ca certificate
@@ -51,6 +78,60 @@ lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, c
   // set rng callback
   mbedtls_ssl_conf_rng(&network->conf, mbedtls_ctr_drbg_random, &network->ctr_drbg);
 
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  // limit record size to the buffer budget
+  ret = mbedtls_ssl_conf_max_frag_len(&network->conf, esp_tls_lwmqtt_network_mfl(network->budget));
+  if (ret != 0) {
+    return ret;
+  }
+#endif
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  // request session tickets
+  mbedtls_ssl_conf_session_tickets(&network->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+  return 0;
+}
+
+void esp_tls_lwmqtt_network_release(esp_tls_lwmqtt_network_t *network) {
+  // check if network is prepared
+  if (!network || !network->prepared) {
+    return;
+  }
+
+  // cleanup retained resources
+  mbedtls_ssl_session_free(&network->session);
+  mbedtls_x509_crt_free(&network->cacert);
+  mbedtls_entropy_free(&network->entropy);
+  mbedtls_ssl_config_free(&network->conf);
+  mbedtls_ctr_drbg_free(&network->ctr_drbg);
+  network->prepared = false;
+  network->resumable = false;
+}
+
+lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, char *host, char *port) {
+  // disconnect if not already the case
+  esp_tls_lwmqtt_network_disconnect(network);
+
+  // initialize connection structures
+  mbedtls_net_init(&network->socket);
+  mbedtls_ssl_init(&network->ssl);
+
+  // setup or reuse random generator, ca chain and configuration
+  int ret = esp_tls_lwmqtt_network_prepare(network);
+  if (ret != 0) {
+    ESP_LOGE("esp_tls_lwmqtt_network_prepare", "ERROR: -0x%x", -ret);
+    esp_tls_lwmqtt_network_release(network);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // connect socket
+  ret = mbedtls_net_connect(&network->socket, host, port, MBEDTLS_NET_PROTO_TCP);
+  if (ret != 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
   // setup ssl context
   ret = mbedtls_ssl_setup(&network->ssl, &network->conf);
   if (ret != 0) {
@@ -63,6 +144,14 @@ lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, c
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
+  // offer the previous session for resumption
+  if (network->resumable) {
+    ret = mbedtls_ssl_set_session(&network->ssl, &network->session);
+    if (ret != 0) {
+      network->resumable = false;
+    }
+  }
+
   // set bio callbacks
   mbedtls_ssl_set_bio(&network->ssl, &network->socket, mbedtls_net_send, mbedtls_net_recv, NULL);
 
@@ -76,16 +165,41 @@ lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, c
     }
   }
 
-  // perform handshake
-  ret = mbedtls_ssl_handshake(&network->ssl);
+  // perform handshake step by step, the flag set for an offered session is only kept by the server hello if the
+  // server accepted it, so it is read once right after that message was parsed
+  uint32_t start = xTaskGetTickCount();
+  bool resumed = false;
+  bool hello = false;
+  ret = 0;
+  while (ret == 0 && network->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+    ret = mbedtls_ssl_handshake_step(&network->ssl);
+    if (!hello && network->ssl.state > MBEDTLS_SSL_SERVER_HELLO && network->ssl.handshake != NULL) {
+      resumed = network->ssl.handshake->resume != 0;
+      hello = true;
+    }
+  }
   if (ret != 0) {
     if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
       ESP_LOGE("mbedtls_ssl_handshake", "ERORR: -0x%x", -ret);
     }
 
+    // do not offer a session that may have caused the failure again
+    network->resumable = false;
+
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
+  // update stats
+  network->handshake_time = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+  network->handshakes++;
+  if (resumed) {
+    network->resumptions++;
+  }
+  ESP_LOGI("mbedtls_ssl_handshake", "%s handshake in %u ms", resumed ? "resumed" : "full", network->handshake_time);
+
+  // save session for the next connection
+  network->resumable = mbedtls_ssl_get_session(&network->ssl, &network->session) == 0;
+
   return LWMQTT_SUCCESS;
 }
 
@@ -120,12 +234,8 @@ void esp_tls_lwmqtt_network_disconnect(esp_tls_lwmqtt_network_t *network) {
     return;
   }
 
-  // cleanup resources
+  // cleanup connection resources, the configuration and session are kept for the next connection
   mbedtls_ssl_close_notify(&network->ssl);
-  mbedtls_x509_crt_free(&network->cacert);
-  mbedtls_entropy_free(&network->entropy);
-  mbedtls_ssl_config_free(&network->conf);
-  mbedtls_ctr_drbg_free(&network->ctr_drbg);
   mbedtls_ssl_free(&network->ssl);
   mbedtls_net_free(&network->socket);
 }
@@ -14,6 +14,13 @@
 
 /**
  * The tls lwmqtt network object for the esp platform.
+ *
+ * The entropy source, random generator, parsed CA chain and ssl configuration are set up on the first connect and kept
+ * until `esp_tls_lwmqtt_network_release` is called. The negotiated session is kept in RAM to resume the next handshake
+ * using a session ticket or session id if the server supports it.
+ *
+ * If a budget is set, the largest max_fragment_length whose in and out record buffers fit into it is negotiated. The
+ * incoming record buffer must still hold 16 KB if the broker may ignore the extension.
  */
 typedef struct {
   mbedtls_entropy_context entropy;
@@ -22,9 +29,16 @@ typedef struct {
   mbedtls_ssl_config conf;
   mbedtls_x509_crt cacert;
   mbedtls_net_context socket;
+  mbedtls_ssl_session session;
   uint8_t *ca_buf;
   size_t ca_len;
   bool verify;
+  size_t budget;
+  bool prepared;
+  bool resumable;
+  uint32_t handshakes;
+  uint32_t resumptions;
+  uint32_t handshake_time;
 } esp_tls_lwmqtt_network_t;
 
 /**
@@ -32,6 +46,13 @@ typedef struct {
  */
 lwmqtt_err_t esp_tls_lwmqtt_network_connect(esp_tls_lwmqtt_network_t *network, char *host, char *port);
 
+/**
+ * Free the retained random generator, CA chain, ssl configuration and cached session.
+ *
+ * Must be called after the CA certificate or verification mode has been changed.
+ */
+void esp_tls_lwmqtt_network_release(esp_tls_lwmqtt_network_t *network);
+
 /**
  * Wait until the socket is connected or a timeout has been reached.
  */
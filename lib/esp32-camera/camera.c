@@ -20,10 +20,12 @@
 #include "driver/rtc_io.h"
 #include "esp_camera.h"
 #include "esp_intr_alloc.h"
+#include "esp_timer.h"
 #include "exlibconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "nvs.h"
 #include "rom/lldesc.h"
 #include "sccb.h"
 #include "sensor.h"
@@ -55,6 +57,15 @@ typedef enum {
 #define REG_MIDH 0x1C
 #define REG_MIDL 0x1D
 
+// the address and id of the last detected sensor are kept in nvs, a single id read confirms them on the next init
+#define CAMERA_NVS_NAMESPACE "camera"
+#define CAMERA_NVS_PROBE "probe"
+
+typedef struct {
+    uint8_t slv_addr;
+    sensor_id_t id;
+} camera_probe_t;
+
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
 #define TAG ""
@@ -64,6 +75,22 @@ static const char* TAG = "camera";
 #endif
 
 typedef void (*dma_filter_t)(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
+// copies count pixels of a line into a region, the first one is in column col of the frame buffer
+typedef void (*dma_filter_roi_t)(const dma_elem_t* src, size_t col, size_t count, uint8_t* dst);
+
+// frame buffer states, a buffer is filled by the filter task, published as the latest frame and freed when the last
+// consumer returned it after a newer frame replaced it
+typedef enum {
+    CAMERA_FB_FREE = 0,
+    CAMERA_FB_FILLING,
+    CAMERA_FB_READY,
+    CAMERA_FB_IN_USE,
+} camera_fb_state_t;
+
+// the state and the number of references share one word so both change atomically
+#define FB_CTL(state, refs) (((uint32_t)(state) << 16) | (refs))
+#define FB_STATE(ctl) ((ctl) >> 16)
+#define FB_REFS(ctl) ((ctl)&0xFFFF)
 
 typedef struct camera_fb_s {
     uint8_t* buf;
@@ -71,12 +98,38 @@ typedef struct camera_fb_s {
     size_t width;
     size_t height;
     pixformat_t format;
+    int64_t timestamp;
+    int64_t timestamp_end;
+    uint32_t seq;
+    uint32_t dropped;
     size_t size;
-    uint8_t ref;
+    size_t seg;
+    size_t segs;
+    uint32_t ctl;
+    uint32_t published;
     uint8_t bad;
     struct camera_fb_s* next;
 } camera_fb_int_t;
 
+struct camera_consumer_s {
+    SemaphoreHandle_t ready;
+    uint32_t seq;
+    size_t frames;
+    size_t dropped;
+};
+
+// filled dma buffers are passed to the filter task through a ring written by the isr, the end of a frame is an entry
+// without buffer
+#define DMA_RING_MASK (CONFIG_CAMERA_DMA_QUEUE_DEPTH - 1)
+_Static_assert((CONFIG_CAMERA_DMA_QUEUE_DEPTH & (CONFIG_CAMERA_DMA_QUEUE_DEPTH - 1)) == 0, "CONFIG_CAMERA_DMA_QUEUE_DEPTH must be a power of two");
+#define DMA_RING_END UINT16_MAX
+
+typedef struct {
+    uint16_t idx;  // descriptor of the buffer
+    uint16_t seq;  // buffers received up to this one, tells how far the dma went on while the entry waited
+    uint16_t pos;  // position of the buffer in its frame
+} dma_ring_entry_t;
+
 typedef struct fb_s {
     uint8_t* buf;
     size_t len;
@@ -88,7 +141,13 @@ typedef struct {
     sensor_t sensor;
 
     camera_fb_int_t* fb;
+    camera_fb_int_t* fb_latest;
+    uint32_t fb_seq;
     size_t fb_size;
+    uint8_t* seg_buf;
+    size_t seg_count;
+    size_t seg_typical;
+    size_t seg_next;
     size_t data_size;
 
     size_t width;
@@ -98,10 +157,29 @@ typedef struct {
 
     size_t dma_received_count;
     size_t dma_filtered_count;
+    size_t dma_rejected_count;
+    size_t dma_skipped_count;
+    size_t dma_overrun_count;
+    size_t dma_pending_max;
+    size_t dma_late_count;
+    uint32_t dma_buf_count;
     size_t dma_per_line;
     size_t dma_buf_width;
     size_t dma_sample_count;
 
+    int64_t frame_time;
+    uint32_t frame_count;
+    uint32_t frame_done;
+
+    size_t jpeg_pos;
+    bool jpeg_scan;
+    bool jpeg_done;
+
+    QueueHandle_t chunk_ready;
+    bool chunk_wanted;
+    bool chunk_stream;
+    bool chunk_pending;
+
     lldesc_t* dma_desc;
     dma_elem_t** dma_buf;
     size_t dma_desc_count;
@@ -109,13 +187,52 @@ typedef struct {
 
     i2s_sampling_mode_t sampling_mode;
     dma_filter_t dma_filter;
+    dma_filter_t dma_filter_motion;
+    dma_filter_roi_t dma_filter_roi;
+    camera_roi_t roi;
+    size_t roi_step;
+    size_t roi_chroma;
+    size_t decimation;
+    bool cropped;
+    uint8_t motion_threshold;
+    size_t motion_blocks;
+    size_t motion_cols;
+    size_t motion_rows;
+    size_t motion_step;
+    size_t motion_row;
+    size_t motion_next;
+    size_t motion_parts;
+    size_t motion_x;
+    size_t motion_end;
+    size_t motion_changed;
+    uint32_t motion_seq;
+    int64_t motion_time;
+    uint32_t* motion_sum;
+    uint8_t* motion_luma;
+    bool* motion_valid;
+    uint8_t* motion_delta;
+    uint8_t* motion_map;
+    camera_motion_t motion;
+    size_t motion_events;
+    SemaphoreHandle_t motion_ready;
+    SemaphoreHandle_t motion_lock;
     intr_handle_t i2s_intr_handle;
-    QueueHandle_t data_ready;
-    QueueHandle_t fb_in;
-    QueueHandle_t fb_out;
+    dma_ring_entry_t dma_ring[CONFIG_CAMERA_DMA_QUEUE_DEPTH];
+    uint32_t dma_ring_head;
+    uint32_t dma_ring_tail;
+    bool dma_filter_idle;
+    camera_consumer_t consumers[CONFIG_CAMERA_MAX_CONSUMERS];
+    size_t consumer_count;
+    SemaphoreHandle_t latest_ready;
+    camera_consumer_t* burst;
 
     SemaphoreHandle_t frame_ready;
+    SemaphoreHandle_t bus_stopped;
+    SemaphoreHandle_t capture_lock;
+    bool bus_started;  // from the start by a consumer until the interrupt or suspend stops the bus
     TaskHandle_t dma_filter_task;
+    SemaphoreHandle_t vsync_skip;
+    bool suspended;
 } camera_state_t;
 
 camera_state_t* s_state = NULL;
@@ -133,6 +250,8 @@ static void dma_filter_yuyv(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t*
 static void dma_filter_yuyv_highspeed(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 static void dma_filter_jpeg(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst);
 static void i2s_stop(bool* need_yield);
+static void camera_capture();
+static void i2s_enable();
 
 static bool is_hs_mode() {
     return s_state->config.xclk_freq_hz > 10000000;
@@ -168,19 +287,130 @@ static void vsync_intr_enable() {
     gpio_set_intr_type(s_state->config.pin_vsync, GPIO_INTR_NEGEDGE);
 }
 
-static void skip_frame() {
-    if (s_state == NULL) {
-        return;
+static bool skip_frame() {
+    // sleep until the next falling edge of vsync, the frame after it is the first complete one with the new settings
+    s_state->vsync_skip = xSemaphoreCreateBinary();
+    if (s_state->vsync_skip == NULL) {
+        return false;
     }
-    while (_gpio_get_level(s_state->config.pin_vsync) == 0) {
-        ;
+    vsync_intr_enable();
+    bool ok = xSemaphoreTake(s_state->vsync_skip, CONFIG_CAMERA_VSYNC_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE;
+    vsync_intr_disable();
+    SemaphoreHandle_t skip = s_state->vsync_skip;
+    s_state->vsync_skip = NULL;
+    vSemaphoreDelete(skip);
+    return ok;
+}
+
+// running histogram of JPEG sizes in segments for the most recent framesize and quality combinations
+#define JPEG_HIST_ENTRIES 4
+#define JPEG_HIST_BINS 32
+#define JPEG_HIST_LIMIT 1024
+
+typedef struct {
+    framesize_t framesize;
+    uint8_t quality;
+    uint16_t count;
+    uint16_t bins[JPEG_HIST_BINS];  // the last bin also counts larger frames
+    uint32_t largest;               // largest frame in the last bin, which has no upper bound
+} jpeg_hist_t;
+
+// kept across esp_camera_deinit, a new init sizes the pool from the frames seen before
+static jpeg_hist_t s_jpeg_hist[JPEG_HIST_ENTRIES];
+
+static jpeg_hist_t* IRAM_ATTR jpeg_hist_get(framesize_t framesize, uint8_t quality, bool add) {
+    jpeg_hist_t* least = &s_jpeg_hist[0];
+    for (size_t i = 0; i < JPEG_HIST_ENTRIES; i++) {
+        jpeg_hist_t* hist = &s_jpeg_hist[i];
+        if (hist->count && hist->framesize == framesize && hist->quality == quality) {
+            return hist;
+        }
+        if (hist->count < least->count) {
+            least = hist;
+        }
     }
-    while (_gpio_get_level(s_state->config.pin_vsync) != 0) {
-        ;
+    if (!add) {
+        return NULL;
     }
-    while (_gpio_get_level(s_state->config.pin_vsync) == 0) {
-        ;
+
+    // replace the least used entry
+    memset(least, 0, sizeof(jpeg_hist_t));
+    least->framesize = framesize;
+    least->quality = quality;
+    return least;
+}
+
+static void IRAM_ATTR jpeg_hist_add(size_t len) {
+    jpeg_hist_t* hist = jpeg_hist_get(s_state->sensor.status.framesize, s_state->sensor.status.quality, true);
+
+    // halve the counts now and then so that the histogram follows the scene
+    if (hist->count >= JPEG_HIST_LIMIT) {
+        hist->count = 0;
+        for (size_t i = 0; i < JPEG_HIST_BINS; i++) {
+            hist->bins[i] /= 2;
+            hist->count += hist->bins[i];
+        }
+        if (!hist->bins[JPEG_HIST_BINS - 1]) {
+            hist->largest = 0;
+        }
     }
+
+    size_t segs = (len + CONFIG_CAMERA_FB_SEGMENT_SIZE - 1) / CONFIG_CAMERA_FB_SEGMENT_SIZE;
+    if (segs >= JPEG_HIST_BINS) {
+        hist->bins[JPEG_HIST_BINS - 1]++;
+        hist->largest = len > hist->largest ? len : hist->largest;
+    } else {
+        hist->bins[segs - 1]++;
+    }
+    hist->count++;
+}
+
+static size_t jpeg_hist_segments(const jpeg_hist_t* hist, size_t bound, size_t* max) {
+    // segments that fit the configured percentile of the frames and the largest frame, frames in the last bin get
+    // the largest one seen or the ratio bound if that is more
+    size_t need = (hist->count * CONFIG_CAMERA_JPEG_SIZE_PERCENTILE + 99) / 100;
+    size_t sum = 0, segs = 0;
+    for (size_t i = 0; i < JPEG_HIST_BINS; i++) {
+        if (!hist->bins[i]) {
+            continue;
+        }
+        size_t bin = i + 1;
+        if (i == JPEG_HIST_BINS - 1) {
+            bin = (hist->largest + CONFIG_CAMERA_FB_SEGMENT_SIZE - 1) / CONFIG_CAMERA_FB_SEGMENT_SIZE;
+            bin = bin > bound ? bin : bound;
+        }
+        if (sum < need) {
+            segs = bin;
+        }
+        sum += hist->bins[i];
+        *max = bin;
+    }
+    return segs;
+}
+
+static size_t camera_fb_segments(size_t count) {
+    // raw frames and JPEGs without history reserve the full frame size per buffer
+    size_t frame = (s_state->fb_size + CONFIG_CAMERA_FB_SEGMENT_SIZE - 1) / CONFIG_CAMERA_FB_SEGMENT_SIZE;
+    s_state->seg_typical = frame;
+    if (s_state->config.pixel_format != PIXFORMAT_JPEG) {
+        return count * frame;
+    }
+    const jpeg_hist_t* hist = jpeg_hist_get(s_state->config.frame_size, s_state->config.jpeg_quality, false);
+    if (hist == NULL || hist->count < CONFIG_CAMERA_JPEG_SIZE_SAMPLES) {
+        return count * frame;
+    }
+
+    // typical JPEGs for every buffer and room for the largest one seen, several buffers also need room for the
+    // segments left over at the end of the pool when a frame starts again at the beginning
+    size_t max = 0;
+    size_t typical = jpeg_hist_segments(hist, frame, &max);
+    if (typical >= frame) {
+        // typical JPEGs beyond the histogram are only bounded by the compression ratio or the largest one seen
+        s_state->seg_typical = max;
+        return count * max;
+    }
+    s_state->seg_typical = typical;
+    return (count > 1 ? count + 1 : 1) * typical + max - typical;
 }
 
 static void camera_fb_deinit() {
@@ -191,9 +421,10 @@ static void camera_fb_deinit() {
         if (_fb2->next == _fb1) {
             s_state->fb = NULL;
         }
-        free(_fb2->buf);
         free(_fb2);
     }
+    free(s_state->seg_buf);
+    s_state->seg_buf = NULL;
 }
 
 static esp_err_t camera_fb_init(size_t count) {
@@ -203,7 +434,28 @@ static esp_err_t camera_fb_init(size_t count) {
 
     camera_fb_deinit();
 
-    ESP_LOGI(TAG, "Allocating %u frame buffers (%d KB total)", count, (s_state->fb_size * count) / 1024);
+    // all frame buffers share one pool of segments
+    size_t segs = camera_fb_segments(count);
+    size_t size = segs * CONFIG_CAMERA_FB_SEGMENT_SIZE;
+    ESP_LOGI(TAG, "Allocating %u frame buffers (%d KB total)", count, size / 1024);
+    s_state->seg_buf = (uint8_t*)calloc(size, 1);
+    if (!s_state->seg_buf) {
+        ESP_LOGI(TAG, "Allocating %d KB frame buffer pool in PSRAM", size / 1024);
+        s_state->seg_buf = (uint8_t*)heap_caps_calloc(size, 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    } else {
+        ESP_LOGI(TAG, "Allocating %d KB frame buffer pool in OnBoard RAM", size / 1024);
+    }
+    if (!s_state->seg_buf) {
+        ESP_LOGE(TAG, "Allocating %d KB frame buffer pool Failed", size / 1024);
+        return ESP_ERR_NO_MEM;
+    }
+    s_state->seg_count = segs;
+    s_state->seg_next = 0;
+
+    // a JPEG may grow into the whole pool
+    if (s_state->config.pixel_format == PIXFORMAT_JPEG) {
+        s_state->fb_size = size;
+    }
 
     camera_fb_int_t *_fb = NULL, *_fb1 = NULL, *_fb2 = NULL;
     for (size_t i = 0; i < count; i++) {
@@ -212,20 +464,7 @@ static esp_err_t camera_fb_init(size_t count) {
             goto fail;
         }
         memset(_fb2, 0, sizeof(camera_fb_int_t));
-        _fb2->size = s_state->fb_size;
-        _fb2->buf = (uint8_t*)calloc(_fb2->size, 1);
-        if (!_fb2->buf) {
-            ESP_LOGI(TAG, "Allocating %d KB frame buffer in PSRAM", s_state->fb_size / 1024);
-            _fb2->buf = (uint8_t*)heap_caps_calloc(_fb2->size, 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-        } else {
-            ESP_LOGI(TAG, "Allocating %d KB frame buffer in OnBoard RAM", s_state->fb_size / 1024);
-        }
-        if (!_fb2->buf) {
-            free(_fb2);
-            ESP_LOGE(TAG, "Allocating %d KB frame buffer Failed", s_state->fb_size / 1024);
-            goto fail;
-        }
-        memset(_fb2->buf, 0, _fb2->size);
+        _fb2->buf = s_state->seg_buf;
         _fb2->next = _fb;
         _fb = _fb2;
         if (!i) {
@@ -244,12 +483,179 @@ fail:
     while (_fb) {
         _fb2 = _fb;
         _fb = _fb->next;
-        free(_fb2->buf);
         free(_fb2);
     }
+    free(s_state->seg_buf);
+    s_state->seg_buf = NULL;
     return ESP_ERR_NO_MEM;
 }
 
+static bool IRAM_ATTR camera_fb_seg_free(camera_fb_int_t* fb, size_t seg) {
+    // a segment is free if no other buffer in use covers it
+    camera_fb_int_t* other = fb->next;
+    for (; other != fb; other = other->next) {
+        if (FB_STATE(__atomic_load_n(&other->ctl, __ATOMIC_ACQUIRE)) != CAMERA_FB_FREE && seg >= other->seg && seg < other->seg + other->segs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IRAM_ATTR camera_fb_extend(camera_fb_int_t* fb, size_t len) {
+    // grow the buffer segment by segment until len bytes fit
+    while (fb->size < len) {
+        size_t seg = fb->seg + fb->segs;
+        if (seg >= s_state->seg_count || !camera_fb_seg_free(fb, seg)) {
+            return false;
+        }
+        fb->segs++;
+        fb->size += CONFIG_CAMERA_FB_SEGMENT_SIZE;
+    }
+    return true;
+}
+
+static size_t IRAM_ATTR camera_fb_run(camera_fb_int_t* fb, size_t seg, size_t max) {
+    // number of free segments from seg on, up to max
+    size_t run = 0;
+    while (run < max && seg + run < s_state->seg_count && camera_fb_seg_free(fb, seg + run)) {
+        run++;
+    }
+    return run;
+}
+
+static bool IRAM_ATTR camera_fb_place(camera_fb_int_t* fb) {
+    // start behind the previous frame unless there is more room for a typical frame at the beginning or, with
+    // frames held in both places, further on. a pool of exactly one typical frame per buffer has no room to spare
+    // for a frame that wraps, its frames start at a multiple of the typical frame
+    size_t step = s_state->seg_typical * s_state->config.fb_count == s_state->seg_count ? s_state->seg_typical : 1;
+    size_t seg = (s_state->seg_next + step - 1) / step * step % s_state->seg_count;
+    size_t run = camera_fb_run(fb, seg, s_state->seg_typical);
+    for (size_t start = 0; run < s_state->seg_typical && start < s_state->seg_count; start += step) {
+        size_t other = camera_fb_run(fb, start, s_state->seg_typical);
+        if (other > run) {
+            seg = start;
+            run = other;
+        }
+    }
+    fb->seg = seg;
+    fb->segs = 0;
+    fb->size = 0;
+    fb->buf = s_state->seg_buf + seg * CONFIG_CAMERA_FB_SEGMENT_SIZE;
+
+    // raw frames reserve their full size, JPEGs extend while they are captured
+    size_t len = s_state->config.pixel_format == PIXFORMAT_JPEG ? CONFIG_CAMERA_FB_SEGMENT_SIZE : s_state->fb_size;
+    if (!camera_fb_extend(fb, len)) {
+        fb->segs = 0;
+        fb->size = 0;
+        return false;
+    }
+    return true;
+}
+
+static bool IRAM_ATTR camera_fb_filling(camera_fb_int_t* fb) {
+    return FB_STATE(__atomic_load_n(&fb->ctl, __ATOMIC_ACQUIRE)) == CAMERA_FB_FILLING;
+}
+
+static bool IRAM_ATTR camera_fb_claim() {
+    // keep the current buffer or take the next free one, the filter task skips frames while there is none
+    camera_fb_int_t* fb = s_state->fb;
+    if (camera_fb_filling(fb)) {
+        return true;
+    }
+    do {
+        uint32_t ctl = CAMERA_FB_FREE;
+        if (__atomic_compare_exchange_n(&fb->ctl, &ctl, FB_CTL(CAMERA_FB_FILLING, 0), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            if (!camera_fb_place(fb)) {
+                __atomic_store_n(&fb->ctl, CAMERA_FB_FREE, __ATOMIC_RELEASE);
+                return false;
+            }
+            s_state->fb = fb;
+            fb->bad = 0;
+            fb->len = 0;
+            *((uint32_t*)fb->buf) = 0;
+            return true;
+        }
+        fb = fb->next;
+    } while (fb != s_state->fb);
+    return false;
+}
+
+static void IRAM_ATTR camera_fb_release(camera_fb_int_t* fb, bool latest) {
+    // drop a reference, the buffer is free once the last one is gone
+    uint32_t ctl = __atomic_load_n(&fb->ctl, __ATOMIC_RELAXED);
+    uint32_t next;
+    do {
+        uint32_t refs = FB_REFS(ctl) - 1;
+        uint32_t state = refs == 0 ? CAMERA_FB_FREE : latest ? CAMERA_FB_IN_USE : FB_STATE(ctl);
+        next = FB_CTL(state, refs);
+    } while (!__atomic_compare_exchange_n(&fb->ctl, &ctl, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void IRAM_ATTR camera_fb_publish(camera_fb_int_t* fb) {
+    // the latest slot holds one reference until a newer frame replaces it
+    fb->published = ++s_state->fb_seq;
+    __atomic_store_n(&fb->ctl, FB_CTL(CAMERA_FB_READY, 1), __ATOMIC_RELEASE);
+    camera_fb_int_t* old = __atomic_exchange_n(&s_state->fb_latest, fb, __ATOMIC_ACQ_REL);
+    if (old != NULL) {
+        camera_fb_release(old, true);
+    }
+
+    // wake up consumers
+    xSemaphoreGive(s_state->latest_ready);
+    size_t count = __atomic_load_n(&s_state->consumer_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; i++) {
+        xSemaphoreGive(s_state->consumers[i].ready);
+    }
+}
+
+static bool camera_fb_ref(camera_fb_int_t* fb) {
+    // reference a finished frame unless it was recycled in the meantime
+    uint32_t ctl = __atomic_load_n(&fb->ctl, __ATOMIC_RELAXED);
+    while (FB_STATE(ctl) == CAMERA_FB_READY || FB_STATE(ctl) == CAMERA_FB_IN_USE) {
+        if (__atomic_compare_exchange_n(&fb->ctl, &ctl, ctl + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static camera_fb_int_t* camera_fb_acquire(camera_consumer_t* consumer) {
+    while (true) {
+        // reference the latest frame
+        camera_fb_int_t* fb = __atomic_load_n(&s_state->fb_latest, __ATOMIC_ACQUIRE);
+        if (fb != NULL && fb->published != consumer->seq && camera_fb_ref(fb)) {
+            // count the frames this consumer missed
+            if ((int32_t)(fb->published - consumer->seq) > 0) {
+                if (consumer->frames) {
+                    consumer->dropped += fb->published - consumer->seq - 1;
+                }
+                consumer->seq = fb->published;
+                consumer->frames++;
+                return fb;
+            }
+            camera_fb_release(fb, false);
+        }
+
+        // wait for the next frame
+        xSemaphoreTake(consumer->ready, portMAX_DELAY);
+    }
+}
+
+static camera_fb_int_t* camera_fb_find(int64_t timestamp) {
+    // the oldest finished frame that started at or after the timestamp
+    camera_fb_int_t* first = s_state->fb;
+    camera_fb_int_t* fb = first;
+    camera_fb_int_t* found = NULL;
+    do {
+        uint32_t state = FB_STATE(__atomic_load_n(&fb->ctl, __ATOMIC_ACQUIRE));
+        if ((state == CAMERA_FB_READY || state == CAMERA_FB_IN_USE) && fb->timestamp >= timestamp && (found == NULL || fb->timestamp < found->timestamp)) {
+            found = fb;
+        }
+        fb = fb->next;
+    } while (fb != first);
+    return found;
+}
+
 static esp_err_t dma_desc_init() {
     assert(s_state->width % 4 == 0);
     size_t line_size = s_state->width * s_state->in_bytes_per_pixel * i2s_bytes_per_sample(s_state->sampling_mode);
@@ -357,7 +763,14 @@ static void i2s_init() {
     gpio_matrix_in(config->pin_href, I2S0I_H_ENABLE_IDX, false);
     gpio_matrix_in(config->pin_pclk, I2S0I_WS_IN_IDX, false);
 
-    // Enable and configure I2S peripheral
+    i2s_enable();
+
+    // Allocate I2S interrupt, keep it disabled
+    esp_intr_alloc(ETS_I2S0_INTR_SOURCE, ESP_INTR_FLAG_INTRDISABLED | ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_IRAM, &i2s_isr, NULL, &s_state->i2s_intr_handle);
+}
+
+static void i2s_enable() {
+    // Enable and configure I2S peripheral, this is repeated on resume as disabling the module resets it
     periph_module_enable(PERIPH_I2S0_MODULE);
     // Toggle some reset bits in LC_CONF register
     // Toggle some reset bits in CONF register
@@ -387,9 +800,12 @@ static void i2s_init() {
     I2S0.conf.rx_short_sync = 0;
     I2S0.timing.val = 0;
     I2S0.timing.rx_dsync_sw = 1;
+}
 
-    // Allocate I2S interrupt, keep it disabled
-    esp_intr_alloc(ETS_I2S0_INTR_SOURCE, ESP_INTR_FLAG_INTRDISABLED | ESP_INTR_FLAG_LEVEL1 | ESP_INTR_FLAG_IRAM, &i2s_isr, NULL, &s_state->i2s_intr_handle);
+static void IRAM_ATTR camera_frame_start() {
+    // the buffers of the frame that starts now are stamped with this time and number
+    s_state->frame_time = esp_timer_get_time();
+    s_state->frame_count++;
 }
 
 static void IRAM_ATTR i2s_start_bus() {
@@ -400,15 +816,18 @@ static void IRAM_ATTR i2s_start_bus() {
     i2s_conf_reset();
 
     I2S0.rx_eof_num = s_state->dma_sample_count;
-    I2S0.in_link.addr = (uint32_t)&s_state->dma_desc[0];
+    I2S0.in_link.addr = (uintptr_t)&s_state->dma_desc[0];
     I2S0.in_link.start = 1;
     I2S0.int_clr.val = I2S0.int_raw.val;
     I2S0.int_ena.val = 0;
     I2S0.int_ena.in_done = 1;
 
+    // also when the filter task restarts the bus after an empty or rejected frame, stopping it clears the flag
+    __atomic_store_n(&s_state->bus_started, true, __ATOMIC_RELEASE);
     esp_intr_enable(s_state->i2s_intr_handle);
     I2S0.conf.rx_start = 1;
     if (s_state->config.pixel_format == PIXFORMAT_JPEG) {
+        camera_frame_start();
         vsync_intr_enable();
     }
 }
@@ -421,14 +840,7 @@ static void i2s_run() {
     }
 
     // wait for frame
-    camera_fb_int_t* fb = s_state->fb;
-    while (s_state->config.fb_count > 1) {
-        while (s_state->fb->ref && s_state->fb->next != fb) {
-            s_state->fb = s_state->fb->next;
-        }
-        if (s_state->fb->ref == 0) {
-            break;
-        }
+    while (s_state->config.fb_count > 1 && !camera_fb_claim()) {
         vTaskDelay(2);
     }
 
@@ -447,41 +859,60 @@ static void IRAM_ATTR i2s_stop_bus() {
     vsync_intr_disable();
     i2s_conf_reset();
     I2S0.conf.rx_start = 0;
+    __atomic_store_n(&s_state->bus_started, false, __ATOMIC_RELEASE);
+}
+
+static bool IRAM_ATTR dma_ring_push(uint16_t idx, bool* need_yield) {
+    // the last slot is kept for the end of the frame
+    uint32_t head = s_state->dma_ring_head;
+    uint32_t tail = __atomic_load_n(&s_state->dma_ring_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= CONFIG_CAMERA_DMA_QUEUE_DEPTH - (idx != DMA_RING_END)) {
+        s_state->dma_overrun_count++;
+        return false;
+    }
+    s_state->dma_ring[head & DMA_RING_MASK] = (dma_ring_entry_t){.idx = idx, .seq = (uint16_t)s_state->dma_buf_count, .pos = (uint16_t)(s_state->dma_received_count - 1)};
+    __atomic_store_n(&s_state->dma_ring_head, head + 1, __ATOMIC_SEQ_CST);
+    if (head + 1 - tail > s_state->dma_pending_max) {
+        s_state->dma_pending_max = head + 1 - tail;
+    }
+
+    // the filter task is only woken up if it ran out of entries, otherwise it picks this one up on its own
+    if (__atomic_load_n(&s_state->dma_filter_idle, __ATOMIC_SEQ_CST)) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(s_state->dma_filter_task, &higher_priority_task_woken);
+        *need_yield = *need_yield || higher_priority_task_woken == pdTRUE;
+    }
+    return true;
 }
 
 static void IRAM_ATTR i2s_stop(bool* need_yield) {
-    if (s_state->config.fb_count == 1 && !s_state->fb->bad) {
+    if (s_state->config.fb_count == 1) {
         i2s_stop_bus();
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xSemaphoreGiveFromISR(s_state->bus_stopped, &higher_priority_task_woken);
+        *need_yield = *need_yield || higher_priority_task_woken == pdTRUE;
     } else {
         s_state->dma_received_count = 0;
     }
-
-    size_t val = SIZE_MAX;
-    BaseType_t higher_priority_task_woken;
-    BaseType_t ret = xQueueSendFromISR(s_state->data_ready, &val, &higher_priority_task_woken);
-    if (need_yield && !*need_yield) {
-        *need_yield = (ret == pdTRUE && higher_priority_task_woken == pdTRUE);
-    }
+    dma_ring_push(DMA_RING_END, need_yield);
 }
 
 static void IRAM_ATTR signal_dma_buf_received(bool* need_yield) {
     size_t dma_desc_filled = s_state->dma_desc_cur;
     s_state->dma_desc_cur = (dma_desc_filled + 1) % s_state->dma_desc_count;
+    // raw frames have no VSYNC interrupt, they start with their first line
+    if (s_state->dma_received_count == 0 && s_state->config.pixel_format != PIXFORMAT_JPEG) {
+        camera_frame_start();
+    }
     s_state->dma_received_count++;
-    if (!s_state->fb->ref && s_state->fb->bad) {
-        *need_yield = false;
+    s_state->dma_buf_count++;
+    // the rest of a bad frame is not filtered, unless motion detection needs it
+    if (camera_fb_filling(s_state->fb) && s_state->fb->bad && !s_state->motion_threshold) {
         return;
     }
-    BaseType_t higher_priority_task_woken;
-    BaseType_t ret = xQueueSendFromISR(s_state->data_ready, &dma_desc_filled, &higher_priority_task_woken);
-    if (ret != pdTRUE) {
-        if (!s_state->fb->ref) {
-            s_state->fb->bad = 1;
-        }
-        // ESP_EARLY_LOGW(TAG, "qsf:%d", s_state->dma_received_count);
-        // ets_printf("qsf:%d\n", s_state->dma_received_count);
+    if (!dma_ring_push(dma_desc_filled, need_yield) && camera_fb_filling(s_state->fb)) {
+        s_state->fb->bad = 1;
     }
-    *need_yield = (ret == pdTRUE && higher_priority_task_woken == pdTRUE);
 }
 
 static void IRAM_ATTR i2s_isr(void* arg) {
@@ -500,26 +931,35 @@ static void IRAM_ATTR vsync_isr(void* arg) {
     GPIO.status1_w1tc.val = GPIO.status1.val;
     GPIO.status_w1tc = GPIO.status;
     bool need_yield = false;
-    // if vsync is low and we have received some data, frame is done
+    // skip_frame waits for vsync while the bus is not running
+    if (s_state->vsync_skip != NULL) {
+        BaseType_t higher_priority_task_woken = pdFALSE;
+        xSemaphoreGiveFromISR(s_state->vsync_skip, &higher_priority_task_woken);
+        if (higher_priority_task_woken == pdTRUE) {
+            portYIELD_FROM_ISR();
+        }
+        return;
+    }
+    // if vsync is low and we have received some data, frame is done. the filter task completes or rejects it and
+    // restarts the bus with a single frame buffer
     if (_gpio_get_level(s_state->config.pin_vsync) == 0) {
         if (s_state->dma_received_count > 0) {
             signal_dma_buf_received(&need_yield);
             // ets_printf("end_vsync\n");
-            if (s_state->dma_filtered_count > 1 || s_state->config.fb_count > 1) {
-                i2s_stop(&need_yield);
-            }
+            i2s_stop(&need_yield);
         }
-        if (s_state->config.fb_count > 1 || s_state->dma_filtered_count < 2) {
+        if (s_state->config.fb_count > 1) {
             I2S0.conf.rx_start = 0;
             I2S0.in_link.start = 0;
             I2S0.int_clr.val = I2S0.int_raw.val;
             i2s_conf_reset();
             s_state->dma_desc_cur = (s_state->dma_desc_cur + 1) % s_state->dma_desc_count;
             // I2S0.rx_eof_num = s_state->dma_sample_count;
-            I2S0.in_link.addr = (uint32_t)&s_state->dma_desc[s_state->dma_desc_cur];
+            I2S0.in_link.addr = (uintptr_t)&s_state->dma_desc[s_state->dma_desc_cur];
             I2S0.in_link.start = 1;
             I2S0.conf.rx_start = 1;
             s_state->dma_received_count = 0;
+            camera_frame_start();
         }
     }
     if (need_yield) {
@@ -527,128 +967,329 @@ static void IRAM_ATTR vsync_isr(void* arg) {
     }
 }
 
-static void IRAM_ATTR camera_fb_done() {
-    camera_fb_int_t *fb = NULL, *fb2 = NULL;
-    BaseType_t taskAwoken = 0;
+static void IRAM_ATTR dma_send_chunk(size_t offset, size_t len, bool final, camera_fb_int_t* fb) {
+    // the queue holds all chunks of a frame, a final chunk without frame buffer aborts the frame
+    camera_chunk_t chunk = {.buf = s_state->fb->buf + offset, .len = len, .offset = offset, .final = final, .fb = (camera_fb_t*)fb};
+    xQueueSend(s_state->chunk_ready, &chunk, 0);
+}
 
+static void IRAM_ATTR camera_fb_done(size_t offset) {
+    // a streamed frame is handed out with a final chunk carrying the data from offset to the end
+    camera_fb_int_t* fb = s_state->fb;
+    fb->timestamp_end = esp_timer_get_time();
+    fb->dropped = s_state->frame_done ? fb->seq - s_state->frame_done - 1 : 0;
+    s_state->frame_done = fb->seq;
     if (s_state->config.fb_count == 1) {
-        xSemaphoreGive(s_state->frame_ready);
+        if (s_state->chunk_stream) {
+            dma_send_chunk(offset, fb->len - offset, true, fb);
+        } else {
+            xSemaphoreGive(s_state->frame_ready);
+        }
         return;
     }
 
-    fb = s_state->fb;
-    if (!fb->ref && fb->len) {
-        // add reference
-        fb->ref = 1;
-
-        // check if the queue is full
-        if (xQueueIsQueueFullFromISR(s_state->fb_out) == pdTRUE) {
-            // pop frame buffer from the queue
-            if (xQueueReceiveFromISR(s_state->fb_out, &fb2, &taskAwoken) == pdTRUE) {
-                // free the popped buffer
-                fb2->ref = 0;
-                fb2->len = 0;
-                // push the new frame to the end of the queue
-                xQueueSendFromISR(s_state->fb_out, &fb, &taskAwoken);
-            } else {
-                // queue is full and we could not pop a frame from it
-            }
-        } else {
-            // push the new frame to the end of the queue
-            xQueueSendFromISR(s_state->fb_out, &fb, &taskAwoken);
-        }
+    // mark a streamed frame as used before the consumer may return it, any other becomes the latest frame
+    if (s_state->chunk_stream) {
+        __atomic_store_n(&fb->ctl, FB_CTL(CAMERA_FB_IN_USE, 1), __ATOMIC_RELEASE);
+        dma_send_chunk(offset, fb->len - offset, true, fb);
     } else {
-        // frame was referenced or empty
+        camera_fb_publish(fb);
     }
 
-    // return buffers to be filled
-    while (xQueueReceiveFromISR(s_state->fb_in, &fb2, &taskAwoken) == pdTRUE) {
-        fb2->ref = 0;
-        fb2->len = 0;
+    // continue with the next free frame buffer behind this one
+    s_state->seg_next = fb->seg + fb->segs;
+    camera_fb_claim();
+}
+
+static size_t IRAM_ATTR dma_roi_rows(size_t lines) {
+    // rows of the region complete once this many lines of the frame arrived
+    if (lines <= s_state->roi.y) {
+        return 0;
     }
+    size_t rows = (lines - s_state->roi.y + s_state->decimation - 1) / s_state->decimation;
+    size_t height = s_state->roi.height / s_state->decimation;
+    return rows < height ? rows : height;
+}
+
+static bool IRAM_ATTR dma_buf_late(dma_ring_entry_t entry) {
+    // the dma reaches a buffer again after filling all others
+    uint16_t lag = (uint16_t)__atomic_load_n(&s_state->dma_buf_count, __ATOMIC_RELAXED) - entry.seq;
+    return lag + 1 >= s_state->dma_desc_count;
+}
 
-    // advance frame buffer only if the current one has data
-    if (s_state->fb->len) {
-        s_state->fb = s_state->fb->next;
+static void IRAM_ATTR dma_motion_row() {
+    // compare the mean luma of the blocks of the current row with the previous frame, a row that misses buffers is
+    // compared again after the next complete one
+    size_t cols = s_state->motion_cols;
+    size_t row = s_state->motion_row;
+    if (row >= s_state->motion_rows) {
+        return;
     }
-    // try to find the next free frame buffer
-    while (s_state->fb->ref && s_state->fb->next != fb) {
-        s_state->fb = s_state->fb->next;
+    uint8_t* luma = s_state->motion_luma + row * cols;
+    uint8_t* delta = s_state->motion_delta + row * cols;
+    bool complete = s_state->motion_parts == s_state->dma_per_line * CONFIG_CAMERA_MOTION_BLOCK;
+    bool compare = complete && s_state->motion_valid[row];
+    for (size_t i = 0; i < cols; ++i) {
+        uint8_t mean = s_state->motion_sum[i] / (CONFIG_CAMERA_MOTION_BLOCK * CONFIG_CAMERA_MOTION_BLOCK);
+        delta[i] = compare ? (mean > luma[i] ? mean - luma[i] : luma[i] - mean) : 0;
+        if (delta[i] >= s_state->motion_threshold) {
+            s_state->motion_changed++;
+        }
+        luma[i] = mean;
+        s_state->motion_sum[i] = 0;
     }
-    // is the found frame buffer free?
-    if (!s_state->fb->ref) {
-        // buffer found. make sure it's empty
-        s_state->fb->len = 0;
-        *((uint32_t*)s_state->fb->buf) = 0;
-    } else {
-        // stay at the previous buffer
-        s_state->fb = fb;
+    s_state->motion_valid[row] = complete;
+    s_state->motion_row = SIZE_MAX;
+    s_state->motion_next = row + 1;
+    s_state->motion_parts = 0;
+}
+
+static void IRAM_ATTR dma_motion_skip(size_t row) {
+    // rows of which no buffer arrived are compared again after the next complete one
+    for (; s_state->motion_next < row && s_state->motion_next < s_state->motion_rows; s_state->motion_next++) {
+        memset(s_state->motion_delta + s_state->motion_next * s_state->motion_cols, 0, s_state->motion_cols);
+        s_state->motion_valid[s_state->motion_next] = false;
+    }
+}
+
+static void IRAM_ATTR dma_motion_frame() {
+    // raise an event at the end of a frame that moved enough blocks
+    dma_motion_row();
+    dma_motion_skip(s_state->motion_rows);
+    s_state->motion_next = 0;
+    size_t changed = s_state->motion_changed;
+    s_state->motion_changed = 0;
+    if (changed < s_state->motion_blocks) {
+        return;
+    }
+    s_state->motion_events++;
+
+    // a caller copying the previous event keeps it, the next event updates the map
+    if (xSemaphoreTake(s_state->motion_lock, 0) == pdTRUE) {
+        s_state->motion.seq = s_state->motion_seq;
+        s_state->motion.timestamp = s_state->motion_time;
+        s_state->motion.changed = changed;
+        memcpy(s_state->motion_map, s_state->motion_delta, s_state->motion_cols * s_state->motion_rows);
+        xSemaphoreGive(s_state->motion_lock);
+    }
+    xSemaphoreGive(s_state->motion_ready);
+}
+
+static bool IRAM_ATTR dma_motion_buffer(dma_ring_entry_t entry) {
+    // move on to the block row of this part of a line and return whether its luma goes into the block sums, pixels
+    // right of and below the last full block are left out
+    if (entry.pos == 0) {
+        s_state->motion_seq = s_state->frame_count;
+        s_state->motion_time = s_state->frame_time;
+    }
+    size_t part = entry.pos % s_state->dma_per_line;
+    size_t line = entry.pos / s_state->dma_per_line;
+    size_t row = line / CONFIG_CAMERA_MOTION_BLOCK;
+    if (row != s_state->motion_row) {
+        dma_motion_row();
+        dma_motion_skip(row);
+        s_state->motion_row = row;
+    }
+    if (row >= s_state->motion_rows) {
+        return false;
+    }
+    size_t pixels = s_state->width / s_state->dma_per_line;
+    s_state->motion_x = part * pixels;
+    s_state->motion_end = s_state->motion_x + pixels;
+    if (s_state->motion_end > s_state->motion_cols * CONFIG_CAMERA_MOTION_BLOCK) {
+        s_state->motion_end = s_state->motion_cols * CONFIG_CAMERA_MOTION_BLOCK;
+    }
+    return true;
+}
+
+static void IRAM_ATTR dma_motion_sum(const dma_elem_t* src) {
+    // add the luma to the block sums for buffers that are not converted to a whole line of the frame buffer
+    size_t x = s_state->motion_x;
+    size_t end = s_state->motion_end;
+    size_t step = s_state->motion_step;
+    while (x < end) {
+        size_t block = x / CONFIG_CAMERA_MOTION_BLOCK;
+        size_t next = (block + 1) * CONFIG_CAMERA_MOTION_BLOCK;
+        size_t count = (next < end ? next : end) - x;
+        uint32_t sum = 0;
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            // manually unrolling 4 iterations of the loop here
+            sum += src[0].sample1 + src[step].sample1 + src[2 * step].sample1 + src[3 * step].sample1;
+            src += 4 * step;
+        }
+        for (; i < count; ++i) {
+            sum += src->sample1;
+            src += step;
+        }
+        s_state->motion_sum[block] += sum;
+        x += count;
+    }
+}
+
+static void IRAM_ATTR dma_motion_done(dma_ring_entry_t entry) {
+    // a torn buffer leaves its row incomplete
+    if (!dma_buf_late(entry)) {
+        s_state->motion_parts++;
     }
 }
 
 static void IRAM_ATTR dma_finish_frame() {
     size_t buf_len = s_state->width * s_state->fb_bytes_per_pixel / s_state->dma_per_line;
 
-    if (!s_state->fb->ref) {
-        // is the frame bad?
-        if (s_state->fb->bad) {
+    if (s_state->jpeg_done) {
+        // JPEG was sent out at its end marker, an overrun in the rest of its frame hit the buffer claimed after it
+        if (camera_fb_filling(s_state->fb)) {
+            s_state->fb->bad = 0;
+        }
+    } else if (camera_fb_filling(s_state->fb)) {
+        // is the frame bad or a JPEG without end marker?
+        if (s_state->fb->bad || (s_state->sensor.pixformat == PIXFORMAT_JPEG && s_state->dma_filtered_count)) {
+            if (s_state->chunk_stream) {
+                dma_send_chunk(0, 0, true, NULL);
+            }
+            s_state->dma_rejected_count++;
             s_state->fb->bad = 0;
             s_state->fb->len = 0;
             *((uint32_t*)s_state->fb->buf) = 0;
             if (s_state->config.fb_count == 1) {
                 i2s_start_bus();
+            } else {
+                // place the buffer again, the segments behind it may be held by the latest frame for good
+                __atomic_store_n(&s_state->fb->ctl, CAMERA_FB_FREE, __ATOMIC_RELEASE);
+                camera_fb_claim();
             }
         } else {
-            s_state->fb->len = s_state->dma_filtered_count * buf_len;
+            if (s_state->cropped) {
+                size_t stride = s_state->roi.width / s_state->decimation * s_state->fb_bytes_per_pixel;
+                s_state->fb->len = dma_roi_rows(s_state->dma_filtered_count / s_state->dma_per_line) * stride;
+            } else {
+                s_state->fb->len = s_state->dma_filtered_count * buf_len;
+            }
             if (s_state->fb->len) {
-                // find the end marker for JPEG. Data after that can be discarded
-                if (s_state->fb->format == PIXFORMAT_JPEG) {
-                    uint8_t* dptr = &s_state->fb->buf[s_state->fb->len - 1];
-                    while (dptr > s_state->fb->buf) {
-                        if (dptr[0] == 0xFF && dptr[1] == 0xD9 && dptr[2] == 0x00 && dptr[3] == 0x00) {
-                            dptr += 2;
-                            s_state->fb->len = dptr - s_state->fb->buf;
-                            if ((s_state->fb->len & 0x1FF) == 0) {
-                                s_state->fb->len += 1;
-                            }
-                            if ((s_state->fb->len % 100) == 0) {
-                                s_state->fb->len += 1;
-                            }
-                            break;
-                        }
-                        dptr--;
-                    }
-                }
                 // send out the frame
-                camera_fb_done();
+                camera_fb_done(s_state->fb->len);
             } else if (s_state->config.fb_count == 1) {
                 // frame was empty?
                 i2s_start_bus();
             }
         }
-    } else if (s_state->fb->len) {
-        camera_fb_done();
+    } else {
+        // no frame buffer was free, try again for the next frame
+        s_state->dma_skipped_count++;
+        camera_fb_claim();
     }
     s_state->dma_filtered_count = 0;
+    if (s_state->motion_threshold) {
+        dma_motion_frame();
+    }
+    s_state->jpeg_pos = 0;
+    s_state->jpeg_scan = false;
+    s_state->jpeg_done = false;
+    s_state->chunk_stream = false;
+}
+
+static size_t IRAM_ATTR jpeg_find_end(const uint8_t* buf, size_t len) {
+    // walk the markers of the data filtered so far, returns the length of the JPEG once EOI was found
+    size_t pos = s_state->jpeg_pos;
+    while (pos + 1 < len) {
+        // entropy coded data, only stuffed bytes and restart markers may follow 0xFF
+        if (s_state->jpeg_scan) {
+            if (buf[pos] != 0xFF || buf[pos + 1] == 0x00 || (buf[pos + 1] >= 0xD0 && buf[pos + 1] <= 0xD7)) {
+                pos += buf[pos] != 0xFF ? 1 : 2;
+                continue;
+            }
+            s_state->jpeg_scan = false;
+        }
+
+        // every segment starts with a marker
+        if (buf[pos] != 0xFF) {
+            s_state->fb->bad = 1;
+            return 0;
+        }
+        uint8_t marker = buf[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+        } else if (marker == 0xD9) {
+            return pos + 2;
+        } else if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+        } else {
+            // skip segment, the length follows the marker
+            if (pos + 3 >= len) {
+                break;
+            }
+            pos += 2 + ((buf[pos + 2] << 8) | buf[pos + 3]);
+            s_state->jpeg_scan = marker == 0xDA;
+        }
+    }
+    s_state->jpeg_pos = pos;
+    return 0;
 }
 
-static void IRAM_ATTR dma_filter_buffer(size_t buf_idx) {
-    // no need to process the data if frame is in use or is bad
-    if (s_state->fb->ref || s_state->fb->bad) {
+static bool IRAM_ATTR dma_filter_roi(dma_ring_entry_t entry) {
+    // lines outside of the region and between the kept ones are not copied
+    const camera_roi_t* roi = &s_state->roi;
+    size_t line = s_state->dma_filtered_count / s_state->dma_per_line;
+    if (line < roi->y || line >= roi->y + roi->height || (line - roi->y) % s_state->decimation) {
+        return false;
+    }
+
+    // the pixels of this part of the line that fall into the region
+    size_t pixels = s_state->width / s_state->dma_per_line;
+    size_t first = (s_state->dma_filtered_count % s_state->dma_per_line) * pixels;
+    size_t start = first > roi->x ? first : roi->x;
+    size_t end = first + pixels < roi->x + roi->width ? first + pixels : roi->x + roi->width;
+    if (start >= end) {
+        return true;
+    }
+    size_t col = (start - roi->x + s_state->decimation - 1) / s_state->decimation;
+    size_t count = (end - roi->x + s_state->decimation - 1) / s_state->decimation - col;
+    size_t row = (line - roi->y) / s_state->decimation;
+    size_t elems = s_state->roi_step / s_state->decimation;
+    const dma_elem_t* src = s_state->dma_buf[entry.idx] + (roi->x + col * s_state->decimation - first) * elems;
+    uint8_t* dst = s_state->fb->buf + (row * (roi->width / s_state->decimation) + col) * s_state->fb_bytes_per_pixel;
+    (*s_state->dma_filter_roi)(src, col, count, dst);
+    return true;
+}
+
+static void IRAM_ATTR dma_filter_frame(dma_ring_entry_t entry, bool* motion) {
+    // no need to process the data if frame is in use, is bad or the JPEG is complete
+    if (!camera_fb_filling(s_state->fb) || s_state->fb->bad || s_state->jpeg_done) {
         return;
     }
 
     // check if there is enough space in the frame buffer for the new data
     size_t buf_len = s_state->width * s_state->fb_bytes_per_pixel / s_state->dma_per_line;
     size_t fb_pos = s_state->dma_filtered_count * buf_len;
-    if (fb_pos > s_state->fb_size - buf_len) {
+    bool row = false;
+    if (s_state->cropped) {
+        // raw frame buffers hold the whole region from the start
+        row = dma_filter_roi(entry);
+    } else if (!camera_fb_extend(s_state->fb, fb_pos + buf_len)) {
         // size_t processed = s_state->dma_received_count * buf_len;
         // ets_printf("[%s:%u] ovf pos: %u, processed: %u\n", __FUNCTION__, __LINE__, fb_pos, processed);
+        // a JPEG that does not fit into the free segments would be truncated, a larger pool is sized next time
+        if (s_state->sensor.pixformat == PIXFORMAT_JPEG) {
+            if (s_state->fb->segs == s_state->seg_count) {
+                jpeg_hist_add(s_state->fb_size + 1);
+            }
+            s_state->fb->bad = 1;
+        }
         return;
+    } else {
+        // convert I2S DMA buffer to pixel data, the motion filter adds the luma to the block sums on the way
+        dma_filter_t filter = *motion ? s_state->dma_filter_motion : s_state->dma_filter;
+        (*filter)(s_state->dma_buf[entry.idx], &s_state->dma_desc[entry.idx], s_state->fb->buf + fb_pos);
+        *motion = false;
     }
 
-    // convert I2S DMA buffer to pixel data
-    (*s_state->dma_filter)(s_state->dma_buf[buf_idx], &s_state->dma_desc[buf_idx], s_state->fb->buf + fb_pos);
+    // the dma reaches the buffer again after filling all others, then the copy may be torn
+    if (dma_buf_late(entry)) {
+        s_state->dma_late_count++;
+        s_state->fb->bad = 1;
+        return;
+    }
 
     // first frame buffer
     if (!s_state->dma_filtered_count) {
@@ -662,25 +1303,81 @@ static void IRAM_ATTR dma_filter_buffer(size_t buf_idx) {
             }
         }
         // set the frame properties
-        s_state->fb->width = resolution[s_state->sensor.status.framesize][0];
-        s_state->fb->height = resolution[s_state->sensor.status.framesize][1];
+        s_state->fb->timestamp = s_state->frame_time;
+        s_state->fb->seq = s_state->frame_count;
+        if (s_state->cropped) {
+            s_state->fb->width = s_state->roi.width / s_state->decimation;
+            s_state->fb->height = s_state->roi.height / s_state->decimation;
+        } else {
+            s_state->fb->width = resolution[s_state->sensor.status.framesize][0];
+            s_state->fb->height = resolution[s_state->sensor.status.framesize][1];
+        }
         s_state->fb->format = s_state->sensor.pixformat;
+
+        // stream the frame if a consumer waits for chunks
+        s_state->chunk_stream = s_state->chunk_wanted;
+        s_state->chunk_wanted = false;
     }
     s_state->dma_filtered_count++;
+
+    // send out the JPEG as soon as the end marker arrived, the rest of the frame is not copied
+    if (s_state->sensor.pixformat == PIXFORMAT_JPEG) {
+        size_t len = jpeg_find_end(s_state->fb->buf, fb_pos + buf_len);
+        if (len) {
+            s_state->fb->len = len;
+            s_state->jpeg_done = true;
+            jpeg_hist_add(len);
+            camera_fb_done(fb_pos);
+            s_state->chunk_stream = false;
+            return;
+        }
+    }
+
+    // pass the data on while the frame is captured, a region by its completed rows
+    if (s_state->chunk_stream && !s_state->cropped) {
+        dma_send_chunk(fb_pos, buf_len, false, NULL);
+    } else if (s_state->chunk_stream && row && s_state->dma_filtered_count % s_state->dma_per_line == 0) {
+        size_t stride = s_state->roi.width / s_state->decimation * s_state->fb_bytes_per_pixel;
+        size_t rows = dma_roi_rows(s_state->dma_filtered_count / s_state->dma_per_line);
+        dma_send_chunk((rows - 1) * stride, stride, false, NULL);
+    }
+}
+
+static void IRAM_ATTR dma_filter_buffer(dma_ring_entry_t entry) {
+    // motion is tracked in every frame, also while no frame buffer is free. the luma of a buffer that is converted to
+    // a whole line is summed by its filter, buffers of regions and of frames that are not copied take a pass of their own
+    bool motion = s_state->motion_threshold && dma_motion_buffer(entry);
+    dma_filter_frame(entry, &motion);
+    if (motion) {
+        dma_motion_sum(s_state->dma_buf[entry.idx]);
+    }
+    if (s_state->motion_threshold) {
+        dma_motion_done(entry);
+    }
 }
 
 static void IRAM_ATTR dma_filter_task(void* pvParameters) {
     s_state->dma_filtered_count = 0;
     while (true) {
-        size_t buf_idx;
-        if (xQueueReceive(s_state->data_ready, &buf_idx, portMAX_DELAY) == pdTRUE) {
-            if (buf_idx == SIZE_MAX) {
-                // this is the end of the frame
-                dma_finish_frame();
-            } else {
-                dma_filter_buffer(buf_idx);
+        // sleep once the ring is empty, the isr sees the idle flag or the task sees the new entry
+        uint32_t tail = s_state->dma_ring_tail;
+        if (tail == __atomic_load_n(&s_state->dma_ring_head, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&s_state->dma_filter_idle, true, __ATOMIC_SEQ_CST);
+            if (tail == __atomic_load_n(&s_state->dma_ring_head, __ATOMIC_SEQ_CST)) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
             }
+            __atomic_store_n(&s_state->dma_filter_idle, false, __ATOMIC_RELAXED);
+            continue;
         }
+
+        dma_ring_entry_t entry = s_state->dma_ring[tail & DMA_RING_MASK];
+        if (entry.idx == DMA_RING_END) {
+            // this is the end of the frame
+            dma_finish_frame();
+        } else {
+            dma_filter_buffer(entry);
+        }
+        __atomic_store_n(&s_state->dma_ring_tail, tail + 1, __ATOMIC_RELEASE);
     }
 }
 
@@ -768,10 +1465,128 @@ static void IRAM_ATTR dma_filter_yuyv_highspeed(const dma_elem_t* src, lldesc_t*
     }
 }
 
+// motion filters, they convert like the dma filters and add the luma of the pixels between motion_x and
+// motion_end to the block sums on the way, so the dma buffer is read once
+
+static inline uint8_t IRAM_ATTR dma_motion_pixel(const dma_elem_t* src, size_t step, size_t bytes_per_pixel, uint8_t* dst) {
+    // copy a pixel and return its luma, the chroma is sample2 or, at high speed, sample1 of the next element
+    uint8_t y = src[0].sample1;
+    dst[0] = y;
+    if (bytes_per_pixel == 2) {
+        dst[1] = step == 2 ? src[1].sample1 : src[0].sample2;  // u or v
+    }
+    return y;
+}
+
+static inline void IRAM_ATTR dma_motion_filter(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst, size_t step, size_t bytes_per_pixel) {
+    const dma_elem_t* start = src;
+    size_t x = s_state->motion_x;
+    size_t end = s_state->motion_end;
+    while (x < end) {
+        size_t block = x / CONFIG_CAMERA_MOTION_BLOCK;
+        size_t next = (block + 1) * CONFIG_CAMERA_MOTION_BLOCK;
+        size_t count = (next < end ? next : end) - x;
+        uint32_t sum = 0;
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            // manually unrolling 4 iterations of the loop here
+            sum += dma_motion_pixel(src, step, bytes_per_pixel, dst);
+            sum += dma_motion_pixel(src + step, step, bytes_per_pixel, dst + bytes_per_pixel);
+            sum += dma_motion_pixel(src + 2 * step, step, bytes_per_pixel, dst + 2 * bytes_per_pixel);
+            sum += dma_motion_pixel(src + 3 * step, step, bytes_per_pixel, dst + 3 * bytes_per_pixel);
+            src += 4 * step;
+            dst += 4 * bytes_per_pixel;
+        }
+        for (; i < count; ++i) {
+            sum += dma_motion_pixel(src, step, bytes_per_pixel, dst);
+            src += step;
+            dst += bytes_per_pixel;
+        }
+        s_state->motion_sum[block] += sum;
+        x += count;
+    }
+
+    // the pixels after the last full block
+    lldesc_t rest = {.length = dma_desc->length - (src - start) * sizeof(dma_elem_t)};
+    (*s_state->dma_filter)(src, &rest, dst);
+}
+
+static void IRAM_ATTR dma_filter_grayscale_motion(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst) {
+    dma_motion_filter(src, dma_desc, dst, 1, 1);
+}
+
+static void IRAM_ATTR dma_filter_grayscale_highspeed_motion(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst) {
+    dma_motion_filter(src, dma_desc, dst, 2, 1);
+}
+
+static void IRAM_ATTR dma_filter_yuyv_motion(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst) {
+    dma_motion_filter(src, dma_desc, dst, 1, 2);
+}
+
+static void IRAM_ATTR dma_filter_yuyv_highspeed_motion(const dma_elem_t* src, lldesc_t* dma_desc, uint8_t* dst) {
+    dma_motion_filter(src, dma_desc, dst, 2, 2);
+}
+
+// region filters, they keep every decimation-th pixel of a line. a pixel is one dma element or, at high speed, two
+
+static void IRAM_ATTR dma_filter_roi_grayscale(const dma_elem_t* src, size_t col, size_t count, uint8_t* dst) {
+    size_t step = s_state->roi_step;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = src->sample1;
+        src += step;
+    }
+}
+
+static void IRAM_ATTR dma_filter_roi_yuyv(const dma_elem_t* src, size_t col, size_t count, uint8_t* dst) {
+    // odd pixels of a decimated YUV422 line take v from the pixel next to the kept one, the kept one carries u
+    size_t step = s_state->roi_step;
+    size_t chroma = s_state->roi_chroma;
+    for (size_t i = 0; i < count; ++i) {
+        dst[0] = src->sample1;
+        dst[1] = src[(col + i) & 1 ? chroma : 0].sample2;
+        src += step;
+        dst += 2;
+    }
+}
+
+static void IRAM_ATTR dma_filter_roi_yuyv_highspeed(const dma_elem_t* src, size_t col, size_t count, uint8_t* dst) {
+    size_t step = s_state->roi_step;
+    size_t chroma = s_state->roi_chroma;
+    for (size_t i = 0; i < count; ++i) {
+        dst[0] = src[0].sample1;
+        dst[1] = src[(col + i) & 1 ? chroma + 1 : 1].sample1;
+        src += step;
+        dst += 2;
+    }
+}
+
 /*
  * Public Methods
  * */
 
+static bool camera_probe_load(camera_probe_t* probe) {
+    nvs_handle handle;
+    if (nvs_open(CAMERA_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*probe);
+    esp_err_t err = nvs_get_blob(handle, CAMERA_NVS_PROBE, probe, &len);
+    nvs_close(handle);
+    return err == ESP_OK && len == sizeof(*probe) && probe->id.PID != 0 && probe->id.PID != 0xFF;
+}
+
+static void camera_probe_store(const camera_probe_t* probe) {
+    nvs_handle handle;
+    if (nvs_open(CAMERA_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to open NVS, the camera is probed again on the next init");
+        return;
+    }
+    if (nvs_set_blob(handle, CAMERA_NVS_PROBE, probe, sizeof(*probe)) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the camera probe");
+    }
+    nvs_close(handle);
+}
+
 esp_err_t camera_probe(const camera_config_t* config, camera_model_t* out_camera_model) {
     if (s_state != NULL) {
         return ESP_ERR_INVALID_STATE;
@@ -827,26 +1642,35 @@ esp_err_t camera_probe(const camera_config_t* config, camera_model_t* out_camera
 #endif
     }
 
-    ESP_LOGD(TAG, "Searching for camera address");
     vTaskDelay(10 / portTICK_PERIOD_MS);
-    uint8_t slv_addr = SCCB_Probe();
-    if (slv_addr == 0) {
-        *out_camera_model = CAMERA_NONE;
-        camera_disable_out_clock();
-        return ESP_ERR_CAMERA_NOT_DETECTED;
+    sensor_id_t* id = &s_state->sensor.id;
+    camera_probe_t probe;
+    if (camera_probe_load(&probe) && SCCB_Read(probe.slv_addr, REG_PID) == probe.id.PID) {
+        ESP_LOGD(TAG, "Found camera at cached address=0x%02x", probe.slv_addr);
+        s_state->sensor.slv_addr = probe.slv_addr;
+        *id = probe.id;
+    } else {
+        ESP_LOGD(TAG, "Searching for camera address");
+        uint8_t slv_addr = SCCB_Probe();
+        if (slv_addr == 0) {
+            *out_camera_model = CAMERA_NONE;
+            camera_disable_out_clock();
+            return ESP_ERR_CAMERA_NOT_DETECTED;
+        }
+        s_state->sensor.slv_addr = slv_addr;
+
+        // s_state->sensor.slv_addr = 0x30;
+        ESP_LOGD(TAG, "Detected camera at address=0x%02x", s_state->sensor.slv_addr);
+        id->PID = SCCB_Read(s_state->sensor.slv_addr, REG_PID);
+        id->VER = SCCB_Read(s_state->sensor.slv_addr, REG_VER);
+        id->MIDL = SCCB_Read(s_state->sensor.slv_addr, REG_MIDL);
+        id->MIDH = SCCB_Read(s_state->sensor.slv_addr, REG_MIDH);
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+        probe.slv_addr = s_state->sensor.slv_addr;
+        probe.id = *id;
+        camera_probe_store(&probe);
     }
-    s_state->sensor.slv_addr = slv_addr;
     s_state->sensor.xclk_freq_hz = config->xclk_freq_hz;
-
-    // s_state->sensor.slv_addr = 0x30;
-    ESP_LOGD(TAG, "Detected camera at address=0x%02x", s_state->sensor.slv_addr);
-    sensor_id_t* id = &s_state->sensor.id;
-
-    id->PID = SCCB_Read(s_state->sensor.slv_addr, REG_PID);
-    id->VER = SCCB_Read(s_state->sensor.slv_addr, REG_VER);
-    id->MIDL = SCCB_Read(s_state->sensor.slv_addr, REG_MIDL);
-    id->MIDH = SCCB_Read(s_state->sensor.slv_addr, REG_MIDH);
-    vTaskDelay(10 / portTICK_PERIOD_MS);
     ESP_LOGD(TAG, "Camera PID=0x%02x VER=0x%02x MIDL=0x%02x MIDH=0x%02x", id->PID, id->VER, id->MIDH, id->MIDL);
 
     switch (id->PID) {
@@ -939,6 +1763,68 @@ esp_err_t camera_init(const camera_config_t* config) {
         goto fail;
     }
 
+    // raw frames may be reduced to a region and decimated while they are copied
+    s_state->roi = config->roi;
+    s_state->decimation = config->decimation > 1 ? config->decimation : 1;
+    if (!s_state->roi.width) {
+        s_state->roi = (camera_roi_t){0, 0, s_state->width, s_state->height};
+    }
+    s_state->cropped = s_state->decimation > 1 || s_state->roi.width != s_state->width || s_state->roi.height != s_state->height;
+    if (s_state->cropped) {
+        const camera_roi_t* roi = &s_state->roi;
+        if (pix_format == PIXFORMAT_JPEG) {
+            ESP_LOGE(TAG, "Region and decimation are not supported for JPEG");
+            err = ESP_ERR_NOT_SUPPORTED;
+            goto fail;
+        }
+        if ((s_state->decimation != 1 && s_state->decimation != 2 && s_state->decimation != 4) || roi->x % 4 || !roi->width || !roi->height ||
+            roi->width % (4 * s_state->decimation) || roi->height % s_state->decimation || roi->x + roi->width > s_state->width ||
+            roi->y + roi->height > s_state->height) {
+            ESP_LOGE(TAG, "Invalid region %ux%u+%u+%u with decimation %u", roi->width, roi->height, roi->x, roi->y, s_state->decimation);
+            err = ESP_ERR_INVALID_ARG;
+            goto fail;
+        }
+        size_t elems = s_state->sampling_mode == SM_0A00_0B00 ? 2 : 1;  // dma elements per pixel
+        s_state->roi_step = s_state->decimation * elems;
+        s_state->roi_chroma = pix_format == PIXFORMAT_YUV422 && s_state->decimation > 1 ? elems : 0;
+        s_state->dma_filter_roi = pix_format == PIXFORMAT_GRAYSCALE ? &dma_filter_roi_grayscale : elems > 1 ? &dma_filter_roi_yuyv_highspeed : &dma_filter_roi_yuyv;
+        s_state->fb_size = (roi->width / s_state->decimation) * (roi->height / s_state->decimation) * s_state->fb_bytes_per_pixel;
+    }
+
+    // motion is detected on the luma of raw frames, which is sample1 of every pixel
+    s_state->motion_threshold = config->motion_threshold;
+    if (s_state->motion_threshold) {
+        if (pix_format != PIXFORMAT_GRAYSCALE && pix_format != PIXFORMAT_YUV422) {
+            ESP_LOGE(TAG, "Motion detection needs grayscale or YUV422");
+            err = ESP_ERR_NOT_SUPPORTED;
+            goto fail;
+        }
+        s_state->motion_blocks = config->motion_blocks > 1 ? config->motion_blocks : 1;
+        s_state->motion_cols = s_state->width / CONFIG_CAMERA_MOTION_BLOCK;
+        s_state->motion_rows = s_state->height / CONFIG_CAMERA_MOTION_BLOCK;
+        s_state->motion_step = s_state->sampling_mode == SM_0A00_0B00 ? 2 : 1;
+        if (pix_format == PIXFORMAT_GRAYSCALE) {
+            s_state->dma_filter_motion = s_state->motion_step > 1 ? &dma_filter_grayscale_highspeed_motion : &dma_filter_grayscale_motion;
+        } else {
+            s_state->dma_filter_motion = s_state->motion_step > 1 ? &dma_filter_yuyv_highspeed_motion : &dma_filter_yuyv_motion;
+        }
+        s_state->motion_row = SIZE_MAX;
+        size_t blocks = s_state->motion_cols * s_state->motion_rows;
+        s_state->motion_sum = (uint32_t*)calloc(s_state->motion_cols, sizeof(uint32_t));
+        s_state->motion_luma = (uint8_t*)calloc(blocks, 1);
+        s_state->motion_valid = (bool*)calloc(s_state->motion_rows, sizeof(bool));
+        s_state->motion_delta = (uint8_t*)calloc(blocks, 1);
+        s_state->motion_map = (uint8_t*)calloc(blocks, 1);
+        s_state->motion_ready = xSemaphoreCreateBinary();
+        s_state->motion_lock = xSemaphoreCreateMutex();
+        if (s_state->motion_sum == NULL || s_state->motion_luma == NULL || s_state->motion_valid == NULL || s_state->motion_delta == NULL || s_state->motion_map == NULL ||
+            s_state->motion_ready == NULL || s_state->motion_lock == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate motion map");
+            err = ESP_ERR_NO_MEM;
+            goto fail;
+        }
+    }
+
     ESP_LOGD(TAG, "in_bpp: %d, fb_bpp: %d, fb_size: %d, mode: %d, width: %d height: %d", s_state->in_bytes_per_pixel, s_state->fb_bytes_per_pixel, s_state->fb_size, s_state->sampling_mode,
              s_state->width, s_state->height);
 
@@ -956,33 +1842,34 @@ esp_err_t camera_init(const camera_config_t* config) {
         ESP_LOGE(TAG, "Failed to allocate frame buffer");
         goto fail;
     }
+    camera_fb_claim();
 
-    s_state->data_ready = xQueueCreate(16, sizeof(size_t));
-    if (s_state->data_ready == NULL) {
-        ESP_LOGE(TAG, "Failed to dma queue");
+    s_state->capture_lock = xSemaphoreCreateMutex();
+    if (s_state->capture_lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create mutex");
         err = ESP_ERR_NO_MEM;
         goto fail;
     }
 
     if (s_state->config.fb_count == 1) {
         s_state->frame_ready = xSemaphoreCreateBinary();
-        if (s_state->frame_ready == NULL) {
+        s_state->bus_stopped = xSemaphoreCreateBinary();
+        if (s_state->frame_ready == NULL || s_state->bus_stopped == NULL) {
             ESP_LOGE(TAG, "Failed to create semaphore");
             err = ESP_ERR_NO_MEM;
             goto fail;
         }
     } else {
-        s_state->fb_in = xQueueCreate(s_state->config.fb_count, sizeof(camera_fb_t*));
-        s_state->fb_out = xQueueCreate(1, sizeof(camera_fb_t*));
-        if (s_state->fb_in == NULL || s_state->fb_out == NULL) {
-            ESP_LOGE(TAG, "Failed to fb queues");
+        // the first consumer is used by esp_camera_fb_get
+        s_state->latest_ready = xSemaphoreCreateBinary();
+        if (s_state->latest_ready == NULL || esp_camera_consumer_add() == NULL) {
+            ESP_LOGE(TAG, "Failed to create consumer");
             err = ESP_ERR_NO_MEM;
             goto fail;
         }
     }
 
-    // ToDo: core affinity?
-    if (!xTaskCreatePinnedToCore(&dma_filter_task, "dma_filter", 4096, NULL, 10, &s_state->dma_filter_task, 1)) {
+    if (!xTaskCreatePinnedToCore(&dma_filter_task, "dma_filter", 4096, NULL, CONFIG_CAMERA_FILTER_TASK_PRIORITY, &s_state->dma_filter_task, CONFIG_CAMERA_FILTER_TASK_CORE)) {
         ESP_LOGE(TAG, "Failed to create DMA filter task");
         err = ESP_ERR_NO_MEM;
         goto fail;
@@ -1013,7 +1900,11 @@ esp_err_t camera_init(const camera_config_t* config) {
         s_state->sensor.set_lenc(&s_state->sensor, true);
     }
 
-    skip_frame();
+    if (!skip_frame()) {
+        ESP_LOGE(TAG, "Timeout waiting for VSYNC");
+        err = ESP_ERR_TIMEOUT;
+        goto fail;
+    }
     // todo: for some reason the first set of the quality does not work.
     if (pix_format == PIXFORMAT_JPEG) {
         (*s_state->sensor.set_quality)(&s_state->sensor, config->jpeg_quality);
@@ -1052,6 +1943,10 @@ esp_err_t esp_camera_init(const camera_config_t* config) {
         ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
         return err;
     }
+    if (config->preroll && config->fb_count > 1) {
+        // capture from now on so that the latest frame is at hand
+        camera_capture();
+    }
     return ESP_OK;
 
 fail:
@@ -1068,18 +1963,35 @@ esp_err_t esp_camera_deinit() {
     if (s_state->dma_filter_task) {
         vTaskDelete(s_state->dma_filter_task);
     }
-    if (s_state->data_ready) {
-        vQueueDelete(s_state->data_ready);
-    }
-    if (s_state->fb_in) {
-        vQueueDelete(s_state->fb_in);
-    }
-    if (s_state->fb_out) {
-        vQueueDelete(s_state->fb_out);
+    for (size_t i = 0; i < s_state->consumer_count; i++) {
+        vSemaphoreDelete(s_state->consumers[i].ready);
     }
     if (s_state->frame_ready) {
         vSemaphoreDelete(s_state->frame_ready);
     }
+    if (s_state->bus_stopped) {
+        vSemaphoreDelete(s_state->bus_stopped);
+    }
+    if (s_state->capture_lock) {
+        vSemaphoreDelete(s_state->capture_lock);
+    }
+    if (s_state->latest_ready) {
+        vSemaphoreDelete(s_state->latest_ready);
+    }
+    if (s_state->chunk_ready) {
+        vQueueDelete(s_state->chunk_ready);
+    }
+    if (s_state->motion_ready) {
+        vSemaphoreDelete(s_state->motion_ready);
+    }
+    if (s_state->motion_lock) {
+        vSemaphoreDelete(s_state->motion_lock);
+    }
+    free(s_state->motion_sum);
+    free(s_state->motion_luma);
+    free(s_state->motion_valid);
+    free(s_state->motion_delta);
+    free(s_state->motion_map);
     gpio_isr_handler_remove(s_state->config.pin_vsync);
     if (s_state->i2s_intr_handle) {
         esp_intr_disable(s_state->i2s_intr_handle);
@@ -1094,34 +2006,314 @@ esp_err_t esp_camera_deinit() {
     return ESP_OK;
 }
 
-camera_fb_t* esp_camera_fb_get() {
-    if (s_state == NULL) {
-        return NULL;
+static void camera_drop_frame() {
+    // the bus is stopped and the filter task idle, a claimed frame buffer is kept for the first frame after resume
+    if (s_state->chunk_stream) {
+        dma_send_chunk(0, 0, true, NULL);
+    }
+    if (s_state->config.fb_count > 1 && camera_fb_filling(s_state->fb)) {
+        s_state->fb->bad = 0;
+        s_state->fb->len = 0;
+        *((uint32_t*)s_state->fb->buf) = 0;
+    }
+    s_state->dma_received_count = 0;
+    s_state->dma_filtered_count = 0;
+    s_state->jpeg_pos = 0;
+    s_state->jpeg_scan = false;
+    s_state->jpeg_done = false;
+    s_state->chunk_stream = false;
+
+    // motion is compared again from the second frame after resume
+    if (s_state->motion_threshold) {
+        memset(s_state->motion_sum, 0, s_state->motion_cols * sizeof(uint32_t));
+        memset(s_state->motion_valid, 0, s_state->motion_rows * sizeof(bool));
+        s_state->motion_row = SIZE_MAX;
+        s_state->motion_next = 0;
+        s_state->motion_parts = 0;
+        s_state->motion_changed = 0;
+    }
+}
+
+esp_err_t esp_camera_suspend() {
+    if (s_state == NULL || s_state->suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_state->suspended = true;
+
+    // stop the bus and let the filter task take the buffers received so far, an interrupt running meanwhile is
+    // done after a tick
+    vsync_intr_disable();
+    i2s_stop_bus();
+    I2S0.in_link.start = 0;
+    do {
+        vTaskDelay(1);
+    } while (__atomic_load_n(&s_state->dma_ring_tail, __ATOMIC_ACQUIRE) != s_state->dma_ring_head);
+    camera_drop_frame();
+
+    // the sensor keeps its registers in standby, everything allocated stays in place
+    if (s_state->sensor.set_standby != NULL) {
+        s_state->sensor.set_standby(&s_state->sensor, true);
+    }
+    camera_stop_out_clock(&s_state->config);
+    periph_module_disable(PERIPH_I2S0_MODULE);
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_resume() {
+    if (s_state == NULL || !s_state->suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = camera_enable_out_clock(&s_state->config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    i2s_enable();
+    if (s_state->sensor.set_standby != NULL) {
+        s_state->sensor.set_standby(&s_state->sensor, false);
+    }
+    s_state->suspended = false;
+
+    // the frame the sensor wakes up in is incomplete
+    if (!skip_frame()) {
+        ESP_LOGE(TAG, "Timeout waiting for VSYNC");
+        return ESP_ERR_TIMEOUT;
+    }
+    if (s_state->config.preroll && s_state->config.fb_count > 1) {
+        camera_capture();
+    }
+    return ESP_OK;
+}
+
+static void camera_capture() {
+    // consumers start the bus one at a time, rx_start is not checked as vsync_isr clears it while restarting the bus
+    xSemaphoreTake(s_state->capture_lock, portMAX_DELAY);
+
+    // the last JPEG was sent out at its end marker, wait for VSYNC to stop the bus, a token left from an earlier stop
+    // is used up by the loop
+    while (s_state->config.fb_count == 1 && s_state->jpeg_done && __atomic_load_n(&s_state->bus_started, __ATOMIC_ACQUIRE)) {
+        xSemaphoreTake(s_state->bus_stopped, portMAX_DELAY);
     }
-    if (!I2S0.conf.rx_start) {
+
+    // the flag is set before the interrupts are enabled, so that stopping the bus always clears it
+    if (!__atomic_load_n(&s_state->bus_started, __ATOMIC_ACQUIRE)) {
         if (s_state->config.fb_count > 1) {
             ESP_LOGD(TAG, "i2s_run");
         }
+        __atomic_store_n(&s_state->bus_started, true, __ATOMIC_RELEASE);
         i2s_run();
     }
+
+    xSemaphoreGive(s_state->capture_lock);
+}
+
+camera_fb_t* esp_camera_fb_get() {
+    if (s_state == NULL || s_state->suspended) {
+        return NULL;
+    }
+    camera_capture();
     if (s_state->config.fb_count == 1) {
         xSemaphoreTake(s_state->frame_ready, portMAX_DELAY);
     }
     if (s_state->config.fb_count == 1) {
         return (camera_fb_t*)s_state->fb;
     }
-    camera_fb_int_t* fb = NULL;
-    if (s_state->fb_out) {
-        xQueueReceive(s_state->fb_out, &fb, portMAX_DELAY);
+    return (camera_fb_t*)camera_fb_acquire(&s_state->consumers[0]);
+}
+
+camera_fb_t* esp_camera_fb_get_latest() {
+    if (s_state == NULL || s_state->suspended || s_state->config.fb_count == 1) {
+        return NULL;
+    }
+    camera_capture();
+    while (true) {
+        camera_fb_int_t* fb = __atomic_load_n(&s_state->fb_latest, __ATOMIC_ACQUIRE);
+        if (fb != NULL && camera_fb_ref(fb)) {
+            return (camera_fb_t*)fb;
+        }
+        xSemaphoreTake(s_state->latest_ready, portMAX_DELAY);
     }
-    return (camera_fb_t*)fb;
+}
+
+camera_fb_t* esp_camera_fb_get_at_or_after(int64_t timestamp) {
+    if (s_state == NULL || s_state->suspended || s_state->config.fb_count == 1) {
+        return NULL;
+    }
+    camera_capture();
+    while (true) {
+        camera_fb_int_t* fb = camera_fb_find(timestamp);
+        if (fb == NULL) {
+            xSemaphoreTake(s_state->latest_ready, portMAX_DELAY);
+        } else if (camera_fb_ref(fb)) {
+            // the buffer may have been reused for a newer frame, which also qualifies
+            return (camera_fb_t*)fb;
+        }
+    }
+}
+
+static float camera_max_fps() {
+    // the OV2640 runs at XCLK / 2, for JPEG with a 10 MHz XCLK the driver doubles XCLK and drops the divider below UXGA
+    if (s_state->sensor.id.PID != OV2640_PID) {
+        return 0;
+    }
+    framesize_t framesize = s_state->sensor.status.framesize;
+    float clock = s_state->config.xclk_freq_hz / 2.0f;
+    if (s_state->sensor.pixformat == PIXFORMAT_JPEG && s_state->config.xclk_freq_hz == 10000000) {
+        clock *= framesize <= FRAMESIZE_SVGA ? 4 : 2;
+    }
+
+    // clocks per line and lines per frame of the UXGA, SVGA and CIF sensor modes
+    if (framesize <= FRAMESIZE_CIF) {
+        return clock / (595 * 336);
+    } else if (framesize <= FRAMESIZE_SVGA) {
+        return clock / (1190 * 672);
+    }
+    return clock / (1922 * 1248);
+}
+
+esp_err_t esp_camera_burst(size_t count, uint32_t interval_ms, camera_burst_cb_t callback, void* arg, camera_burst_stats_t* stats) {
+    if (s_state == NULL || s_state->suspended || s_state->config.fb_count == 1) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || callback == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the burst has its own consumer which starts with the next frame
+    if (s_state->burst == NULL) {
+        s_state->burst = esp_camera_consumer_add();
+        if (s_state->burst == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    camera_consumer_t* consumer = s_state->burst;
+    consumer->seq = __atomic_load_n(&s_state->fb_seq, __ATOMIC_ACQUIRE);
+    camera_capture();
+
+    // hand consecutive frames to the callback, frames within the interval are left out on purpose
+    int64_t first = 0, last = 0;
+    uint32_t seq = 0;
+    size_t dropped = 0;
+    for (size_t i = 0; i < count;) {
+        camera_fb_int_t* fb = camera_fb_acquire(consumer);
+        if (i > 0 && fb->timestamp - last < (int64_t)interval_ms * 1000) {
+            camera_fb_release(fb, false);
+            continue;
+        }
+        if (i == 0) {
+            first = fb->timestamp;
+        } else if (!interval_ms) {
+            dropped += fb->seq - seq - 1;
+        }
+        last = fb->timestamp;
+        seq = fb->seq;
+        callback((camera_fb_t*)fb, i++, arg);
+    }
+
+    if (stats != NULL) {
+        stats->frames = count;
+        stats->dropped = dropped;
+        stats->fps = count > 1 && last > first ? (count - 1) * 1000000.0f / (last - first) : 0;
+        stats->fps_max = camera_max_fps();
+    }
+    return ESP_OK;
+}
+
+camera_consumer_t* esp_camera_consumer_add() {
+    if (s_state == NULL || s_state->config.fb_count == 1 || s_state->consumer_count >= CONFIG_CAMERA_MAX_CONSUMERS) {
+        return NULL;
+    }
+    camera_consumer_t* consumer = &s_state->consumers[s_state->consumer_count];
+    consumer->ready = xSemaphoreCreateBinary();
+    if (consumer->ready == NULL) {
+        return NULL;
+    }
+    __atomic_store_n(&s_state->consumer_count, s_state->consumer_count + 1, __ATOMIC_RELEASE);
+    return consumer;
+}
+
+camera_fb_t* esp_camera_consumer_fb_get(camera_consumer_t* consumer) {
+    if (s_state == NULL || s_state->suspended || consumer == NULL) {
+        return NULL;
+    }
+    camera_capture();
+    return (camera_fb_t*)camera_fb_acquire(consumer);
+}
+
+void esp_camera_consumer_stats(camera_consumer_t* consumer, camera_consumer_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    if (consumer == NULL && s_state != NULL && s_state->consumer_count > 0) {
+        consumer = &s_state->consumers[0];
+    }
+    stats->frames = consumer != NULL ? consumer->frames : 0;
+    stats->dropped = consumer != NULL ? consumer->dropped : 0;
+}
+
+esp_err_t esp_camera_motion_get(camera_motion_t* motion, uint32_t timeout_ms) {
+    if (s_state == NULL || s_state->suspended || motion == NULL || !s_state->motion_threshold || s_state->config.fb_count == 1) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // the blocks are compared while frames are received
+    camera_capture();
+    if (xSemaphoreTake(s_state->motion_ready, timeout_ms / portTICK_PERIOD_MS) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // the filter task leaves the event alone while it is copied
+    xSemaphoreTake(s_state->motion_lock, portMAX_DELAY);
+    motion->seq = s_state->motion.seq;
+    motion->timestamp = s_state->motion.timestamp;
+    motion->changed = s_state->motion.changed;
+    motion->cols = s_state->motion_cols;
+    motion->rows = s_state->motion_rows;
+    if (motion->map != NULL && motion->map_len >= s_state->motion_cols * s_state->motion_rows) {
+        memcpy(motion->map, s_state->motion_map, s_state->motion_cols * s_state->motion_rows);
+    }
+    xSemaphoreGive(s_state->motion_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_chunk_get(camera_chunk_t* chunk) {
+    if (s_state == NULL || s_state->suspended || chunk == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // the queue is allocated on first use and holds every chunk of a frame
+    if (s_state->chunk_ready == NULL) {
+        size_t buf_len = s_state->width * s_state->fb_bytes_per_pixel / s_state->dma_per_line;
+        if (s_state->cropped) {
+            buf_len = s_state->roi.width / s_state->decimation * s_state->fb_bytes_per_pixel;
+        }
+        s_state->chunk_ready = xQueueCreate(s_state->fb_size / buf_len + 2, sizeof(camera_chunk_t));
+        if (s_state->chunk_ready == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // ask for the next frame
+    if (!s_state->chunk_pending) {
+        s_state->chunk_pending = true;
+        s_state->chunk_wanted = true;
+        camera_capture();
+    }
+
+    xQueueReceive(s_state->chunk_ready, chunk, portMAX_DELAY);
+    if (chunk->final) {
+        s_state->chunk_pending = false;
+        if (chunk->fb == NULL) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
 }
 
 void esp_camera_fb_return(camera_fb_t* fb) {
-    if (fb == NULL || s_state == NULL || s_state->config.fb_count == 1 || s_state->fb_in == NULL) {
+    if (fb == NULL || s_state == NULL || s_state->config.fb_count == 1) {
         return;
     }
-    xQueueSend(s_state->fb_in, &fb, portMAX_DELAY);
+    camera_fb_release((camera_fb_int_t*)fb, false);
 }
 
 sensor_t* esp_camera_sensor_get() {
@@ -1130,3 +2322,24 @@ sensor_t* esp_camera_sensor_get() {
     }
     return &s_state->sensor;
 }
+
+void esp_camera_stats_get(camera_stats_t* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    stats->frames_rejected = s_state != NULL ? s_state->dma_rejected_count : 0;
+    stats->frames_skipped = s_state != NULL ? s_state->dma_skipped_count : 0;
+    stats->pool_size = s_state != NULL ? s_state->seg_count * CONFIG_CAMERA_FB_SEGMENT_SIZE : 0;
+    stats->buffers_overrun = s_state != NULL ? s_state->dma_overrun_count : 0;
+    stats->buffers_late = s_state != NULL ? s_state->dma_late_count : 0;
+    stats->motion_events = s_state != NULL ? s_state->motion_events : 0;
+    stats->buffers_pending_max = s_state != NULL ? s_state->dma_pending_max : 0;
+    stats->fb_busy = 0;
+    if (s_state != NULL && s_state->fb != NULL) {
+        camera_fb_int_t* fb = s_state->fb;
+        do {
+            stats->fb_busy += FB_STATE(__atomic_load_n(&fb->ctl, __ATOMIC_ACQUIRE)) != CAMERA_FB_FREE;
+            fb = fb->next;
+        } while (fb != s_state->fb);
+    }
+}
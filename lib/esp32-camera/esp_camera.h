@@ -65,6 +65,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include "esp_err.h"
 #include "driver/ledc.h"
 #include "sensor.h"
@@ -73,6 +74,16 @@
 extern "C" {
 #endif
 
+/**
+ * @brief Region of a raw frame in pixels of the configured frame size
+ */
+typedef struct {
+    uint16_t x;                 /*!< Left edge, a multiple of 4 */
+    uint16_t y;                 /*!< Top edge */
+    uint16_t width;             /*!< Width, a multiple of 4 times the decimation. 0 selects the whole frame */
+    uint16_t height;            /*!< Height, a multiple of the decimation */
+} camera_roi_t;
+
 /**
  * @brief Configuration structure for camera initialization
  */
@@ -104,6 +115,11 @@ typedef struct {
 
     int jpeg_quality;               /*!< Quality of JPEG output. 0-63 lower means higher quality  */
     size_t fb_count;                /*!< Number of frame buffers to be allocated. If more than one, then each frame will be acquired (double speed)  */
+    bool preroll;                   /*!< Capture continuously from esp_camera_init on so that the latest frame is at hand. Needs more than one frame buffer  */
+    camera_roi_t roi;               /*!< Part of raw frames that is copied to the frame buffer, all zero for the whole frame. Not supported for JPEG  */
+    uint8_t decimation;             /*!< Keep every 1st, 2nd or 4th pixel and line of the region of raw frames, 0 is the same as 1. Not supported for JPEG  */
+    uint8_t motion_threshold;       /*!< Change of the mean luma of a block at which it counts as moving, 0 disables motion detection. Grayscale and YUV422 only  */
+    uint16_t motion_blocks;         /*!< Moving blocks of a frame that raise a motion event, 0 is the same as 1  */
 } camera_config_t;
 
 /**
@@ -115,8 +131,84 @@ typedef struct {
     size_t width;               /*!< Width of the buffer in pixels */
     size_t height;              /*!< Height of the buffer in pixels */
     pixformat_t format;         /*!< Format of the pixel data */
+    int64_t timestamp;          /*!< Start of the frame in microseconds since boot (esp_timer_get_time), the VSYNC for JPEG and the first line otherwise */
+    int64_t timestamp_end;      /*!< Time the frame was complete in the frame buffer, in microseconds since boot */
+    uint32_t seq;               /*!< Number of the frame among all frames the driver saw start */
+    uint32_t dropped;           /*!< Frames that started since the previous complete frame but were rejected or skipped */
 } camera_fb_t;
 
+/**
+ * @brief Consumer of frames with its own position in the frame sequence
+ */
+typedef struct camera_consumer_s camera_consumer_t;
+
+/**
+ * @brief Statistics of a consumer
+ */
+typedef struct {
+    size_t frames;              /*!< Frames obtained by the consumer */
+    size_t dropped;             /*!< Frames the consumer missed because newer ones replaced them before it asked */
+} camera_consumer_stats_t;
+
+/**
+ * @brief Part of a frame that is still being captured
+ */
+typedef struct {
+    const uint8_t * buf;        /*!< Pointer to the data inside the frame buffer */
+    size_t len;                 /*!< Length of the data in bytes, may be 0 for the final chunk */
+    size_t offset;              /*!< Position of the data within the frame */
+    bool final;                 /*!< Last chunk of the frame */
+    camera_fb_t * fb;           /*!< The complete frame with the final chunk, NULL before and if the frame was rejected */
+} camera_chunk_t;
+
+/**
+ * @brief Capture statistics
+ */
+typedef struct {
+    size_t frames_rejected;     /*!< Frames dropped because they were corrupt or truncated (bad JPEG header or markers, no end marker, too large, overrun or late DMA buffers) */
+    size_t frames_skipped;      /*!< Frames not captured because every frame buffer was held by consumers or the latest frame */
+    size_t pool_size;           /*!< Bytes of the segment pool shared by the frame buffers */
+    size_t buffers_overrun;     /*!< DMA buffers dropped because the filter task had CONFIG_CAMERA_DMA_QUEUE_DEPTH buffers pending */
+    size_t buffers_late;        /*!< DMA buffers the DMA had started to fill again before the filter task copied them */
+    size_t buffers_pending_max; /*!< Most DMA buffers that waited for the filter task at once */
+    size_t fb_busy;             /*!< Frame buffers currently filling, ready or held by consumers */
+    size_t motion_events;       /*!< Frames in which at least camera_config_t.motion_blocks blocks moved */
+} camera_stats_t;
+
+/**
+ * @brief Motion detected in a frame
+ *
+ * The map holds one byte per block of CONFIG_CAMERA_MOTION_BLOCK pixels of the whole sensor frame, row by row. Each
+ * byte is the change of the mean luma of the block against the previous frame.
+ */
+typedef struct {
+    uint32_t seq;               /*!< Number of the frame, compare with camera_fb_t.seq */
+    int64_t timestamp;          /*!< Start of the frame in microseconds since boot */
+    size_t changed;             /*!< Blocks whose mean luma changed by at least camera_config_t.motion_threshold */
+    size_t cols;                /*!< Blocks per row of the map */
+    size_t rows;                /*!< Rows of the map */
+    uint8_t * map;              /*!< Buffer for the map provided by the caller, may be NULL */
+    size_t map_len;             /*!< Size of the buffer, the map is only copied if cols * rows bytes fit */
+} camera_motion_t;
+
+/**
+ * @brief Statistics of a burst
+ */
+typedef struct {
+    size_t frames;              /*!< Frames handed to the callback */
+    size_t dropped;             /*!< Frames the sensor delivered between them that were missed, only counted without interval */
+    float fps;                  /*!< Achieved frame rate from the first to the last frame */
+    float fps_max;              /*!< Frame rate of the sensor for the XCLK and framesize, 0 if unknown */
+} camera_burst_stats_t;
+
+/**
+ * @brief Receives the frames of a burst
+ *
+ * The callback owns the frame and gives it back with esp_camera_fb_return, e.g. after it was published. It should
+ * return quickly and queue the frame for that, otherwise the burst misses frames.
+ */
+typedef void (*camera_burst_cb_t)(camera_fb_t * fb, size_t index, void * arg);
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
@@ -149,6 +241,34 @@ esp_err_t esp_camera_init(const camera_config_t* config);
  */
 esp_err_t esp_camera_deinit();
 
+/**
+ * @brief Put the camera to sleep between captures without freeing anything
+ *
+ * Stops the I2S bus and XCLK and puts the sensor into standby, which keeps its registers. The frame in progress is
+ * dropped, frame buffers held by the caller stay valid. Until esp_camera_resume the calls that take frames return
+ * NULL or ESP_ERR_INVALID_STATE and the sensor settings must not be changed.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet or is suspended already
+ */
+esp_err_t esp_camera_suspend();
+
+/**
+ * @brief Wake the camera up after esp_camera_suspend
+ *
+ * Restarts XCLK and I2S and takes the sensor out of standby with a single register write, the settings made before
+ * suspending are kept. With camera_config_t.preroll the capture starts again at once, the latest frame is the one from
+ * before the suspend until the next one is captured, esp_camera_fb_get_at_or_after with the time of the resume waits
+ * for it.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver isn't suspended
+ *      - ESP_ERR_TIMEOUT if the sensor did not start within CONFIG_CAMERA_VSYNC_TIMEOUT
+ */
+esp_err_t esp_camera_resume();
+
 /**
  * @brief Obtain pointer to a frame buffer.
  *
@@ -156,6 +276,113 @@ esp_err_t esp_camera_deinit();
  */
 camera_fb_t* esp_camera_fb_get();
 
+/**
+ * @brief Obtain the latest complete frame without waiting for a new one.
+ *
+ * Together with camera_config_t.preroll the frame is served from memory at once. Only waits if no frame was captured
+ * yet. Several callers may hold the same frame. Requires more than one frame buffer.
+ *
+ * @return pointer to the frame buffer, NULL with a single frame buffer
+ */
+camera_fb_t* esp_camera_fb_get_latest();
+
+/**
+ * @brief Obtain the oldest complete frame that started at or after a point in time.
+ *
+ * Frames held by consumers and the latest frame are searched first, otherwise this waits for the next frame that
+ * starts after the timestamp. Requires more than one frame buffer, and waiting needs one that is neither held nor the
+ * latest frame.
+ *
+ * @param timestamp  Time in microseconds since boot (esp_timer_get_time), compared with camera_fb_t.timestamp
+ *
+ * @return pointer to the frame buffer, NULL with a single frame buffer
+ */
+camera_fb_t* esp_camera_fb_get_at_or_after(int64_t timestamp);
+
+/**
+ * @brief Capture consecutive frames at the rate of the sensor.
+ *
+ * The frames come from the frame buffer pool without returning between them, so the callback has to give them back
+ * while the burst goes on. Frames still held count against the pool like those of other consumers. Requires more than
+ * one frame buffer.
+ *
+ * @param count        Number of frames
+ * @param interval_ms  Least time between the starts of two frames, 0 for every frame
+ * @param callback     Receives each frame with its index in the burst
+ * @param arg          Passed to the callback
+ * @param stats        Pointer to the statistics to fill, may be NULL
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE if the camera is not initialized or has a single frame buffer
+ *     - ESP_ERR_INVALID_ARG if count is 0 or the callback is missing
+ *     - ESP_ERR_NO_MEM if no consumer is left for the burst
+ */
+esp_err_t esp_camera_burst(size_t count, uint32_t interval_ms, camera_burst_cb_t callback, void * arg, camera_burst_stats_t * stats);
+
+/**
+ * @brief Wait for the next frame with motion.
+ *
+ * The blocks are compared while the DMA buffers are filtered, for every frame the sensor delivers whether or not a
+ * frame buffer was free, so frames need not be fetched for this. Requires camera_config_t.motion_threshold and more
+ * than one frame buffer.
+ *
+ * @param motion      Pointer to the motion to fill
+ * @param timeout_ms  Time to wait for motion
+ *
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_STATE if the camera is not initialized or motion detection is disabled
+ *     - ESP_ERR_TIMEOUT if no motion was detected in time
+ */
+esp_err_t esp_camera_motion_get(camera_motion_t * motion, uint32_t timeout_ms);
+
+/**
+ * @brief Register an additional consumer of frames.
+ *
+ * Several consumers may hold the same frame at once, each frame buffer is reused once all of them returned it with
+ * esp_camera_fb_return. Consumers always get the latest frame they have not seen yet. esp_camera_fb_get uses the first
+ * consumer, which is registered by esp_camera_init. Requires more than one frame buffer. The latest frame keeps its
+ * buffer, so capturing continues while consumers hold frames only with at least one buffer more than those.
+ *
+ * @return pointer to the consumer, NULL if CONFIG_CAMERA_MAX_CONSUMERS are registered or memory is missing
+ */
+camera_consumer_t * esp_camera_consumer_add();
+
+/**
+ * @brief Obtain the latest frame buffer that the consumer has not seen yet.
+ *
+ * @param consumer  Pointer to the consumer
+ *
+ * @return pointer to the frame buffer
+ */
+camera_fb_t* esp_camera_consumer_fb_get(camera_consumer_t * consumer);
+
+/**
+ * @brief Get the statistics of a consumer
+ *
+ * @param consumer  Pointer to the consumer, NULL for the one used by esp_camera_fb_get
+ * @param stats     Pointer to the statistics to fill
+ */
+void esp_camera_consumer_stats(camera_consumer_t * consumer, camera_consumer_stats_t * stats);
+
+/**
+ * @brief Obtain the next chunk of a frame while it is being captured.
+ *
+ * The first call starts streaming the next frame, the following calls return its chunks in order as soon as they are
+ * filtered. The final chunk carries the complete frame buffer, which has to be returned with esp_camera_fb_return.
+ * The chunks point into that frame buffer and stay valid until then. Do not mix with esp_camera_fb_get.
+ *
+ * @param chunk  Pointer to the chunk to fill
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the frame was rejected, the chunks received so far have to be discarded
+ *      - ESP_ERR_NO_MEM if the chunk queue could not be allocated
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t esp_camera_chunk_get(camera_chunk_t * chunk);
+
 /**
  * @brief Return the frame buffer to be reused again.
  *
@@ -170,6 +397,13 @@ void esp_camera_fb_return(camera_fb_t * fb);
  */
 sensor_t * esp_camera_sensor_get();
 
+/**
+ * @brief Get the capture statistics since initialization
+ *
+ * @param stats  Pointer to the statistics to fill
+ */
+void esp_camera_stats_get(camera_stats_t * stats);
+
 
 #ifdef __cplusplus
 }
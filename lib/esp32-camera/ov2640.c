@@ -453,6 +453,12 @@ static int set_lenc_dsp(sensor_t *sensor, int enable)
     return set_reg_bits(sensor, BANK_DSP, CTRL1, 1, 1, enable?1:0);
 }
 
+static int set_standby(sensor_t *sensor, int enable)
+{
+    // the registers are kept while the sensor sleeps
+    return write_reg_bits(sensor, BANK_SENSOR, COM2, COM2_STDBY, enable);
+}
+
 static int set_dcw_dsp(sensor_t *sensor, int enable)
 {
     sensor->status.dcw = enable;
@@ -545,6 +551,8 @@ int ov2640_init(sensor_t *sensor)
     sensor->set_raw_gma = set_raw_gma_dsp;
     sensor->set_lenc = set_lenc_dsp;
 
+    sensor->set_standby = set_standby;
+
     ESP_LOGD(TAG, "OV2640 Attached");
     return 0;
 }
@@ -286,6 +286,18 @@ static int set_vflip(sensor_t *sensor, int enable)
     return SCCB_Write(sensor->slv_addr, COM3, reg);
 }
 
+static int set_standby(sensor_t *sensor, int enable)
+{
+    // Read register COM2
+    uint8_t reg = SCCB_Read(sensor->slv_addr, COM2);
+
+    // Set soft sleep on/off, the registers are kept
+    reg = enable ? reg | COM2_SOFT_SLEEP : reg & ~COM2_SOFT_SLEEP;
+
+    // Write back register COM2
+    return SCCB_Write(sensor->slv_addr, COM2, reg);
+}
+
 int ov7725_init(sensor_t *sensor)
 {
     // Set function pointers
@@ -298,6 +310,7 @@ int ov7725_init(sensor_t *sensor)
     sensor->set_exposure_ctrl = set_exposure_ctrl;
     sensor->set_hmirror = set_hmirror;
     sensor->set_vflip = set_vflip;
+    sensor->set_standby = set_standby;
 
     // Retrieve sensor's signature
     sensor->id.MIDH = SCCB_Read(sensor->slv_addr, REG_MIDH);
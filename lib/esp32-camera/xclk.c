@@ -42,6 +42,12 @@ esp_err_t camera_enable_out_clock(camera_config_t* config)
     return ESP_OK;
 }
 
+void camera_stop_out_clock(camera_config_t* config)
+{
+    // other channels of the ledc module keep running, the pin is held low
+    ledc_stop(LEDC_HIGH_SPEED_MODE, config->ledc_channel, 0);
+}
+
 void camera_disable_out_clock()
 {
     periph_module_disable(PERIPH_LEDC_MODULE);
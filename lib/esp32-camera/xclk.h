@@ -4,4 +4,6 @@
 
 esp_err_t camera_enable_out_clock();
 
+void camera_stop_out_clock(camera_config_t* config);
+
 void camera_disable_out_clock();
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "packet.h"
 
 void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_size, uint8_t *read_buf,
@@ -12,6 +14,7 @@ void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_s
   client->read_buf_size = read_buf_size;
 
   client->callback = NULL;
+  client->ack_callback = NULL;
   client->callback_ref = NULL;
 
   client->network = NULL;
@@ -46,6 +49,8 @@ void lwmqtt_set_callback(lwmqtt_client_t *client, void *ref, lwmqtt_callback_t c
   client->callback = cb;
 }
 
+void lwmqtt_set_ack_callback(lwmqtt_client_t *client, lwmqtt_ack_callback_t cb) { client->ack_callback = cb; }
+
 static uint16_t lwmqtt_get_next_packet_id(lwmqtt_client_t *client) {
   // check overflow
   if (client->last_packet_id == 65535) {
@@ -91,7 +96,7 @@ static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t off
   return LWMQTT_SUCCESS;
 }
 
-static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, size_t offset, size_t len) {
+static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, uint8_t *buf, size_t len) {
   // prepare counter
   size_t written = 0;
 
@@ -105,7 +110,7 @@ static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, size_t offs
 
     // write
     size_t partial_write = 0;
-    lwmqtt_err_t err = client->network_write(client->network, client->write_buf + offset + written, len - written,
+    lwmqtt_err_t err = client->network_write(client->network, buf + written, len - written,
                                              &partial_write, (uint32_t)remaining_time);
     if (err != LWMQTT_SUCCESS) {
       return err;
@@ -177,7 +182,7 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
 
 static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t length) {
   // write to network
-  lwmqtt_err_t err = lwmqtt_write_to_network(client, 0, length);
+  lwmqtt_err_t err = lwmqtt_write_to_network(client, client->write_buf, length);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
@@ -267,6 +272,11 @@ static lwmqtt_err_t lwmqtt_cycle(lwmqtt_client_t *client, size_t *read, lwmqtt_p
         return err;
       }
 
+      // call callback if set
+      if (client->ack_callback != NULL) {
+        client->ack_callback(client, client->callback_ref, packet_id, false);
+      }
+
       break;
     }
 
@@ -296,6 +306,25 @@ static lwmqtt_err_t lwmqtt_cycle(lwmqtt_client_t *client, size_t *read, lwmqtt_p
       break;
     }
 
+    // handle puback and pubcomp packets
+    case LWMQTT_PUBACK_PACKET:
+    case LWMQTT_PUBCOMP_PACKET: {
+      // decode ack packet
+      bool dup;
+      uint16_t packet_id;
+      err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, *packet_type, &dup, &packet_id);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+
+      // call callback if set
+      if (client->ack_callback != NULL) {
+        client->ack_callback(client, client->callback_ref, packet_id, true);
+      }
+
+      break;
+    }
+
     // handle pingresp packets
     case LWMQTT_PINGRESP_PACKET: {
       // set flag
@@ -353,7 +382,7 @@ lwmqtt_err_t lwmqtt_yield(lwmqtt_client_t *client, size_t available, uint32_t ti
 }
 
 lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, lwmqtt_will_t *will,
-                            lwmqtt_return_code_t *return_code, uint32_t timeout) {
+                            lwmqtt_return_code_t *return_code, bool *session_present, uint32_t timeout) {
   // set command timer
   client->timer_set(client->command_timer, timeout);
 
@@ -366,8 +395,9 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
   // reset pong pending flag
   client->pong_pending = false;
 
-  // initialize return code
+  // initialize return code and session flag
   *return_code = LWMQTT_UNKNOWN_RETURN_CODE;
+  *session_present = false;
 
   // encode connect packet
   size_t len;
@@ -392,8 +422,7 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
   }
 
   // decode connack packet
-  bool session_present;
-  err = lwmqtt_decode_connack(client->read_buf, client->read_buf_size, &session_present, return_code);
+  err = lwmqtt_decode_connack(client->read_buf, client->read_buf_size, session_present, return_code);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
@@ -500,61 +529,141 @@ lwmqtt_err_t lwmqtt_unsubscribe_one(lwmqtt_client_t *client, lwmqtt_string_t top
   return lwmqtt_unsubscribe(client, 1, &topic_filter, timeout);
 }
 
-lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
-                            uint32_t timeout) {
+static lwmqtt_err_t lwmqtt_send_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
+                                        bool dup, uint16_t packet_id) {
+  // encode publish header
+  size_t len = 0;
+  lwmqtt_err_t err =
+      lwmqtt_encode_publish_header(client->write_buf, client->write_buf_size, &len, dup, packet_id, topic, message);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // fill the rest of the buffer with the beginning of the payload
+  size_t head = client->write_buf_size - len;
+  if (head > message.payload_len) {
+    head = message.payload_len;
+  }
+  if (head > 0) {
+    memcpy(client->write_buf + len, message.payload, head);
+  }
+
+  // send header and beginning of the payload
+  err = lwmqtt_write_to_network(client, client->write_buf, len + head);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // send the remaining payload directly without staging it in the buffer
+  err = lwmqtt_write_to_network(client, message.payload + head, message.payload_len - head);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // reset keep alive timer
+  client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_publish_nowait(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
+                                   uint16_t *packet_id, uint32_t timeout) {
   // set command timer
   client->timer_set(client->command_timer, timeout);
 
   // add packet id if at least qos 1
-  uint16_t packet_id = 0;
+  *packet_id = 0;
   if (message.qos == LWMQTT_QOS1 || message.qos == LWMQTT_QOS2) {
-    packet_id = lwmqtt_get_next_packet_id(client);
+    *packet_id = lwmqtt_get_next_packet_id(client);
   }
 
-  // encode publish packet
-  size_t len = 0;
+  return lwmqtt_send_publish(client, topic, message, false, *packet_id);
+}
+
+lwmqtt_err_t lwmqtt_republish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
+                              uint16_t packet_id, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  return lwmqtt_send_publish(client, topic, message, true, packet_id);
+}
+
+lwmqtt_err_t lwmqtt_release(lwmqtt_client_t *client, uint16_t packet_id, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  // encode pubrel packet
+  size_t len;
   lwmqtt_err_t err =
-      lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, 0, packet_id, topic, message);
+      lwmqtt_encode_ack(client->write_buf, client->write_buf_size, &len, LWMQTT_PUBREL_PACKET, 0, packet_id);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
-  // send packet
-  err = lwmqtt_send_packet_in_buffer(client, len);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  }
+  return lwmqtt_send_packet_in_buffer(client, len);
+}
 
+static lwmqtt_err_t lwmqtt_await_ack(lwmqtt_client_t *client, uint16_t packet_id, lwmqtt_qos_t qos) {
   // immediately return on qos zero
-  if (message.qos == LWMQTT_QOS0) {
+  if (qos == LWMQTT_QOS0) {
     return LWMQTT_SUCCESS;
   }
 
   // define ack packet
   lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
-  if (message.qos == LWMQTT_QOS1) {
+  if (qos == LWMQTT_QOS1) {
     ack_type = LWMQTT_PUBACK_PACKET;
-  } else if (message.qos == LWMQTT_QOS2) {
+  } else if (qos == LWMQTT_QOS2) {
     ack_type = LWMQTT_PUBCOMP_PACKET;
   }
 
-  // wait for ack packet
-  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
-  err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  } else if (packet_type != ack_type) {
-    return LWMQTT_MISSING_OR_WRONG_PACKET;
+  // wait for the ack packet of this message, acks of other messages are skipped
+  for (;;) {
+    lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+    lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    } else if (packet_type != ack_type) {
+      return LWMQTT_MISSING_OR_WRONG_PACKET;
+    }
+
+    // decode ack packet
+    bool dup;
+    uint16_t ack_id;
+    err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, ack_type, &dup, &ack_id);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    } else if (ack_id == packet_id) {
+      return LWMQTT_SUCCESS;
+    }
   }
+}
 
-  // decode ack packet
-  bool dup;
-  err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, ack_type, &dup, &packet_id);
+lwmqtt_err_t lwmqtt_wait_ack(lwmqtt_client_t *client, uint16_t packet_id, lwmqtt_qos_t qos, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  return lwmqtt_await_ack(client, packet_id, qos);
+}
+
+lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
+                            uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  // add packet id if at least qos 1
+  uint16_t packet_id = 0;
+  if (message.qos == LWMQTT_QOS1 || message.qos == LWMQTT_QOS2) {
+    packet_id = lwmqtt_get_next_packet_id(client);
+  }
+
+  // send packet
+  lwmqtt_err_t err = lwmqtt_send_publish(client, topic, message, false, packet_id);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
-  return LWMQTT_SUCCESS;
+  return lwmqtt_await_ack(client, packet_id, message.qos);
 }
 
 lwmqtt_err_t lwmqtt_disconnect(lwmqtt_client_t *client, uint32_t timeout) {
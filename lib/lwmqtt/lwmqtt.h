@@ -141,6 +141,14 @@ typedef int32_t (*lwmqtt_timer_get_t)(void *ref);
  */
 typedef void (*lwmqtt_callback_t)(lwmqtt_client_t *client, void *ref, lwmqtt_string_t str, lwmqtt_message_t msg);
 
+/**
+ * The callback used to report the acks of outgoing qos 1 or 2 publishes. A puback or pubcomp completes a message, a
+ * pubrec is reported as incomplete after the pubrel has been sent.
+ *
+ * Note: The callback is executed from the same calls as the message callback and receives its reference.
+ */
+typedef void (*lwmqtt_ack_callback_t)(lwmqtt_client_t *client, void *ref, uint16_t packet_id, bool complete);
+
 /**
  * The client object.
  */
@@ -153,6 +161,7 @@ struct lwmqtt_client_t {
   uint8_t *write_buf, *read_buf;
 
   lwmqtt_callback_t callback;
+  lwmqtt_ack_callback_t ack_callback;
   void *callback_ref;
 
   void *network;
@@ -208,6 +217,14 @@ void lwmqtt_set_timers(lwmqtt_client_t *client, void *keep_alive_timer, void *co
  */
 void lwmqtt_set_callback(lwmqtt_client_t *client, void *ref, lwmqtt_callback_t cb);
 
+/**
+ * Will set the callback used to report completed outgoing publishes. The reference of the message callback is passed.
+ *
+ * @param client - The client object.
+ * @param cb - The callback to be called.
+ */
+void lwmqtt_set_ack_callback(lwmqtt_client_t *client, lwmqtt_ack_callback_t cb);
+
 /**
  * The object defining the last will of a client.
  */
@@ -264,11 +281,12 @@ typedef enum {
  * @param options - The options object.
  * @param will - The will object.
  * @param return_code - The variable that will receive the return code.
+ * @param session_present - The variable that will receive the session present flag.
  * @param timeout - The command timeout.
  * @return An error value.
  */
 lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, lwmqtt_will_t *will,
-                            lwmqtt_return_code_t *return_code, uint32_t timeout);
+                            lwmqtt_return_code_t *return_code, bool *session_present, uint32_t timeout);
 
 /**
  * Will send a publish packet and wait for all acks to complete.
@@ -283,6 +301,57 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
  */
 lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t msg, uint32_t timeout);
 
+/**
+ * Will send a publish packet without waiting for its acks. The completion of a qos 1 or 2 message is reported to the
+ * ack callback with the returned packet id while incoming packets are processed.
+ *
+ * @param client - The client object.
+ * @param topic - The topic.
+ * @param message - The message.
+ * @param packet_id - Variable that will be set with the packet id (0 for qos 0).
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_publish_nowait(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t msg,
+                                   uint16_t *packet_id, uint32_t timeout);
+
+/**
+ * Will send a publish packet again with the dup flag and the packet id of the original message without waiting for its
+ * acks. Used to resend unacknowledged messages after a reconnect of a persistent session.
+ *
+ * @param client - The client object.
+ * @param topic - The topic.
+ * @param message - The message.
+ * @param packet_id - The packet id of the original message.
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_republish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t msg,
+                              uint16_t packet_id, uint32_t timeout);
+
+/**
+ * Will send a pubrel packet for a qos 2 message whose pubrec has already been received without waiting for the pubcomp.
+ *
+ * @param client - The client object.
+ * @param packet_id - The packet id of the message.
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_release(lwmqtt_client_t *client, uint16_t packet_id, uint32_t timeout);
+
+/**
+ * Will wait for the final ack of a message sent with `lwmqtt_publish_nowait` or `lwmqtt_republish`.
+ *
+ * Note: The message callback might be called with incoming messages as part of this call.
+ *
+ * @param client - The client object.
+ * @param packet_id - The packet id of the message.
+ * @param qos - The qos level of the message.
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_wait_ack(lwmqtt_client_t *client, uint16_t packet_id, lwmqtt_qos_t qos, uint32_t timeout);
+
 /**
  * Will send a subscribe packet with multiple topic filters plus QOS levels and wait for the suback to complete.
  *
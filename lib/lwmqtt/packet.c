@@ -246,7 +246,7 @@ lwmqtt_err_t lwmqtt_decode_connack(uint8_t *buf, size_t buf_len, bool *session_p
   }
 
   // get session present
-  *session_present = lwmqtt_read_bits(flags, 7, 1) == 1;
+  *session_present = lwmqtt_read_bits(flags, 0, 1) == 1;
 
   // get return code
   switch (raw_return_code) {
@@ -474,6 +474,31 @@ lwmqtt_err_t lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint
 
 lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bool dup, uint16_t packet_id,
                                    lwmqtt_string_t topic, lwmqtt_message_t msg) {
+  // encode header
+  size_t header_len = 0;
+  lwmqtt_err_t err = lwmqtt_encode_publish_header(buf, buf_len, &header_len, dup, packet_id, topic, msg);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // prepare pointer
+  uint8_t *buf_ptr = buf + header_len;
+  uint8_t *buf_end = buf + buf_len;
+
+  // write payload
+  err = lwmqtt_write_data(&buf_ptr, buf_end, msg.payload, msg.payload_len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // set length
+  *len = buf_ptr - buf;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_encode_publish_header(uint8_t *buf, size_t buf_len, size_t *len, bool dup, uint16_t packet_id,
+                                          lwmqtt_string_t topic, lwmqtt_message_t msg) {
   // prepare pointer
   uint8_t *buf_ptr = buf;
   uint8_t *buf_end = buf + buf_len;
@@ -532,12 +557,6 @@ lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bo
     }
   }
 
-  // write payload
-  err = lwmqtt_write_data(&buf_ptr, buf_end, msg.payload, msg.payload_len);
-  if (err != LWMQTT_SUCCESS) {
-    return err;
-  }
-
   // set length
   *len = buf_ptr - buf;
 
@@ -139,6 +139,22 @@ lwmqtt_err_t lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint
 lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bool dup, uint16_t packet_id,
                                    lwmqtt_string_t topic, lwmqtt_message_t msg);
 
+/**
+ * Encodes the fixed and variable header of a publish packet into the supplied buffer. The payload has to be sent
+ * directly after the header.
+ *
+ * @param buf - The buffer into which the header will be encoded.
+ * @param buf_len - The length of the specified buffer.
+ * @param len - The encoded length of the header.
+ * @param dup - The dup flag.
+ * @param packet_id  - The packet id.
+ * @param topic - The topic.
+ * @param msg - The message.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_encode_publish_header(uint8_t *buf, size_t buf_len, size_t *len, bool dup, uint16_t packet_id,
+                                          lwmqtt_string_t topic, lwmqtt_message_t msg);
+
 /**
  * Encodes a subscribe packet into the supplied buffer.
  *
@@ -25,6 +25,23 @@
 #define CONFIG_MEMMAP_SMP 1
 #define CONFIG_FREERTOS_UNICORE 0
 #define CONFIG_FREERTOS_HZ 100
+// frame buffer pool, consumers that may hold frames at the same time
+#define CONFIG_CAMERA_MAX_CONSUMERS 4
+// frame buffers are built from segments of a shared pool, JPEGs grow by one segment at a time
+#define CONFIG_CAMERA_FB_SEGMENT_SIZE 4096
+// the pool follows this percentile of the JPEG sizes once enough frames of a framesize and quality were seen
+#define CONFIG_CAMERA_JPEG_SIZE_PERCENTILE 95
+#define CONFIG_CAMERA_JPEG_SIZE_SAMPLES 16
+// dma buffers waiting for the filter task, a power of two, and the core and priority of the task
+#ifndef CONFIG_CAMERA_DMA_QUEUE_DEPTH
+#define CONFIG_CAMERA_DMA_QUEUE_DEPTH 16
+#endif
+#define CONFIG_CAMERA_FILTER_TASK_CORE 1
+#define CONFIG_CAMERA_FILTER_TASK_PRIORITY 10
+// init fails if vsync does not fall within this many milliseconds while skipping the first frame
+#define CONFIG_CAMERA_VSYNC_TIMEOUT 1000
+// motion detection compares the mean luma of square blocks of this many pixels per side
+#define CONFIG_CAMERA_MOTION_BLOCK 16
 
 /*****************************
  * Defines for mqtt library
@@ -33,4 +50,22 @@
 #define CONFIG_ESP_MQTT_ENABLED 1
 #define CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE 5
 #define CONFIG_ESP_MQTT_TASK_STACK_SIZE 3048
-#define CONFIG_ESP_MQTT_TASK_STACK_PRIORITY 3
\ No newline at end of file
+#define CONFIG_ESP_MQTT_TASK_STACK_PRIORITY 3
+// reconnection engine
+#define CONFIG_ESP_MQTT_BACKOFF_MIN 250      // ms
+#define CONFIG_ESP_MQTT_BACKOFF_MAX 30000    // ms
+#define CONFIG_ESP_MQTT_DNS_TTL 300000       // ms
+// dispatcher task for message callbacks
+#define CONFIG_ESP_MQTT_DISPATCHER_STACK_SIZE 3048
+#define CONFIG_ESP_MQTT_DISPATCHER_PRIORITY 2
+#define CONFIG_ESP_MQTT_BATCH_SIZE 8
+// persistent sessions, unacknowledged messages are copied for the resend after a reconnect. messages that do not fit,
+// like a picture, are stored in the outbox instead when their ack is missing
+#define CONFIG_ESP_MQTT_INFLIGHT_MAX 4
+#define CONFIG_ESP_MQTT_INFLIGHT_BYTES 8192  // bytes
+// tls record buffers (in + out), selects the negotiated max_fragment_length, 0 keeps 16 KB records. a budget only
+// saves memory with CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN lowered to match, which breaks every connect to a broker that
+// ignores max_fragment_length and sends full 16 KB records, starting with its certificate chain
+#ifndef CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET
+#define CONFIG_ESP_MQTT_TLS_BUFFER_BUDGET 0  // bytes
+#endif
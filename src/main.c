@@ -16,6 +16,7 @@
 // - #define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "nvs_flash.h"
 // SNTP
@@ -41,13 +42,44 @@
 #define CLIENTID_MQTT   "ESP32Doorbell" ROOM
 #define TOPIC_MQTT_PIC  "hska/office"   ROOM "/doorbell/picture"
 #define TOPIC_MQTT_TS   "hska/office"   ROOM "/doorbell/timestamp"
+#define TOPIC_MQTT_FRAG "hska/office"   ROOM "/doorbell/picture/fragment"
+
+// MQTT session - keep it on the broker so unacknowledged rings are resent after a reconnect
+#define MQTT_KEEP_ALIVE     30      // s
+#define MQTT_CLEAN_SESSION  false
 
 // TAG for the esp_log macros
 #define TAG "MQTT_Doorbell"
 
-// Expected max. size of frame - used for the send-buffer to optimize heap usage
-// (camera often allocates a larger framebuffer than actually necessary)
-#define MAXSIZE_OF_FRAME 27000  // bytes
+// Size of the MQTT send- and receive-buffer - pictures are streamed from the framebuffer and don't have to fit
+#define MQTT_BUFFER_SIZE 2048  // bytes
+
+// Outbox for rings while the broker is unreachable (partition label from partitions.csv)
+#define OUTBOX_PARTITION        "outbox"
+#define OUTBOX_QUOTA            (192 * 1024)    // bytes
+#define OUTBOX_MAX_MESSAGES     32
+#define OUTBOX_REPLAY_INTERVAL  200             // ms
+
+// JPEG quality (0-63, lower is better) and the time a picture may take to leave the device
+#define JPEG_QUALITY            50
+#define JPEG_QUALITY_LOWEST     63
+#define PICTURE_DEADLINE        2000            // ms
+
+// Publish the picture in fragments while it is captured instead of once it is complete - needs a client that
+// reassembles them. Every fragment starts with the offset in the picture (4 bytes) and a flags byte
+#define PICTURE_STREAM          false
+#define PICTURE_FRAGMENT_SIZE   4096            // bytes
+#define FRAGMENT_HEADER_SIZE    5               // bytes
+#define FRAGMENT_LAST           BIT0
+#define FRAGMENT_ABORT          BIT1
+
+// Keep capturing into a second frame buffer so that a ring is answered with the picture already in memory instead of
+// waiting for the next frame - costs the memory of another picture
+#define PICTURE_PREROLL         false
+
+// Put the camera to sleep between rings - it keeps its buffers and settings and wakes up within about two frames
+// instead of a full init, a ring waits for that. Can't be combined with PICTURE_PREROLL
+#define CAMERA_SUSPEND          false
 
 // clang-format on
 /*****************************************
@@ -62,29 +94,93 @@ const static int RECONNECT_BIT_MQTT = BIT2;
 /*****************************************
  * Local helperfunctions
  *****************************************/
-// Call esps's local time, set it's timezone and return a tm-struct
-struct tm getLocalTime() {
-    time_t now;
+// Convert a time to the local time, set it's timezone and return a tm-struct
+struct tm toLocalTime(time_t now) {
     struct tm timeinfo;
     setenv("TZ", "CET-1CET,M3.5.0/2,M10.5.0/3", 1);  // Central European Timezone including summer- wintertime
     tzset();
-    time(&now);
     localtime_r(&now, &timeinfo);
     return timeinfo;
 }
 
-// Reconnect MQTT without init only if actually needed and not already triggered by mqtt_init
+// Call esps's local time and return a tm-struct
+struct tm getLocalTime() {
+    time_t now;
+    time(&now);
+    return toLocalTime(now);
+}
+
+// Start the MQTT process if a previous start failed (e.g. not enough heap memory for the mqtt background task)
+// Reconnects of a running process are handled by esp_mqtt itself
 void mqtt_reconnect() {
-    // Wait for a Wifi-connection
     if (RECONNECT_BIT_MQTT & xEventGroupGetBits(connection_event_group)) {
         ESP_LOGI(TAG, "Biggest free heap-block is %d bytes", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));  // heapcontrol
-        bool success = false;
-        // Retry if there is not enough heap memory to start the mqtt background task
-        while (!success) {
-            success = esp_mqtt_start(CONFIG_MQTT_BROKER_IP, CONFIG_MQTT_PORT, CLIENTID_MQTT, CONFIG_MQTT_USER, CONFIG_MQTT_PASS);
-            vTaskDelay(500 / portTICK_PERIOD_MS);
+        if (esp_mqtt_start(CONFIG_MQTT_BROKER_IP, CONFIG_MQTT_PORT, CLIENTID_MQTT, CONFIG_MQTT_USER, CONFIG_MQTT_PASS, MQTT_KEEP_ALIVE, MQTT_CLEAN_SESSION)) {
+            xEventGroupClearBits(connection_event_group, RECONNECT_BIT_MQTT);
+        }
+    }
+}
+
+// Step the JPEG quality down if the link can't send a picture of the given size in time and back up if it can
+void adapt_quality(size_t len) {
+    static int quality = JPEG_QUALITY;
+    int next = quality;
+    if (!esp_mqtt_can_accept(len, PICTURE_DEADLINE)) {
+        next = quality + 5 < JPEG_QUALITY_LOWEST ? quality + 5 : JPEG_QUALITY_LOWEST;
+    } else if (quality > JPEG_QUALITY) {
+        next = quality - 1;
+    }
+    if (next != quality) {
+        sensor_t* sensor = esp_camera_sensor_get();
+        sensor->set_quality(sensor, next);
+        ESP_LOGI(TAG, "JPEG quality set to %d", next);
+        quality = next;
+    }
+}
+
+// Publish a fragment of a picture with its header
+void publish_fragment(const uint8_t* data, size_t offset, size_t len, uint8_t flags) {
+    static uint8_t fragment[FRAGMENT_HEADER_SIZE + PICTURE_FRAGMENT_SIZE];
+    fragment[0] = (uint8_t)(offset >> 24) & 0xFF;
+    fragment[1] = (uint8_t)(offset >> 16) & 0xFF;
+    fragment[2] = (uint8_t)(offset >> 8) & 0xFF;
+    fragment[3] = (uint8_t)offset & 0xFF;
+    fragment[4] = flags;
+    if (len) {
+        memcpy(fragment + FRAGMENT_HEADER_SIZE, data, len);
+    }
+    esp_mqtt_publish_lane(TOPIC_MQTT_FRAG, fragment, FRAGMENT_HEADER_SIZE + len, 1, false, ESP_MQTT_LANE_BULK);
+}
+
+// Shoot a picture and publish it in fragments while the sensor is still reading it out
+camera_fb_t* stream_picture() {
+    size_t sent = 0;
+    while (1) {
+        camera_chunk_t chunk;
+        esp_err_t err = esp_camera_chunk_get(&chunk);
+        if (err != ESP_OK) {
+            // Let the client drop what it got and retry with the next frame if this one was corrupt
+            if (sent) {
+                publish_fragment(NULL, sent, 0, FRAGMENT_LAST | FRAGMENT_ABORT);
+                sent = 0;
+            }
+            if (err == ESP_FAIL) {
+                continue;
+            }
+            return NULL;
+        }
+        // Send full fragments as they fill up and the rest with the final chunk
+        const uint8_t* picture = chunk.buf - chunk.offset;
+        size_t end = chunk.offset + chunk.len;
+        while (end - sent >= PICTURE_FRAGMENT_SIZE || chunk.final) {
+            size_t len = end - sent < PICTURE_FRAGMENT_SIZE ? end - sent : PICTURE_FRAGMENT_SIZE;
+            bool last = chunk.final && sent + len == end;
+            publish_fragment(picture + sent, sent, len, last ? FRAGMENT_LAST : 0);
+            sent += len;
+            if (last) {
+                return chunk.fb;
+            }
         }
-        xEventGroupClearBits(connection_event_group, RECONNECT_BIT_MQTT);
     }
 }
 
@@ -104,6 +200,8 @@ void statusled_task(void* pvParameter) {
             gpio_set_level(PIN_STATUSLED, 1);
         } else if (CONNECTED_BIT_WIFI & xEventGroupGetBits(connection_event_group)) {
             gpio_set_level(PIN_STATUSLED, !gpio_get_level(PIN_STATUSLED));
+            // Retry a failed start of the MQTT process
+            mqtt_reconnect();
         } else {
             gpio_set_level(PIN_STATUSLED, 0);
         }
@@ -118,21 +216,31 @@ void mqtt_publish_task(void* pvParameter) {
     gpio_set_direction(PIN_PUSHBUTTON, GPIO_MODE_INPUT);
     while (1) {
         if (!gpio_get_level(PIN_PUSHBUTTON)) {
-            // Get the current time
+            // Wake the camera up
+            if (CAMERA_SUSPEND && esp_camera_resume() != ESP_OK) {
+                ESP_LOGE(TAG, "Camera Resume Failed");
+                break;
+            }
+            // Shoot a picture first so the time stamp tells when it was taken, a streamed one is sent while it is taken
+            camera_fb_t* fb = NULL;
+            if (!PICTURE_STREAM) {
+                fb = PICTURE_PREROLL ? esp_camera_fb_get_latest() : esp_camera_fb_get();
+                if (!fb) {
+                    ESP_LOGE(TAG, "Camera Capture Failed");
+                    break;
+                }
+            }
+            // Get the time the picture was taken, the camera stamps it with the monotonic time since boot
             time_t now;
             time(&now);
-            struct tm localtime = getLocalTime();
+            if (fb) {
+                now -= (esp_timer_get_time() - fb->timestamp) / 1000000;
+            }
+            struct tm localtime = toLocalTime(now);
             // A C-String (char-array) to store a formatted string
             char timestr_buffer[64];
             // Build a human-readable string of the time information
             strftime(timestr_buffer, sizeof(timestr_buffer), "%c", &localtime);
-            // Shoot a picture and retrieve the pointer to a struct containing the buffer
-            camera_fb_t* fb = esp_camera_fb_get();
-            if (!fb) {
-                ESP_LOGE(TAG, "Camera Capture Failed");
-                break;
-            }
-            ESP_LOGI(TAG, "Doorbell ringing at %s, picture with %dbytes sent", timestr_buffer, fb->len);
             // Build timestamp buffer
             uint8_t send_buffer_time[4];
             // The time_t datatype is a long -> 4 bytes that have to be sent
@@ -141,13 +249,34 @@ void mqtt_publish_task(void* pvParameter) {
             send_buffer_time[2] = (uint8_t)(now >> 8) & 0xFF;
             send_buffer_time[3] = (uint8_t)now & 0xFF;
             // Send time stamp
-            esp_mqtt_publish(TOPIC_MQTT_TS, send_buffer_time, 4, 1, true);
+            esp_mqtt_publish_lane(TOPIC_MQTT_TS, send_buffer_time, 4, 1, true, ESP_MQTT_LANE_REALTIME);
             // Check RAM
             ESP_LOGI(TAG, "Biggest free heap-block is %d bytes", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));  // heapcontrol
+            // Stream the picture and retrieve the pointer to a struct containing the buffer
+            if (PICTURE_STREAM) {
+                fb = stream_picture();
+                if (!fb) {
+                    ESP_LOGE(TAG, "Camera Capture Failed");
+                    break;
+                }
+            }
+            ESP_LOGI(TAG, "Doorbell ringing at %s, picture with %dbytes sent", timestr_buffer, fb->len);
+            // Lower the quality of the next pictures while the link can't take this one in time
+            adapt_quality(fb->len);
             // Send picture
-            esp_mqtt_publish(TOPIC_MQTT_PIC, fb->buf, fb->len, 1, true);
+            if (!PICTURE_STREAM) {
+                esp_mqtt_publish_lane(TOPIC_MQTT_PIC, fb->buf, fb->len, 1, true, ESP_MQTT_LANE_BULK);
+            }
+            // Latency from the start of the frame, frames dropped before it point to a busy camera or a slow consumer
+            ESP_LOGI(TAG, "Picture %u captured in %d ms, handed to MQTT after %d ms, %u frames dropped before", fb->seq, (int)((fb->timestamp_end - fb->timestamp) / 1000),
+                     (int)((esp_timer_get_time() - fb->timestamp) / 1000), fb->dropped);
+            ESP_LOGI(TAG, "Lowest free heap so far is %d bytes", heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));  // heapcontrol
             // Give back the buffer pointer
             esp_camera_fb_return(fb);
+            // Let the camera sleep until the next ring
+            if (CAMERA_SUSPEND) {
+                esp_camera_suspend();
+            }
             // Debounce
             vTaskDelay(500 / portTICK_PERIOD_MS);
         } else {
@@ -176,19 +305,19 @@ static esp_err_t wifi_event_handler(void* ctx, system_event_t* event) {
             // WiFi got connected and DHCP retrieved an IP
             xEventGroupSetBits(connection_event_group, CONNECTED_BIT_WIFI);
             ESP_LOGI(TAG, "Wifi got IP.");
+            // Let the MQTT process retry right away instead of waiting for its backoff
             mqtt_reconnect();
+            esp_mqtt_kick();
             break;
         case SYSTEM_EVENT_STA_DISCONNECTED:
             xEventGroupClearBits(connection_event_group, CONNECTED_BIT_MQTT | CONNECTED_BIT_WIFI);
             ESP_LOGI(TAG, "Wifi disconnected");
-            // WiFi disconnected
-            esp_mqtt_stop();
+            // WiFi disconnected, the MQTT process keeps retrying with a backoff until the network is back
             // Try to reastablish a Wifi-connection
             if (!(CONNECTED_BIT_WIFI & xEventGroupGetBits(connection_event_group))) {
                 ESP_ERROR_CHECK(esp_wifi_connect());
                 ESP_LOGI(TAG, "Wifi trying to reconnect");
             }
-            xEventGroupSetBits(connection_event_group, RECONNECT_BIT_MQTT);
             break;
         default:
             ESP_LOGW(TAG, "unknown WiFi-state");
@@ -205,7 +334,6 @@ void mqtt_status_callback(esp_mqtt_status_t status) {
         case ESP_MQTT_STATUS_CONNECTED:
             // Connected to MQTT-Broker
             // Task to publish data on button-down should be created and started if this is a fresh startup
-            // and should be resumed if it has already been created
             xEventGroupSetBits(connection_event_group, CONNECTED_BIT_MQTT);
             if (!mqtt_publish_task_handle) {
                 ESP_LOGI(TAG, "MQTT connected - starting publish task");
@@ -213,23 +341,21 @@ void mqtt_status_callback(esp_mqtt_status_t status) {
                     ESP_LOGE(TAG, "mqtt_publish_task could not be created");
                 }
             } else {
-                ESP_LOGI(TAG, "MQTT connected - resuming publish task");
-                vTaskResume(mqtt_publish_task_handle);
+                esp_mqtt_outbox_stats_t stats;
+                esp_mqtt_outbox_stats(&stats);
+                ESP_LOGI(TAG, "MQTT connected - replaying %d stored messages", stats.pending);
             }
             break;
         case ESP_MQTT_STATUS_DISCONNECTED:
             xEventGroupClearBits(connection_event_group, CONNECTED_BIT_MQTT);
             // Disconnected from MQTT-Broker
-            ESP_LOGI(TAG, "MQTT disconnected - suspending publish task");
-            // Task to publish data on button-down can be suspended as long as there is no connection to a broker
-            vTaskSuspend(mqtt_publish_task_handle);
+            // The publish task keeps running, rings are stored in the outbox until the broker is reachable again
+            ESP_LOGI(TAG, "MQTT disconnected - storing rings in outbox");
             // When working at the limit of the RAM-size there might be the need to wait for the IDLE-task to free memory
             // ESP_LOGI(TAG, "Let IDLE-Task free memory");
             // vTaskDelay(5000 / portTICK_PERIOD_MS);
             // ESP_LOGI(TAG, "Biggest free heap-block is %d bytes", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));  // heapcontrol
-            // Try to reastablish a connection to the MQTT-Broker
-            xEventGroupSetBits(connection_event_group, RECONNECT_BIT_MQTT);
-            mqtt_reconnect();
+            // The connection to the MQTT-Broker gets reastablished by the MQTT process
             break;
     }
 }
@@ -307,8 +433,9 @@ void cam_init() {
         .xclk_freq_hz   = CONFIG_XCLK_FREQ,
         .pixel_format   = PIXFORMAT_JPEG,
         .frame_size     = FRAMESIZE_VGA,
-        .jpeg_quality   = 50,
-        .fb_count       = 1,
+        .jpeg_quality   = JPEG_QUALITY,
+        .fb_count       = PICTURE_PREROLL ? 2 : 1,
+        .preroll        = PICTURE_PREROLL,
         // clang-format on
     };
     esp_err_t err = esp_camera_init(&camera_config);
@@ -316,6 +443,9 @@ void cam_init() {
         ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
         return;
     }
+    if (CAMERA_SUSPEND) {
+        esp_camera_suspend();
+    }
 }
 
 // MQTT
@@ -323,8 +453,14 @@ void mqtt_init() {
     // Wait for a Wifi-connection
     xEventGroupWaitBits(connection_event_group, CONNECTED_BIT_WIFI, false, true, portMAX_DELAY);
     ESP_LOGI(TAG, "Initializing MQTT");
-    esp_mqtt_init(mqtt_status_callback, NULL, MAXSIZE_OF_FRAME, 30000);
-    esp_mqtt_start(CONFIG_MQTT_BROKER_IP, CONFIG_MQTT_PORT, CLIENTID_MQTT, CONFIG_MQTT_USER, CONFIG_MQTT_PASS);
+    esp_mqtt_init(mqtt_status_callback, NULL, MQTT_BUFFER_SIZE, 30000);
+    if (!esp_mqtt_outbox(OUTBOX_PARTITION, OUTBOX_QUOTA, OUTBOX_MAX_MESSAGES, ESP_MQTT_OUTBOX_DROP_OLDEST, OUTBOX_REPLAY_INTERVAL)) {
+        ESP_LOGW(TAG, "MQTT outbox not available - rings during outages will be lost");
+    }
+    if (!esp_mqtt_start(CONFIG_MQTT_BROKER_IP, CONFIG_MQTT_PORT, CLIENTID_MQTT, CONFIG_MQTT_USER, CONFIG_MQTT_PASS, MQTT_KEEP_ALIVE, MQTT_CLEAN_SESSION)) {
+        // Retried by the status LED task
+        xEventGroupSetBits(connection_event_group, RECONNECT_BIT_MQTT);
+    }
 }
 /*****************************************
  * Main
@@ -209,7 +209,7 @@
 #define CONFIG_MBEDTLS_ECP_NIST_OPTIM 1
 #define CONFIG_ESP32_TIME_SYSCALL_USE_RTC_FRC1 1
 #define CONFIG_ESPTOOLPY_COMPRESSED 1
-#define CONFIG_PARTITION_TABLE_FILENAME "partitions_singleapp.csv"
+#define CONFIG_PARTITION_TABLE_FILENAME "partitions.csv"
 #define CONFIG_MB_CONTROLLER_STACK_SIZE 4096
 #define CONFIG_TCP_SND_BUF_DEFAULT 5744
 #define CONFIG_GARP_TMR_INTERVAL 60
@@ -220,7 +220,7 @@
 #define CONFIG_MBEDTLS_SSL_PROTO_TLS1_1 1
 #define CONFIG_LWIP_SO_REUSE_RXTOALL 1
 #define CONFIG_MB_CONTROLLER_NOTIFY_TIMEOUT 20
-#define CONFIG_PARTITION_TABLE_SINGLE_APP 1
+#define CONFIG_PARTITION_TABLE_CUSTOM 1
 #define CONFIG_ESP32_WIFI_RX_BA_WIN 6
 #define CONFIG_MBEDTLS_X509_CSR_PARSE_C 1
 #define CONFIG_SPIFFS_USE_MTIME 1